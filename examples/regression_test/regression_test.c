@@ -17,6 +17,7 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "nvfuse_core.h"
 #include "nvfuse_api.h"
@@ -25,6 +26,10 @@
 #include "nvfuse_gettimeofday.h"
 #include "nvfuse_aio.h"
 #include "nvfuse_misc.h"
+#include "nvfuse_index.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_bc_policy.h"
+#include "nvfuse_bc_arena.h"
 #include "spdk/env.h"
 #include <rte_lcore.h>
 
@@ -71,6 +76,14 @@ int rt_gen_aio_rw(struct nvfuse_handle *nvh, s64 file_size, s32 block_size, s32
 int rt_create_max_sized_file_aio_4KB(struct nvfuse_handle *nvh, u32 is_rand);
 int rt_create_max_sized_file_aio_128KB(struct nvfuse_handle *nvh, u32 is_rand);
 int rt_create_4KB_files(struct nvfuse_handle *nvh, u32 arg);
+int rt_index(struct nvfuse_handle *nvh, u32 arg);
+int rt_extent_tree(struct nvfuse_handle *nvh, u32 arg);
+int rt_bc_policy_2q(struct nvfuse_handle *nvh, u32 arg);
+int rt_bc_arena(struct nvfuse_handle *nvh, u32 arg);
+int rt_multi_thread(struct nvfuse_handle *nvh, u32 arg);
+int rt_iov(struct nvfuse_handle *nvh, u32 arg);
+int rt_inline_data(struct nvfuse_handle *nvh, u32 arg);
+int rt_small_dir(struct nvfuse_handle *nvh, u32 arg);
 void rt_usage(char *cmd);
 static int rt_main(void *arg);
 static void print_stats(s32 num_cores, s32 num_tc);
@@ -643,6 +656,972 @@ int rt_create_4KB_files(struct nvfuse_handle *nvh, u32 arg)
 
 }
 
+#define RT_INDEX_KEYS	100000
+
+int rt_index(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_index index;
+	u64 keys[4];
+	u64 key;
+	u32 home;
+	s32 nr;
+	s32 i;
+
+	if (nvfuse_index_init(&index, 16) < 0)
+		return -1;
+
+	/* grow */
+	for (i = 0; i < RT_INDEX_KEYS; i++) {
+		if (nvfuse_index_insert(&index, (u64)i << 12, (void *)(long)(i + 1)) < 0) {
+			printf(" Error: index insert key = %d \n", i);
+			return -1;
+		}
+	}
+
+	if (index.count != RT_INDEX_KEYS ||
+	    (u64)index.count * 100 > (u64)index.capacity * NVFUSE_INDEX_MAX_LOAD) {
+		printf(" Error: index count = %u capacity = %u \n", index.count, index.capacity);
+		return -1;
+	}
+
+	/* remove every other key, others must stay reachable after backward shift */
+	for (i = 0; i < RT_INDEX_KEYS; i += 2) {
+		if (nvfuse_index_remove(&index, (u64)i << 12) != (void *)(long)(i + 1)) {
+			printf(" Error: index remove key = %d \n", i);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < RT_INDEX_KEYS; i++) {
+		if (nvfuse_index_lookup(&index, (u64)i << 12) != ((i % 2) ? (void *)(long)(i + 1) : NULL)) {
+			printf(" Error: index lookup key = %d \n", i);
+			return -1;
+		}
+	}
+
+	/* shrink */
+	for (i = 1; i < RT_INDEX_KEYS; i += 2)
+		nvfuse_index_remove(&index, (u64)i << 12);
+
+	if (index.count != 0 || index.capacity != index.min_capacity) {
+		printf(" Error: index count = %u capacity = %u \n", index.count, index.capacity);
+		return -1;
+	}
+
+	nvfuse_index_deinit(&index);
+
+	/* keys colliding on the last slot wrap around to the head of table */
+	if (nvfuse_index_init(&index, 1024) < 0)
+		return -1;
+
+	nr = 0;
+	for (key = 1; nr < 4; key++) {
+		home = (u32)((key * 0x9E3779B97F4A7C15ULL) >> index.shift);
+		if (home == index.capacity - 1)
+			keys[nr++] = key;
+	}
+
+	for (i = 0; i < 4; i++)
+		nvfuse_index_insert(&index, keys[i], (void *)(long)(i + 1));
+
+	for (i = 0; i < 4; i++) {
+		if (nvfuse_index_remove(&index, keys[i]) != (void *)(long)(i + 1)) {
+			printf(" Error: index remove wrapped key = %lu \n", (unsigned long)keys[i]);
+			return -1;
+		}
+
+		for (nr = i + 1; nr < 4; nr++) {
+			if (nvfuse_index_lookup(&index, keys[nr]) != (void *)(long)(nr + 1)) {
+				printf(" Error: index lookup wrapped key = %lu \n", (unsigned long)keys[nr]);
+				return -1;
+			}
+		}
+	}
+
+	nvfuse_index_deinit(&index);
+
+	return NVFUSE_SUCCESS;
+}
+
+#define RT_EXTENT_BLOCKS	4096
+
+static void rt_extent_fill(u32 *buf, u32 lblock)
+{
+	u32 i;
+
+	for (i = 0; i < CLUSTER_SIZE / sizeof(u32); i++)
+		buf[i] = lblock;
+}
+
+static s32 rt_extent_verify(struct nvfuse_handle *nvh, s32 fid, u32 *buf, u32 nr_blocks)
+{
+	u32 lblock;
+	u32 i;
+
+	for (lblock = 0; lblock < nr_blocks; lblock++) {
+		if (nvfuse_readfile(nvh, fid, (s8 *)buf, CLUSTER_SIZE, (s64)lblock * CLUSTER_SIZE) !=
+		    CLUSTER_SIZE) {
+			printf(" Error: read lblock = %d \n", lblock);
+			return -1;
+		}
+
+		for (i = 0; i < CLUSTER_SIZE / sizeof(u32); i++) {
+			if (buf[i] != lblock) {
+				printf(" Error: data mismatch lblock = %d (%d) \n", lblock, buf[i]);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Blocks are written in an order that splits every extent (even blocks
+ * first, odd blocks backward) while another file takes the neighboring
+ * physical blocks, so the mapping needs index nodes.
+ */
+int rt_extent_tree(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct stat st_buf;
+	u32 *buf;
+	s32 fid, fid_other;
+	s32 lblock;
+	s32 i;
+	s32 ret = -1;
+
+	if (!nvfuse_extent_enabled(&nvh->nvh_sb))
+		printf(" Note: file system is formatted without extents. \n");
+
+	buf = (u32 *)malloc(CLUSTER_SIZE);
+	if (buf == NULL)
+		return -1;
+
+	fid = nvfuse_openfile_path(nvh, "extent_test", O_RDWR | O_CREAT, 0);
+	fid_other = nvfuse_openfile_path(nvh, "extent_test_other", O_RDWR | O_CREAT, 0);
+	if (fid < 0 || fid_other < 0) {
+		printf(" Error: file open or create \n");
+		goto FREE;
+	}
+
+	for (i = 0; i < RT_EXTENT_BLOCKS; i++) {
+		if (i < RT_EXTENT_BLOCKS / 2)
+			lblock = i * 2;
+		else
+			lblock = (RT_EXTENT_BLOCKS - 1 - i) * 2 + 1;
+
+		rt_extent_fill(buf, lblock);
+		if (nvfuse_writefile(nvh, fid, (s8 *)buf, CLUSTER_SIZE, (s64)lblock * CLUSTER_SIZE) !=
+		    CLUSTER_SIZE) {
+			printf(" Error: write lblock = %d \n", lblock);
+			goto CLOSE;
+		}
+
+		if (nvfuse_writefile(nvh, fid_other, (s8 *)buf, CLUSTER_SIZE, (s64)i * CLUSTER_SIZE) !=
+		    CLUSTER_SIZE) {
+			printf(" Error: write other file \n");
+			goto CLOSE;
+		}
+	}
+
+	if (rt_extent_verify(nvh, fid, buf, RT_EXTENT_BLOCKS) < 0)
+		goto CLOSE;
+
+	/* truncate in the middle of a block, then grow again */
+	if (nvfuse_ftruncate(nvh, fid, (s64)RT_EXTENT_BLOCKS / 3 * CLUSTER_SIZE + 100) < 0) {
+		printf(" Error: ftruncate \n");
+		goto CLOSE;
+	}
+
+	if (nvfuse_getattr(nvh, "extent_test", &st_buf) ||
+	    st_buf.st_size != (s64)RT_EXTENT_BLOCKS / 3 * CLUSTER_SIZE + 100) {
+		printf(" Error: size after truncate \n");
+		goto CLOSE;
+	}
+
+	if (rt_extent_verify(nvh, fid, buf, RT_EXTENT_BLOCKS / 3) < 0)
+		goto CLOSE;
+
+	for (lblock = RT_EXTENT_BLOCKS / 3 + 1; lblock < RT_EXTENT_BLOCKS; lblock++) {
+		rt_extent_fill(buf, lblock);
+		if (nvfuse_writefile(nvh, fid, (s8 *)buf, CLUSTER_SIZE, (s64)lblock * CLUSTER_SIZE) !=
+		    CLUSTER_SIZE) {
+			printf(" Error: write lblock = %d \n", lblock);
+			goto CLOSE;
+		}
+	}
+
+	/* block at the cut keeps 100 bytes and the rest reads as zero */
+	if (nvfuse_readfile(nvh, fid, (s8 *)buf, CLUSTER_SIZE,
+			    (s64)RT_EXTENT_BLOCKS / 3 * CLUSTER_SIZE) != CLUSTER_SIZE) {
+		printf(" Error: read block at truncate point \n");
+		goto CLOSE;
+	}
+
+	for (i = 100 / sizeof(u32); i < (s32)(CLUSTER_SIZE / sizeof(u32)); i++) {
+		if (buf[i] != 0) {
+			printf(" Error: stale data beyond truncate point \n");
+			goto CLOSE;
+		}
+	}
+
+	ret = NVFUSE_SUCCESS;
+
+CLOSE:
+	if (fid >= 0)
+		nvfuse_closefile(nvh, fid);
+	if (fid_other >= 0)
+		nvfuse_closefile(nvh, fid_other);
+
+	if (nvfuse_rmfile_path(nvh, "extent_test") < 0 ||
+	    nvfuse_rmfile_path(nvh, "extent_test_other") < 0) {
+		printf(" Error: rmfile \n");
+		ret = -1;
+	}
+FREE:
+	free(buf);
+
+	return ret;
+}
+
+#define RT_2Q_BUFFERS	100
+#define RT_2Q_HOT	10
+
+static void rt_2q_load(struct nvfuse_buffer_manager *bm, struct nvfuse_buffer_cache *bc, u64 key)
+{
+	bc->bc_bno = key;
+	bc->bc_part = 0;
+	nvfuse_bc_policy_miss(bm, bc);
+	bc->bc_list_type = BUFFER_TYPE_CLEAN;
+	nvfuse_bc_policy_add_clean(bm, bc, INSERT_HEAD);
+}
+
+static struct nvfuse_buffer_cache *rt_2q_evict(struct nvfuse_buffer_manager *bm)
+{
+	struct nvfuse_buffer_cache *bc;
+
+	bc = nvfuse_bc_policy_victim(bm, 0);
+	if (bc == NULL)
+		return NULL;
+
+	nvfuse_bc_policy_del_clean(bm, bc);
+	bc->bc_list_type = BUFFER_TYPE_UNUSED;
+
+	return bc;
+}
+
+/* a scan of cold blocks must not evict blocks referenced again after eviction */
+int rt_bc_policy_2q(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_buffer_manager *bm;
+	struct nvfuse_buffer_cache *bcs;
+	struct nvfuse_buffer_cache *bc;
+	s32 ret = -1;
+	s32 i;
+
+	bm = (struct nvfuse_buffer_manager *)calloc(1, sizeof(struct nvfuse_buffer_manager));
+	bcs = (struct nvfuse_buffer_cache *)calloc(RT_2Q_BUFFERS, sizeof(struct nvfuse_buffer_cache));
+	if (bm == NULL || bcs == NULL)
+		goto FREE;
+
+	bm->bm_id = 1;
+	if (nvfuse_bc_policy_init(bm, NVFUSE_BC_POLICY_2Q) < 0)
+		goto FREE;
+	bm->bm_part[0].bp_size = RT_2Q_BUFFERS;
+
+	for (i = 0; i < RT_2Q_BUFFERS; i++)
+		rt_2q_load(bm, &bcs[i], i);
+
+	/* oldest buffers of a1in go first and are remembered in a1out */
+	for (i = 0; i < RT_2Q_HOT; i++) {
+		bc = rt_2q_evict(bm);
+		if (bc == NULL || bc->bc_bno != (u64)i) {
+			printf(" Error: 2q victim = %ld, expected = %d \n",
+			       bc ? (long)bc->bc_bno : -1, i);
+			goto DEINIT;
+		}
+	}
+
+	/* re-referenced keys are loaded into am */
+	for (i = 0; i < RT_2Q_HOT; i++) {
+		rt_2q_load(bm, &bcs[i], i);
+		if (!bcs[i].bc_hot) {
+			printf(" Error: 2q key = %d is not hot \n", i);
+			goto DEINIT;
+		}
+	}
+
+	/* a pinned buffer is skipped */
+	bcs[RT_2Q_HOT].bc_ref = 1;
+
+	for (i = 0; i < RT_2Q_BUFFERS * 10; i++) {
+		bc = rt_2q_evict(bm);
+		if (bc == NULL || bc->bc_bno < RT_2Q_HOT || bc == &bcs[RT_2Q_HOT]) {
+			printf(" Error: 2q victim = %ld during scan \n", bc ? (long)bc->bc_bno : -1);
+			goto DEINIT;
+		}
+		rt_2q_load(bm, bc, RT_2Q_BUFFERS + i);
+	}
+
+	ret = NVFUSE_SUCCESS;
+
+DEINIT:
+	nvfuse_bc_policy_deinit(bm);
+FREE:
+	free(bcs);
+	free(bm);
+
+	return ret;
+}
+
+int rt_bc_arena(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_io_manager io_manager;
+	struct nvfuse_bc_arena arena;
+	struct nvfuse_bc_chunk *chunk;
+	struct nvfuse_buffer_cache **bcs;
+	struct nvfuse_buffer_cache *bc;
+	s32 nr, pages;
+	s32 ret = -1;
+	s32 i;
+
+	/* no I/O backend to register chunks to */
+	memset(&io_manager, 0x00, sizeof(struct nvfuse_io_manager));
+
+	if (nvfuse_bc_arena_init(&arena, &io_manager) < 0)
+		return -1;
+
+	pages = arena.ba_chunk_pages;
+	nr = pages * 2 + 1;
+
+	bcs = (struct nvfuse_buffer_cache **)calloc(nr, sizeof(struct nvfuse_buffer_cache *));
+	if (bcs == NULL)
+		goto DEINIT;
+
+	for (i = 0; i < nr; i++) {
+		bcs[i] = nvfuse_bc_arena_alloc(&arena);
+		if (bcs[i] == NULL) {
+			printf(" Error: arena alloc %d \n", i);
+			goto FREE;
+		}
+
+		/* page must be in the chunk of its descriptor */
+		chunk = &arena.ba_chunks[nvfuse_bc_arena_chunk(&arena, bcs[i]->bc_idx)];
+		if (nvfuse_bc_arena_get(&arena, bcs[i]->bc_idx) != bcs[i] ||
+		    bcs[i]->bc_buf < (s8 *)chunk->ch_region ||
+		    bcs[i]->bc_buf + CLUSTER_SIZE > (s8 *)chunk->ch_bcs) {
+			printf(" Error: arena buffer idx = %d \n", bcs[i]->bc_idx);
+			goto FREE;
+		}
+
+		memset(bcs[i]->bc_buf, i & 0xff, CLUSTER_SIZE);
+	}
+
+	if (arena.ba_nr_chunks != 3 || arena.ba_nr_used != (u32)nr) {
+		printf(" Error: arena chunks = %d used = %d \n", arena.ba_nr_chunks, arena.ba_nr_used);
+		goto FREE;
+	}
+
+	/* pages don't overlap each other or descriptors */
+	for (i = 0; i < nr; i++) {
+		if (bcs[i]->bc_buf[0] != (s8)(i & 0xff) ||
+		    bcs[i]->bc_buf[CLUSTER_SIZE - 1] != (s8)(i & 0xff)) {
+			printf(" Error: arena page idx = %d is overwritten \n", bcs[i]->bc_idx);
+			goto FREE;
+		}
+	}
+
+	/* the last chunk empties out and is returned */
+	nvfuse_bc_arena_free(&arena, bcs[nr - 1]);
+	bcs[nr - 1] = NULL;
+	if (arena.ba_nr_chunks != 2) {
+		printf(" Error: arena chunks = %d after free \n", arena.ba_nr_chunks);
+		goto FREE;
+	}
+
+	/* a hole in the lowest chunk is filled first */
+	nvfuse_bc_arena_free(&arena, bcs[pages / 2]);
+	bc = nvfuse_bc_arena_alloc(&arena);
+	bcs[pages / 2] = bc;
+	if (bc == NULL || nvfuse_bc_arena_chunk(&arena, bc->bc_idx) != 0) {
+		printf(" Error: arena hole is not reused \n");
+		goto FREE;
+	}
+
+	ret = NVFUSE_SUCCESS;
+
+FREE:
+	for (i = 0; i < nr; i++) {
+		if (bcs[i])
+			nvfuse_bc_arena_free(&arena, bcs[i]);
+	}
+
+	if (ret == NVFUSE_SUCCESS && (arena.ba_nr_chunks || arena.ba_nr_used)) {
+		printf(" Error: arena chunks = %d used = %d after all freed \n",
+		       arena.ba_nr_chunks, arena.ba_nr_used);
+		ret = -1;
+	}
+
+	free(bcs);
+DEINIT:
+	nvfuse_bc_arena_deinit(&arena);
+
+	return ret;
+}
+
+#define RT_MT_THREADS	8
+#define RT_MT_BLOCKS	256
+#define RT_MT_FILES	64
+
+struct rt_mt_arg {
+	struct nvfuse_handle *nvh;
+	s32 id;
+	s32 ret;
+};
+
+static void rt_mt_fill(u32 *buf, s32 id, s32 lblock)
+{
+	u32 i;
+
+	for (i = 0; i < CLUSTER_SIZE / sizeof(u32); i++)
+		buf[i] = ((u32)id << 16) | (u32)lblock;
+}
+
+/* each worker writes and verifies its own file, and creates and removes files in a shared directory */
+static void *rt_mt_worker(void *arg)
+{
+	struct rt_mt_arg *mt = (struct rt_mt_arg *)arg;
+	struct nvfuse_handle *nvh = mt->nvh;
+	char str[FNAME_SIZE];
+	u32 *buf;
+	s32 fid, tfid;
+	s32 lblock;
+	s32 i;
+	u32 j;
+
+	mt->ret = -1;
+
+	buf = (u32 *)malloc(CLUSTER_SIZE);
+	if (buf == NULL)
+		return NULL;
+
+	sprintf(str, "mt_file_%d", mt->id);
+	fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+	if (fid < 0) {
+		printf(" Error: file open or create %s \n", str);
+		goto FREE;
+	}
+
+	for (lblock = 0; lblock < RT_MT_BLOCKS; lblock++) {
+		rt_mt_fill(buf, mt->id, lblock);
+		if (nvfuse_writefile(nvh, fid, (s8 *)buf, CLUSTER_SIZE, (s64)lblock * CLUSTER_SIZE) !=
+		    CLUSTER_SIZE) {
+			printf(" Error: thread %d write lblock = %d \n", mt->id, lblock);
+			goto CLOSE;
+		}
+	}
+
+	if (nvfuse_fsync(nvh, fid) < 0) {
+		printf(" Error: thread %d fsync \n", mt->id);
+		goto CLOSE;
+	}
+
+	for (lblock = 0; lblock < RT_MT_BLOCKS; lblock++) {
+		if (nvfuse_readfile(nvh, fid, (s8 *)buf, CLUSTER_SIZE, (s64)lblock * CLUSTER_SIZE) !=
+		    CLUSTER_SIZE) {
+			printf(" Error: thread %d read lblock = %d \n", mt->id, lblock);
+			goto CLOSE;
+		}
+
+		for (j = 0; j < CLUSTER_SIZE / sizeof(u32); j++) {
+			if (buf[j] != (((u32)mt->id << 16) | (u32)lblock)) {
+				printf(" Error: thread %d data mismatch lblock = %d (%x) \n", mt->id, lblock, buf[j]);
+				goto CLOSE;
+			}
+		}
+	}
+
+	for (i = 0; i < RT_MT_FILES; i++) {
+		sprintf(str, "mt_dir/t%d_%d", mt->id, i);
+		tfid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+		if (tfid < 0) {
+			printf(" Error: file open or create %s \n", str);
+			goto CLOSE;
+		}
+		nvfuse_closefile(nvh, tfid);
+	}
+
+	for (i = 0; i < RT_MT_FILES; i++) {
+		sprintf(str, "mt_dir/t%d_%d", mt->id, i);
+		if (nvfuse_rmfile_path(nvh, str) < 0) {
+			printf(" Error: rmfile %s \n", str);
+			goto CLOSE;
+		}
+	}
+
+	mt->ret = 0;
+
+CLOSE:
+	nvfuse_closefile(nvh, fid);
+	sprintf(str, "mt_file_%d", mt->id);
+	if (nvfuse_rmfile_path(nvh, str) < 0)
+		mt->ret = -1;
+FREE:
+	free(buf);
+
+	return NULL;
+}
+
+/* threads sharing a handle run file and namespace operations concurrently */
+int rt_multi_thread(struct nvfuse_handle *nvh, u32 arg)
+{
+	pthread_t threads[RT_MT_THREADS];
+	struct rt_mt_arg args[RT_MT_THREADS];
+	struct stat st_buf;
+	char str[FNAME_SIZE];
+	s32 ret = NVFUSE_SUCCESS;
+	s32 nr;
+	s32 i, j;
+
+	if (nvfuse_mkdir_path(nvh, "mt_dir", 0644) < 0) {
+		printf(" Error: mkdir mt_dir \n");
+		return -1;
+	}
+
+	for (nr = 0; nr < RT_MT_THREADS; nr++) {
+		args[nr].nvh = nvh;
+		args[nr].id = nr;
+		args[nr].ret = -1;
+		if (pthread_create(&threads[nr], NULL, rt_mt_worker, &args[nr])) {
+			printf(" Error: pthread_create() \n");
+			ret = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < nr; i++) {
+		pthread_join(threads[i], NULL);
+		if (args[i].ret < 0)
+			ret = -1;
+	}
+
+	/* names removed by one thread must not be left by updates of others */
+	for (i = 0; i < nr; i++) {
+		for (j = 0; j < RT_MT_FILES; j++) {
+			sprintf(str, "mt_dir/t%d_%d", i, j);
+			if (nvfuse_getattr(nvh, str, &st_buf) == 0) {
+				printf(" Error: %s is left in shared directory \n", str);
+				ret = -1;
+			}
+		}
+	}
+
+	if (nvfuse_rmdir_path(nvh, "mt_dir") < 0) {
+		printf(" Error: rmdir mt_dir \n");
+		ret = -1;
+	}
+
+	return ret;
+}
+
+#define RT_IOV_BYTES(x)	((u8)((x) * 13 + 7))
+
+static void rt_iov_fill(struct iovec *iov, s32 iovcnt, s64 offset)
+{
+	s32 i;
+	size_t j;
+
+	for (i = 0; i < iovcnt; i++) {
+		for (j = 0; j < iov[i].iov_len; j++)
+			((u8 *)iov[i].iov_base)[j] = RT_IOV_BYTES(offset++);
+	}
+}
+
+static s32 rt_iov_check(struct iovec *iov, s32 iovcnt, s64 offset)
+{
+	s32 i;
+	size_t j;
+
+	for (i = 0; i < iovcnt; i++) {
+		for (j = 0; j < iov[i].iov_len; j++) {
+			if (((u8 *)iov[i].iov_base)[j] != RT_IOV_BYTES(offset)) {
+				printf(" Error: data mismatch offset = %ld \n", (long)offset);
+				return -1;
+			}
+			offset++;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * readv()/writev() move file offset by the bytes transferred, while
+ * preadv()/pwritev() leave it unchanged. Segments are unaligned and
+ * cross block boundaries.
+ */
+int rt_iov(struct nvfuse_handle *nvh, u32 arg)
+{
+	size_t len[3] = { 100, CLUSTER_SIZE, 3000 };
+	struct iovec iov[3];
+	s8 *buf;
+	s64 total = len[0] + len[1] + len[2];
+	s64 poffset = (s64)CLUSTER_SIZE * 3 + 123;
+	s32 fid;
+	s32 ret = -1;
+	s32 i;
+
+	buf = (s8 *)malloc(total);
+	if (buf == NULL)
+		return -1;
+
+	iov[0].iov_base = buf;
+	for (i = 0; i < 3; i++) {
+		iov[i].iov_len = len[i];
+		if (i)
+			iov[i].iov_base = (s8 *)iov[i - 1].iov_base + len[i - 1];
+	}
+
+	fid = nvfuse_openfile_path(nvh, "iov_test", O_RDWR | O_CREAT, 0);
+	if (fid < 0) {
+		printf(" Error: file open or create \n");
+		goto FREE;
+	}
+
+	rt_iov_fill(iov, 3, 0);
+	if (nvfuse_writev(nvh, fid, iov, 3) != total ||
+	    nvh->nvh_sb.sb_file_table[fid].rwoffset != total) {
+		printf(" Error: writev offset = %ld \n", (long)nvh->nvh_sb.sb_file_table[fid].rwoffset);
+		goto CLOSE;
+	}
+
+	/* file offset is not used nor moved */
+	rt_iov_fill(iov, 2, poffset);
+	if (nvfuse_pwritev(nvh, fid, iov, 2, poffset) != len[0] + len[1] ||
+	    nvh->nvh_sb.sb_file_table[fid].rwoffset != total) {
+		printf(" Error: pwritev offset = %ld \n", (long)nvh->nvh_sb.sb_file_table[fid].rwoffset);
+		goto CLOSE;
+	}
+
+	memset(buf, 0x00, total);
+	if (nvfuse_preadv(nvh, fid, iov, 2, poffset) != len[0] + len[1] ||
+	    nvh->nvh_sb.sb_file_table[fid].rwoffset != total ||
+	    rt_iov_check(iov, 2, poffset) < 0) {
+		printf(" Error: preadv offset = %ld \n", (long)nvh->nvh_sb.sb_file_table[fid].rwoffset);
+		goto CLOSE;
+	}
+
+	/* segments of a different layout read the data of writev() back */
+	nvfuse_lseek(nvh, fid, 0, SEEK_SET);
+	memset(buf, 0x00, total);
+	iov[0].iov_len = 1;
+	iov[1].iov_base = buf + 1;
+	iov[1].iov_len = total - 2;
+	iov[2].iov_base = buf + total - 1;
+	iov[2].iov_len = 1;
+	if (nvfuse_readv(nvh, fid, iov, 3) != total ||
+	    nvh->nvh_sb.sb_file_table[fid].rwoffset != total ||
+	    rt_iov_check(iov, 3, 0) < 0) {
+		printf(" Error: readv offset = %ld \n", (long)nvh->nvh_sb.sb_file_table[fid].rwoffset);
+		goto CLOSE;
+	}
+
+	/* writev() continues from offset left by readv() */
+	rt_iov_fill(iov, 1, total);
+	if (nvfuse_writev(nvh, fid, iov, 1) != 1 ||
+	    nvh->nvh_sb.sb_file_table[fid].rwoffset != total + 1 ||
+	    nvfuse_readfile(nvh, fid, buf, 1, total) != 1 ||
+	    (u8)buf[0] != RT_IOV_BYTES(total)) {
+		printf(" Error: writev after readv \n");
+		goto CLOSE;
+	}
+
+	ret = NVFUSE_SUCCESS;
+
+CLOSE:
+	nvfuse_closefile(nvh, fid);
+	nvfuse_rmfile_path(nvh, "iov_test");
+FREE:
+	free(buf);
+
+	return ret;
+}
+
+/* copy of inode of path, read under file system lock */
+static s32 rt_read_inode(struct nvfuse_handle *nvh, const char *path, struct nvfuse_inode *inode)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct nvfuse_inode_ctx *ictx;
+	struct stat st_buf;
+
+	if (nvfuse_getattr(nvh, path, &st_buf) < 0)
+		return -1;
+
+	nvfuse_lock(sb);
+	ictx = nvfuse_read_inode(sb, NULL, st_buf.st_ino);
+	if (ictx == NULL) {
+		nvfuse_unlock(sb);
+		return -1;
+	}
+	memcpy(inode, ictx->ictx_inode, sizeof(struct nvfuse_inode));
+	nvfuse_release_inode(sb, ictx, CLEAN);
+	nvfuse_unlock(sb);
+
+	return 0;
+}
+
+#define RT_INLINE_MAX	(CLUSTER_SIZE * 2)
+
+struct rt_inline_file {
+	s32 fid;
+	s64 size;
+	u8 data[RT_INLINE_MAX]; /* expected contents */
+	u8 buf[RT_INLINE_MAX];
+};
+
+static s32 rt_inline_write(struct nvfuse_handle *nvh, struct rt_inline_file *f, s64 offset, u32 count)
+{
+	u32 i;
+
+	for (i = 0; i < count; i++)
+		f->data[offset + i] = (u8)(offset + i + 1);
+
+	if (nvfuse_writefile(nvh, f->fid, (s8 *)f->data + offset, count, offset) != count) {
+		printf(" Error: write offset = %ld count = %u \n", (long)offset, count);
+		return -1;
+	}
+
+	if (offset + count > f->size)
+		f->size = offset + count;
+
+	return 0;
+}
+
+static s32 rt_inline_truncate(struct nvfuse_handle *nvh, struct rt_inline_file *f, s64 size)
+{
+	if (nvfuse_ftruncate(nvh, f->fid, size) < 0) {
+		printf(" Error: ftruncate size = %ld \n", (long)size);
+		return -1;
+	}
+
+	/* shrunk region reads back as zeroes when file grows again */
+	if (size < f->size)
+		memset(f->data + size, 0x00, f->size - size);
+	f->size = size;
+
+	return 0;
+}
+
+/* whole file is compared and data is expected in inode if inline is set */
+static s32 rt_inline_verify(struct nvfuse_handle *nvh, struct rt_inline_file *f, s32 inline_data)
+{
+	struct nvfuse_inode inode;
+	s64 i;
+
+	if (rt_read_inode(nvh, "inline_test", &inode) < 0)
+		return -1;
+
+	if (inode.i_size != f->size) {
+		printf(" Error: size = %ld expected = %ld \n", (long)inode.i_size, (long)f->size);
+		return -1;
+	}
+
+	if (nvfuse_inline_data_enabled(&nvh->nvh_sb) &&
+	    !nvfuse_inode_has_inline_data(&inode) != !inline_data) {
+		printf(" Error: inline data flag = %d expected = %d (size = %ld) \n",
+		       nvfuse_inode_has_inline_data(&inode) ? 1 : 0, inline_data, (long)f->size);
+		return -1;
+	}
+
+	memset(f->buf, 0xff, f->size);
+	if (nvfuse_readfile(nvh, f->fid, (s8 *)f->buf, f->size, 0) != f->size) {
+		printf(" Error: read size = %ld \n", (long)f->size);
+		return -1;
+	}
+
+	for (i = 0; i < f->size; i++) {
+		if (f->buf[i] != f->data[i]) {
+			printf(" Error: data mismatch offset = %ld (%d, %d) \n", (long)i, f->buf[i], f->data[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Tiny file is written, overwritten, shrunk and grown inside the inode,
+ * and then moved to a block by a write and by ftruncate() past the
+ * inline area. Truncation to zero lets the file go inline again.
+ */
+int rt_inline_data(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_inode inode;
+	struct rt_inline_file *f;
+	s32 ret = -1;
+
+	if (!nvfuse_inline_data_enabled(&nvh->nvh_sb))
+		printf(" Note: file system is formatted without inline data. \n");
+
+	f = (struct rt_inline_file *)calloc(1, sizeof(struct rt_inline_file));
+	if (f == NULL)
+		return -1;
+
+	f->fid = nvfuse_openfile_path(nvh, "inline_test", O_RDWR | O_CREAT, 0);
+	if (f->fid < 0) {
+		printf(" Error: file open or create \n");
+		goto FREE;
+	}
+
+	if (rt_inline_write(nvh, f, 0, 40) || rt_inline_verify(nvh, f, 1))
+		goto CLOSE;
+
+	if (rt_inline_write(nvh, f, 20, 10) || rt_inline_verify(nvh, f, 1))
+		goto CLOSE;
+
+	/* tail of inline area is zeroed by shrink */
+	if (rt_inline_truncate(nvh, f, 16) || rt_inline_verify(nvh, f, 1))
+		goto CLOSE;
+
+	if (rt_inline_truncate(nvh, f, NVFUSE_INLINE_DATA_SIZE) || rt_inline_verify(nvh, f, 1))
+		goto CLOSE;
+
+	/* write past inline area moves data to a block */
+	if (rt_inline_write(nvh, f, 100, 50) || rt_inline_verify(nvh, f, 0))
+		goto CLOSE;
+
+	if (rt_inline_truncate(nvh, f, 0) || rt_inline_verify(nvh, f, 0))
+		goto CLOSE;
+
+	if (rt_inline_write(nvh, f, 0, 20) || rt_inline_verify(nvh, f, 1))
+		goto CLOSE;
+
+	/* ftruncate past inline area moves data to a block */
+	if (rt_inline_truncate(nvh, f, CLUSTER_SIZE - 10) || rt_inline_verify(nvh, f, 0))
+		goto CLOSE;
+
+	if (rt_inline_truncate(nvh, f, 0) || rt_inline_write(nvh, f, 0, 20))
+		goto CLOSE;
+
+	/* growth by whole blocks moves it as well */
+	if (rt_inline_truncate(nvh, f, CLUSTER_SIZE + 10))
+		goto CLOSE;
+
+	if (rt_read_inode(nvh, "inline_test", &inode) < 0 || nvfuse_inode_has_inline_data(&inode)) {
+		printf(" Error: inline data is left in inode of size = %ld \n", (long)f->size);
+		goto CLOSE;
+	}
+
+	ret = NVFUSE_SUCCESS;
+
+CLOSE:
+	nvfuse_closefile(nvh, f->fid);
+	nvfuse_rmfile_path(nvh, "inline_test");
+FREE:
+	free(f);
+
+	return ret;
+}
+
+/* names f0 .. f(nr - 1) in small_dir are found and f(nr) is not */
+static s32 rt_small_dir_lookup(struct nvfuse_handle *nvh, s32 nr)
+{
+	struct stat st_buf;
+	char str[FNAME_SIZE];
+	s32 i;
+
+	for (i = 0; i <= nr; i++) {
+		sprintf(str, "small_dir/f%d", i);
+		if ((nvfuse_getattr(nvh, str, &st_buf) == 0) != (i < nr)) {
+			printf(" Error: lookup %s with %d files \n", str, nr);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Directory is searched linearly while its entries fit in a dentry block,
+ * and gets a bptree which indexes the entries stored so far once it
+ * outgrows the block.
+ */
+int rt_small_dir(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_inode inode;
+	struct stat st_buf;
+	char str[FNAME_SIZE];
+	/* "." and ".." take the first two dentries */
+	s32 nr_small = NVFUSE_DIR_INDEX_THRESHOLD - 2;
+	s32 nr = 0;
+	s32 fid;
+	s32 ret = -1;
+	s32 i;
+
+	if (nvfuse_mkdir_path(nvh, "small_dir", 0644) < 0) {
+		printf(" Error: mkdir small_dir \n");
+		return -1;
+	}
+
+	for (; nr < nr_small; nr++) {
+		sprintf(str, "small_dir/f%d", nr);
+		fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+		if (fid < 0) {
+			printf(" Error: file open or create %s \n", str);
+			goto REMOVE;
+		}
+		nvfuse_closefile(nvh, fid);
+	}
+
+	if (rt_read_inode(nvh, "small_dir", &inode) < 0 || rt_small_dir_lookup(nvh, nr) < 0)
+		goto REMOVE;
+
+#ifdef NVFUSE_USE_DELAYED_BPTREE_CREATION
+	if (inode.i_bpino) {
+		printf(" Error: directory of %d files has bptree \n", nr);
+		goto REMOVE;
+	}
+#endif
+
+	/* the next entry promotes directory to bptree */
+	for (; nr < nr_small + NVFUSE_DIR_INDEX_THRESHOLD; nr++) {
+		sprintf(str, "small_dir/f%d", nr);
+		fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+		if (fid < 0) {
+			printf(" Error: file open or create %s \n", str);
+			goto REMOVE;
+		}
+		nvfuse_closefile(nvh, fid);
+	}
+
+	if (rt_read_inode(nvh, "small_dir", &inode) < 0 || rt_small_dir_lookup(nvh, nr) < 0)
+		goto REMOVE;
+
+	if (inode.i_bpino == 0) {
+		printf(" Error: directory of %d files has no bptree \n", nr);
+		goto REMOVE;
+	}
+
+	ret = NVFUSE_SUCCESS;
+
+REMOVE:
+	/* removed names are dropped from index as well */
+	for (i = 0; i < nr; i++) {
+		sprintf(str, "small_dir/f%d", i);
+		if (nvfuse_rmfile_path(nvh, str) < 0 || nvfuse_getattr(nvh, str, &st_buf) == 0) {
+			printf(" Error: rmfile %s \n", str);
+			ret = -1;
+		}
+	}
+
+	if (nvfuse_rmdir_path(nvh, "small_dir") < 0) {
+		printf(" Error: rmdir small_dir \n");
+		ret = -1;
+	}
+
+	return ret;
+}
+
 #define RANDOM		1
 #define SEQUENTIAL	0
 
@@ -661,7 +1640,15 @@ rt_ctx[] = {
 	{ rt_create_max_sized_file_aio_4KB, "Creating Maximum Sized Single File with 4KB Random AIO Read and Write.", RANDOM, 0, 0},
 	{ rt_create_max_sized_file_aio_128KB, "Creating Maximum Sized Single File with 128KB Sequential AIO Read and Write.", SEQUENTIAL, 0, 0 },
 	{ rt_create_max_sized_file_aio_128KB, "Creating Maximum Sized Single File with 128KB Random AIO Read and Write.", RANDOM, 0, 0 },
-	{ rt_create_4KB_files, "Creating 4KB files with fsync.", 0, 0, 0}
+	{ rt_create_4KB_files, "Creating 4KB files with fsync.", 0, 0, 0},
+	{ rt_index, "Growing and Shrinking Buffer Cache Index.", 0, 0, 0},
+	{ rt_extent_tree, "Fragmenting and Truncating Extent Tree.", 0, 0, 0},
+	{ rt_bc_policy_2q, "Selecting 2Q Victims During Scan.", 0, 0, 0},
+	{ rt_bc_arena, "Allocating and Returning Buffer Cache Arena Chunks.", 0, 0, 0},
+	{ rt_multi_thread, "Sharing a Handle among Threads.", 0, 0, 0},
+	{ rt_iov, "Moving File Offset by Vectored Read and Write.", 0, 0, 0},
+	{ rt_inline_data, "Writing, Growing and Truncating Inline Data.", 0, 0, 0},
+	{ rt_small_dir, "Promoting Small Directory to Bptree.", 0, 0, 0}
 };
 
 void rt_usage(char *cmd)
@@ -20,11 +20,19 @@
 #ifndef __NVFUSE_AIO_H
 #define __NVFUSE_AIO_H
 
+struct iovec;
+struct io_job;
+
 #define NVFUSE_MAX_AIO_DEPTH		1024
 #define NVFUSE_MAX_AIO_COMPLETION	1
 #define NVFUSE_READY_QUEUE			0
 #define NVFUSE_SUBMISSION_QUEUE		1
 #define NVFUSE_COMPLETION_QUEUE		2
+#define NVFUSE_GROUP_COMMIT_QUEUE	3 /* fsync requests waiting for group commit */
+
+/* opcodes other than READ and WRITE */
+#define NVFUSE_AIO_FSYNC	2
+#define NVFUSE_AIO_FDSYNC	3
 
 #define NVFUSE_AIO_STATUS_READY			0
 #define NVFUSE_AIO_STATUS_SUMISSION		1
@@ -32,7 +40,7 @@
 
 struct nvfuse_aio_ctx {
 	s32 actx_fid; /* file descriptor */
-	s32 actx_opcode; /* Read or Write */
+	s32 actx_opcode; /* Read, Write, NVFUSE_AIO_FSYNC or NVFUSE_AIO_FDSYNC */
 	void *actx_buf; /* actual data buffer */
 	s64 actx_offset; /* start address in bytes */
 	s64 actx_bytes; /* number of bytes */
@@ -41,6 +49,7 @@ struct nvfuse_aio_ctx {
 	struct list_head actx_list; /* linked list */
 	struct list_head actx_bh_head; /* buffer head list */
 	s32 actx_bh_count;
+	struct iovec *actx_iov; /* pages of merged device requests */
 	void(*actx_cb_func)(void *arg); /* callback function to process completion for each context */
 	struct nvfuse_aio_queue *actx_queue; /* aio queue pointer */
 	struct nvfuse_superblock *actx_sb; /* superblock pointer */
@@ -65,6 +74,11 @@ struct nvfuse_aio_queue {
 	s32 acq_max_depth; /* maximum completion queue depth */
 	s32 acq_cur_depth; /* current completion queue depth */
 
+	struct list_head agq_head; /* group commit queue head */
+	s32 agq_max_depth; /* maximum group commit queue depth */
+	s32 agq_cur_depth; /* current group commit queue depth */
+	u64 agq_start_tsc; /* arrival of the oldest fsync request */
+
 	s32 aio_cur_depth;
 
 	s32 max_completions;
@@ -89,6 +103,9 @@ void nvfuse_aio_gen_dev_cpls_directio(void *arg);
 s32 nvfuse_aio_gen_dev_reqs_buffered(struct nvfuse_superblock *sb, struct nvfuse_aio_ctx *actx);
 s32 nvfuse_aio_gen_dev_reqs_directio(struct nvfuse_superblock *sb, struct nvfuse_aio_ctx *actx);
 s32 nvfuse_aio_wait_dev_cpls(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq);
+/* account a job reaped from completion ring to its owner */
+void nvfuse_aio_dispatch_cjob(struct nvfuse_superblock *sb, struct io_job *job);
+s32 nvfuse_aio_group_commit(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq, s32 force);
 
 s32 nvfuse_aio_get_queue_depth_total(struct nvfuse_aio_queue *aioq);
 s32 nvfuse_aio_get_queue_depth_type(struct nvfuse_aio_queue *aioq, s32 qtype);
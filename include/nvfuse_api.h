@@ -15,9 +15,11 @@
 
 #if NVFUSE_OS == NVFUSE_OS_LINUX
 #include <sys/statvfs.h>
+#include <sys/uio.h>
 #endif
 
 #include "nvfuse_types.h"
+#include "nvfuse_config.h"
 
 #ifndef _NVFUSE_API_H
 #define _NVFUSE_API_H
@@ -53,10 +55,25 @@ s32 nvfuse_readfile(struct nvfuse_handle *nvh, u32 fid, s8 *buffer, s32 count,
 		    nvfuse_off_t roffset);
 s32 nvfuse_readfile_aio(struct nvfuse_handle *nvh, u32 fid, s8 *buffer, s32 count,
 			nvfuse_off_t roffset);
+#ifdef NVFUSE_USE_ZERO_COPY_READ
+/* buffer must be allocated by nvfuse_alloc_aligned_buffer() to bypass buffer cache */
+s32 nvfuse_readfile_zcopy(struct nvfuse_handle *nvh, u32 fid, s8 *buffer, s32 count,
+			  nvfuse_off_t roffset);
+s32 nvfuse_readfile_zcopy_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
+			       nvfuse_off_t roffset);
+#endif
 
 s32 nvfuse_writefile(struct nvfuse_handle *nvh, u32 fid, const s8 *user_buf, u32 count,
 		     nvfuse_off_t woffset);
 
+/* vectored I/O, readv and writev use and advance the current file offset */
+s32 nvfuse_readv(struct nvfuse_handle *nvh, s32 fid, const struct iovec *iov, s32 iovcnt);
+s32 nvfuse_writev(struct nvfuse_handle *nvh, s32 fid, const struct iovec *iov, s32 iovcnt);
+s32 nvfuse_preadv(struct nvfuse_handle *nvh, s32 fid, const struct iovec *iov, s32 iovcnt,
+		  nvfuse_off_t offset);
+s32 nvfuse_pwritev(struct nvfuse_handle *nvh, s32 fid, const struct iovec *iov, s32 iovcnt,
+		   nvfuse_off_t offset);
+
 s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *str, inode_t *new_ino,
 		      mode_t mode, dev_t dev);
 
@@ -96,6 +113,9 @@ s32 nvfuse_chown(struct nvfuse_handle *nvh, const char *path, uid_t uid, gid_t g
 #endif
 s32 nvfuse_fdatasync(struct nvfuse_handle *nvh, int fd);
 s32 nvfuse_fsync(struct nvfuse_handle *nvh, int fd);
+s32 nvfuse_group_commit(struct nvfuse_handle *nvh, s32 *fds, s32 nr_fds, s32 datasync);
+s32 nvfuse_group_commit_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx **ictxs,
+			     s32 nr_ictxs, s32 datasync);
 s32 nvfuse_sync(struct nvfuse_handle *nvh);
 
 s32 nvfuse_fdsync_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
@@ -131,6 +151,10 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 			  nvfuse_off_t woffset);
 s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
 			 nvfuse_off_t roffset, s32 sync_read);
+s32 nvfuse_readv_core(struct nvfuse_superblock *sb, u32 fid, const struct iovec *iov, s32 iovcnt,
+		      nvfuse_off_t roffset, s32 sync_read);
+s32 nvfuse_writev_core(struct nvfuse_superblock *sb, s32 fid, const struct iovec *iov, s32 iovcnt,
+		       nvfuse_off_t woffset);
 s32 nvfuse_path_resolve(struct nvfuse_handle *nvh, const char *path, char *filename,
 			struct nvfuse_dir_entry *direntry);
 s32 nvfuse_fgetblk(struct nvfuse_superblock *sb, s32 fid, s32 lblk, s32 max_blocks, u32 *num_alloc);
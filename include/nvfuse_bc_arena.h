@@ -0,0 +1,67 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <pthread.h>
+#include "nvfuse_types.h"
+
+#ifndef __NVFUSE_BC_ARENA_H__
+#define __NVFUSE_BC_ARENA_H__
+
+struct nvfuse_buffer_cache;
+struct nvfuse_io_manager;
+
+/*
+ * A chunk is a single hugepage region of NVFUSE_BC_ARENA_CHUNK_SIZE bytes.
+ * Its head is carved into ba_chunk_pages cache pages followed by their
+ * descriptors and a stack of free slots. The pages of a chunk are
+ * registered to the I/O backend as one buffer.
+ */
+struct nvfuse_bc_chunk {
+	void *ch_region; /* NULL if chunk is not allocated */
+	struct nvfuse_buffer_cache *ch_bcs; /* descriptors in slot order */
+	u32 *ch_free; /* stack of free slots */
+	u32 ch_nr_free;
+};
+
+/*
+ * Buffer cache arena
+ *
+ * Descriptors are addressed by index (i.e., chunk * ba_chunk_pages + slot),
+ * and the page of a descriptor lives at the same slot of its chunk. New
+ * descriptors are taken from the lowest chunk having free slots, so that
+ * chunks at the end empty out and are returned as a whole.
+ */
+struct nvfuse_bc_arena {
+	pthread_mutex_t ba_lock;
+	u32 ba_chunk_pages; /* buffers carved out of a chunk */
+	u32 ba_max_chunks;
+	u32 ba_nr_chunks; /* allocated chunks */
+	u32 ba_low; /* no chunk below this has free slots */
+	u32 ba_nr_used; /* descriptors handed out */
+	struct nvfuse_bc_chunk *ba_chunks;
+	struct nvfuse_io_manager *ba_io_manager; /* chunks are registered to it */
+};
+
+s32 nvfuse_bc_arena_init(struct nvfuse_bc_arena *arena, struct nvfuse_io_manager *io_manager);
+void nvfuse_bc_arena_deinit(struct nvfuse_bc_arena *arena);
+/* returns a descriptor with its page attached, it grows by a chunk if needed */
+struct nvfuse_buffer_cache *nvfuse_bc_arena_alloc(struct nvfuse_bc_arena *arena);
+/* a chunk having no descriptor in use is returned at once */
+void nvfuse_bc_arena_free(struct nvfuse_bc_arena *arena, struct nvfuse_buffer_cache *bc);
+struct nvfuse_buffer_cache *nvfuse_bc_arena_get(struct nvfuse_bc_arena *arena, u32 idx);
+
+#define nvfuse_bc_arena_chunk(arena, idx) ((idx) / (arena)->ba_chunk_pages)
+
+#endif /* __NVFUSE_BC_ARENA_H__ */
@@ -0,0 +1,73 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+#include "nvfuse_buffer_cache.h"
+
+#ifndef __NVFUSE_BC_POLICY_H__
+#define __NVFUSE_BC_POLICY_H__
+
+/* Buffer Replacement Policy */
+#define NVFUSE_BC_POLICY_LRU	0 /* single LRU list of clean buffers */
+#define NVFUSE_BC_POLICY_2Q		1 /* scan resistant 2Q */
+#define NVFUSE_BC_POLICY_NUM	2
+
+/*
+ * Replacement policy decides which clean buffer is evicted. Buffers enter
+ * and leave the clean list through nvfuse_move_buffer_list(), and victims
+ * are asked for only when no unused buffer is available. Each partition
+ * of a shard runs its own instance of the policy.
+ */
+struct nvfuse_bc_policy {
+	const char *name;
+	int (*init)(struct nvfuse_bc_part *part);
+	void (*deinit)(struct nvfuse_bc_part *part);
+	/* bc is loaded for a key missed in cache */
+	void (*miss)(struct nvfuse_bc_part *part, struct nvfuse_buffer_cache *bc);
+	/* cached bc is referenced again */
+	void (*hit)(struct nvfuse_bc_part *part, struct nvfuse_buffer_cache *bc);
+	/* bc enters or leaves clean list */
+	void (*add_clean)(struct nvfuse_bc_part *part, struct nvfuse_buffer_cache *bc, s32 tail);
+	void (*del_clean)(struct nvfuse_bc_part *part, struct nvfuse_buffer_cache *bc);
+	/* select clean bc to be replaced, it stays in clean list */
+	struct nvfuse_buffer_cache *(*victim)(struct nvfuse_bc_part *part);
+};
+
+#define nvfuse_bc_policy_miss(bm, bc) \
+	if ((bm)->bm_policy->miss) \
+	(bm)->bm_policy->miss(&(bm)->bm_part[(bc)->bc_part], bc);
+
+#define nvfuse_bc_policy_hit(bm, bc) \
+	if ((bm)->bm_policy->hit) \
+	(bm)->bm_policy->hit(&(bm)->bm_part[(bc)->bc_part], bc);
+
+#define nvfuse_bc_policy_add_clean(bm, bc, tail) \
+	if ((bm)->bm_policy->add_clean) \
+	(bm)->bm_policy->add_clean(&(bm)->bm_part[(bc)->bc_part], bc, tail);
+
+#define nvfuse_bc_policy_del_clean(bm, bc) \
+	if ((bm)->bm_policy->del_clean) \
+	(bm)->bm_policy->del_clean(&(bm)->bm_part[(bc)->bc_part], bc);
+
+#define nvfuse_bc_policy_victim(bm, part) (bm)->bm_policy->victim(&(bm)->bm_part[part])
+
+/* returns policy number with given name (e.g., "lru", "2q") or -1 */
+s32 nvfuse_bc_policy_lookup(const char *name);
+s32 nvfuse_bc_policy_init(struct nvfuse_buffer_manager *bm, s32 policy);
+void nvfuse_bc_policy_deinit(struct nvfuse_buffer_manager *bm);
+/* print hit and miss counts of buffer cache summed over shards */
+void nvfuse_bc_policy_print_stat(struct nvfuse_superblock *sb);
+
+#endif /* __NVFUSE_BC_POLICY_H__ */
@@ -16,6 +16,8 @@
 #include "nvfuse_config.h"
 #include "nvfuse_core.h"
 #include "list.h"
+#include "nvfuse_index.h"
+#include "nvfuse_bc_arena.h"
 
 #ifndef __NVFUSE_BUFFER_CACHE_H__
 #define __NVFUSE_BUFFER_CACHE_H__
@@ -29,7 +31,8 @@
 #define BUFFER_TYPE_CLEAN		2
 #define BUFFER_TYPE_DIRTY		3
 #define BUFFER_TYPE_FLUSHING	4
-#define BUFFER_TYPE_NUM			5
+#define BUFFER_TYPE_WRITEBACK	5 /* under asynchronous writeback */
+#define BUFFER_TYPE_NUM			6
 
 /* Buffer Status */
 #define BUFFER_STATUS_UNUSED	0
@@ -42,6 +45,13 @@
 #define DIRTY_FLUSH_DELAY		0
 #define DIRTY_FLUSH_FORCE		1
 
+/* Buffer Cache Partitions */
+#define NVFUSE_BC_PART_DATA		0 /* file data */
+#define NVFUSE_BC_PART_META		1 /* blocks read with NVFUSE_TYPE_META */
+#define NVFUSE_BC_PART_NUM		2
+
+struct nvfuse_bc_policy;
+
 /* buffer head to track dirty buffer for each inode */
 struct nvfuse_buffer_head {
 	struct list_head bh_dirty_list; /* metadata buffer list for specific inode */
@@ -62,11 +72,13 @@ struct nvfuse_buffer_head {
 
 /* buffer cache allocated to each physical block */
 struct nvfuse_buffer_cache {
-	struct hlist_node bc_hash;	/* hash list*/
 	struct list_head bc_list;	/* main buffer list */
+	struct list_head bc_policy_list; /* list of replacement policy while clean */
 	struct list_head bc_bh_head; /* buffer list to retrieve */
 	s32 bc_bh_count;
 
+	struct nvfuse_buffer_manager *bc_bm; /* shard owning this buffer */
+
 	union {
 		u64 bc_bno;					/* buffer number (type | inode | block number)*/
 		struct {
@@ -79,35 +91,88 @@ struct nvfuse_buffer_cache {
 
 	u32 bc_dirty: 1;				/* dirty status */
 	u32 bc_load	: 1;				/* data loaded from storage */
-	u32 bc_ref	: 27;					/* reference count*/
+	u32 bc_ref	: 25;					/* reference count*/
+	u32 bc_hot	: 1;				/* hot buffer for replacement policy */
+	u32 bc_part	: 1;				/* partition (e.g., meta, data) */
 	u32 bc_list_type: 3;				/* buffer status (e.g., clean, dirty, unused) */
+	u32 bc_tick;				/* shard clock of last reference */
 
 	s8 *bc_buf;					/* actual buffered data */
+	u32 bc_idx;					/* descriptor index in buffer cache arena */
+	u64 bc_dirty_tsc;			/* time when buffer became dirty */
+	s32 bc_ra;					/* read by readahead is in flight */
 
 	struct nvfuse_superblock *bc_sb; /* FIXME: it must be eliminated. */
 };
 
+/*
+ * Buffers in a shard are owned by either metadata or data partition while
+ * they are in use. Each partition keeps its own clean list and replacement
+ * policy state, and its size is kept between minimum and maximum.
+ */
+struct nvfuse_bc_part {
+	struct list_head bp_clean; /* clean buffers in MRU order */
+	s32 bp_nr_clean;
+	s32 bp_size; /* buffers owned by partition (i.e., not unused) */
+	s32 bp_min_percent;
+	s32 bp_max_percent;
+	u64 bp_cache_ref;
+	u64 bp_cache_hit;
+
+	void *bp_policy_priv; /* state of replacement policy */
+};
+
+/*
+ * Buffer cache is split into NVFUSE_BC_SHARDS shards. Each shard owns the keys
+ * hashed to it by nvfuse_bc_shard() and protects its lists, index and
+ * replacement policy with bm_lock, so threads working on different files or
+ * distant ranges of a file rarely contend on the same lock.
+ *
+ * Shard locks protect only the buffer cache itself. Inode contexts, block and
+ * inode allocation, dirty inode lists and the file table are protected by
+ * sb_lock (see nvfuse_lock()), and I/O queues are private to each thread
+ * (see nvfuse_io_channel.c). Threads get affinity to the shards they use
+ * most (see nvfuse_stage_flushing_dirty() and nvfuse_steal_unused_bc()).
+ */
 struct nvfuse_buffer_manager {
 	/* block buffer manager */
+	pthread_mutex_t bm_lock;
+	s32 bm_id;
+
 	struct list_head bm_list[BUFFER_TYPE_NUM];
-	struct hlist_head bm_hash[HASH_NUM + 1]; /* regular hash list and unused hash list (1) */
+	struct nvfuse_index bm_index; /* key to bc */
 
 	s32 bm_list_count[BUFFER_TYPE_NUM];
-	s32 bm_hash_count[HASH_NUM + 1];
 	s32 bm_cache_size;
 
 	u64 bm_cache_ref;
 	u64 bm_cache_hit;
+	u32 bm_tick; /* clock advanced by each reference */
+
+	struct nvfuse_bc_part bm_part[NVFUSE_BC_PART_NUM];
+
+	/* replacement policy of clean buffers */
+	struct nvfuse_bc_policy *bm_policy;
 };
 
+#define nvfuse_bm_lock(bm) pthread_mutex_lock(&(bm)->bm_lock)
+#define nvfuse_bm_unlock(bm) pthread_mutex_unlock(&(bm)->bm_lock)
+
+/* shard owning a given key */
+static inline struct nvfuse_buffer_manager *nvfuse_bc_shard(struct nvfuse_superblock *sb, u64 key)
+{
+	u64 range = key >> NVFUSE_BC_SHARD_RANGE_BITS;
+
+	return sb->sb_bm[(u32)((range * 0x9E3779B97F4A7C15ULL) >> 32) % NVFUSE_BC_SHARDS];
+}
+
 /* inode context cache manager */
 struct nvfuse_ictx_manager {
 	struct list_head ictxc_list[BUFFER_TYPE_NUM];
-	struct hlist_head ictxc_hash[HASH_NUM + 1]; /* regular hash list and unused hash list (1) */
+	struct nvfuse_index ictxc_index; /* inode number to ictx */
 
 	void *ictx_buf; /* allocated by spdk_zmalloc() */
 	s32 ictxc_list_count[BUFFER_TYPE_NUM];
-	s32 ictxc_hash_count[HASH_NUM + 1];
 	s32 ictxc_cache_size;
 	u64 ictxc_cache_ref;
 	u64 ictxc_cache_hit;
@@ -127,9 +192,9 @@ void nvfuse_init_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc
 struct nvfuse_buffer_head *nvfuse_alloc_buffer_head(struct nvfuse_superblock *sb);
 /* free buffer head (bh) using memppol */
 void nvfuse_free_buffer_head(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *bh);
-/* alloc buffer cache (bc) using mempool */
+/* alloc buffer cache (bc) with its page from arena */
 struct nvfuse_buffer_cache *nvfuse_alloc_bc(struct nvfuse_superblock *sb);
-/* free buffer cache (bc) using mempool */
+/* free buffer cache (bc) and its page to arena */
 void nvfuse_free_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc);
 /* get buffer head (bh) with inode, inode number and lba number */
 struct nvfuse_buffer_head *nvfuse_get_bh(struct nvfuse_superblock *sb,
@@ -141,18 +206,36 @@ struct nvfuse_buffer_head *nvfuse_get_new_bh(struct nvfuse_superblock *sb,
 											struct nvfuse_inode_ctx *ictx, 
 											inode_t ino, lbno_t lblock, s32 is_meta);
 /* find out buffer cache (bc) associated with key and lblock */
-struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key, lbno_t lblock);
-/* replace the buffer cahce located at the end of the LRU list*/
-struct nvfuse_buffer_cache *nvfuse_replace_buffer_cache(struct nvfuse_superblock *sb, u64 key);
+s32 nvfuse_prefetch_bc(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+		       inode_t ino, lbno_t lblock, u32 nr_blocks);
+/* returned bc is referenced, it is dropped by nvfuse_put_bc() or nvfuse_release_bh() */
+struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key, lbno_t lblock,
+					   s32 is_meta);
+/* replace the buffer cahce located at the end of the LRU list, shard lock is held */
+struct nvfuse_buffer_cache *nvfuse_replace_buffer_cache(struct nvfuse_superblock *sb, u64 key, s32 part);
 /* move buffer cache (bc) to another list */
 void nvfuse_move_buffer_list(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc,
 							 s32 buffer_type, s32 tail);
+/* same as above, but lock of shard owning bc is held by caller */
+void __nvfuse_move_buffer_list(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc,
+							 s32 buffer_type, s32 tail);
+/* take and drop a reference of bc under lock of its shard */
+void nvfuse_get_bc(struct nvfuse_buffer_cache *bc);
+void nvfuse_put_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc, s32 tail);
+/* mark dirty bc as being flushed on writeback list of its shard */
+s32 nvfuse_stage_flushing_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc);
+void nvfuse_unstage_flushing_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc);
+s32 nvfuse_stage_flushing_dirty(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache **bcs, s32 nr);
+/* return the number of buffer caches in a given list type of all shards */
+s32 nvfuse_get_list_count(struct nvfuse_superblock *sb, s32 buffer_type);
+/* return the number of buffer caches of all shards */
+s32 nvfuse_get_cache_size(struct nvfuse_superblock *sb);
 /* return the number of dirty buffer caches (e.g., 4K dirty buffers) */
 s32 nvfuse_get_dirty_count(struct nvfuse_superblock *sb);
 /* mark the buffer head as dirty */
 void nvfuse_mark_dirty_bh(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *bh);
 /* lookup the buffer cache (bc) related to a given key */
-struct nvfuse_buffer_cache *nvfuse_hash_lookup(struct nvfuse_buffer_manager *bm, u64 key);
+struct nvfuse_buffer_cache *nvfuse_hash_lookup(struct nvfuse_superblock *sb, u64 key);
 /* set bh status */
 void nvfuse_set_bh_status(struct nvfuse_buffer_head *bh, s32 status);
 /* clear bh status */
@@ -55,15 +55,27 @@ inline int nvfuse_process_model_is_dataplane(void)
 #define __NOUSE_FUSE__
 #endif
 
-#	define CLUSTER_SIZE (4*1024)
-#	define CLUSTER_SIZE_BITS 12
+/*
+ * Block size is a build-time constant (e.g., make BLOCK_SIZE_BITS=14 for 16KB),
+ * not a per-superblock value. mkfs records it in sb_block_size and mount
+ * rejects a file system formatted by a build of another block size.
+ */
+#ifndef NVFUSE_BLOCK_SIZE_BITS
+#	define NVFUSE_BLOCK_SIZE_BITS 12
+#endif
+#if NVFUSE_BLOCK_SIZE_BITS < 12 || NVFUSE_BLOCK_SIZE_BITS > 16
+#	error "NVFUSE_BLOCK_SIZE_BITS must be between 12 (4KB) and 16 (64KB)"
+#endif
+#	define CLUSTER_SIZE (1 << NVFUSE_BLOCK_SIZE_BITS)
+#	define CLUSTER_SIZE_BITS NVFUSE_BLOCK_SIZE_BITS
 #   define BITS_PER_CLUSTER 8
 #   define BITS_PER_CLUSTER_BITS 3
 
-/* LRU Cache Size and Hash Size */
-//#define NVFUSE_HASH_SIZE 100000
-//#define HASH_NUM (15331)
-#define HASH_NUM (52631)
+/* Buffer and Inode Context Index */
+/* index grows twice when load factor (in percent) exceeds this */
+#define NVFUSE_INDEX_MAX_LOAD 70
+/* initial and minimum number of slots */
+#define NVFUSE_INDEX_MIN_SIZE 4096
 
 /* attempting to allocate buffers and containers as much as desired at mount time*/
 #define NVFUSE_CONTAINER_PERALLOCATION_SIZE	1024 /* in 128MB unit */
@@ -78,19 +90,46 @@ inline int nvfuse_process_model_is_dataplane(void)
 /* Default Inode Context Size */
 #define NVFUSE_ICTXC_SIZE (32*1024)
 
+/* Buffer Replacement Policy (e.g., NVFUSE_BC_POLICY_2Q), selectable with -r option */
+#define NVFUSE_BC_POLICY_DEFAULT NVFUSE_BC_POLICY_LRU
+/* 2Q: a1in is evicted first while it is larger than this */
+#define NVFUSE_2Q_KIN_PERCENT 25
+/* 2Q: keys of buffers evicted from a1in are remembered up to this */
+#define NVFUSE_2Q_KOUT_PERCENT 50
+#define NVFUSE_2Q_GHOST_HASH_NUM 4099
+
+/* Buffer Cache Partitions (in percent of buffers in a shard) */
+/* metadata (e.g., bitmaps, inode tables, directories) is never evicted below its minimum by data */
+#define NVFUSE_BC_META_MIN_PERCENT 10
+#define NVFUSE_BC_META_MAX_PERCENT 50
+#define NVFUSE_BC_DATA_MIN_PERCENT 10
+#define NVFUSE_BC_DATA_MAX_PERCENT 90
+
+/* Buffer Cache Shards */
+/* each shard has its own lists, index, replacement policy and lock */
+#define NVFUSE_BC_SHARDS 16
+/* 2^NVFUSE_BC_SHARD_RANGE_BITS consecutive blocks of an inode belong to the same shard */
+#define NVFUSE_BC_SHARD_RANGE_BITS 6
+/* maximum number of unused buffers borrowed from another shard at once */
+#define NVFUSE_BC_SHARD_STEAL_SIZE 64
+/* per-thread shard reference counts are halved every 2^N references */
+#define NVFUSE_BC_AFFINITY_DECAY_BITS 16
+
 /* RATIO BG TO BUFFER Cache */
 //#define NVFUSE_BUFFER_RATIO_TO_DATA (0.001) /* data optimized */
 //#define NVFUSE_BUFFER_RATIO_TO_DATA (0.005) /* meta optimized*/
 //#define NVFUSE_BUFFER_RATIO_TO_DATA (0.01) /* meta optimized*/
-#define NVFUSE_BUFFER_DEFAULT_ALLOC_SIZE_PER_MSG 1
+/* buffers are requested to and returned to control plane in arena chunk unit */
+#define NVFUSE_BUFFER_DEFAULT_ALLOC_CHUNKS_PER_MSG 1
 
 /* Buffer Head Mempool Settings */
 #define NVFUSE_BH_MEMPOOL_TOTAL_SIZE	(0x10000) /* 256MB */
 #define NVFUSE_BH_MEMPOOL_CACHE_SIZE	2048
 
-/* Buffer Cache Mempool Settings */
-#define NVFUSE_BC_MEMPOOL_TOTAL_SIZE	(0x400000) /* 16GB */
-#define NVFUSE_BC_MEMPOOL_CACHE_SIZE	2048
+/* Buffer Cache Arena Settings */
+/* pages and descriptors are carved out of a hugepage region of this size (2MB or 1GB) */
+#define NVFUSE_BC_ARENA_CHUNK_SIZE	(2 * 1024 * 1024)
+#define NVFUSE_BC_ARENA_MAX_SIZE	(16ULL * 1024 * 1024 * 1024) /* 16GB */
 
 /* Buffer Cache Mempool Settings */
 #define NVFUSE_BPTREE_MEMPOOL_TOTAL_SIZE	(0x800)
@@ -125,6 +164,27 @@ enum bp_mempool_type {
 #define NVFUSE_SYNC_TIMEOUT_USEC 1000
 #define NVFUSE_SYNC_TIMEOUT_SEC 5
 
+/* FUA Sync */
+/* fsync writes blocks with FUA and skips device flush if nothing else is cached */
+#define NVFUSE_USE_FUA_SYNC
+
+/* Group Commit */
+/* aio fsync requests arriving within the window share dirty writeback and device flush */
+#define NVFUSE_GROUP_COMMIT_USEC 100
+#define NVFUSE_GROUP_COMMIT_MAX 64 /* requests */
+
+/* Background Writeback */
+/* dirty blocks are written asynchronously between low and high watermarks */
+#define NVFUSE_USE_BACKGROUND_WRITEBACK
+#define NVFUSE_WB_LOW_WATERMARK (NVFUSE_SYNC_DIRTY_COUNT / 4) /* blocks */
+#define NVFUSE_WB_HIGH_WATERMARK (NVFUSE_SYNC_DIRTY_COUNT / 2) /* blocks */
+/* foreground writers are throttled beyond this */
+#define NVFUSE_WB_HARD_LIMIT NVFUSE_SYNC_DIRTY_COUNT /* blocks */
+/* dirty blocks older than this are written regardless of watermarks */
+#define NVFUSE_WB_EXPIRE_SEC NVFUSE_SYNC_TIMEOUT_SEC
+#define NVFUSE_WB_MAX_BATCHES 4 /* in-flight writeback batches */
+#define NVFUSE_WB_BATCH_BLOCKS 128
+
 /* Meta Data Dirty Sync Policy */
 /* buffer cache keeps dirty meta data until a centain amount of time passes*/
 #define NVFUSE_META_DIRTY_SYNC_DELAYED DIRTY_FLUSH_DELAY
@@ -135,8 +195,9 @@ enum bp_mempool_type {
 
 /*	*/
 #define NVFUSE_USE_DELAYED_REDISTRIBUTION_BPTREE
-/*	*/
+/* small directories are searched linearly and indexed by bptree once they grow */
 #define NVFUSE_USE_DELAYED_BPTREE_CREATION
+#define NVFUSE_DIR_INDEX_THRESHOLD DIR_ENTRY_NUM /* dentries in a single dir block */
 
 /* actual dir blocks are allocated lazyily */
 #define NVFUSE_USE_DELAYED_DIRECTORY_ALLOC
@@ -151,6 +212,58 @@ enum bp_mempool_type {
 #define NVFUSE_MIN_RA_SIZE (4*CLUSTER_SIZE)
 #define NVFUSE_MAX_RA_SIZE (32*CLUSTER_SIZE)
 
+/* Coalesced Buffered Read */
+/* missing clusters which are physically contiguous are read by a single I/O */
+#define NVFUSE_USE_COALESCED_READ
+#define NVFUSE_MAX_COALESCED_READ_SIZE (256*CLUSTER_SIZE) /* 256 blocks (1MB with 4KB block) */
+
+/* Per-inode Mapping Cache */
+/* recently resolved (lblk, pblk, len) runs are kept in inode context */
+#define NVFUSE_USE_MAP_CACHE
+#define NVFUSE_MAP_CACHE_SIZE 16
+
+/* Zero Copy Buffered Read */
+/* nvfuse_readfile_zcopy() reads uncached clusters into DMA-capable user buffer directly */
+#define NVFUSE_USE_ZERO_COPY_READ
+
+/* SPDK Striping */
+/* blocks are striped across every attached namespace in units of NVFUSE_SPDK_STRIPE_BLOCKS */
+//#define NVFUSE_USE_SPDK_STRIPING
+#define NVFUSE_SPDK_STRIPE_BLOCKS 32 /* 128KB for 4KB block */
+
+/* SPDK Queue Pool */
+/* number of qpairs allocated per handle and namespace to separate traffic classes */
+#define NVFUSE_SPDK_NR_QUEUES 4 /* 1 ~ SPDK_QUEUE_NUM */
+
+/* io_uring Backend */
+/* buffer cache arena chunks are registered as fixed buffers up to this count */
+#define NVFUSE_URING_MAX_BUFS 16384 /* kernel limit */
+/* kernel thread polls submission queue instead of io_uring_enter() */
+//#define NVFUSE_USE_URING_SQPOLL
+#define NVFUSE_URING_SQPOLL_IDLE_MS 100
+
+/* File Disk Workers */
+/* async jobs of file disk are served by a pool of threads with pread/pwrite */
+#define NVFUSE_FILEIO_WORKERS 4
+
+/* Ramdisk Device Model */
+/* ramdisk completes async commands after emulated latency instead of immediately (opt-in) */
+//#define NVFUSE_USE_RAMDISK_MODEL
+#define NVFUSE_RAMDISK_READ_USEC 80 /* base read latency */
+#define NVFUSE_RAMDISK_WRITE_USEC 20 /* base write latency (device cache) */
+#define NVFUSE_RAMDISK_JITTER_USEC 10 /* uniform jitter added to base latency */
+#define NVFUSE_RAMDISK_TAIL_PERMIL 5 /* commands out of 1000 hitting tail latency */
+#define NVFUSE_RAMDISK_TAIL_USEC 1000
+#define NVFUSE_RAMDISK_CHANNELS 8 /* commands served in parallel */
+#define NVFUSE_RAMDISK_BW_MBPS 2000 /* transfer bandwidth (0: unlimited) */
+/* completions are reported as commands finish (0: in submission order) */
+#define NVFUSE_RAMDISK_REORDER 1
+
+/* Inline Data */
+/* contents of files up to NVFUSE_INLINE_DATA_SIZE bytes are kept in inode */
+#define NVFUSE_USE_INLINE_DATA
+#define NVFUSE_INLINE_DATA_SIZE 64 /* resv1, i_blocks and resv2 of inode */
+
 /* MKFS uses zeroing to initialize inode table */
 //#define NVFUSE_USE_MKFS_INODE_ZEROING
 
@@ -26,6 +26,7 @@
 #include <sys/mount.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <pthread.h>
 #include <string.h>
 
@@ -114,6 +115,16 @@
 #define NVFUSE_GET_BG_TO_CLU(sb, bgid) (bgid << NVFUSE_CLU_P_BG_BITS(sb))
 #define NVFUSE_NUM_CLU (DISK_SIZE >> CLUSTER_SIZE_BITS)
 
+/* On-disk Feature Flags */
+#define NVFUSE_FEATURE_EXTENT	(1 << 0) /* extent based block mapping */
+#define NVFUSE_FEATURE_INLINE_DATA	(1 << 1) /* tiny file data in inode */
+
+#define nvfuse_extent_enabled(sb) ((sb)->sb_features & NVFUSE_FEATURE_EXTENT)
+#define nvfuse_inline_data_enabled(sb) ((sb)->sb_features & NVFUSE_FEATURE_INLINE_DATA)
+
+/* file systems formatted before sb_block_size was introduced use 4KB */
+#define nvfuse_sb_block_size(sb) ((sb)->sb_block_size ? (sb)->sb_block_size : 4096)
+
 #define FALSE	0
 #define TRUE	1
 
@@ -177,6 +188,31 @@ struct nvfuse_superblock_common {
 	s32 sb_max_inode_num;
 
 	struct nvfuse_app_superblock asb;
+
+	u32 sb_features; /* RDONLY, NVFUSE_FEATURE_* */
+	u32 sb_block_size; /* RDONLY, 0 means 4KB */
+};
+
+/* a set of dirty buffers written by a single submission */
+struct nvfuse_wb_batch {
+	s32 nr_bcs;
+	s32 nr_jobs;
+	struct nvfuse_buffer_cache *bcs[NVFUSE_WB_BATCH_BLOCKS];
+	struct io_job *jobs[NVFUSE_WB_BATCH_BLOCKS];
+	struct iovec iov[NVFUSE_WB_BATCH_BLOCKS];
+};
+
+/* asynchronous writeback state */
+struct nvfuse_writeback {
+	s32 wb_active;		/* writing back until low watermark is reached */
+	s32 wb_head;		/* oldest in-flight batch */
+	s32 wb_nr_batches;	/* number of in-flight batches */
+	s32 wb_nr_bcs;		/* number of buffers under writeback */
+	s32 wb_need_flush;	/* written buffers are not flushed to media yet */
+	s32 wb_next_shard;	/* shard scanned first for next batch */
+	u64 wb_expire_tsc;	/* buffers dirtied before this are expired */
+	u64 wb_next_scan_tsc;	/* time of next scan for expired buffers */
+	struct nvfuse_wb_batch wb_batch[NVFUSE_WB_MAX_BATCHES];
 };
 
 /* Super Block Structure */
@@ -204,6 +240,9 @@ struct nvfuse_superblock {
 		s32	sb_max_inode_num;
 
 		struct nvfuse_app_superblock asb;
+
+		u32 sb_features; /* RDONLY, NVFUSE_FEATURE_* */
+		u32 sb_block_size; /* RDONLY, 0 means 4KB */
 	};
 
 	struct {
@@ -224,13 +263,25 @@ struct nvfuse_superblock {
 		s32 sb_sb_cur;
 		s32 sb_sb_flush;
 
-		/* block buffer manager */
-		struct nvfuse_buffer_manager *sb_bm;
+		/* block buffer manager (one per shard) */
+		struct nvfuse_buffer_manager *sb_bm[NVFUSE_BC_SHARDS];
 
 		/* inode context cache */
 		struct nvfuse_ictx_manager *sb_ictxc;
 
 		struct nvfuse_file_table *sb_file_table; /* INCLUDING FINE GRAINED LOCK */
+
+		/* asynchronous dirty buffer writeback */
+		struct nvfuse_writeback sb_wb;
+
+		/* per-thread foreground I/O channels (nvfuse_io_channel.c) */
+		struct list_head sb_io_channels;
+		pthread_mutex_t sb_io_channel_lock;
+		u64 sb_io_channel_gen;
+		/* writeback and readahead share io_manager as background channel */
+		pthread_mutex_t sb_bg_io_lock;
+		/* file system operations of threads sharing the handle */
+		pthread_mutex_t sb_lock;
 		//pthread_mutex_t sb_file_table_lock; /* COARSE LOCK */
 
 		struct timeval sb_last_update;	/* SUPER BLOCK in memory UPDATE TIME */
@@ -264,8 +315,8 @@ struct nvfuse_superblock {
 		union perf_stat perf_stat_ipc;
 		/* buffer head mempool */
 		struct spdk_mempool *bh_mempool;
-		/* buffer cache mempool */
-		struct spdk_mempool *bc_mempool; /* allocated for primary core */
+		/* buffer cache arena (pages and descriptors) */
+		struct nvfuse_bc_arena *bc_arena;
 		/* bptree mempool */
 		struct spdk_mempool *bp_mempool[BP_MEMPOOL_NUM];
 		/* bg node mempool*/
@@ -281,12 +332,27 @@ struct bg_node {
 	u32 bg_id;
 };
 
+#define NVFUSE_RA_MAX_BLOCKS (NVFUSE_MAX_RA_SIZE >> CLUSTER_SIZE_BITS)
+#define NVFUSE_RA_MIN_BLOCKS (NVFUSE_MIN_RA_SIZE >> CLUSTER_SIZE_BITS)
+
+/* per open file readahead state */
+struct nvfuse_readahead {
+	lbno_t ra_next;		/* expected start block of next sequential read */
+	lbno_t ra_head;		/* start block of the first window of current stream */
+	lbno_t ra_start;	/* start block of current readahead window */
+	u32 ra_size;		/* window size in blocks (0: no readahead) */
+	s32 ra_nr_jobs;		/* number of in-flight prefetch requests */
+	struct io_job *ra_jobs[NVFUSE_RA_MAX_BLOCKS];
+	struct nvfuse_buffer_cache *ra_bcs[NVFUSE_RA_MAX_BLOCKS];
+};
+
 struct nvfuse_file_table {
 	inode_t	ino;
 	s64	size;
 	s32	used;
 	nvfuse_off_t rwoffset;
 	s32 flags;
+	struct nvfuse_readahead ra;
 };
 
 #define MAX_FILES_PER_DIR (0x7FFFFFFF)
@@ -379,15 +445,43 @@ struct nvfuse_inode {
 	u16	i_gid;		/* Low 16 bits of Group Id */ //50
 	u16	i_uid;		/* Low 16 bits of Owner Uid */	//52
 	u16	i_mode;		/* File mode */ //54
-	u32 resv1[1]; //64
-	u32 i_blocks[TINDIRECT_BLOCKS + 1];
-	u32 resv2[1];
+	u16	i_flags;	/* NVFUSE_INODE_FLAG_* */
+	union {
+		struct {
+			u32 resv1[1]; //64
+			u32 i_blocks[TINDIRECT_BLOCKS + 1];
+			u32 resv2[1];
+		};
+		/* contents of tiny file (NVFUSE_INODE_FLAG_INLINE_DATA) */
+		u8 i_inline_data[NVFUSE_INLINE_DATA_SIZE];
+	};
 };
 
+/* Inode Flags */
+#define NVFUSE_INODE_FLAG_INLINE_DATA	(1 << 0)
+
+#define nvfuse_inode_has_inline_data(inode) ((inode)->i_flags & NVFUSE_INODE_FLAG_INLINE_DATA)
+
+#ifdef NVFUSE_USE_MAP_CACHE
+/* logical to physical block run */
+struct nvfuse_map_cache_entry {
+	lbno_t mc_lblk;
+	u32 mc_pblk;
+	u32 mc_len;
+	u32 mc_stamp; /* last access time for replacement */
+};
+
+/* entries are sorted by mc_lblk and never overlap */
+struct nvfuse_map_cache {
+	s32 mc_nr;
+	u32 mc_clock;
+	struct nvfuse_map_cache_entry mc_ents[NVFUSE_MAP_CACHE_SIZE];
+};
+#endif
+
 struct nvfuse_inode_ctx {
 	inode_t ictx_ino;
 	struct list_head ictx_cache_list;   /* cache list */
-	struct hlist_node ictx_hash;		/* hash list*/
 
 	struct nvfuse_inode *ictx_inode;
 	struct nvfuse_buffer_head *ictx_bh;
@@ -403,11 +497,18 @@ struct nvfuse_inode_ctx {
 	s32 ictx_meta_dirty_count;
 	s32 ictx_data_dirty_count;
 
+#ifdef NVFUSE_USE_MAP_CACHE
+	struct nvfuse_map_cache ictx_map;
+#endif
+
 	s32 ictx_type;
 	s32 ictx_status;
 	s32 ictx_ref;
 };
 
+/* maximum number of segments in vectored I/O */
+#define NVFUSE_IOV_MAX 128
+
 #if NVFUSE_OS == NVFUSE_OS_WINDOWS
 struct iovec {
 	s8 *iov_base;
@@ -427,6 +528,8 @@ struct nvfuse_params {
 	s32 need_format;
 	s32 need_mount;
 	s32 preallocation;
+	s32 extent_mapping;
+	s32 bc_policy; /* buffer replacement policy (NVFUSE_BC_POLICY_*) */
 };
 
 /* IPC Ring Queue Name */
@@ -480,6 +583,7 @@ void nvfuse_release_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx
 s32 nvfuse_relocate_delete_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
 void nvfuse_mark_inode_dirty(struct nvfuse_inode_ctx *ictx);
 void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s64 size);
+s32 nvfuse_inline_data_convert(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
 u32 nvfuse_find_free_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 last_ino);
 void nvfuse_print_inode(struct nvfuse_inode *inode, s8 *str);
 u32 nvfuse_scan_free_ibitmap(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 bg_id, u32 hint_free_inode);
@@ -497,7 +601,11 @@ void nvfuse_dir_hash(s8 *filename, u32 *hash, u32 *hash2);
 
 /* Dirty Sync Functions */
 struct io_job;
-s32 nvfuse_sync_dirty_data(struct nvfuse_superblock *sb, struct list_head *head, s32 num_blocks);
+s32 nvfuse_sync_dirty_data(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache **bcs,
+			   s32 num_blocks, s32 fua);
+s32 nvfuse_sync_use_fua(struct nvfuse_superblock *sb);
+void nvfuse_sync_dev_cache(struct nvfuse_superblock *sb);
+int nvfuse_bc_pno_cmp(const void *a, const void *b);
 void io_cancel_incomplete_ios(struct nvfuse_superblock *sb, struct io_job **jobq, int job_cnt);
 s32 nvfuse_wait_aio_completion(struct nvfuse_superblock *sb, struct io_job **jobq, int job_cnt);
 s32 nvfuse_make_jobs(struct nvfuse_superblock *sb, struct io_job **jobs, int numjobs);
@@ -546,11 +654,17 @@ u32 nvfuse_get_free_blocks(struct nvfuse_superblock *sb, u32 bg_id);
 void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force);
 
 /* Lock Management Functions */
-#define nvfuse_lock()
-#define nvfuse_unlock()
-
-void nvfuse_lock_init(void);
-void nvfuse_lock_exit(void);
+/*
+ * sb_lock is taken by every entry point of a handle, so namespace, inode
+ * contexts, block and inode allocation, dirty inode lists and the file table
+ * are changed by one thread at a time. It is recursive since entry points
+ * call each other. Lock order is sb_lock, sb_bg_io_lock and then bm_lock.
+ */
+#define nvfuse_lock(sb) pthread_mutex_lock(&(sb)->sb_lock)
+#define nvfuse_unlock(sb) pthread_mutex_unlock(&(sb)->sb_lock)
+
+void nvfuse_lock_init(struct nvfuse_superblock *sb);
+void nvfuse_lock_exit(struct nvfuse_superblock *sb);
 
 /* container management function */
 s32 nvfuse_alloc_container_from_primary_process(struct nvfuse_handle *nvh, s32 type);
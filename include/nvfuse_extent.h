@@ -0,0 +1,68 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+#include "nvfuse_core.h"
+
+#ifndef __NVFUSE_EXTENT_H__
+#define __NVFUSE_EXTENT_H__
+
+#define NVFUSE_EXT_MAGIC		0xF30A
+#define NVFUSE_EXT_MAX_DEPTH	5
+
+/* maximum number of data blocks allocated by a single nvfuse_ext_get_block() */
+#define NVFUSE_EXT_MAX_ALLOC	1024
+
+/*
+ * Extent tree node header
+ * the root node is stored in inode->i_blocks and the other nodes occupy
+ * a whole block.
+ */
+struct nvfuse_extent_header {
+	u16 eh_magic;
+	u16 eh_entries;	/* number of valid entries */
+	u16 eh_max;	/* capacity of entries */
+	u16 eh_depth;	/* 0: leaf node */
+};
+
+/* leaf node entry */
+struct nvfuse_extent {
+	u32 ee_block;	/* first logical block */
+	u32 ee_len;	/* number of blocks */
+	u32 ee_start;	/* first physical block */
+};
+
+/* index node entry (must have the same layout as nvfuse_extent) */
+struct nvfuse_extent_idx {
+	u32 ei_block;	/* first logical block covered by child */
+	u32 ei_leaf;	/* physical block of child node */
+	u32 ei_unused;
+};
+
+#define NVFUSE_EXT_ROOT_MAX ((sizeof(((struct nvfuse_inode *)0)->i_blocks) - \
+			      sizeof(struct nvfuse_extent_header)) / sizeof(struct nvfuse_extent))
+#define NVFUSE_EXT_NODE_MAX ((CLUSTER_SIZE - sizeof(struct nvfuse_extent_header)) / \
+			     sizeof(struct nvfuse_extent))
+
+#define NVFUSE_EXT_FIRST_EXTENT(hdr) ((struct nvfuse_extent *)((hdr) + 1))
+#define NVFUSE_EXT_FIRST_INDEX(hdr) ((struct nvfuse_extent_idx *)((hdr) + 1))
+
+void nvfuse_ext_format_root(struct nvfuse_inode *inode, u32 lblock, u32 pblock, u32 len);
+s32 nvfuse_ext_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
+			 u32 maxblocks, u32 *num_alloc_blocks, u32 *pblock, u32 create);
+void nvfuse_ext_truncate_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				u64 offset);
+
+#endif /* __NVFUSE_EXTENT_H__ */
@@ -0,0 +1,48 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+
+#ifndef __NVFUSE_INDEX_H__
+#define __NVFUSE_INDEX_H__
+
+/* slot of open addressing index, key is kept inline next to value */
+struct nvfuse_index_slot {
+	u64 key;
+	void *val; /* NULL for empty slot */
+};
+
+/*
+ * Resizable open addressing index (linear probing) mapping u64 keys to
+ * pointers. A lookup touches consecutive slots only, so a miss usually
+ * costs one or two cache lines.
+ */
+struct nvfuse_index {
+	struct nvfuse_index_slot *slots;
+	u32 capacity; /* power of two */
+	u32 shift; /* 64 - log2(capacity) */
+	u32 count;
+	u32 min_capacity;
+};
+
+s32 nvfuse_index_init(struct nvfuse_index *index, u32 min_capacity);
+void nvfuse_index_deinit(struct nvfuse_index *index);
+void *nvfuse_index_lookup(struct nvfuse_index *index, u64 key);
+/* key must not exist in index */
+s32 nvfuse_index_insert(struct nvfuse_index *index, u64 key, void *val);
+/* returns removed value or NULL */
+void *nvfuse_index_remove(struct nvfuse_index *index, u64 key);
+
+#endif /* __NVFUSE_INDEX_H__ */
@@ -27,6 +27,9 @@ u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, u32 *blocks,
 			     u32 num_indirect_blocks, u32 num_blocks, u32 *direct_map, s32 *error);
 void nvfuse_return_free_blocks(struct nvfuse_superblock *sb, u32 *blks, u32 num);
+#ifdef NVFUSE_USE_MAP_CACHE
+void nvfuse_map_cache_init(struct nvfuse_inode_ctx *ictx);
+#endif
 s32 nvfuse_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
 		     u32 maxblocks, u32 *num_alloc_blocks, u32 *pblock, u32 create);
 
@@ -0,0 +1,40 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+#include "nvfuse_core.h"
+#include "nvfuse_io_manager.h"
+
+#ifndef __NVFUSE_IO_CHANNEL_H__
+#define __NVFUSE_IO_CHANNEL_H__
+
+/* foreground I/O channel of a thread */
+struct nvfuse_io_channel {
+	struct list_head ch_list;
+	pthread_t ch_thread;
+	struct nvfuse_io_manager ch_iom;
+};
+
+void nvfuse_io_channel_init(struct nvfuse_superblock *sb);
+void nvfuse_io_channel_release_all(struct nvfuse_superblock *sb);
+struct nvfuse_io_manager *nvfuse_io_channel(struct nvfuse_superblock *sb);
+s32 nvfuse_io_wc_dirty(struct nvfuse_superblock *sb);
+void nvfuse_io_flush(struct nvfuse_superblock *sb);
+
+/* writeback and readahead share sb->io_manager */
+#define nvfuse_bg_io_lock(sb) pthread_mutex_lock(&(sb)->sb_bg_io_lock)
+#define nvfuse_bg_io_unlock(sb) pthread_mutex_unlock(&(sb)->sb_bg_io_lock)
+
+#endif /* __NVFUSE_IO_CHANNEL_H__ */
@@ -38,6 +38,7 @@
 #define IO_MANAGER_BLKDEVIO	2
 #define IO_MANAGER_FILEDISK	3
 #define IO_MANAGER_RAMDISK	4
+#define IO_MANAGER_URING	5 /* block device through io_uring */
 
 
 #ifndef __USE_FUSE__
@@ -88,11 +89,19 @@
 /* Maximum Number of Queue Depth */
 #define AIO_MAX_QDEPTH  512
 
+/* Maximum Number of Pages Merged into a Job */
+#define AIO_MAX_IOV     32
+
 #define AIO_RETRY_COUNT         5
 #define AIO_MAX_TIMEOUT_SEC     10   // 5 sec
 #define AIO_MAX_TIMEOUT_NSEC    0    // 0 nsec
 
 
+struct iovec;
+struct nvfuse_uring;
+struct nvfuse_fileio;
+struct nvfuse_ramdisk_model;
+
 struct io_job {
 #if NVFUSE_OS == NVFUSE_OS_LINUX
 	struct iocb iocb;
@@ -106,11 +115,28 @@ struct io_job {
 	int complete;
 	void *tag1;
 	void *tag2;
+	int pending; // outstanding device commands of a striped job
+	int qid; // SPDK_QUEUE_* the job is steered to
+	/* pages of a job merged from adjacent blocks (buf is ignored if iovcnt > 1) */
+	struct iovec *iov;
+	int iovcnt;
+	int iov_idx; // scatter gather cursor for backend
+	unsigned int iov_offset;
+	int fua; // write is durable on completion (Force Unit Access)
 };
 
-#define SPDK_QUEUE_SYNC 0
-#define SPDK_QUEUE_AIO  1
-#define SPDK_QUEUE_NUM  2
+/*
+ * Traffic classes in order of priority. Each class has a private qpair if
+ * spdk_nr_queues allows, otherwise it shares the last allocated qpair.
+ */
+#define SPDK_QUEUE_SYNC 0 /* synchronous metadata and data misses */
+#define SPDK_QUEUE_AIO  1 /* asynchronous foreground I/O */
+#define SPDK_QUEUE_WRITEBACK 2 /* dirty writeback and flush */
+#define SPDK_QUEUE_RA   3 /* readahead */
+#define SPDK_QUEUE_NUM  4
+
+/* Maximum Number of Striped Namespaces */
+#define SPDK_MAX_NAMESPACES 8
 
 struct nvfuse_io_manager {
 	char *io_name;
@@ -130,9 +156,16 @@ struct nvfuse_io_manager {
 	io_context_t io_ctx;
 	struct io_event events[AIO_MAX_QDEPTH];
 
-	struct spdk_nvme_qpair *spdk_queue[SPDK_QUEUE_NUM];
+	/* qpairs of each namespace in stripe order */
+	struct spdk_nvme_qpair *spdk_queue[SPDK_MAX_NAMESPACES][SPDK_QUEUE_NUM];
+	int spdk_nr_ns; /* number of striped namespaces */
+	int spdk_nr_queues; /* qpairs per namespace (1 ~ SPDK_QUEUE_NUM) */
+	int spdk_stripe_blocks; /* stripe unit in clusters */
 	struct nvfuse_ipc_context *ipc_ctx;
 	union perf_stat perf_stat_dev;
+	struct nvfuse_uring *uring; /* io_uring ring and registered buffers */
+	struct nvfuse_fileio *fileio; /* worker threads of file disk */
+	struct nvfuse_ramdisk_model *ramdisk_model; /* emulated device of ramdisk */
 #endif
 	int queue_cur_count;
 
@@ -144,27 +177,43 @@ struct nvfuse_io_manager {
 
 	int iodepth;
 
+	int fua_support; /* backend honors io_job->fua */
+	int wc_dirty; /* non-FUA writes may sit in device write cache */
+
 	int (*io_open)(struct nvfuse_io_manager *io_manager, int flags);
 	int (*io_close)(struct nvfuse_io_manager *io_manager);
 	int (*io_read)(struct nvfuse_io_manager *io_manager, long block, int count, void *data);
 	int (*io_write)(struct nvfuse_io_manager *io_manager, long block, int count, void *data);
+	/* vectored sync I/O (optional), count blocks are scattered to or gathered from iov */
+	int (*io_readv)(struct nvfuse_io_manager *io_manager, long block, int count,
+			struct iovec *iov, int iovcnt);
+	int (*io_writev)(struct nvfuse_io_manager *io_manager, long block, int count,
+			 struct iovec *iov, int iovcnt);
 
 	int (*aio_init)(struct nvfuse_io_manager *);
 	int (*aio_cleanup)(struct nvfuse_io_manager *);
 	int (*aio_prep)(struct nvfuse_io_manager *, struct io_job *);
 	int (*aio_submit)(struct nvfuse_io_manager *, struct iocb **, int qcnt);
 	int (*aio_complete)(struct nvfuse_io_manager *);
+	/* reaps completions without blocking (optional) */
+	int (*aio_poll)(struct nvfuse_io_manager *);
 	struct io_job *(*aio_getnextcjob)(struct nvfuse_io_manager *);
 	void (*aio_resetnextcjob)(struct nvfuse_io_manager *);
 	void (*aio_resetnextsjob)(struct nvfuse_io_manager *);
 	int (*aio_cancel)(struct nvfuse_io_manager *, struct io_job *);
 	int (*dev_format)(struct nvfuse_io_manager *);
 	int (*dev_flush)(struct nvfuse_io_manager *);
+	/* buffers used for I/O repeatedly (e.g., buffer cache) can be registered to backend (optional) */
+	int (*io_register_buf)(struct nvfuse_io_manager *, void *buf, size_t len);
+	int (*io_unregister_buf)(struct nvfuse_io_manager *, void *buf);
 };
 
 #define nvfuse_write_ncluster(b, n, k, io_manager) io_manager->io_write(io_manager, (long)n, k, b)
 #define nvfuse_read_ncluster(b, n, k, io_manager) io_manager->io_read(io_manager, (long)n, k, b)
 
+#define nvfuse_readv_ncluster(v, c, n, k, io_manager) io_manager->io_readv(io_manager, (long)n, k, v, c)
+#define nvfuse_writev_ncluster(v, c, n, k, io_manager) io_manager->io_writev(io_manager, (long)n, k, v, c)
+
 #define nvfuse_write_cluster(b, n, io_manager) io_manager->io_write(io_manager, (long)n, 1, b)
 #define nvfuse_read_cluster(b, n, io_manager) io_manager->io_read(io_manager, (long)n, 1, b)
 
@@ -183,8 +232,12 @@ struct nvfuse_io_manager {
     io_manager->aio_resetnextcjob(io_manager);
 
 #define nvfuse_aio_complete(io_manager) io_manager->aio_complete(io_manager);
+#define nvfuse_aio_poll(io_manager) \
+	((io_manager)->aio_poll ? (io_manager)->aio_poll(io_manager) : 0)
 #define nvfuse_aio_getnextcjob(io_manager) io_manager->aio_getnextcjob(io_manager);
-#define nvfuse_aio_cancel(b, io_manager) io_manager->aio_cancel(io_manager, b);
+/* backends without cancel (e.g., file disk and ramdisk workers) let the job complete */
+#define nvfuse_aio_cancel(b, io_manager) \
+	((io_manager)->aio_cancel ? (io_manager)->aio_cancel(io_manager, b) : 0)
 /* device level format (e.g., nvme format) */
 #define nvfuse_dev_format(io_manager) \
     if ((io_manager)->dev_format) \
@@ -195,13 +248,32 @@ struct nvfuse_io_manager {
     if ((io_manager)->dev_flush) \
 	(io_manager)->dev_flush(io_manager);
 
+/* register long-lived I/O buffer */
+#define nvfuse_io_register_buf(io_manager, b, l) \
+	if ((io_manager)->io_register_buf) \
+	(io_manager)->io_register_buf(io_manager, b, l);
+
+/* unregister I/O buffer before it is freed */
+#define nvfuse_io_unregister_buf(io_manager, b) \
+	if ((io_manager)->io_unregister_buf) \
+	(io_manager)->io_unregister_buf(io_manager, b);
+
 extern struct nvfuse_io_manager *nvfuse_io_manager;
 void nvfuse_init_blkdevio(struct nvfuse_io_manager *io_manager, char *name, char *path, int qdepth);
+#ifdef LIBURING_ENABLED
+void nvfuse_init_uringio(struct nvfuse_io_manager *io_manager, char *name, char *path, int qdepth);
+#endif
 void nvfuse_init_spdk(struct nvfuse_io_manager *io_manager, char *filename, char *path,
 		      int iodepth);
 void nvfuse_init_fileio(struct nvfuse_io_manager *io_manager, char *name, char *path, int dev_size);
 void nvfuse_init_memio(struct nvfuse_io_manager *io_manager, char *name, char *path, int qdepth);
 
+/* backend implements aio_* interface */
+static inline s32 nvfuse_io_support_aio(struct nvfuse_io_manager *io_manager)
+{
+	return io_manager->aio_submit != NULL;
+}
+
 static inline s32 cjob_empty(struct nvfuse_io_manager *io_manager)
 {
 	return io_manager->cjob_head == io_manager->cjob_tail;
@@ -226,5 +298,6 @@ static inline s32 cjob_size(struct nvfuse_io_manager *io_manager)
 
 int spdk_eal_init(s32 core_mask);
 int spdk_alloc_qpair(struct nvfuse_io_manager *io_manager);
+void spdk_free_qpair(struct nvfuse_io_manager *io_manager);
 void spdk_release_qpair(struct nvfuse_io_manager *io_manager);
 #endif
@@ -21,4 +21,7 @@ void nvfuse_free(void *ptr);
 
 void *nvfuse_alloc_aligned_buffer(size_t size);
 void nvfuse_free_aligned_buffer(void *ptr);
+
+void *nvfuse_alloc_hugepage_region(size_t size);
+void nvfuse_free_hugepage_region(void *ptr);
 #endif
@@ -0,0 +1,32 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+#include "nvfuse_core.h"
+
+#ifndef __NVFUSE_READAHEAD_H__
+#define __NVFUSE_READAHEAD_H__
+
+void nvfuse_ra_init(struct nvfuse_readahead *ra);
+void nvfuse_ra_update(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+		      struct nvfuse_file_table *of, lbno_t lblock, u32 nr_blocks);
+s32 nvfuse_ra_covered(struct nvfuse_readahead *ra, lbno_t lblock, u32 nr_blocks);
+void nvfuse_ra_wait_range(struct nvfuse_superblock *sb, struct nvfuse_readahead *ra,
+			  lbno_t lblock, u32 nr_blocks);
+void nvfuse_ra_wait(struct nvfuse_superblock *sb, struct nvfuse_readahead *ra);
+void nvfuse_ra_wait_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc);
+void nvfuse_ra_wait_all(struct nvfuse_superblock *sb);
+
+#endif /* __NVFUSE_READAHEAD_H__ */
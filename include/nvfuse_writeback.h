@@ -0,0 +1,28 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include "nvfuse_types.h"
+#include "nvfuse_core.h"
+
+#ifndef __NVFUSE_WRITEBACK_H__
+#define __NVFUSE_WRITEBACK_H__
+
+void nvfuse_wb_init(struct nvfuse_superblock *sb);
+s32 nvfuse_wb_support_aio(struct nvfuse_superblock *sb);
+s32 nvfuse_wb_run(struct nvfuse_superblock *sb);
+void nvfuse_wb_wait(struct nvfuse_superblock *sb);
+void nvfuse_wb_wait_block(struct nvfuse_superblock *sb, inode_t ino, lbno_t lblock);
+
+#endif /* __NVFUSE_WRITEBACK_H__ */
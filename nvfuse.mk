@@ -2,3 +2,14 @@
 DEBUG = -g
 OPTIMIZATION = -O3
 WARNING_OPTION = -Wall -Werror -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+
+# file system block size (12: 4KB, 13: 8KB, 14: 16KB, 15: 32KB, 16: 64KB)
+# library, mkfs and applications must be built with the same value
+BLOCK_SIZE_BITS ?= 12
+NVFUSE_CFLAGS = -DNVFUSE_BLOCK_SIZE_BITS=$(BLOCK_SIZE_BITS)
+
+# io_uring backend is built if liburing is installed
+ifneq "$(wildcard /usr/include/liburing.h)" ""
+NVFUSE_CFLAGS += -DLIBURING_ENABLED
+LDFLAGS += -luring
+endif
@@ -20,6 +20,7 @@
 #include <assert.h>
 
 #include "nvfuse_io_manager.h"
+#include "nvfuse_io_channel.h"
 #include "nvfuse_core.h"
 #include "nvfuse_aio.h"
 #include "nvfuse_api.h"
@@ -51,6 +52,11 @@ s32 nvfuse_aio_queue_init(struct nvfuse_aio_queue *aioq, s32 max_depth)
 	aioq->acq_cur_depth = 0;
 	aioq->acq_max_depth = max_depth > NVFUSE_MAX_AIO_DEPTH ? NVFUSE_MAX_AIO_DEPTH : max_depth;
 
+	/* Group Commit Queue */
+	INIT_LIST_HEAD(&aioq->agq_head);
+	aioq->agq_cur_depth = 0;
+	aioq->agq_max_depth = max_depth > NVFUSE_MAX_AIO_DEPTH ? NVFUSE_MAX_AIO_DEPTH : max_depth;
+
 	aioq->max_completions = NVFUSE_MAX_AIO_COMPLETION;
 	aioq->aio_cur_depth = 0;
 
@@ -137,7 +143,7 @@ void nvfuse_aio_queue_deinit(struct nvfuse_handle *nvh, struct nvfuse_aio_queue
 
 s32 nvfuse_aio_get_queue_depth_total(struct nvfuse_aio_queue *aioq)
 {
-	return aioq->arq_cur_depth + aioq->asq_cur_depth + aioq->acq_cur_depth;
+	return aioq->arq_cur_depth + aioq->asq_cur_depth + aioq->acq_cur_depth + aioq->agq_cur_depth;
 }
 
 s32 nvfuse_aio_get_queue_depth_type(struct nvfuse_aio_queue *aioq, s32 qtype)
@@ -149,6 +155,8 @@ s32 nvfuse_aio_get_queue_depth_type(struct nvfuse_aio_queue *aioq, s32 qtype)
 		return aioq->asq_cur_depth;
 	case NVFUSE_COMPLETION_QUEUE:
 		return aioq->acq_cur_depth;
+	case NVFUSE_GROUP_COMMIT_QUEUE:
+		return aioq->agq_cur_depth;
 	default:
 		return 0;
 	}
@@ -184,6 +192,14 @@ s32 nvfuse_aio_queue_enqueue(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_ct
 		list_add_tail(&actx->actx_list, &aioq->acq_head);
 		aioq->acq_cur_depth++;
 		break;
+	case NVFUSE_GROUP_COMMIT_QUEUE:
+		if (aioq->agq_cur_depth == aioq->agq_max_depth) {
+			//printf(" aio group commit queue is full %d\n", aioq->agq_cur_depth);
+			return -1;
+		}
+		list_add_tail(&actx->actx_list, &aioq->agq_head);
+		aioq->agq_cur_depth++;
+		break;
 	default:
 		printf(" invalid aio qtype = %d", qtype);
 		return -1;
@@ -210,6 +226,11 @@ s32 nvfuse_aio_queue_dequeue(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_ct
 		aioq->acq_cur_depth--;
 		assert(aioq->acq_cur_depth >= 0);
 		break;
+	case NVFUSE_GROUP_COMMIT_QUEUE:
+		list_del(&actx->actx_list);
+		aioq->agq_cur_depth--;
+		assert(aioq->agq_cur_depth >= 0);
+		break;
 	default:
 		printf(" invalid aio qtype = %d", qtype);
 		return -1;
@@ -243,6 +264,10 @@ void nvfuse_aio_gen_dev_cpls_buffered(void *arg)
 	/* casting */
 	actx = (struct nvfuse_aio_ctx *)arg;
 
+	/* every job of the context is completed */
+	free(actx->actx_iov);
+	actx->actx_iov = NULL;
+
 	/* release bh*/
 	head = &actx->actx_bh_head;
 
@@ -254,7 +279,9 @@ void nvfuse_aio_gen_dev_cpls_buffered(void *arg)
 		bc = bh->bh_bc;
 
 		if (actx->actx_opcode == WRITE) {
+			nvfuse_bm_lock(bc->bc_bm);
 			bc->bc_ref--;
+			nvfuse_bm_unlock(bc->bc_bm);
 			nvfuse_remove_bhs_in_bc(actx->actx_sb, bc);
 			assert(bc->bc_dirty);
 			bc->bc_dirty = 0;
@@ -283,6 +310,7 @@ void nvfuse_aio_gen_dev_cpls_directio(void *arg)
 
 s32 nvfuse_aio_gen_dev_reqs_buffered(struct nvfuse_superblock *sb, struct nvfuse_aio_ctx *actx)
 {
+	struct nvfuse_io_manager *io_manager = nvfuse_io_channel(sb);
 	struct list_head *head, *ptr, *temp;
 	struct nvfuse_buffer_head *bh;
 	struct nvfuse_buffer_cache *bc;
@@ -290,57 +318,85 @@ s32 nvfuse_aio_gen_dev_reqs_buffered(struct nvfuse_superblock *sb, struct nvfuse
 #if (NVFUSE_OS == NVFUSE_OS_LINUX)
 	struct io_job *jobs[AIO_MAX_QDEPTH];
 	struct iocb *iocb[AIO_MAX_QDEPTH];
+	struct io_job *job = NULL;
+	s32 nr_iov = 0;
 	s32 count = 0;
 	s32 res;
 
+	actx->actx_iov = NULL;
+
 	res = nvfuse_make_jobs(sb, jobs, actx->actx_bh_count);
 	if (res < 0) {
 		return res;
 	}
+
+	/* without iovec, every page is sent by its own job */
+	actx->actx_iov = malloc(sizeof(struct iovec) * actx->actx_bh_count);
 #endif
 
+	/* nvfuse_gather_bh() prepends buffer heads, so walk backwards in file order */
 	head = &actx->actx_bh_head;
-	list_for_each_safe(ptr, temp, head) {
+	for (ptr = head->prev, temp = ptr->prev; ptr != head; ptr = temp, temp = ptr->prev) {
 		bh = (struct nvfuse_buffer_head *)list_entry(ptr, struct nvfuse_buffer_head, bh_aio_list);
 		bc = bh->bh_bc;
 
 #if (NVFUSE_OS == NVFUSE_OS_LINUX)
-		jobs[count]->offset = (long)bc->bc_pno * CLUSTER_SIZE;
-		jobs[count]->bytes = (size_t)CLUSTER_SIZE;
-		jobs[count]->ret = 0;
-		jobs[count]->req_type = (actx->actx_opcode == READ) ? READ : WRITE;
-		jobs[count]->buf = bc->bc_buf;
-		jobs[count]->complete = 0;
-		jobs[count]->tag1 = (void *)actx;
-
-		iocb[count] = &jobs[count]->iocb;
+		if (actx->actx_iov) {
+			actx->actx_iov[nr_iov].iov_base = bc->bc_buf;
+			actx->actx_iov[nr_iov].iov_len = CLUSTER_SIZE;
+			nr_iov++;
+
+			/* physically adjacent page joins current job */
+			if (job && job->iovcnt < AIO_MAX_IOV &&
+			    job->offset + (long)job->bytes == (long)bc->bc_pno * CLUSTER_SIZE) {
+				job->bytes += CLUSTER_SIZE;
+				job->iovcnt++;
+				continue;
+			}
+		}
+
+		job = jobs[count];
+		job->offset = (long)bc->bc_pno * CLUSTER_SIZE;
+		job->bytes = (size_t)CLUSTER_SIZE;
+		job->ret = 0;
+		job->req_type = (actx->actx_opcode == READ) ? READ : WRITE;
+		job->buf = bc->bc_buf;
+		job->complete = 0;
+		job->tag1 = (void *)actx;
+		if (actx->actx_iov) {
+			job->iov = &actx->actx_iov[nr_iov - 1];
+			job->iovcnt = 1;
+		}
+
+		iocb[count] = &job->iocb;
 		count++;
 #else
 		if (actx->actx_opcode == READ)
-			nvfuse_read_cluster(bc->bc_buf, bc->bc_pno, sb->io_manager);
+			nvfuse_read_cluster(bc->bc_buf, bc->bc_pno, io_manager);
 		else
-			nvfuse_write_cluster(bc->bc_buf, bc->bc_pno, sb->io_manager);
+			nvfuse_write_cluster(bc->bc_buf, bc->bc_pno, io_manager);
 #endif
 	}
 
+#if (NVFUSE_OS == NVFUSE_OS_LINUX)
 	if (count < actx->actx_bh_count) {
 		nvfuse_release_jobs(sb, jobs + count, actx->actx_bh_count - count);
 	}
 
-#if (NVFUSE_OS == NVFUSE_OS_LINUX)
-	count = 0;
-	while (count < actx->actx_bh_count) {
-		nvfuse_aio_prep(jobs[count], sb->io_manager);
-		count ++;
-	}
+	/* completion of each job is counted down */
+	actx->actx_bh_count = count;
+
+	for (res = 0; res < count; res++)
+		nvfuse_aio_prep(jobs[res], io_manager);
 
-	nvfuse_aio_submit(iocb, actx->actx_bh_count, sb->io_manager);
-	sb->io_manager->queue_cur_count += actx->actx_bh_count;
+	nvfuse_aio_submit(iocb, count, io_manager);
+	io_manager->queue_cur_count += count;
 
 	//actx->tag1 = (void *)jobs;
 	//actx->tag2 = (void *)iocb;
 
 #elif (NVFUSE_OS == NVFUSE_OS_WINDOWS)
+	actx->actx_iov = NULL;
 	nvfuse_aio_gen_dev_cpls_buffered((void *)actx);
 #endif
 
@@ -349,6 +405,7 @@ s32 nvfuse_aio_gen_dev_reqs_buffered(struct nvfuse_superblock *sb, struct nvfuse
 
 s32 nvfuse_aio_gen_dev_reqs_directio(struct nvfuse_superblock *sb, struct nvfuse_aio_ctx *actx)
 {
+	struct nvfuse_io_manager *io_manager = nvfuse_io_channel(sb);
 	s64 start, length;
 	s32 count = 0;
 	s32 req_count = 0;
@@ -384,8 +441,12 @@ s32 nvfuse_aio_gen_dev_reqs_directio(struct nvfuse_superblock *sb, struct nvfuse
 #endif
 
 		pblk = nvfuse_fgetblk(sb, actx->actx_fid, lblk, max_blocks, &num_alloc);
-		if (pblk < 0) {
+		if (pblk <= 0 || num_alloc == 0) {
+			/* unmapped block would never advance the request */
 			printf(" Error: nvfuse_fgetblk() lblk = %x\n", lblk);
+#if (NVFUSE_OS == NVFUSE_OS_LINUX)
+			nvfuse_release_jobs(sb, jobs, actx->actx_bh_count);
+#endif
 			return -1;
 		}
 
@@ -403,9 +464,9 @@ s32 nvfuse_aio_gen_dev_reqs_directio(struct nvfuse_superblock *sb, struct nvfuse
 		assert(iocb[req_count] != NULL);
 #else
 		if (actx->actx_opcode == READ)
-			nvfuse_read_ncluster((s8 *)actx->actx_buf + count * CLUSTER_SIZE, pblk, num_alloc, sb->io_manager);
+			nvfuse_read_ncluster((s8 *)actx->actx_buf + count * CLUSTER_SIZE, pblk, num_alloc, io_manager);
 		else
-			nvfuse_write_ncluster((s8 *)actx->actx_buf + count * CLUSTER_SIZE, pblk, num_alloc, sb->io_manager);
+			nvfuse_write_ncluster((s8 *)actx->actx_buf + count * CLUSTER_SIZE, pblk, num_alloc, io_manager);
 #endif
 		start += (num_alloc * CLUSTER_SIZE);
 		length -= (num_alloc * CLUSTER_SIZE);
@@ -423,20 +484,20 @@ s32 nvfuse_aio_gen_dev_reqs_directio(struct nvfuse_superblock *sb, struct nvfuse
 #if (NVFUSE_OS == NVFUSE_OS_LINUX)
 	count = 0;
 	while (count < req_count) {
-		nvfuse_aio_prep(jobs[count], sb->io_manager);
+		nvfuse_aio_prep(jobs[count], io_manager);
 		count++;
 	}
 
-	res = nvfuse_aio_submit(iocb, req_count, sb->io_manager);
+	res = nvfuse_aio_submit(iocb, req_count, io_manager);
 	if (res < 0) {
 		printf(" Error: aio submit error = %d\n", res);
 		return -1;
 	}
 
-	sb->io_manager->queue_cur_count += req_count;
+	io_manager->queue_cur_count += req_count;
 	actx->actx_bh_count = req_count;
 
-	//printf(" cur queue depth = %d \n", sb->io_manager->queue_cur_count);
+	//printf(" cur queue depth = %d \n", io_manager->queue_cur_count);
 
 	//actx->tag1 = (void *)jobs;
 	//actx->tag2 = (void *)iocb;
@@ -448,7 +509,7 @@ s32 nvfuse_aio_gen_dev_reqs_directio(struct nvfuse_superblock *sb, struct nvfuse
 	return 0;
 }
 
-s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq)
+static s32 __nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq)
 {
 	struct list_head *head, *ptr, *temp;
 	struct nvfuse_aio_ctx *actx;
@@ -469,6 +530,17 @@ s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_que
 
 		//printf(" aio ready queue : fd = %d offset = %ld, bytes = %ld, op = %d\n", actx->actx_fid, (long)actx->actx_offset,
 		//	(long)actx->actx_bytes, actx->actx_opcode);
+		if (actx->actx_opcode == NVFUSE_AIO_FSYNC || actx->actx_opcode == NVFUSE_AIO_FDSYNC) {
+			if (aioq->agq_cur_depth == 0)
+				aioq->agq_start_tsc = spdk_get_ticks();
+			/* completed by nvfuse_aio_group_commit() together with other fsync requests */
+			if (nvfuse_aio_queue_move(aioq, actx, NVFUSE_GROUP_COMMIT_QUEUE)) {
+				printf(" submission error\n ");
+				return -1;
+			}
+			continue;
+		}
+
 		if (nvfuse_is_directio(&nvh->nvh_sb, actx->actx_fid)) {
 			if (actx->actx_opcode == READ) {
 				bytes = nvfuse_readfile_aio_directio(nvh, actx->actx_fid, actx->actx_buf, actx->actx_bytes,
@@ -523,47 +595,139 @@ s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_que
 		nvfuse_aio_queue_dequeue(aioq, actx, NVFUSE_SUBMISSION_QUEUE);
 	}
 
+	nvfuse_aio_group_commit(&nvh->nvh_sb, aioq, 0);
+
 	return 0;
 }
 
-s32 nvfuse_aio_wait_dev_cpls(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq)
+s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_aio_queue_submission(nvh, aioq);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+/*
+ * Group commit for aio fsync requests
+ * Pending fsync requests are completed together once NVFUSE_GROUP_COMMIT_MAX
+ * requests are gathered or the oldest one has waited for
+ * NVFUSE_GROUP_COMMIT_USEC. Requests submitted before them are completed
+ * first so that their data is included in the commit. returns the number of
+ * completed fsync requests.
+ */
+s32 nvfuse_aio_group_commit(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq, s32 force)
 {
+	struct nvfuse_inode_ctx *ictxs[NVFUSE_GROUP_COMMIT_MAX];
+	struct nvfuse_aio_ctx *actxs[NVFUSE_GROUP_COMMIT_MAX];
+	struct list_head *head, *ptr, *temp;
 	struct nvfuse_aio_ctx *actx;
-	struct io_job *job;
-	struct io_job *jobs[AIO_MAX_QDEPTH];
-	int num_jobs = 0;
-	int cc = 0; // completion count
+	u64 window = NVFUSE_GROUP_COMMIT_USEC * spdk_get_ticks_hz() / 1000000;
+	s32 datasync = 1;
+	s32 count = 0;
+	s32 res;
+	s32 i;
 
-	cc = nvfuse_aio_complete(sb->io_manager);
-	sb->io_manager->queue_cur_count -= cc;
+	if (aioq->agq_cur_depth == 0)
+		return 0;
 
-	aioq->aio_cc_sum += cc;
-	aioq->aio_cc_cnt ++;
+	if (!force && aioq->agq_cur_depth < NVFUSE_GROUP_COMMIT_MAX &&
+	    spdk_get_ticks() - aioq->agq_start_tsc < window)
+		return 0;
 
-	while (cc--) {
-		job = nvfuse_aio_getnextcjob(sb->io_manager);
-		jobs[num_jobs++] = job;
+#if (NVFUSE_OS==NVFUSE_OS_LINUX)
+	while (nvfuse_io_channel(sb)->queue_cur_count)
+		nvfuse_aio_wait_dev_cpls(sb, aioq);
+#endif
 
-		job->complete = 1;
+	head = &aioq->agq_head;
+	list_for_each_safe(ptr, temp, head) {
+		actx = (struct nvfuse_aio_ctx *)list_entry(ptr, struct nvfuse_aio_ctx, actx_list);
 
-		actx = (struct nvfuse_aio_ctx *)job->tag1;
-		actx->actx_bh_count--;
+		if (actx->actx_opcode == NVFUSE_AIO_FSYNC)
+			datasync = 0;
 
-		if (job->ret != job->bytes) {
-			printf(" IO error \n");
-			actx->actx_error = -1;
-		}
+		actxs[count] = actx;
+		ictxs[count] = nvfuse_read_inode(sb, NULL, sb->sb_file_table[actx->actx_fid].ino);
+		count++;
+		if (count == NVFUSE_GROUP_COMMIT_MAX)
+			break;
+	}
 
-		if (actx->actx_bh_count == 0) {
-			if (!nvfuse_is_directio(sb, actx->actx_fid)) {
-				nvfuse_aio_gen_dev_cpls_buffered(actx);
-			} else {
-				nvfuse_aio_gen_dev_cpls_directio(actx);
-			}
+	res = nvfuse_group_commit_ictx(sb, ictxs, count, datasync);
+
+	for (i = 0; i < count; i++) {
+		nvfuse_release_inode(sb, ictxs[i], CLEAN);
+
+		actx = actxs[i];
+		actx->actx_bh_count = 0;
+		actx->actx_error = res ? -1 : 0;
+		nvfuse_aio_queue_move(aioq, actx, NVFUSE_COMPLETION_QUEUE);
+	}
+
+	/* remaining requests start a new window */
+	aioq->agq_start_tsc = spdk_get_ticks();
+
+	return count;
+}
+
+/*
+ * Every reaper of a completion ring (aio queue and sync flush on the
+ * thread's channel, readahead and writeback on the background channel)
+ * hands completed jobs to this function. Jobs of
+ * nvfuse_aio_ctx (non-null tag1) are accounted to their context and
+ * released here, and the context is completed with its last job. Other
+ * jobs are only marked complete and released by their owners.
+ */
+void nvfuse_aio_dispatch_cjob(struct nvfuse_superblock *sb, struct io_job *job)
+{
+	struct nvfuse_aio_ctx *actx;
+
+	job->complete = 1;
+
+	if (job->tag1 == NULL)
+		return;
+
+	actx = (struct nvfuse_aio_ctx *)job->tag1;
+	actx->actx_bh_count--;
+
+	if (job->ret != job->bytes) {
+		printf(" IO error \n");
+		actx->actx_error = -1;
+	}
+
+	nvfuse_release_jobs(sb, &job, 1);
+
+	if (actx->actx_bh_count == 0) {
+		if (!nvfuse_is_directio(sb, actx->actx_fid)) {
+			nvfuse_aio_gen_dev_cpls_buffered(actx);
+		} else {
+			nvfuse_aio_gen_dev_cpls_directio(actx);
 		}
 	}
+}
+
+s32 nvfuse_aio_wait_dev_cpls(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq)
+{
+	struct nvfuse_io_manager *io_manager = nvfuse_io_channel(sb);
+	struct io_job *job;
+	int cc = 0; // completion count
 
-	nvfuse_release_jobs(sb, jobs, num_jobs);
+	cc = nvfuse_aio_complete(io_manager);
+	io_manager->queue_cur_count -= cc;
+
+	aioq->aio_cc_sum += cc;
+	aioq->aio_cc_cnt ++;
+
+	/* readahead and writeback requests are reaped by their owners */
+	while (cc--) {
+		job = nvfuse_aio_getnextcjob(io_manager);
+		nvfuse_aio_dispatch_cjob(sb, job);
+	}
 
 	return 0;
 }
@@ -573,11 +737,23 @@ s32 nvfuse_aio_queue_completion(struct nvfuse_superblock *sb, struct nvfuse_aio_
 	struct list_head *head, *ptr, *temp;
 	struct nvfuse_aio_ctx *actx;
 
+	nvfuse_lock(sb);
 	while (aioq->acq_cur_depth < aioq->max_completions) {
+		/* nothing else can join the group while caller waits here */
+		if (nvfuse_io_channel(sb)->queue_cur_count == 0) {
+			if (nvfuse_aio_group_commit(sb, aioq, 1))
+				continue;
+		} else if (nvfuse_aio_group_commit(sb, aioq, 0)) {
+			continue;
+		}
+
 		/* busy wating here*/
 #if (NVFUSE_OS==NVFUSE_OS_LINUX)
 		nvfuse_aio_wait_dev_cpls(sb, aioq);
 #endif
+		/* other threads go on while this thread polls its channel */
+		nvfuse_unlock(sb);
+		nvfuse_lock(sb);
 	}
 
 	//printf(" completion queue depth = %d", aioq->acq_cur_depth);
@@ -603,6 +779,7 @@ s32 nvfuse_aio_queue_completion(struct nvfuse_superblock *sb, struct nvfuse_aio_
 		aioq->aio_cur_depth--;
 		actx->actx_cb_func(actx);
 	}
+	nvfuse_unlock(sb);
 
 	return 0;
 }
@@ -37,9 +37,13 @@
 #include "nvfuse_core.h"
 #include "nvfuse_dep.h"
 #include "nvfuse_io_manager.h"
+#include "nvfuse_io_channel.h"
 #include "nvfuse_buffer_cache.h"
 #include "nvfuse_gettimeofday.h"
 #include "nvfuse_indirect.h"
+#include "nvfuse_readahead.h"
+#include "nvfuse_writeback.h"
+#include "nvfuse_bc_policy.h"
 #include "nvfuse_bp_tree.h"
 #include "nvfuse_malloc.h"
 #include "nvfuse_api.h"
@@ -59,6 +63,8 @@ void nvfuse_core_usage(char *cmd)
 	printf("\t-c: CPU core mask (e.g., 0x1 (default), 0x2, 0x4\n");
 	printf("\t-a: application name (e.g., rocksdb, fiebenc, redis\n");
 	printf("\t-p: pre-allocation of buffers and containers\n");
+	printf("\t-e: extent based block mapping (with -f)\n");
+	printf("\t-r: buffer replacement policy (lru (default), 2q)\n");
 }
 
 void nvfuse_core_usage_example(char *cmd)
@@ -69,7 +75,7 @@ void nvfuse_core_usage_example(char *cmd)
 
 s8 *nvfuse_get_core_options()
 {
-	return "a:c:fmq:s:b:p";
+	return "a:c:fmq:s:b:per:";
 }
 
 s32 nvfuse_is_core_option(s8 option)
@@ -175,6 +181,8 @@ s32 nvfuse_parse_args(int argc, char **argv, struct nvfuse_params *params)
 	s32 dev_size = 0; /* in MB units */
 	s32 buffer_size = 0; /* in MB units */
 	s32 preallocation = 0;
+	s32 extent_mapping = 0;
+	s32 bc_policy = NVFUSE_BC_POLICY_DEFAULT;
 	s8 op;
 	s8 *cmd;
 
@@ -218,6 +226,8 @@ s32 nvfuse_parse_args(int argc, char **argv, struct nvfuse_params *params)
 #endif
 			} else if (!strcmp("block", optarg)) {
 				io_manager_type = IO_MANAGER_BLKDEVIO;
+			} else if (!strcmp("uring", optarg)) {
+				io_manager_type = IO_MANAGER_URING;
 			} else if (!strcmp("file", optarg)) {
 				io_manager_type = IO_MANAGER_FILEDISK;
 			} else if (!strcmp("ramdisk", optarg)) {
@@ -248,6 +258,16 @@ s32 nvfuse_parse_args(int argc, char **argv, struct nvfuse_params *params)
 		case 'p':
 			preallocation = 1;
 			break;
+		case 'e':
+			extent_mapping = 1;
+			break;
+		case 'r':
+			bc_policy = nvfuse_bc_policy_lookup(optarg);
+			if (bc_policy < 0) {
+				fprintf(stderr, "Invalid buffer replacement policy = %s\n", optarg);
+				goto PRINT_USAGE;
+			}
+			break;
 		default:
 			fprintf(stderr, " Invalid op code %c in getopt()\n", op);
 			goto PRINT_USAGE;
@@ -271,6 +291,8 @@ s32 nvfuse_parse_args(int argc, char **argv, struct nvfuse_params *params)
 	params->need_format		= need_format; /* no allowed for secondary processes */
 	params->need_mount		= need_mount;
 	params->preallocation	= preallocation;
+	params->extent_mapping	= extent_mapping;
+	params->bc_policy		= bc_policy;
 #if 1
 	printf(" appname = %s\n", appname);
 	printf(" cpu core mask = %x\n", cpu_core_mask);
@@ -279,6 +301,8 @@ s32 nvfuse_parse_args(int argc, char **argv, struct nvfuse_params *params)
 	printf(" need format = %d \n", need_format);
 	printf(" need mount = %d \n", need_mount);
 	printf(" preallocation = %d \n", preallocation);
+	printf(" extent mapping = %d \n", extent_mapping);
+	printf(" buffer replacement policy = %d \n", bc_policy);
 #endif
 
 	return 0;
@@ -377,6 +401,9 @@ void nvfuse_destroy_handle(struct nvfuse_handle *nvh, s32 deinit_iom, s32 need_u
 		if (ret < 0) {
 			printf(" Error: umount() \n");
 		}
+	} else if (nvh->nvh_mounted) {
+		/* qpairs of threads must be freed before the handle's */
+		nvfuse_io_channel_release_all(nvfuse_read_super(nvh));
 	}
 
 	nvfuse_stat_ring_put(io_manager->ipc_ctx->stat_ring[IPC_STAT],
@@ -413,17 +440,13 @@ s32 nvfuse_lookup(struct nvfuse_superblock *sb,
 
 	dir_inode = dir_ictx->ictx_inode;
 
-	if (dir_inode->i_bpino) {
 #if NVFUSE_USE_DIR_INDEXING == 1
-		res = nvfuse_get_dir_indexing(sb, dir_inode, (char *)filename, &offset);
-		if (res < 0) {
-			goto RES;
-		}
-#endif
-	} else {
-		res = -1;
+	/* offset stays zero for small directories without bptree */
+	res = nvfuse_get_dir_indexing(sb, dir_inode, (char *)filename, &offset);
+	if (res < 0) {
 		goto RES;
 	}
+#endif
 	res = -1;
 
 	dir_size = dir_inode->i_size;
@@ -432,6 +455,10 @@ s32 nvfuse_lookup(struct nvfuse_superblock *sb,
 	if (offset) { // dir entry found
 		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(start), READ,
 				       NVFUSE_TYPE_META);
+		if (dir_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			goto RES;
+		}
 		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 		dir += (offset % DIR_ENTRY_NUM);
 
@@ -462,6 +489,10 @@ s32 nvfuse_lookup(struct nvfuse_superblock *sb,
 
 				dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(read_bytes), READ,
 						       NVFUSE_TYPE_META);
+				if (dir_bh == NULL) {
+					printf(" Error: get_bh()\n");
+					goto RES;
+				}
 				dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 			}
 
@@ -512,8 +543,8 @@ void nvfuse_set_cwd_ino(struct nvfuse_handle *nvh, inode_t cwd_ino)
 	nvh->nvh_cwd_ino = cwd_ino;
 }
 
-s32 nvfuse_path_resolve(struct nvfuse_handle *nvh, const char *path, char *filename,
-			struct nvfuse_dir_entry *direntry)
+static s32 __nvfuse_path_resolve(struct nvfuse_handle *nvh, const char *path, char *filename,
+				 struct nvfuse_dir_entry *direntry)
 {
 	s8 dirname[FNAME_SIZE];
 	int res;
@@ -530,7 +561,20 @@ s32 nvfuse_path_resolve(struct nvfuse_handle *nvh, const char *path, char *filen
 	return res;
 }
 
-s32 nvfuse_opendir(struct nvfuse_handle *nvh, const char *path)
+s32 nvfuse_path_resolve(struct nvfuse_handle *nvh, const char *path, char *filename,
+			struct nvfuse_dir_entry *direntry)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_path_resolve(nvh, path, filename, direntry);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_opendir(struct nvfuse_handle *nvh, const char *path)
 {
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	struct nvfuse_dir_entry dir_entry;
@@ -554,8 +598,20 @@ s32 nvfuse_opendir(struct nvfuse_handle *nvh, const char *path)
 	return par_ino;
 }
 
-struct dirent *nvfuse_readdir(struct nvfuse_handle *nvh, inode_t par_ino, struct dirent *dentry,
-			      off_t dir_offset)
+s32 nvfuse_opendir(struct nvfuse_handle *nvh, const char *path)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_opendir(nvh, path);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static struct dirent *__nvfuse_readdir(struct nvfuse_handle *nvh, inode_t par_ino,
+				       struct dirent *dentry, off_t dir_offset)
 {
 	struct nvfuse_inode_ctx *dir_ictx, *ictx;
 	struct nvfuse_inode *dir_inode, *inode;
@@ -575,6 +631,10 @@ struct dirent *nvfuse_readdir(struct nvfuse_handle *nvh, inode_t par_ino, struct
 
 	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino,
 			       NVFUSE_SIZE_TO_BLK((s64)dir_offset * DIR_ENTRY_SIZE), READ, NVFUSE_TYPE_META);
+	if (dir_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		goto RES;
+	}
 	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 
 	dir += (dir_offset % DIR_ENTRY_NUM);
@@ -608,6 +668,19 @@ RES:
 	return return_dentry;
 }
 
+struct dirent *nvfuse_readdir(struct nvfuse_handle *nvh, inode_t par_ino, struct dirent *dentry,
+			      off_t dir_offset)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct dirent *res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_readdir(nvh, par_ino, dentry, dir_offset);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
 s32 nvfuse_openfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename, s32 flags,
 		    s32 mode)
 {
@@ -670,6 +743,7 @@ s32 nvfuse_openfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename,
 	ft->size = inode->i_size;
 	ft->rwoffset = 0;
 	ft->flags = flags;
+	nvfuse_ra_init(&ft->ra);
 
 	if (O_APPEND & flags)
 		nvfuse_seek(sb, ft, inode->i_size, SEEK_SET);
@@ -687,7 +761,7 @@ RES:
 	return (fid);
 }
 
-s32 nvfuse_openfile_path(struct nvfuse_handle *nvh, const char *path, int flags, int mode)
+static s32 __nvfuse_openfile_path(struct nvfuse_handle *nvh, const char *path, int flags, int mode)
 {
 	int fd;
 	struct nvfuse_dir_entry dir_entry;
@@ -697,8 +771,6 @@ s32 nvfuse_openfile_path(struct nvfuse_handle *nvh, const char *path, int flags,
 
 	memset(&dir_entry, 0x00, sizeof(struct nvfuse_dir_entry));
 
-	nvfuse_lock();
-
 	sb = nvfuse_read_super(nvh);
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
@@ -712,11 +784,22 @@ s32 nvfuse_openfile_path(struct nvfuse_handle *nvh, const char *path, int flags,
 	}
 
 	nvfuse_release_super(sb);
-	nvfuse_unlock();
 
 	return fd;
 }
 
+s32 nvfuse_openfile_path(struct nvfuse_handle *nvh, const char *path, int flags, int mode)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_openfile_path(nvh, path, flags, mode);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
 s32 nvfuse_openfile_ino(struct nvfuse_superblock *sb, inode_t ino, s32 flags)
 {
 	struct nvfuse_inode_ctx *ictx;
@@ -743,6 +826,7 @@ s32 nvfuse_openfile_ino(struct nvfuse_superblock *sb, inode_t ino, s32 flags)
 	ft->size = inode->i_size;
 	//	ft->status = inode->i_type;
 	ft->rwoffset = 0;
+	nvfuse_ra_init(&ft->ra);
 
 	if (O_APPEND & flags)
 		nvfuse_seek(sb, ft, inode->i_size, SEEK_SET);
@@ -753,13 +837,16 @@ s32 nvfuse_openfile_ino(struct nvfuse_superblock *sb, inode_t ino, s32 flags)
 	return (fid);
 }
 
-s32 nvfuse_closefile(struct nvfuse_handle *nvh, s32 fid)
+static s32 __nvfuse_closefile(struct nvfuse_handle *nvh, s32 fid)
 {
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	struct nvfuse_file_table *ft;
 
 	ft = sb->sb_file_table + fid;
 
+	/* in-flight readahead pins buffers of this file */
+	nvfuse_ra_wait(sb, &ft->ra);
+
 	ft->ino = 0;
 	ft->size = 0;
 	ft->used = 0;
@@ -771,18 +858,150 @@ s32 nvfuse_closefile(struct nvfuse_handle *nvh, s32 fid)
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
-			 nvfuse_off_t roffset, s32 sync_read)
+s32 nvfuse_closefile(struct nvfuse_handle *nvh, s32 fid)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_closefile(nvh, fid);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+/* cursor over an I/O vector */
+struct nvfuse_iov_iter {
+	const struct iovec *iov;
+	s32 iovcnt;
+	s32 idx;
+	size_t off;
+};
+
+static void nvfuse_iov_iter_init(struct nvfuse_iov_iter *iter, const struct iovec *iov, s32 iovcnt)
+{
+	iter->iov = iov;
+	iter->iovcnt = iovcnt;
+	iter->idx = 0;
+	iter->off = 0;
+}
+
+static s32 nvfuse_iov_length(const struct iovec *iov, s32 iovcnt)
+{
+	s64 len = 0;
+	s32 i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len > 0x7FFFFFFF)
+		return -1;
+
+	return (s32)len;
+}
+
+/* copy data to the vector and advance cursor */
+static void nvfuse_iov_copy_to(struct nvfuse_iov_iter *iter, const s8 *src, u32 len)
+{
+	const struct iovec *cur;
+	u32 n;
+
+	while (len) {
+		assert(iter->idx < iter->iovcnt);
+		cur = &iter->iov[iter->idx];
+		n = cur->iov_len - iter->off;
+		if (n > len)
+			n = len;
+
+		rte_memcpy((s8 *)cur->iov_base + iter->off, src, n);
+		src += n;
+		len -= n;
+
+		iter->off += n;
+		if (iter->off == cur->iov_len) {
+			iter->idx++;
+			iter->off = 0;
+		}
+	}
+}
+
+/* copy data from the vector and advance cursor */
+static void nvfuse_iov_copy_from(struct nvfuse_iov_iter *iter, s8 *dst, u32 len)
+{
+	const struct iovec *cur;
+	u32 n;
+
+	while (len) {
+		assert(iter->idx < iter->iovcnt);
+		cur = &iter->iov[iter->idx];
+		n = cur->iov_len - iter->off;
+		if (n > len)
+			n = len;
+
+		rte_memcpy(dst, (s8 *)cur->iov_base + iter->off, n);
+		dst += n;
+		len -= n;
+
+		iter->off += n;
+		if (iter->off == cur->iov_len) {
+			iter->idx++;
+			iter->off = 0;
+		}
+	}
+}
+
+/* build a sub vector covering next len bytes and advance cursor */
+static s32 nvfuse_iov_slice(struct nvfuse_iov_iter *iter, u32 len, struct iovec *out)
+{
+	const struct iovec *cur;
+	s32 cnt = 0;
+	u32 n;
+
+	while (len) {
+		assert(iter->idx < iter->iovcnt);
+		cur = &iter->iov[iter->idx];
+		n = cur->iov_len - iter->off;
+		if (n > len)
+			n = len;
+
+		out[cnt].iov_base = (s8 *)cur->iov_base + iter->off;
+		out[cnt].iov_len = n;
+		cnt++;
+		len -= n;
+
+		iter->off += n;
+		if (iter->off == cur->iov_len) {
+			iter->idx++;
+			iter->off = 0;
+		}
+	}
+
+	return cnt;
+}
+
+/*
+ * Buffered read into an I/O vector. The file is walked once for the whole
+ * vector and data is copied from the buffer cache segment by segment.
+ */
+s32 nvfuse_readv_core(struct nvfuse_superblock *sb, u32 fid, const struct iovec *iov, s32 iovcnt,
+		      nvfuse_off_t roffset, s32 sync_read)
 {
 	struct nvfuse_inode_ctx *ictx;
 	struct nvfuse_inode *inode;
 	struct nvfuse_buffer_head *bh;
 	struct nvfuse_file_table *of;
+	struct nvfuse_iov_iter iter;
 
 	s32 offset, remain, rcount = 0;
+	s32 count;
 
 	of = &(sb->sb_file_table[fid]);
 
+	count = nvfuse_iov_length(iov, iovcnt);
+	if (count < 0)
+		return NVFUSE_ERROR;
+	nvfuse_iov_iter_init(&iter, iov, iovcnt);
+
 	ictx = nvfuse_read_inode(sb, NULL, of->ino);
 	inode = ictx->ictx_inode;
 
@@ -794,6 +1013,45 @@ s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32
 	of->rwoffset = roffset;
 #endif
 
+	/* tiny file is served from inode without touching buffer cache */
+	if (nvfuse_inode_has_inline_data(inode)) {
+		if (count > 0 && of->rwoffset < inode->i_size) {
+			remain = inode->i_size - of->rwoffset;
+			if (remain > count)
+				remain = count;
+
+			if (sync_read)
+				nvfuse_iov_copy_to(&iter, (s8 *)inode->i_inline_data + of->rwoffset, remain);
+
+			rcount += remain;
+			of->rwoffset += remain;
+		}
+		goto RES;
+	}
+
+	if (count > 0 && of->rwoffset < inode->i_size) {
+		s64 end = of->rwoffset + count;
+		lbno_t start_lblk;
+		u32 nr_blocks;
+
+		if (end > inode->i_size)
+			end = inode->i_size;
+
+		start_lblk = NVFUSE_SIZE_TO_BLK(of->rwoffset);
+		nr_blocks = NVFUSE_SIZE_TO_BLK(end + CLUSTER_SIZE - 1) - start_lblk;
+
+		/* blocks being prefetched must be completed before they are accessed */
+		nvfuse_ra_wait_range(sb, &of->ra, start_lblk, nr_blocks);
+		if (sync_read)
+			nvfuse_ra_update(sb, ictx, of, start_lblk, nr_blocks);
+
+#ifdef NVFUSE_USE_COALESCED_READ
+		/* read contiguous missing blocks in advance with large I/Os */
+		if (sync_read && !nvfuse_ra_covered(&of->ra, start_lblk, nr_blocks))
+			nvfuse_prefetch_bc(sb, ictx, inode->i_ino, start_lblk, nr_blocks);
+#endif
+	}
+
 	while (count > 0 && of->rwoffset < inode->i_size) {
 
 		bh = nvfuse_get_bh(sb, ictx, inode->i_ino, NVFUSE_SIZE_TO_BLK(of->rwoffset), sync_read,
@@ -810,7 +1068,7 @@ s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32
 			remain = count;
 
 		if (sync_read)
-			rte_memcpy(buffer + rcount, &bh->bh_buf[offset], remain);
+			nvfuse_iov_copy_to(&iter, &bh->bh_buf[offset], remain);
 
 		rcount += remain;
 		of->rwoffset += remain;
@@ -825,12 +1083,42 @@ RES:
 	return rcount;
 }
 
+s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
+			 nvfuse_off_t roffset, s32 sync_read)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = count > 0 ? count : 0;
+
+	return nvfuse_readv_core(sb, fid, &iov, 1, roffset, sync_read);
+}
+
+/*
+ * Direct I/O maps blocks with nvfuse_fgetblk() and bypasses buffer cache,
+ * so inline data is moved to its block and written to device first.
+ */
+static s32 nvfuse_directio_convert_inline(struct nvfuse_superblock *sb,
+		struct nvfuse_inode_ctx *ictx)
+{
+	if (!nvfuse_inode_has_inline_data(ictx->ictx_inode))
+		return 0;
+
+	if (nvfuse_inline_data_convert(sb, ictx)) {
+		printf(" Error: inline data conversion (ino = %d)\n", ictx->ictx_ino);
+		return -1;
+	}
+
+	return nvfuse_fdsync_ictx(sb, ictx);
+}
+
 s32 nvfuse_readfile_directio_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
 				  nvfuse_off_t roffset, s32 sync_read)
 {
 	struct nvfuse_inode_ctx *ictx = NULL;
 	struct nvfuse_inode *inode;
 	struct nvfuse_file_table *of;
+	s32 release_type = CLEAN;
 	s32 rcount = 0;
 
 	of = &(sb->sb_file_table[fid]);
@@ -858,6 +1146,15 @@ s32 nvfuse_readfile_directio_core(struct nvfuse_superblock *sb, u32 fid, s8 *buf
 		rcount = count;
 	}
 
+	/* inode is modified when inline data is moved out */
+	if (nvfuse_inode_has_inline_data(inode)) {
+		release_type = DIRTY;
+		if (nvfuse_directio_convert_inline(sb, ictx)) {
+			rcount = 0;
+			goto RET;
+		}
+	}
+
 	of->rwoffset += count;
 	rcount = count;
 
@@ -866,19 +1163,157 @@ s32 nvfuse_readfile_directio_core(struct nvfuse_superblock *sb, u32 fid, s8 *buf
 
 RET:
 	if (ictx)
+		nvfuse_release_inode(sb, ictx, release_type);
+
+	return rcount;
+}
+
+#ifdef NVFUSE_USE_ZERO_COPY_READ
+/* device can transfer data to buffer directly */
+static s32 nvfuse_zcopy_capable(struct nvfuse_superblock *sb, s8 *buffer)
+{
+	if ((unsigned long)buffer & (SECTOR_SIZE - 1))
+		return 0;
+
+#ifdef SPDK_ENABLED
+	if (sb->io_manager->type == IO_MANAGER_SPDK)
+		return spdk_vtophys(buffer) != SPDK_VTOPHYS_ERROR;
+#endif
+
+	return 1;
+}
+
+/*
+ * Cluster aligned buffered read without staging data in buffer cache.
+ * Cached blocks (possibly dirty) are copied from buffer cache, while
+ * runs of missing blocks are read from device into user buffer directly.
+ */
+s32 nvfuse_readfile_zcopy_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
+			       nvfuse_off_t roffset)
+{
+	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_inode *inode;
+	struct nvfuse_buffer_head *bh;
+	struct nvfuse_file_table *of;
+	lbno_t lblock, end_lblk, next;
+	u32 num_blocks, pblock;
+	s32 rcount = 0;
+	s64 end;
+	u64 key;
+	s32 ret;
+
+	if ((roffset & (CLUSTER_SIZE - 1)) || (count & (CLUSTER_SIZE - 1)) ||
+	    !nvfuse_zcopy_capable(sb, buffer))
+		return nvfuse_readfile_core(sb, fid, buffer, count, roffset, READ);
+
+	of = &(sb->sb_file_table[fid]);
+	of->rwoffset = roffset;
+
+	ictx = nvfuse_read_inode(sb, NULL, of->ino);
+	inode = ictx->ictx_inode;
+
+	if (nvfuse_inode_has_inline_data(inode)) {
 		nvfuse_release_inode(sb, ictx, CLEAN);
+		return nvfuse_readfile_core(sb, fid, buffer, count, roffset, READ);
+	}
+
+	if (count <= 0 || of->rwoffset >= inode->i_size)
+		goto RES;
+
+	end = of->rwoffset + count;
+	if (end > inode->i_size)
+		end = inode->i_size;
+
+	lblock = NVFUSE_SIZE_TO_BLK(of->rwoffset);
+	end_lblk = NVFUSE_SIZE_TO_BLK(end + CLUSTER_SIZE - 1);
+
+	nvfuse_ra_wait_range(sb, &of->ra, lblock, end_lblk - lblock);
+
+	while (lblock < end_lblk) {
+		nvfuse_make_pbno_key(inode->i_ino, lblock, &key, NVFUSE_BP_TYPE_DATA);
+		if (nvfuse_hash_lookup(sb, key)) {
+			bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblock, READ, NVFUSE_TYPE_DATA);
+			if (bh == NULL) {
+				printf(" read error \n");
+				goto ADVANCE;
+			}
+			rte_memcpy(buffer + rcount, bh->bh_buf, CLUSTER_SIZE);
+			nvfuse_release_bh(sb, bh, 0, CLEAN);
+			lblock++;
+			rcount += CLUSTER_SIZE;
+			continue;
+		}
+
+		/* run of missing blocks, bounded by the largest coalesced read */
+		for (next = lblock + 1; next < end_lblk &&
+		     next - lblock < NVFUSE_MAX_COALESCED_READ_SIZE / CLUSTER_SIZE; next++) {
+			nvfuse_make_pbno_key(inode->i_ino, next, &key, NVFUSE_BP_TYPE_DATA);
+			if (nvfuse_hash_lookup(sb, key))
+				break;
+		}
+
+		ret = nvfuse_get_block(sb, ictx, lblock, next - lblock, &num_blocks, &pblock, 0);
+		if (ret < 0) {
+			printf(" Error: get_block for zero copy read\n");
+			goto ADVANCE;
+		}
+
+		if (pblock == 0) {
+			/* hole */
+			memset(buffer + rcount, 0x00, CLUSTER_SIZE);
+			num_blocks = 1;
+		} else {
+			if (num_blocks > next - lblock)
+				num_blocks = next - lblock;
+
+			ret = nvfuse_read_ncluster(buffer + rcount, pblock, num_blocks, nvfuse_io_channel(sb));
+			if (ret <= 0) {
+				printf(" Error: zero copy read (pblock = %d)\n", pblock);
+				goto ADVANCE;
+			}
+		}
+
+		lblock += num_blocks;
+		rcount += num_blocks * CLUSTER_SIZE;
+	}
+
+ADVANCE:
+	/* the last block may be beyond the end of file */
+	if (of->rwoffset + rcount > end)
+		rcount = end - of->rwoffset;
+	of->rwoffset += rcount;
+
+RES:
+	nvfuse_release_inode(sb, ictx, CLEAN);
 
 	return rcount;
 }
 
+s32 nvfuse_readfile_zcopy(struct nvfuse_handle *nvh, u32 fid, s8 *buffer, s32 count,
+			  nvfuse_off_t roffset)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 rcount;
+
+	nvfuse_lock(sb);
+	rcount = nvfuse_readfile_zcopy_core(sb, fid, buffer, count, roffset);
+
+	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
+	return rcount;
+}
+#endif
+
 s32 nvfuse_readfile(struct nvfuse_handle *nvh, u32 fid, s8 *buffer, s32 count, nvfuse_off_t roffset)
 {
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	s32 rcount;
 
+	nvfuse_lock(sb);
 	rcount = nvfuse_readfile_core(sb, fid, buffer, count, roffset, READ);
 
 	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
 	return rcount;
 }
 
@@ -888,9 +1323,11 @@ s32 nvfuse_readfile_aio(struct nvfuse_handle *nvh, u32 fid, s8 *buffer, s32 coun
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	s32 rcount;
 
+	nvfuse_lock(sb);
 	rcount = nvfuse_readfile_core(sb, fid, buffer, count, roffset, 0 /* no sync read */);
 
 	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
 	return rcount;
 }
 
@@ -900,26 +1337,93 @@ s32 nvfuse_readfile_aio_directio(struct nvfuse_handle *nvh, u32 fid, s8 *buffer,
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	s32 rcount;
 
+	nvfuse_lock(sb);
 	rcount = nvfuse_readfile_directio_core(sb, fid, buffer, count, roffset, 0 /* no sync read */);
 
 	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
 	return rcount;
 }
 
 
-s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf, u32 count,
-			  nvfuse_off_t woffset)
+#ifdef NVFUSE_USE_INLINE_DATA
+/* inode can keep its data inline only if no data block is mapped yet */
+static s32 nvfuse_inline_data_possible(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	u32 num_blocks, pblock;
+
+	if (nvfuse_inode_has_inline_data(inode))
+		return 1;
+
+	if (inode->i_size != 0)
+		return 0;
+
+	/* blocks may be left behind by direct I/O or fallocate */
+	if (nvfuse_get_block(sb, ictx, 0, 1, &num_blocks, &pblock, 0) || pblock)
+		return 0;
+
+	return 1;
+}
+#endif
+
+/*
+ * Blocks between old EOF and the start of a write are allocated but never
+ * written by it, so [start, end) is zeroed in buffer cache instead of
+ * exposing stale contents of the device.
+ */
+static s32 nvfuse_zero_gap(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			   s64 start, s64 end)
+{
+	struct nvfuse_buffer_head *bh;
+	u32 offset;
+
+	while (start < end) {
+		offset = start & (CLUSTER_SIZE - 1);
+		/* only the old last block holds valid data */
+		bh = nvfuse_get_bh(sb, ictx, ictx->ictx_ino, NVFUSE_SIZE_TO_BLK(start),
+				   offset ? READ : WRITE, NVFUSE_TYPE_DATA);
+		if (bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return -1;
+		}
+
+		memset(&bh->bh_buf[offset], 0x00, CLUSTER_SIZE - offset);
+		nvfuse_release_bh(sb, bh, 0, DIRTY);
+
+		start += CLUSTER_SIZE - offset;
+	}
+
+	return 0;
+}
+
+/*
+ * Buffered write from an I/O vector. Blocks for the extended region are
+ * allocated once and the vector is drained into the buffer cache in a
+ * single pass.
+ */
+s32 nvfuse_writev_core(struct nvfuse_superblock *sb, s32 fid, const struct iovec *iov, s32 iovcnt,
+		       nvfuse_off_t woffset)
 {
 	struct nvfuse_inode_ctx *ictx;
 	struct nvfuse_inode *inode;
 	struct nvfuse_file_table *of;
 	struct nvfuse_buffer_head *bh = NULL;
+	struct nvfuse_iov_iter iter;
 	u32 offset = 0, remain = 0, wcount = 0;
+	u32 count;
 	lbno_t lblock = 0;
+	s64 old_size;
 	int ret;
 
 	of = &(sb->sb_file_table[fid]);
 
+	ret = nvfuse_iov_length(iov, iovcnt);
+	if (ret < 0)
+		return NVFUSE_ERROR;
+	count = ret;
+	nvfuse_iov_iter_init(&iter, iov, iovcnt);
+
 #if NVFUSE_OS == NVFUSE_OS_WINDOWS
 	if (woffset) {
 		of->rwoffset = woffset;
@@ -928,33 +1432,80 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 	of->rwoffset = woffset;
 #endif
 
-	while (count > 0) {
+	if (count == 0)
+		return 0;
 
-		ictx = nvfuse_read_inode(sb, NULL, of->ino);
-		inode = ictx->ictx_inode;
+	/* inode is pinned during the whole request */
+	ictx = nvfuse_read_inode(sb, NULL, of->ino);
+	inode = ictx->ictx_inode;
+	old_size = inode->i_size;
 
-		lblock = NVFUSE_SIZE_TO_BLK(of->rwoffset);
-		offset = of->rwoffset & (CLUSTER_SIZE - 1);
-		remain = CLUSTER_SIZE - offset;
-		if (remain > count)
-			remain = count;
+#ifdef NVFUSE_USE_INLINE_DATA
+	/* data fitting in inode is stored inline as long as file has no blocks */
+	if (nvfuse_inline_data_enabled(sb) && of->rwoffset + count <= NVFUSE_INLINE_DATA_SIZE &&
+	    nvfuse_inline_data_possible(sb, ictx)) {
+		nvfuse_iov_copy_from(&iter, (s8 *)inode->i_inline_data + of->rwoffset, count);
+		inode->i_flags |= NVFUSE_INODE_FLAG_INLINE_DATA;
+
+		wcount = count;
+		of->rwoffset += count;
+		if (of->rwoffset > of->size)
+			of->size = of->rwoffset;
+
+		inode->i_type = NVFUSE_TYPE_FILE;
+		inode->i_size = of->size;
+		nvfuse_release_inode(sb, ictx, DIRTY);
+		goto SYNC_FILE;
+	}
+#endif
+
+	/* allocate blocks for the extended region at once */
+	if (of->rwoffset + count > old_size) {
+		lbno_t first = NVFUSE_SIZE_TO_BLK(old_size);
+		lbno_t last = NVFUSE_SIZE_TO_BLK(of->rwoffset + count - 1);
+		u32 num_alloc_blocks;
 
-		if (count && inode->i_size <= of->rwoffset) {
-			ret = nvfuse_get_block(sb, ictx, NVFUSE_SIZE_TO_BLK(inode->i_size), 1/* num block */, NULL, NULL,
-					       1);
-			if (ret) {
+		while (first <= last) {
+			ret = nvfuse_get_block(sb, ictx, first, last - first + 1, &num_alloc_blocks, NULL, 1);
+			if (ret || num_alloc_blocks == 0) {
 				printf(" data block allocation fails.");
+				nvfuse_release_inode(sb, ictx, DIRTY);
 				return NVFUSE_ERROR;
 			}
+			first += num_alloc_blocks;
+		}
+
+		if (of->rwoffset > old_size &&
+		    nvfuse_zero_gap(sb, ictx, old_size, of->rwoffset)) {
+			nvfuse_release_inode(sb, ictx, DIRTY);
+			return NVFUSE_ERROR;
 		}
+	}
+
+	while (count > 0) {
+
+		lblock = NVFUSE_SIZE_TO_BLK(of->rwoffset);
+		offset = of->rwoffset & (CLUSTER_SIZE - 1);
+		remain = CLUSTER_SIZE - offset;
+		if (remain > count)
+			remain = count;
 
 		/*read modify write or partial write */
-		if (remain != CLUSTER_SIZE)
+		if (remain != CLUSTER_SIZE && ((s64)lblock << CLUSTER_SIZE_BITS) < old_size) {
 			bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblock, READ, NVFUSE_TYPE_DATA);
-		else
+		} else {
 			bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblock, WRITE, NVFUSE_TYPE_DATA);
+		}
+		if (bh == NULL) {
+			printf(" Error: get_bh()\n");
+			nvfuse_release_inode(sb, ictx, DIRTY);
+			return wcount ? wcount : NVFUSE_ERROR;
+		}
+		/* newly allocated block has no valid data on disk */
+		if (remain != CLUSTER_SIZE && !bh->bh_bc->bc_load)
+			memset(bh->bh_buf, 0x00, CLUSTER_SIZE);
 
-		rte_memcpy(&bh->bh_buf[offset], user_buf + wcount, remain);
+		nvfuse_iov_copy_from(&iter, &bh->bh_buf[offset], remain);
 
 		wcount += remain;
 		of->rwoffset += remain;
@@ -968,9 +1519,13 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 		assert(inode->i_size < MAX_FILE_SIZE);
 
 		nvfuse_release_bh(sb, bh, 0, DIRTY);
-		nvfuse_release_inode(sb, ictx, DIRTY);
 	}
 
+	nvfuse_release_inode(sb, ictx, DIRTY);
+
+#ifdef NVFUSE_USE_INLINE_DATA
+SYNC_FILE:
+#endif
 	if (of->flags & O_SYNC) {
 		if (of->flags & __O_SYNC) {
 			ictx = nvfuse_read_inode(sb, NULL, of->ino);
@@ -981,19 +1536,31 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 			nvfuse_fsync_ictx(sb, ictx);
 			nvfuse_release_inode(sb, ictx, CLEAN);
 		}
-		/* flush cmd to nvme ssd */
-		nvfuse_dev_flush(sb->io_manager);
+		/* flush cmd to nvme ssd unless blocks were written with FUA */
+		nvfuse_sync_dev_cache(sb);
 	}
 
 	return wcount;
 }
 
+s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf, u32 count,
+			  nvfuse_off_t woffset)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)user_buf;
+	iov.iov_len = count;
+
+	return nvfuse_writev_core(sb, fid, &iov, 1, woffset);
+}
+
 s32 nvfuse_writefile_directio_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf,
 				   u32 count, nvfuse_off_t woffset)
 {
 	struct nvfuse_inode_ctx *ictx;
 	struct nvfuse_inode *inode;
 	struct nvfuse_file_table *of;
+	s32 release_type = CLEAN;
 	u32 wcount = 0;
 	int ret;
 
@@ -1015,6 +1582,15 @@ s32 nvfuse_writefile_directio_core(struct nvfuse_superblock *sb, s32 fid, const
 
 	ictx = nvfuse_read_inode(sb, NULL, of->ino);
 	inode = ictx->ictx_inode;
+	/* inode is modified when inline data is moved out */
+	if (nvfuse_inode_has_inline_data(inode)) {
+		release_type = DIRTY;
+		if (nvfuse_directio_convert_inline(sb, ictx)) {
+			nvfuse_release_inode(sb, ictx, release_type);
+			return 0;
+		}
+	}
+
 	if (count && inode->i_size <= of->rwoffset) {
 		u32 num_alloc = count >> CLUSTER_SIZE_BITS;
 		ret = nvfuse_get_block(sb, ictx, NVFUSE_SIZE_TO_BLK(inode->i_size), num_alloc/* num block */, NULL,
@@ -1028,7 +1604,7 @@ s32 nvfuse_writefile_directio_core(struct nvfuse_superblock *sb, s32 fid, const
 		inode->i_size += count;
 		nvfuse_release_inode(sb, ictx, DIRTY);
 	} else {
-		nvfuse_release_inode(sb, ictx, CLEAN);
+		nvfuse_release_inode(sb, ictx, release_type);
 	}
 
 	of->rwoffset += count;
@@ -1049,11 +1625,13 @@ s32 nvfuse_writefile(struct nvfuse_handle *nvh, u32 fid, const s8 *user_buf, u32
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	s32 wcount;
 
+	nvfuse_lock(sb);
 	wcount = nvfuse_writefile_core(sb, fid, user_buf, count, woffset);
 
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 
 	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
 
 	return wcount;
 }
@@ -1064,9 +1642,11 @@ s32 nvfuse_writefile_buffered_aio(struct nvfuse_handle *nvh, u32 fid, const s8 *
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	s32 wcount;
 
+	nvfuse_lock(sb);
 	wcount = nvfuse_writefile_core(sb, fid, user_buf, count, woffset);
 
 	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
 
 	return wcount;
 }
@@ -1077,13 +1657,244 @@ s32 nvfuse_writefile_directio_prepare(struct nvfuse_handle *nvh, u32 fid, const
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	s32 wcount;
 
+	nvfuse_lock(sb);
 	wcount = nvfuse_writefile_directio_core(sb, fid, user_buf, count, woffset);
 
 	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
 
 	return wcount;
 }
 
+/* transfer whole clusters between vector and device */
+static s32 nvfuse_rwv_ncluster(struct nvfuse_superblock *sb, struct iovec *iov, s32 iovcnt,
+			       u32 pblock, u32 num_blocks, s32 rw)
+{
+	struct nvfuse_io_manager *io_manager = nvfuse_io_channel(sb);
+	s32 i, ret;
+
+	/* short transfer (e.g., preadv() hitting end of device) is an error */
+	if (rw == READ && io_manager->io_readv) {
+		ret = nvfuse_readv_ncluster(iov, iovcnt, pblock, num_blocks, io_manager);
+		return ret == (s32)(num_blocks << CLUSTER_SIZE_BITS) ? 0 : -1;
+	}
+
+	if (rw == WRITE && io_manager->io_writev) {
+		ret = nvfuse_writev_ncluster(iov, iovcnt, pblock, num_blocks, io_manager);
+		return ret == (s32)(num_blocks << CLUSTER_SIZE_BITS) ? 0 : -1;
+	}
+
+	/* segments are aligned to cluster size in direct I/O */
+	for (i = 0; i < iovcnt; i++) {
+		num_blocks = iov[i].iov_len >> CLUSTER_SIZE_BITS;
+		if (rw == READ)
+			ret = nvfuse_read_ncluster(iov[i].iov_base, pblock, num_blocks, io_manager);
+		else
+			ret = nvfuse_write_ncluster(iov[i].iov_base, pblock, num_blocks, io_manager);
+		if (ret != (s32)(num_blocks << CLUSTER_SIZE_BITS))
+			return -1;
+		pblock += num_blocks;
+	}
+
+	return 0;
+}
+
+/*
+ * Direct I/O with a vector. Each physically contiguous run of the file is
+ * transferred by a single scatter gather request.
+ */
+static s32 nvfuse_rwv_directio_core(struct nvfuse_superblock *sb, s32 fid,
+				    const struct iovec *iov, s32 iovcnt, nvfuse_off_t offset, s32 rw)
+{
+	struct iovec seg[NVFUSE_IOV_MAX];
+	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_inode *inode;
+	struct nvfuse_file_table *of;
+	struct nvfuse_iov_iter iter;
+	lbno_t lblock, end_lblk;
+	u32 num_blocks, pblock;
+	s32 count, bytes = 0;
+	s32 segcnt, i;
+	s64 end;
+	s32 ret;
+
+	of = &(sb->sb_file_table[fid]);
+
+	count = nvfuse_iov_length(iov, iovcnt);
+	if (count < 0 || (count & (CLUSTER_SIZE - 1)) || (offset & (CLUSTER_SIZE - 1))) {
+		printf(" Error: direct I/O is not aligned to 4KB.\n");
+		return NVFUSE_ERROR;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len & (CLUSTER_SIZE - 1)) {
+			printf(" Error: iov_len is not aligned to 4KB.\n");
+			return NVFUSE_ERROR;
+		}
+	}
+
+	of->rwoffset = offset;
+	if (count == 0)
+		return 0;
+
+	ictx = nvfuse_read_inode(sb, NULL, of->ino);
+	inode = ictx->ictx_inode;
+
+	/* inline data lives in inode, so device has nothing to read */
+	if (rw == READ && nvfuse_inode_has_inline_data(inode)) {
+		nvfuse_release_inode(sb, ictx, CLEAN);
+		return nvfuse_readv_core(sb, fid, iov, iovcnt, offset, READ);
+	}
+
+	end = offset + count;
+	if (rw == READ) {
+		if (end > inode->i_size)
+			end = inode->i_size;
+		if (offset >= end)
+			goto RES;
+	} else if (end > inode->i_size) {
+		/* allocate blocks for the extended region at once */
+		lblock = NVFUSE_SIZE_TO_BLK(inode->i_size + CLUSTER_SIZE - 1);
+		end_lblk = NVFUSE_SIZE_TO_BLK(end);
+
+		while (lblock < end_lblk) {
+			ret = nvfuse_get_block(sb, ictx, lblock, end_lblk - lblock, &num_blocks, NULL, 1);
+			if (ret || num_blocks == 0) {
+				printf(" data block allocation fails.");
+				nvfuse_release_inode(sb, ictx, DIRTY);
+				return NVFUSE_ERROR;
+			}
+			lblock += num_blocks;
+		}
+
+		/* gap has to reach device before direct I/O can read it */
+		if (offset > inode->i_size) {
+			if (nvfuse_zero_gap(sb, ictx, inode->i_size, offset) ||
+			    nvfuse_fdsync_ictx(sb, ictx)) {
+				nvfuse_release_inode(sb, ictx, DIRTY);
+				return NVFUSE_ERROR;
+			}
+		}
+	}
+
+	nvfuse_iov_iter_init(&iter, iov, iovcnt);
+
+	lblock = NVFUSE_SIZE_TO_BLK(offset);
+	end_lblk = NVFUSE_SIZE_TO_BLK(end + CLUSTER_SIZE - 1);
+
+	while (lblock < end_lblk) {
+		ret = nvfuse_get_block(sb, ictx, lblock, end_lblk - lblock, &num_blocks, &pblock,
+				       rw == WRITE);
+		if (ret < 0) {
+			printf(" Error: nvfuse_get_block lblk = %d\n", lblock);
+			break;
+		}
+
+		if (pblock == 0) {
+			/* hole is read as zero */
+			assert(rw == READ);
+			segcnt = nvfuse_iov_slice(&iter, CLUSTER_SIZE, seg);
+			for (i = 0; i < segcnt; i++)
+				memset(seg[i].iov_base, 0x00, seg[i].iov_len);
+			lblock++;
+			bytes += CLUSTER_SIZE;
+			continue;
+		}
+
+		if (num_blocks > end_lblk - lblock)
+			num_blocks = end_lblk - lblock;
+
+		segcnt = nvfuse_iov_slice(&iter, num_blocks << CLUSTER_SIZE_BITS, seg);
+		ret = nvfuse_rwv_ncluster(sb, seg, segcnt, pblock, num_blocks, rw);
+		if (ret < 0) {
+			printf(" Error: direct I/O pblock = %d, count = %d\n", pblock, num_blocks);
+			break;
+		}
+
+		lblock += num_blocks;
+		bytes += num_blocks << CLUSTER_SIZE_BITS;
+	}
+
+	if (offset + bytes > end)
+		bytes = end - offset;
+
+	of->rwoffset += bytes;
+	if (of->rwoffset > of->size)
+		of->size = of->rwoffset;
+
+	if (rw == WRITE && of->rwoffset > inode->i_size) {
+		assert(of->rwoffset < MAX_FILE_SIZE);
+		inode->i_size = of->rwoffset;
+		nvfuse_release_inode(sb, ictx, DIRTY);
+		return bytes;
+	}
+
+RES:
+	nvfuse_release_inode(sb, ictx, CLEAN);
+
+	return bytes;
+}
+
+static s32 nvfuse_rwv(struct nvfuse_handle *nvh, s32 fid, const struct iovec *iov, s32 iovcnt,
+		      nvfuse_off_t offset, s32 use_offset, s32 rw)
+{
+	struct nvfuse_superblock *sb;
+	nvfuse_off_t rwoffset;
+	s32 bytes;
+
+	if (iovcnt < 0 || iovcnt > NVFUSE_IOV_MAX) {
+		printf(" Error: invalid iovcnt = %d\n", iovcnt);
+		return NVFUSE_ERROR;
+	}
+
+	sb = nvfuse_read_super(nvh);
+	nvfuse_lock(sb);
+
+	/* preadv()/pwritev() leave file offset unchanged */
+	rwoffset = sb->sb_file_table[fid].rwoffset;
+	if (!use_offset)
+		offset = rwoffset;
+
+	if (nvfuse_is_directio(sb, fid)) {
+		bytes = nvfuse_rwv_directio_core(sb, fid, iov, iovcnt, offset, rw);
+	} else if (rw == READ) {
+		bytes = nvfuse_readv_core(sb, fid, iov, iovcnt, offset, READ);
+	} else {
+		bytes = nvfuse_writev_core(sb, fid, iov, iovcnt, offset);
+		nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+	}
+
+	if (use_offset)
+		sb->sb_file_table[fid].rwoffset = rwoffset;
+
+	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
+
+	return bytes;
+}
+
+s32 nvfuse_readv(struct nvfuse_handle *nvh, s32 fid, const struct iovec *iov, s32 iovcnt)
+{
+	return nvfuse_rwv(nvh, fid, iov, iovcnt, 0, 0, READ);
+}
+
+s32 nvfuse_writev(struct nvfuse_handle *nvh, s32 fid, const struct iovec *iov, s32 iovcnt)
+{
+	return nvfuse_rwv(nvh, fid, iov, iovcnt, 0, 0, WRITE);
+}
+
+s32 nvfuse_preadv(struct nvfuse_handle *nvh, s32 fid, const struct iovec *iov, s32 iovcnt,
+		  nvfuse_off_t offset)
+{
+	return nvfuse_rwv(nvh, fid, iov, iovcnt, offset, 1, READ);
+}
+
+s32 nvfuse_pwritev(struct nvfuse_handle *nvh, s32 fid, const struct iovec *iov, s32 iovcnt,
+		   nvfuse_off_t offset)
+{
+	return nvfuse_rwv(nvh, fid, iov, iovcnt, offset, 1, WRITE);
+}
+
 
 s32 nvfuse_gather_bh(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf, u32 count,
 		     nvfuse_off_t woffset, struct list_head *aio_bh_head, s32 *aio_bh_count)
@@ -1103,6 +1914,12 @@ s32 nvfuse_gather_bh(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf,
 	ictx = nvfuse_read_inode(sb, NULL, of->ino);
 	inode = ictx->ictx_inode;
 
+	/* aio writes data blocks, so inline data has to be moved first */
+	if (nvfuse_inode_has_inline_data(inode) && nvfuse_inline_data_convert(sb, ictx)) {
+		nvfuse_release_inode(sb, ictx, DIRTY);
+		return -1;
+	}
+
 	while (count > 0) {
 		lblock = NVFUSE_SIZE_TO_BLK(curoffset);
 		offset = curoffset & (CLUSTER_SIZE - 1);
@@ -1205,17 +2022,6 @@ s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *fiename
 	search_lblock = empty_dentry / DIR_ENTRY_NUM;
 	search_entry = empty_dentry % DIR_ENTRY_NUM;
 
-#ifdef NVFUSE_USE_DELAYED_BPTREE_CREATION
-	if (dir_inode->i_bpino == 0 && dir_inode->i_links_count == 2) {
-		/* create bptree related nodes for new directory's dentries */
-		ret = nvfuse_create_bptree(sb, dir_inode);
-		if (ret) {
-			printf(" bptree allocation fails.");
-			return NVFUSE_ERROR;
-		}
-	}
-#endif
-
 	dir_inode->i_links_count++;
 	dir_inode->i_ptr = search_lblock * DIR_ENTRY_NUM + search_entry;
 	assert(dir_inode->i_links_count == dir_inode->i_ptr + 1);
@@ -1255,6 +2061,12 @@ s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *fiename
 		*new_ino = new_inode->i_ino;
 
 	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ, NVFUSE_TYPE_META);
+	if (dir_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_inode(sb, new_ictx, DIRTY);
+		nvfuse_release_inode(sb, dir_ictx, DIRTY);
+		return -1;
+	}
 	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 	dir[search_entry].d_flag = DIR_USED;
 	dir[search_entry].d_ino = new_inode->i_ino;
@@ -1293,12 +2105,21 @@ s32 nvfuse_shrink_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *
 
 	dir_bh_from = nvfuse_get_bh(sb, ictx, inode->i_ino,
 				    NVFUSE_SIZE_TO_BLK((s64)from_entry * DIR_ENTRY_SIZE), READ, NVFUSE_TYPE_META);
+	if (dir_bh_from == NULL) {
+		printf(" Error: get_bh()\n");
+		return -1;
+	}
 	dir_from = (struct nvfuse_dir_entry *)dir_bh_from->bh_buf;
 	dir_from += (from_entry % DIR_ENTRY_NUM);
 	assert(dir_from->d_flag != DIR_DELETED);
 
 	dir_bh_to = nvfuse_get_bh(sb, ictx, inode->i_ino,
 				  NVFUSE_SIZE_TO_BLK((s64)to_entry * DIR_ENTRY_SIZE), READ, NVFUSE_TYPE_META);
+	if (dir_bh_to == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_bh(sb, dir_bh_from, 0, CLEAN);
+		return -1;
+	}
 	dir_to = (struct nvfuse_dir_entry *)dir_bh_to->bh_buf;
 	dir_to += (to_entry % DIR_ENTRY_NUM);
 	assert(dir_to->d_flag == DIR_DELETED);
@@ -1348,6 +2169,11 @@ s32 nvfuse_rmfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 	search_entry = found_entry % DIR_ENTRY_NUM;
 	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ,
 						   NVFUSE_TYPE_META);
+	if (dir_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_inode(sb, dir_ictx, CLEAN);
+		return -1;
+	}
 	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 	dir += search_entry;
 
@@ -1403,15 +2229,13 @@ s32 nvfuse_rmfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_rmfile_path(struct nvfuse_handle *nvh, const char *path)
+static s32 __nvfuse_rmfile_path(struct nvfuse_handle *nvh, const char *path)
 {
 	int res;
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	s8 filename[FNAME_SIZE];
 
-	nvfuse_lock();
-
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
 		return res;
@@ -1423,15 +2247,38 @@ s32 nvfuse_rmfile_path(struct nvfuse_handle *nvh, const char *path)
 		res = nvfuse_rmfile(sb, dir_entry.d_ino, filename);
 	}
 
-	nvfuse_unlock();
 	return res;
 }
 
-s32 nvfuse_unlink(struct nvfuse_handle *nvh, const char *path)
+s32 nvfuse_rmfile_path(struct nvfuse_handle *nvh, const char *path)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_rmfile_path(nvh, path);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_unlink(struct nvfuse_handle *nvh, const char *path)
 {
 	return nvfuse_rmfile_path(nvh, path);
 }
 
+s32 nvfuse_unlink(struct nvfuse_handle *nvh, const char *path)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_unlink(nvh, path);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
 s32 nvfuse_rmdir(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 {
 	struct nvfuse_dir_entry *dir = NULL;
@@ -1453,6 +2300,11 @@ s32 nvfuse_rmdir(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 	search_entry = found_entry % DIR_ENTRY_NUM;
 	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ,
 						   NVFUSE_TYPE_META);
+	if (dir_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_inode(sb, dir_ictx, CLEAN);
+		return -1;
+	}
 	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 	dir += search_entry;
 
@@ -1523,15 +2375,13 @@ s32 nvfuse_rmdir(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename)
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_rmdir_path(struct nvfuse_handle *nvh, const char *path)
+static s32 __nvfuse_rmdir_path(struct nvfuse_handle *nvh, const char *path)
 {
 	int res = 0;
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_superblock *sb;
 	s8 filename[FNAME_SIZE];
 
-	nvfuse_lock();
-
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
 		return res;
@@ -1545,7 +2395,18 @@ s32 nvfuse_rmdir_path(struct nvfuse_handle *nvh, const char *path)
 		nvfuse_release_super(sb);
 	}
 
-	nvfuse_unlock();
+	return res;
+}
+
+s32 nvfuse_rmdir_path(struct nvfuse_handle *nvh, const char *path)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_rmdir_path(nvh, path);
+	nvfuse_unlock(sb);
+
 	return res;
 }
 
@@ -1569,6 +2430,10 @@ s32 nvfuse_make_first_directory(struct nvfuse_superblock *sb, struct nvfuse_inod
 	nvfuse_mark_inode_dirty(ictx);
 
 	dir_bh = nvfuse_get_bh(sb, ictx, inode->i_ino, 0, WRITE, NVFUSE_TYPE_META);
+	if (dir_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return NVFUSE_ERROR;
+	}
 	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 
 	strcpy(dir[0].d_filename, "."); // current dir
@@ -1638,17 +2503,6 @@ s32 nvfuse_mkdir(struct nvfuse_superblock *sb, const inode_t par_ino, const s8 *
 	search_lblock = empty_dentry / DIR_ENTRY_NUM;
 	search_entry = empty_dentry % DIR_ENTRY_NUM;
 
-#ifdef NVFUSE_USE_DELAYED_BPTREE_CREATION
-	if (dir_inode->i_bpino == 0 && dir_inode->i_links_count == 2) {
-		/* create bptree related nodes for new directory's dentries */
-		ret = nvfuse_create_bptree(sb, dir_inode);
-		if (ret) {
-			printf(" bptree allocation fails.");
-			return NVFUSE_ERROR;
-		}
-	}
-#endif
-
 	dir_inode->i_links_count++;
 	dir_inode->i_ptr = search_lblock * DIR_ENTRY_NUM + search_entry;
 	assert(dir_inode->i_links_count == dir_inode->i_ptr + 1);
@@ -1686,6 +2540,12 @@ s32 nvfuse_mkdir(struct nvfuse_superblock *sb, const inode_t par_ino, const s8 *
 		*new_ino = new_inode->i_ino;
 
 	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ, NVFUSE_TYPE_META);
+	if (dir_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_inode(sb, new_ictx, DIRTY);
+		nvfuse_release_inode(sb, dir_ictx, DIRTY);
+		return -1;
+	}
 	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 	dir[search_entry].d_flag = DIR_USED;
 	dir[search_entry].d_ino = new_inode->i_ino;
@@ -1729,8 +2589,8 @@ RET:
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_rename(struct nvfuse_handle *nvh, inode_t par_ino, s8 *name, inode_t new_par_ino,
-		  s8 *newname)
+static s32 __nvfuse_rename(struct nvfuse_handle *nvh, inode_t par_ino, s8 *name, inode_t new_par_ino,
+			   s8 *newname)
 {
 	struct nvfuse_superblock *sb;
 	struct nvfuse_inode_ctx *ictx;
@@ -1761,7 +2621,20 @@ s32 nvfuse_rename(struct nvfuse_handle *nvh, inode_t par_ino, s8 *name, inode_t
 	return 0;
 }
 
-s32 nvfuse_rename_path(struct nvfuse_handle *nvh, const char *from, const char *to)
+s32 nvfuse_rename(struct nvfuse_handle *nvh, inode_t par_ino, s8 *name, inode_t new_par_ino,
+		  s8 *newname)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_rename(nvh, par_ino, name, new_par_ino, newname);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_rename_path(struct nvfuse_handle *nvh, const char *from, const char *to)
 {
 	struct nvfuse_dir_entry old_dir_entry;
 	s8 old_filename[FNAME_SIZE];
@@ -1781,6 +2654,18 @@ s32 nvfuse_rename_path(struct nvfuse_handle *nvh, const char *from, const char *
 	return nvfuse_rename(nvh, old_dir_entry.d_ino, old_filename, new_dir_entry.d_ino, new_filename);
 }
 
+s32 nvfuse_rename_path(struct nvfuse_handle *nvh, const char *from, const char *to)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_rename_path(nvh, from, to);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
 s32 nvfuse_hardlink(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name, inode_t new_par_ino,
 		    s8 *newname)
 {
@@ -1812,7 +2697,7 @@ s32 nvfuse_hardlink(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name, ino
 	return 0;
 }
 
-s32 nvfuse_hardlink_path(struct nvfuse_handle *nvh, const char *from, const char *to)
+static s32 __nvfuse_hardlink_path(struct nvfuse_handle *nvh, const char *from, const char *to)
 {
 	struct nvfuse_dir_entry from_dir_entry;
 	s8 from_filename[FNAME_SIZE];
@@ -1837,20 +2722,30 @@ s32 nvfuse_hardlink_path(struct nvfuse_handle *nvh, const char *from, const char
 
 	res = nvfuse_hardlink(sb, from_dir_entry.d_ino, from_filename, to_dir_entry.d_ino, to_filename);
 
-	nvfuse_release_super(sb);
+	nvfuse_release_super(sb);
+
+	return res;
+}
+
+s32 nvfuse_hardlink_path(struct nvfuse_handle *nvh, const char *from, const char *to)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_hardlink_path(nvh, from, to);
+	nvfuse_unlock(sb);
 
 	return res;
 }
 
-s32 nvfuse_mknod(struct nvfuse_handle *nvh, const char *path, mode_t mode, dev_t dev)
+static s32 __nvfuse_mknod(struct nvfuse_handle *nvh, const char *path, mode_t mode, dev_t dev)
 {
 	int res = 0;
 	struct nvfuse_dir_entry dir_entry;
 	s8 filename[FNAME_SIZE];
 	struct nvfuse_superblock *sb;
 
-	nvfuse_lock();
-
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
 		return res;
@@ -1873,20 +2768,29 @@ s32 nvfuse_mknod(struct nvfuse_handle *nvh, const char *path, mode_t mode, dev_t
 		nvfuse_release_super(sb);
 	}
 
-	nvfuse_unlock();
 
 	return 0;
 }
 
-s32 nvfuse_mkdir_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
+s32 nvfuse_mknod(struct nvfuse_handle *nvh, const char *path, mode_t mode, dev_t dev)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_mknod(nvh, path, mode, dev);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_mkdir_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
 {
 	int res = 0;
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_superblock *sb;
 	s8 filename[FNAME_SIZE];
 
-	nvfuse_lock();
-
 	sb = nvfuse_read_super(nvh);
 
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
@@ -1901,12 +2805,23 @@ s32 nvfuse_mkdir_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
 	}
 
 	nvfuse_release_super(sb);
-	nvfuse_unlock();
 
 	return res;
 }
 
-s32 nvfuse_truncate_path(struct nvfuse_handle *nvh, const char *path, nvfuse_off_t size)
+s32 nvfuse_mkdir_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_mkdir_path(nvh, path, mode);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_truncate_path(struct nvfuse_handle *nvh, const char *path, nvfuse_off_t size)
 {
 	int res;
 	struct nvfuse_dir_entry dir_entry;
@@ -1929,7 +2844,19 @@ s32 nvfuse_truncate_path(struct nvfuse_handle *nvh, const char *path, nvfuse_off
 	return res;
 }
 
-s32 nvfuse_ftruncate(struct nvfuse_handle *nvh, s32 fid, nvfuse_off_t size)
+s32 nvfuse_truncate_path(struct nvfuse_handle *nvh, const char *path, nvfuse_off_t size)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_truncate_path(nvh, path, size);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_ftruncate(struct nvfuse_handle *nvh, s32 fid, nvfuse_off_t size)
 {
 	struct nvfuse_superblock *sb;
 	struct nvfuse_file_table *ft;
@@ -1955,7 +2882,20 @@ s32 nvfuse_ftruncate(struct nvfuse_handle *nvh, s32 fid, nvfuse_off_t size)
 	return res;
 }
 
-s32 nvfuse_symlink(struct nvfuse_handle *nvh, const char *link, inode_t parent, const char *name)
+s32 nvfuse_ftruncate(struct nvfuse_handle *nvh, s32 fid, nvfuse_off_t size)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_ftruncate(nvh, fid, size);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_symlink(struct nvfuse_handle *nvh, const char *link, inode_t parent,
+			    const char *name)
 {
 	struct nvfuse_superblock *sb;
 	int res = 0;
@@ -1968,8 +2908,6 @@ s32 nvfuse_symlink(struct nvfuse_handle *nvh, const char *link, inode_t parent,
 	printf(" symlink : \"%s\", parent #%d, name \"%s\" \n",
 	       link, (int)parent, name);
 
-	nvfuse_lock();
-
 	if (!nvfuse_lookup(sb, NULL, NULL, name, parent))
 		return error_msg(" exist file or directory\n");
 
@@ -1994,12 +2932,24 @@ s32 nvfuse_symlink(struct nvfuse_handle *nvh, const char *link, inode_t parent,
 
 	nvfuse_release_super(sb);
 
-	nvfuse_unlock();
 
 	return 0;
 }
 
-s32 nvfuse_symlink_path(struct nvfuse_handle *nvh, const char *target_name, const char *link_name)
+s32 nvfuse_symlink(struct nvfuse_handle *nvh, const char *link, inode_t parent, const char *name)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_symlink(nvh, link, parent, name);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_symlink_path(struct nvfuse_handle *nvh, const char *target_name,
+				 const char *link_name)
 {
 	struct nvfuse_dir_entry dir_entry;
 	s8 filename[FNAME_SIZE];
@@ -2012,7 +2962,19 @@ s32 nvfuse_symlink_path(struct nvfuse_handle *nvh, const char *target_name, cons
 	return nvfuse_symlink(nvh, target_name, dir_entry.d_ino, filename);
 }
 
-s32 nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_t size)
+s32 nvfuse_symlink_path(struct nvfuse_handle *nvh, const char *target_name, const char *link_name)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_symlink_path(nvh, target_name, link_name);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_t size)
 {
 	unsigned int bytes;
 	int fid;
@@ -2025,8 +2987,6 @@ s32 nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_
 	if (ino == 0)
 		ino = ROOT_INO;
 
-	nvfuse_lock();
-
 	fid = nvfuse_openfile_ino(sb, ino, O_RDONLY);
 
 	bytes = nvfuse_readfile(nvh, fid, buf, size, 0);
@@ -2040,12 +3000,23 @@ s32 nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_
 
 	nvfuse_release_super(sb);
 
-	nvfuse_unlock();
 
 	return bytes;
 }
 
-s32 nvfuse_getattr(struct nvfuse_handle *nvh, const char *path, struct stat *stbuf)
+s32 nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_t size)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_readlink_ino(nvh, ino, buf, size);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_getattr(struct nvfuse_handle *nvh, const char *path, struct stat *stbuf)
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
@@ -2104,7 +3075,19 @@ RET:
 	return res;
 }
 
-s32 nvfuse_fgetattr(struct nvfuse_handle *nvh, const char *path, struct stat *stbuf, s32 fd)
+s32 nvfuse_getattr(struct nvfuse_handle *nvh, const char *path, struct stat *stbuf)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_getattr(nvh, path, stbuf);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_fgetattr(struct nvfuse_handle *nvh, const char *path, struct stat *stbuf, s32 fd)
 {
 	struct nvfuse_inode_ctx *ictx;
 	struct nvfuse_inode *inode;
@@ -2140,8 +3123,20 @@ s32 nvfuse_fgetattr(struct nvfuse_handle *nvh, const char *path, struct stat *st
 
 	return res;
 }
+
+s32 nvfuse_fgetattr(struct nvfuse_handle *nvh, const char *path, struct stat *stbuf, s32 fd)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_fgetattr(nvh, path, stbuf, fd);
+	nvfuse_unlock(sb);
+
+	return res;
+}
 #if NVFUSE_OS == NVFUSE_OS_LINUX
-s32 nvfuse_access(struct nvfuse_handle *nvh, const char *path, int mask)
+static s32 __nvfuse_access(struct nvfuse_handle *nvh, const char *path, int mask)
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
@@ -2197,9 +3192,21 @@ s32 nvfuse_access(struct nvfuse_handle *nvh, const char *path, int mask)
 RET:
 	return res;
 }
+
+s32 nvfuse_access(struct nvfuse_handle *nvh, const char *path, int mask)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_access(nvh, path, mask);
+	nvfuse_unlock(sb);
+
+	return res;
+}
 #endif
 
-s32 nvfuse_readlink(struct nvfuse_handle *nvh, const char *path, char *buf, size_t size)
+static s32 __nvfuse_readlink(struct nvfuse_handle *nvh, const char *path, char *buf, size_t size)
 {
 	struct nvfuse_dir_entry parent_dir, cur_dir;
 	struct nvfuse_superblock *sb;
@@ -2236,7 +3243,19 @@ RET:
 	return res;
 }
 
-s32 nvfuse_statvfs(struct nvfuse_handle *nvh, const char *path, struct statvfs *buf)
+s32 nvfuse_readlink(struct nvfuse_handle *nvh, const char *path, char *buf, size_t size)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_readlink(nvh, path, buf, size);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_statvfs(struct nvfuse_handle *nvh, const char *path, struct statvfs *buf)
 {
 	struct nvfuse_superblock *sb;
 
@@ -2260,8 +3279,20 @@ s32 nvfuse_statvfs(struct nvfuse_handle *nvh, const char *path, struct statvfs *
 
 	return 0;
 }
+
+s32 nvfuse_statvfs(struct nvfuse_handle *nvh, const char *path, struct statvfs *buf)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_statvfs(nvh, path, buf);
+	nvfuse_unlock(sb);
+
+	return res;
+}
 #if NVFUSE_OS == NVFUSE_OS_LINUX
-s32 nvfuse_chmod_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
+static s32 __nvfuse_chmod_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
@@ -2304,7 +3335,19 @@ RET:
 	return res;
 }
 
-s32 nvfuse_chown(struct nvfuse_handle *nvh, const char *path, uid_t uid, gid_t gid)
+s32 nvfuse_chmod_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_chmod_path(nvh, path, mode);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_chown(struct nvfuse_handle *nvh, const char *path, uid_t uid, gid_t gid)
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
@@ -2345,7 +3388,19 @@ RET:
 	return res;
 }
 
-s32 nvfuse_utimens(struct nvfuse_handle *nvh, const char *path, const struct timespec ts[2])
+s32 nvfuse_chown(struct nvfuse_handle *nvh, const char *path, uid_t uid, gid_t gid)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_chown(nvh, path, uid, gid);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_utimens(struct nvfuse_handle *nvh, const char *path, const struct timespec ts[2])
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
@@ -2386,53 +3441,140 @@ s32 nvfuse_utimens(struct nvfuse_handle *nvh, const char *path, const struct tim
 RET:
 	return res;
 }
+
+s32 nvfuse_utimens(struct nvfuse_handle *nvh, const char *path, const struct timespec ts[2])
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_utimens(nvh, path, ts);
+	nvfuse_unlock(sb);
+
+	return res;
+}
 #endif
 
-s32 nvfuse_fdatasync(struct nvfuse_handle *nvh, int fd)
+/* stage dirty buffers of ictx to be flushed; returns 1 if the array is full */
+static s32 nvfuse_gather_dirty_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				    s32 datasync, struct nvfuse_buffer_cache **flushing, s32 *flushing_count)
 {
-	struct nvfuse_superblock *sb;
-	struct nvfuse_file_table *ft;
-	struct nvfuse_inode_ctx *ictx;
+	struct list_head *dirty_head;
+	struct list_head *temp, *ptr;
+	struct nvfuse_buffer_head *bh;
+	s32 meta;
 
-	sb = nvfuse_read_super(nvh);
-	ft = sb->sb_file_table + fd;
-	ictx = nvfuse_read_inode(sb, NULL, ft->ino);
-	/* flush dirty pages associated with inode context including only data pages */
-	nvfuse_fdsync_ictx(sb, ictx);
-	nvfuse_release_inode(sb, ictx, CLEAN);
-	nvfuse_release_super(sb);
+	for (meta = 0; meta <= !datasync; meta++) {
+		dirty_head = meta ? &ictx->ictx_meta_bh_head : &ictx->ictx_data_bh_head;
+
+		list_for_each_safe(ptr, temp, dirty_head) {
+			bh = (struct nvfuse_buffer_head *)list_entry(ptr, struct nvfuse_buffer_head, bh_dirty_list);
+			assert(test_bit(&bh->bh_status, BUFFER_STATUS_DIRTY));
+
+			if (!nvfuse_stage_flushing_bc(sb, bh->bh_bc))
+				continue;
+
+			flushing[(*flushing_count)++] = bh->bh_bc;
+			if (*flushing_count >= AIO_MAX_QDEPTH)
+				return 1;
+		}
+	}
 
 	return 0;
 }
 
-s32 nvfuse_fsync(struct nvfuse_handle *nvh, int fd)
+/*
+ * Group commit
+ * dirty buffers of every inode in the group are written in full batches
+ * and a single device flush makes all of them durable.
+ */
+s32 nvfuse_group_commit_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx **ictxs,
+			     s32 nr_ictxs, s32 datasync)
+{
+	struct nvfuse_buffer_cache *flushing[AIO_MAX_QDEPTH];
+	s32 flushing_count = 0;
+	s32 fua = nvfuse_sync_use_fua(sb);
+	s32 res = 0;
+	s32 i, j;
+
+	/* dirty buffer heads may point to buffers under writeback */
+	nvfuse_wb_wait(sb);
+
+	for (i = 0; i < nr_ictxs; i++) {
+		/* the same inode may be requested more than once */
+		for (j = 0; j < i; j++) {
+			if (ictxs[j] == ictxs[i])
+				break;
+		}
+		if (j < i)
+			continue;
+
+		while (nvfuse_gather_dirty_ictx(sb, ictxs[i], datasync, flushing, &flushing_count)) {
+			res = nvfuse_sync_dirty_data(sb, flushing, flushing_count, fua);
+			flushing_count = 0;
+			if (res)
+				return res;
+		}
+	}
+
+	if (flushing_count) {
+		res = nvfuse_sync_dirty_data(sb, flushing, flushing_count, fua);
+		if (res)
+			return res;
+	}
+
+	/* flush cmd to nvme ssd unless blocks were written with FUA */
+	nvfuse_sync_dev_cache(sb);
+
+	return 0;
+}
+
+s32 nvfuse_group_commit(struct nvfuse_handle *nvh, s32 *fds, s32 nr_fds, s32 datasync)
 {
 	struct nvfuse_superblock *sb;
-	struct nvfuse_file_table *ft;
-	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_inode_ctx **ictxs;
+	s32 res;
+	s32 i;
+
+	ictxs = malloc(sizeof(struct nvfuse_inode_ctx *) * nr_fds);
+	if (ictxs == NULL) {
+		printf(" Error: malloc() \n");
+		return -1;
+	}
 
 	sb = nvfuse_read_super(nvh);
-	ft = sb->sb_file_table + fd;
-	ictx = nvfuse_read_inode(sb, NULL, ft->ino);
+	nvfuse_lock(sb);
 
-	/* flush dirty pages associated with inode context including meta and data pages */
-	nvfuse_fsync_ictx(sb, ictx);
+	for (i = 0; i < nr_fds; i++)
+		ictxs[i] = nvfuse_read_inode(sb, NULL, sb->sb_file_table[fds[i]].ino);
 
-	/* flush cmd to nvme ssd */
-	nvfuse_dev_flush(sb->io_manager);
+	res = nvfuse_group_commit_ictx(sb, ictxs, nr_fds, datasync);
+
+	for (i = 0; i < nr_fds; i++)
+		nvfuse_release_inode(sb, ictxs[i], CLEAN);
 
-	nvfuse_release_inode(sb, ictx, CLEAN);
 	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
+	free(ictxs);
 
-	return 0;
+	return res;
+}
+
+s32 nvfuse_fdatasync(struct nvfuse_handle *nvh, int fd)
+{
+	/* flush dirty pages associated with inode context including only data pages */
+	return nvfuse_group_commit(nvh, &fd, 1, 1);
+}
+
+s32 nvfuse_fsync(struct nvfuse_handle *nvh, int fd)
+{
+	/* flush dirty pages associated with inode context including meta and data pages */
+	return nvfuse_group_commit(nvh, &fd, 1, 0);
 }
 
 s32 _nvfuse_fsync_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
 {
-	struct list_head *dirty_head, *flushing_head;
-	struct list_head *temp, *ptr;
-	struct nvfuse_buffer_head *bh;
-	struct nvfuse_buffer_cache *bc;
+	struct nvfuse_buffer_cache *flushing[AIO_MAX_QDEPTH];
 	s32 flushing_count = 0;
 	s32 res = 0;
 
@@ -2441,44 +3583,10 @@ s32 _nvfuse_fsync_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ic
 	    !ictx->ictx_meta_dirty_count)
 		goto RES;
 
-	/* dirty list for file data */
-	dirty_head = &ictx->ictx_data_bh_head;
-	flushing_head = &sb->sb_bm->bm_list[BUFFER_TYPE_FLUSHING];
-
-	list_for_each_safe(ptr, temp, dirty_head) {
-		bh = (struct nvfuse_buffer_head *)list_entry(ptr, struct nvfuse_buffer_head, bh_dirty_list);
-		assert(test_bit(&bh->bh_status, BUFFER_STATUS_DIRTY));
-
-		bc = bh->bh_bc;
-
-		list_move(&bc->bc_list, flushing_head);
-		flushing_count++;
-		if (flushing_count >= AIO_MAX_QDEPTH)
-			break;
-	}
-
-	if (flushing_count >= AIO_MAX_QDEPTH)
-		goto SYNC_DIRTY;
-
-	/* dirty list for meta data */
-	dirty_head = &ictx->ictx_meta_bh_head;
-	flushing_head = &sb->sb_bm->bm_list[BUFFER_TYPE_FLUSHING];
-
-	list_for_each_safe(ptr, temp, dirty_head) {
-		bh = (struct nvfuse_buffer_head *)list_entry(ptr, struct nvfuse_buffer_head, bh_dirty_list);
-		assert(test_bit(&bh->bh_status, BUFFER_STATUS_DIRTY));
-
-		bc = bh->bh_bc;
-
-		list_move(&bc->bc_list, flushing_head);
-		flushing_count++;
-		if (flushing_count >= AIO_MAX_QDEPTH)
-			break;
-	}
+	/* dirty lists for file data and meta data */
+	nvfuse_gather_dirty_ictx(sb, ictx, 0, flushing, &flushing_count);
 
-SYNC_DIRTY:
-	;
-	res = nvfuse_sync_dirty_data(sb, flushing_head, flushing_count);
+	res = nvfuse_sync_dirty_data(sb, flushing, flushing_count, nvfuse_sync_use_fua(sb));
 
 RES:
 	;
@@ -2490,6 +3598,9 @@ s32 nvfuse_fsync_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ict
 {
 	s32 res;
 
+	/* dirty buffer heads of ictx may point to buffers under writeback */
+	nvfuse_wb_wait(sb);
+
 	/* ictx doesn't keep dirty data */
 	while (ictx->ictx_data_dirty_count ||
 	       ictx->ictx_meta_dirty_count) {
@@ -2504,33 +3615,19 @@ s32 nvfuse_fsync_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ict
 
 s32 nvfuse_fdsync_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
 {
-	struct list_head *dirty_head, *flushing_head;
-	struct list_head *temp, *ptr;
-	struct nvfuse_buffer_head *bh;
-	struct nvfuse_buffer_cache *bc;
-	s32 flushing_count = 0;
+	struct nvfuse_buffer_cache *flushing[AIO_MAX_QDEPTH];
+	s32 flushing_count;
 	s32 res;
 
+	nvfuse_wb_wait(sb);
+
 	/* ictx doesn't keep dirty data */
 	while (ictx->ictx_data_dirty_count) {
 		/* dirty list for file data */
-		dirty_head = &ictx->ictx_data_bh_head;
-		flushing_head = &sb->sb_bm->bm_list[BUFFER_TYPE_FLUSHING];
 		flushing_count = 0;
+		nvfuse_gather_dirty_ictx(sb, ictx, 1, flushing, &flushing_count);
 
-		list_for_each_safe(ptr, temp, dirty_head) {
-			bh = (struct nvfuse_buffer_head *)list_entry(ptr, struct nvfuse_buffer_head, bh_dirty_list);
-			assert(test_bit(&bh->bh_status, BUFFER_STATUS_DIRTY));
-
-			bc = bh->bh_bc;
-
-			list_move(&bc->bc_list, flushing_head);
-			flushing_count++;
-			if (flushing_count >= AIO_MAX_QDEPTH)
-				break;
-		}
-
-		res = nvfuse_sync_dirty_data(sb, flushing_head, flushing_count);
+		res = nvfuse_sync_dirty_data(sb, flushing, flushing_count, nvfuse_sync_use_fua(sb));
 		if (res)
 			break;
 	}
@@ -2543,8 +3640,10 @@ s32 nvfuse_sync(struct nvfuse_handle *nvh)
 {
 	struct nvfuse_superblock *sb;
 	sb = nvfuse_read_super(nvh);
+	nvfuse_lock(sb);
 	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
 	nvfuse_release_super(sb);
+	nvfuse_unlock(sb);
 	return 0;
 }
 
@@ -2588,7 +3687,7 @@ RET:
 	return 0;
 }
 
-s32 nvfuse_fallocate(struct nvfuse_handle *nvh, const char *path, s64 start, s64 length)
+static s32 __nvfuse_fallocate(struct nvfuse_handle *nvh, const char *path, s64 start, s64 length)
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
@@ -2664,6 +3763,18 @@ RET:
 	return res;
 }
 
+s32 nvfuse_fallocate(struct nvfuse_handle *nvh, const char *path, s64 start, s64 length)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_fallocate(nvh, path, start, length);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
 s32 nvfuse_fgetblk(struct nvfuse_superblock *sb, s32 fid, s32 lblk, s32 max_blocks, u32 *num_alloc)
 {
 	struct nvfuse_file_table *of;
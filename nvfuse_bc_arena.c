@@ -0,0 +1,205 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nvfuse_core.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_bc_arena.h"
+#include "nvfuse_malloc.h"
+#include "nvfuse_io_manager.h"
+
+/*
+ * Buffer cache pages used to be allocated one by one with rte_malloc(), and
+ * descriptors were taken from a mempool sized for the largest cache. The
+ * arena instead allocates a hugepage region at a time and carves all of its
+ * pages and descriptors at once, so a large cache is set up with a few
+ * allocations and the hugepage heap is not fragmented by 4KB elements.
+ */
+
+s32 nvfuse_bc_arena_init(struct nvfuse_bc_arena *arena, struct nvfuse_io_manager *io_manager)
+{
+	memset(arena, 0x00, sizeof(struct nvfuse_bc_arena));
+	arena->ba_io_manager = io_manager;
+
+	arena->ba_chunk_pages = NVFUSE_BC_ARENA_CHUNK_SIZE /
+				(CLUSTER_SIZE + sizeof(struct nvfuse_buffer_cache) + sizeof(u32));
+	arena->ba_max_chunks = NVFUSE_BC_ARENA_MAX_SIZE / NVFUSE_BC_ARENA_CHUNK_SIZE;
+	assert(arena->ba_chunk_pages);
+	assert(arena->ba_max_chunks);
+
+	arena->ba_chunks = (struct nvfuse_bc_chunk *)calloc(arena->ba_max_chunks,
+			   sizeof(struct nvfuse_bc_chunk));
+	if (arena->ba_chunks == NULL) {
+		printf(" Error: malloc() \n");
+		return -1;
+	}
+
+	pthread_mutex_init(&arena->ba_lock, NULL);
+
+	printf(" Buffer cache arena chunk = %dKB (%d buffers)\n",
+	       NVFUSE_BC_ARENA_CHUNK_SIZE / 1024, arena->ba_chunk_pages);
+
+	return 0;
+}
+
+void nvfuse_bc_arena_deinit(struct nvfuse_bc_arena *arena)
+{
+	u32 id;
+
+	if (arena->ba_nr_used)
+		printf(" Warning: %d buffers are still in use.\n", arena->ba_nr_used);
+
+	for (id = 0; id < arena->ba_max_chunks; id++) {
+		if (arena->ba_chunks[id].ch_region == NULL)
+			continue;
+
+		nvfuse_io_unregister_buf(arena->ba_io_manager, arena->ba_chunks[id].ch_region);
+		nvfuse_free_hugepage_region(arena->ba_chunks[id].ch_region);
+	}
+
+	free(arena->ba_chunks);
+	arena->ba_chunks = NULL;
+	pthread_mutex_destroy(&arena->ba_lock);
+}
+
+/* carve pages, descriptors and free stack out of a new region, arena lock is held */
+static s32 nvfuse_bc_arena_grow(struct nvfuse_bc_arena *arena, u32 id)
+{
+	struct nvfuse_bc_chunk *chunk = &arena->ba_chunks[id];
+	struct nvfuse_buffer_cache *bc;
+	u32 pages = arena->ba_chunk_pages;
+	u32 slot;
+
+	chunk->ch_region = nvfuse_alloc_hugepage_region(NVFUSE_BC_ARENA_CHUNK_SIZE);
+	if (chunk->ch_region == NULL) {
+		printf(" %s:%d: nvfuse_malloc error \n", __FUNCTION__, __LINE__);
+#ifdef SPDK_ENABLED
+		printf(" Please, increase # of huge pages in scripts/setup.sh\n");
+#endif
+		return -1;
+	}
+
+	chunk->ch_bcs = (struct nvfuse_buffer_cache *)((s8 *)chunk->ch_region +
+			(size_t)pages * CLUSTER_SIZE);
+	chunk->ch_free = (u32 *)(chunk->ch_bcs + pages);
+
+	for (slot = 0; slot < pages; slot++) {
+		bc = &chunk->ch_bcs[slot];
+		bc->bc_idx = id * pages + slot;
+		bc->bc_buf = (s8 *)chunk->ch_region + (size_t)slot * CLUSTER_SIZE;
+		/* lower slots are popped first */
+		chunk->ch_free[pages - 1 - slot] = slot;
+	}
+	chunk->ch_nr_free = pages;
+	arena->ba_nr_chunks++;
+
+	/* backend may transfer pages of this chunk without mapping them per request */
+	nvfuse_io_register_buf(arena->ba_io_manager, chunk->ch_region, (size_t)pages * CLUSTER_SIZE);
+
+	return 0;
+}
+
+struct nvfuse_buffer_cache *nvfuse_bc_arena_alloc(struct nvfuse_bc_arena *arena)
+{
+	struct nvfuse_bc_chunk *chunk = NULL;
+	struct nvfuse_buffer_cache *bc;
+	u32 id;
+	u32 slot;
+
+	pthread_mutex_lock(&arena->ba_lock);
+
+	for (id = arena->ba_low; id < arena->ba_max_chunks; id++) {
+		if (arena->ba_chunks[id].ch_nr_free) {
+			chunk = &arena->ba_chunks[id];
+			break;
+		}
+	}
+	arena->ba_low = id;
+
+	if (chunk == NULL) {
+		/* every allocated chunk is full, so the lowest hole is filled */
+		for (id = 0; id < arena->ba_max_chunks; id++) {
+			if (arena->ba_chunks[id].ch_region == NULL)
+				break;
+		}
+
+		if (id == arena->ba_max_chunks) {
+			printf(" Error: buffer cache arena is full (%lluMB).\n",
+			       (unsigned long long)NVFUSE_BC_ARENA_MAX_SIZE / NVFUSE_MEGA_BYTES);
+			pthread_mutex_unlock(&arena->ba_lock);
+			return NULL;
+		}
+
+		if (nvfuse_bc_arena_grow(arena, id) < 0) {
+			pthread_mutex_unlock(&arena->ba_lock);
+			return NULL;
+		}
+
+		chunk = &arena->ba_chunks[id];
+		arena->ba_low = id;
+	}
+
+	slot = chunk->ch_free[--chunk->ch_nr_free];
+	bc = &chunk->ch_bcs[slot];
+	arena->ba_nr_used++;
+
+	pthread_mutex_unlock(&arena->ba_lock);
+
+	return bc;
+}
+
+void nvfuse_bc_arena_free(struct nvfuse_bc_arena *arena, struct nvfuse_buffer_cache *bc)
+{
+	u32 id = nvfuse_bc_arena_chunk(arena, bc->bc_idx);
+	struct nvfuse_bc_chunk *chunk = &arena->ba_chunks[id];
+
+	assert(id < arena->ba_max_chunks);
+	assert(bc == &chunk->ch_bcs[bc->bc_idx % arena->ba_chunk_pages]);
+
+	pthread_mutex_lock(&arena->ba_lock);
+
+	chunk->ch_free[chunk->ch_nr_free++] = bc->bc_idx % arena->ba_chunk_pages;
+	arena->ba_nr_used--;
+
+	if (chunk->ch_nr_free == arena->ba_chunk_pages) {
+		/* whole region goes back to hugepage heap */
+		nvfuse_io_unregister_buf(arena->ba_io_manager, chunk->ch_region);
+		nvfuse_free_hugepage_region(chunk->ch_region);
+		memset(chunk, 0x00, sizeof(struct nvfuse_bc_chunk));
+		arena->ba_nr_chunks--;
+	} else if (id < arena->ba_low) {
+		arena->ba_low = id;
+	}
+
+	pthread_mutex_unlock(&arena->ba_lock);
+}
+
+struct nvfuse_buffer_cache *nvfuse_bc_arena_get(struct nvfuse_bc_arena *arena, u32 idx)
+{
+	struct nvfuse_bc_chunk *chunk;
+
+	if (nvfuse_bc_arena_chunk(arena, idx) >= arena->ba_max_chunks)
+		return NULL;
+
+	chunk = &arena->ba_chunks[nvfuse_bc_arena_chunk(arena, idx)];
+	if (chunk->ch_region == NULL)
+		return NULL;
+
+	return &chunk->ch_bcs[idx % arena->ba_chunk_pages];
+}
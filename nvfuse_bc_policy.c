@@ -0,0 +1,374 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nvfuse_core.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_bc_policy.h"
+#include "list.h"
+
+/*
+ * LRU
+ *
+ * Clean buffers are kept in the clean list of their partition in MRU order
+ * by nvfuse_find_bc() and nvfuse_move_buffer_list(), so only victim
+ * selection is needed.
+ */
+
+static struct nvfuse_buffer_cache *nvfuse_lru_victim(struct nvfuse_bc_part *part)
+{
+	struct list_head *head = &part->bp_clean;
+	struct list_head *ptr;
+	struct nvfuse_buffer_cache *bc;
+
+	for (ptr = head->prev; ptr != head; ptr = ptr->prev) {
+		bc = list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+		if (bc->bc_ref == 0 && bc->bc_bh_count == 0)
+			return bc;
+	}
+
+	return NULL;
+}
+
+static struct nvfuse_bc_policy nvfuse_lru_policy = {
+	.name = "lru",
+	.victim = nvfuse_lru_victim,
+};
+
+/*
+ * 2Q (Johnson and Shasha, VLDB'94)
+ *
+ * A buffer loaded for the first time is put on A1in, and its key is
+ * remembered in ghost list A1out when it is evicted from A1in. Only a
+ * buffer whose key is found in A1out is loaded into Am, an LRU list of
+ * hot buffers. A1in is the victim list as long as it holds more than
+ * NVFUSE_2Q_KIN_PERCENT of cache, so that a large scan only recycles
+ * A1in and never pushes hot meta data out of Am.
+ *
+ * Buffers still pinned by buffer heads are rotated to the head of the
+ * list while victim is searched, which keeps the search O(1) amortized.
+ */
+
+struct nvfuse_2q_ghost {
+	struct hlist_node g_hash;
+	struct list_head g_list;
+	u64 g_key;
+};
+
+struct nvfuse_2q {
+	struct list_head q_a1in; /* clean buffers referenced once */
+	struct list_head q_am; /* clean hot buffers in LRU order */
+	s32 q_nr_a1in;
+	s32 q_nr_am;
+
+	struct list_head q_a1out; /* keys evicted from a1in in FIFO order */
+	struct list_head q_free; /* unused ghost entries */
+	struct hlist_head q_hash[NVFUSE_2Q_GHOST_HASH_NUM];
+	s32 q_nr_a1out;
+
+	u64 q_ghost_hit;
+};
+
+static struct nvfuse_2q_ghost *nvfuse_2q_ghost_lookup(struct nvfuse_2q *q, u64 key)
+{
+	struct hlist_node *node;
+	struct nvfuse_2q_ghost *ghost;
+
+	hlist_for_each(node, &q->q_hash[key % NVFUSE_2Q_GHOST_HASH_NUM]) {
+		ghost = hlist_entry(node, struct nvfuse_2q_ghost, g_hash);
+		if (ghost->g_key == key)
+			return ghost;
+	}
+
+	return NULL;
+}
+
+static void nvfuse_2q_ghost_del(struct nvfuse_2q *q, struct nvfuse_2q_ghost *ghost)
+{
+	hlist_del(&ghost->g_hash);
+	list_move(&ghost->g_list, &q->q_free);
+	q->q_nr_a1out--;
+}
+
+static void nvfuse_2q_ghost_add(struct nvfuse_bc_part *part, struct nvfuse_2q *q, u64 key)
+{
+	s32 kout = part->bp_size * NVFUSE_2Q_KOUT_PERCENT / 100;
+	struct nvfuse_2q_ghost *ghost;
+
+	if (kout == 0 || nvfuse_2q_ghost_lookup(q, key))
+		return;
+
+	/* the oldest key is forgotten */
+	while (q->q_nr_a1out >= kout) {
+		ghost = list_entry(q->q_a1out.prev, struct nvfuse_2q_ghost, g_list);
+		nvfuse_2q_ghost_del(q, ghost);
+	}
+
+	if (list_empty(&q->q_free)) {
+		ghost = (struct nvfuse_2q_ghost *)malloc(sizeof(struct nvfuse_2q_ghost));
+		if (ghost == NULL)
+			return;
+		INIT_LIST_HEAD(&ghost->g_list);
+		list_add(&ghost->g_list, &q->q_free);
+	}
+
+	ghost = list_entry(q->q_free.next, struct nvfuse_2q_ghost, g_list);
+	ghost->g_key = key;
+	hlist_add_head(&ghost->g_hash, &q->q_hash[key % NVFUSE_2Q_GHOST_HASH_NUM]);
+	list_move(&ghost->g_list, &q->q_a1out);
+	q->q_nr_a1out++;
+}
+
+static int nvfuse_2q_init(struct nvfuse_bc_part *part)
+{
+	struct nvfuse_2q *q;
+	s32 i;
+
+	q = (struct nvfuse_2q *)malloc(sizeof(struct nvfuse_2q));
+	if (q == NULL) {
+		printf(" Error: malloc() \n");
+		return -1;
+	}
+
+	INIT_LIST_HEAD(&q->q_a1in);
+	INIT_LIST_HEAD(&q->q_am);
+	INIT_LIST_HEAD(&q->q_a1out);
+	INIT_LIST_HEAD(&q->q_free);
+	for (i = 0; i < NVFUSE_2Q_GHOST_HASH_NUM; i++)
+		INIT_HLIST_HEAD(&q->q_hash[i]);
+
+	q->q_nr_a1in = 0;
+	q->q_nr_am = 0;
+	q->q_nr_a1out = 0;
+	q->q_ghost_hit = 0;
+
+	part->bp_policy_priv = q;
+
+	return 0;
+}
+
+static void nvfuse_2q_deinit(struct nvfuse_bc_part *part)
+{
+	struct nvfuse_2q *q = (struct nvfuse_2q *)part->bp_policy_priv;
+	struct nvfuse_2q_ghost *ghost;
+	struct list_head *ptr, *temp;
+
+	printf(" > 2q: a1in = %d, am = %d, a1out = %d, ghost hit = %lu \n",
+	       q->q_nr_a1in, q->q_nr_am, q->q_nr_a1out, (unsigned long)q->q_ghost_hit);
+
+	list_for_each_safe(ptr, temp, &q->q_a1out) {
+		ghost = list_entry(ptr, struct nvfuse_2q_ghost, g_list);
+		free(ghost);
+	}
+
+	list_for_each_safe(ptr, temp, &q->q_free) {
+		ghost = list_entry(ptr, struct nvfuse_2q_ghost, g_list);
+		free(ghost);
+	}
+
+	free(q);
+	part->bp_policy_priv = NULL;
+}
+
+static void nvfuse_2q_miss(struct nvfuse_bc_part *part, struct nvfuse_buffer_cache *bc)
+{
+	struct nvfuse_2q *q = (struct nvfuse_2q *)part->bp_policy_priv;
+	struct nvfuse_2q_ghost *ghost;
+
+	ghost = nvfuse_2q_ghost_lookup(q, bc->bc_bno);
+	if (ghost) {
+		/* re-referenced after eviction */
+		nvfuse_2q_ghost_del(q, ghost);
+		q->q_ghost_hit++;
+		bc->bc_hot = 1;
+	} else {
+		bc->bc_hot = 0;
+	}
+}
+
+static void nvfuse_2q_hit(struct nvfuse_bc_part *part, struct nvfuse_buffer_cache *bc)
+{
+	struct nvfuse_2q *q = (struct nvfuse_2q *)part->bp_policy_priv;
+
+	/* correlated references in a1in don't make a buffer hot */
+	if (bc->bc_list_type == BUFFER_TYPE_CLEAN && bc->bc_hot)
+		list_move(&bc->bc_policy_list, &q->q_am);
+}
+
+static void nvfuse_2q_add_clean(struct nvfuse_bc_part *part, struct nvfuse_buffer_cache *bc,
+				s32 tail)
+{
+	struct nvfuse_2q *q = (struct nvfuse_2q *)part->bp_policy_priv;
+	struct list_head *head;
+
+	if (bc->bc_hot) {
+		head = &q->q_am;
+		q->q_nr_am++;
+	} else {
+		head = &q->q_a1in;
+		q->q_nr_a1in++;
+	}
+
+	if (tail)
+		list_add_tail(&bc->bc_policy_list, head);
+	else
+		list_add(&bc->bc_policy_list, head);
+}
+
+static void nvfuse_2q_del_clean(struct nvfuse_bc_part *part, struct nvfuse_buffer_cache *bc)
+{
+	struct nvfuse_2q *q = (struct nvfuse_2q *)part->bp_policy_priv;
+
+	list_del(&bc->bc_policy_list);
+	if (bc->bc_hot)
+		q->q_nr_am--;
+	else
+		q->q_nr_a1in--;
+}
+
+/* find evictable buffer from the tail, pinned buffers get another round */
+static struct nvfuse_buffer_cache *nvfuse_2q_scan(struct list_head *head, s32 nr)
+{
+	struct nvfuse_buffer_cache *bc;
+
+	while (nr--) {
+		bc = list_entry(head->prev, struct nvfuse_buffer_cache, bc_policy_list);
+		if (bc->bc_ref == 0 && bc->bc_bh_count == 0)
+			return bc;
+		list_move(&bc->bc_policy_list, head);
+	}
+
+	return NULL;
+}
+
+static struct nvfuse_buffer_cache *nvfuse_2q_victim(struct nvfuse_bc_part *part)
+{
+	struct nvfuse_2q *q = (struct nvfuse_2q *)part->bp_policy_priv;
+	s32 kin = part->bp_size * NVFUSE_2Q_KIN_PERCENT / 100;
+	struct nvfuse_buffer_cache *bc = NULL;
+
+	if (q->q_nr_a1in > kin || q->q_nr_am == 0)
+		bc = nvfuse_2q_scan(&q->q_a1in, q->q_nr_a1in);
+
+	if (bc == NULL)
+		bc = nvfuse_2q_scan(&q->q_am, q->q_nr_am);
+
+	if (bc == NULL)
+		bc = nvfuse_2q_scan(&q->q_a1in, q->q_nr_a1in);
+
+	if (bc && !bc->bc_hot)
+		nvfuse_2q_ghost_add(part, q, bc->bc_bno);
+
+	return bc;
+}
+
+static struct nvfuse_bc_policy nvfuse_2q_policy = {
+	.name = "2q",
+	.init = nvfuse_2q_init,
+	.deinit = nvfuse_2q_deinit,
+	.miss = nvfuse_2q_miss,
+	.hit = nvfuse_2q_hit,
+	.add_clean = nvfuse_2q_add_clean,
+	.del_clean = nvfuse_2q_del_clean,
+	.victim = nvfuse_2q_victim,
+};
+
+static struct nvfuse_bc_policy *nvfuse_bc_policies[NVFUSE_BC_POLICY_NUM] = {
+	[NVFUSE_BC_POLICY_LRU] = &nvfuse_lru_policy,
+	[NVFUSE_BC_POLICY_2Q] = &nvfuse_2q_policy,
+};
+
+s32 nvfuse_bc_policy_lookup(const char *name)
+{
+	s32 i;
+
+	for (i = 0; i < NVFUSE_BC_POLICY_NUM; i++) {
+		if (!strcmp(nvfuse_bc_policies[i]->name, name))
+			return i;
+	}
+
+	return -1;
+}
+
+s32 nvfuse_bc_policy_init(struct nvfuse_buffer_manager *bm, s32 policy)
+{
+	s32 i;
+
+	if (policy < 0 || policy >= NVFUSE_BC_POLICY_NUM) {
+		printf(" Warning: invalid buffer replacement policy = %d \n", policy);
+		policy = NVFUSE_BC_POLICY_LRU;
+	}
+
+	bm->bm_policy = nvfuse_bc_policies[policy];
+
+	for (i = 0; i < NVFUSE_BC_PART_NUM; i++) {
+		bm->bm_part[i].bp_policy_priv = NULL;
+		if (bm->bm_policy->init && bm->bm_policy->init(&bm->bm_part[i]) < 0) {
+			printf(" Error: init of buffer replacement policy %s \n", bm->bm_policy->name);
+			return -1;
+		}
+	}
+
+	if (bm->bm_id == 0)
+		printf(" Buffer replacement policy = %s\n", bm->bm_policy->name);
+
+	return 0;
+}
+
+void nvfuse_bc_policy_deinit(struct nvfuse_buffer_manager *bm)
+{
+	s32 i;
+
+	if (bm->bm_policy->deinit) {
+		for (i = 0; i < NVFUSE_BC_PART_NUM; i++)
+			bm->bm_policy->deinit(&bm->bm_part[i]);
+	}
+}
+
+void nvfuse_bc_policy_print_stat(struct nvfuse_superblock *sb)
+{
+	static const char *part_name[NVFUSE_BC_PART_NUM] = {"data", "meta"};
+	u64 cache_ref = 0, cache_hit = 0;
+	u64 part_ref, part_hit;
+	s32 part_size;
+	s32 i, j;
+
+	for (i = 0; i < NVFUSE_BC_SHARDS; i++) {
+		cache_ref += sb->sb_bm[i]->bm_cache_ref;
+		cache_hit += sb->sb_bm[i]->bm_cache_hit;
+	}
+
+	printf(" > buffer cache (%s, %d shards) hit = %lu, miss = %lu, hit rate = %f \n",
+	       sb->sb_bm[0]->bm_policy->name, NVFUSE_BC_SHARDS, (unsigned long)cache_hit,
+	       (unsigned long)(cache_ref - cache_hit),
+	       cache_ref ? (double)cache_hit / cache_ref : 0);
+
+	for (j = 0; j < NVFUSE_BC_PART_NUM; j++) {
+		part_ref = part_hit = 0;
+		part_size = 0;
+		for (i = 0; i < NVFUSE_BC_SHARDS; i++) {
+			part_ref += sb->sb_bm[i]->bm_part[j].bp_cache_ref;
+			part_hit += sb->sb_bm[i]->bm_part[j].bp_cache_hit;
+			part_size += sb->sb_bm[i]->bm_part[j].bp_size;
+		}
+
+		printf(" > %s partition size = %d, hit = %lu, miss = %lu \n", part_name[j],
+		       part_size, (unsigned long)part_hit, (unsigned long)(part_ref - part_hit));
+	}
+}
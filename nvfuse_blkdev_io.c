@@ -29,6 +29,11 @@
 #include <libaio.h>
 #	include <unistd.h>
 #	include <sys/types.h>
+#	include <sys/uio.h>
+#endif
+
+#ifdef LIBURING_ENABLED
+#include <liburing.h>
 #endif
 
 static int blkdev_open(struct nvfuse_io_manager *io_manager, int flags);
@@ -37,6 +42,10 @@ static int blkdev_read_blk(struct nvfuse_io_manager *io_manager, long block,
 			 int count, void *buf);
 static int blkdev_write_blk(struct nvfuse_io_manager *io_manager, long block,
 			  int count, void *buf);
+static int blkdev_readv_blk(struct nvfuse_io_manager *io_manager, long block,
+			    int count, struct iovec *iov, int iovcnt);
+static int blkdev_writev_blk(struct nvfuse_io_manager *io_manager, long block,
+			     int count, struct iovec *iov, int iovcnt);
 
 static void io_getevents_error(int error)
 {
@@ -103,6 +112,15 @@ static int libaio_cleanup(struct nvfuse_io_manager *io_manager)
 
 static int libaio_prep(struct nvfuse_io_manager *io_manager, struct io_job *job)
 {
+	/* merged pages are transferred by a single vectored request */
+	if (job->iovcnt > 1) {
+		if (job->req_type == READ)
+			io_prep_preadv(&job->iocb, io_manager->dev, job->iov, job->iovcnt, job->offset);
+		else
+			io_prep_pwritev(&job->iocb, io_manager->dev, job->iov, job->iovcnt, job->offset);
+		return 0;
+	}
+
 	if (job->req_type == READ)
 		io_prep_pread(&job->iocb, io_manager->dev, job->buf, job->bytes, job->offset);
 	else
@@ -144,6 +162,25 @@ static int libaio_submit(struct nvfuse_io_manager *io_manager, struct iocb **ioq
 	return ret;
 }
 
+/* move reaped events to completion job queue */
+static void libaio_reap_events(struct nvfuse_io_manager *io_manager, int cc)
+{
+	struct iocb *iocb;
+	struct io_event *event;
+	struct io_job *job;
+	int i;
+
+	for (i = 0; i < cc; i++) {
+		event = &io_manager->events[i];
+		iocb = (struct iocb *)(event->obj);
+		job  = (struct io_job *)container_of(iocb, struct io_job, iocb);
+
+		job->ret = event->res; // return value
+		io_manager->cjob[io_manager->cjob_head] = job;
+		io_manager->cjob_head = (io_manager->cjob_head + 1) % io_manager->iodepth;
+	}
+}
+
 static int libaio_complete(struct nvfuse_io_manager *io_manager)
 {
 	struct timespec time_out = {AIO_MAX_TIMEOUT_SEC, AIO_MAX_TIMEOUT_NSEC}; // {sec, nano}
@@ -152,7 +189,6 @@ static int libaio_complete(struct nvfuse_io_manager *io_manager)
 	int retry_count = AIO_RETRY_COUNT;
 	int cc = 0; // completion count
 	int res;
-	int i;
 
 	//printf(" libaio_complete: max_nr = %d \n", max_nr);
 	while (max_nr) {
@@ -185,21 +221,32 @@ static int libaio_complete(struct nvfuse_io_manager *io_manager)
 		}
 	}
 
-	for (i = 0; i < cc; i++) {
-		struct iocb *iocb;
-		struct io_event *event;
-		struct io_job *job;
+	libaio_reap_events(io_manager, cc);
 
-		event = &io_manager->events[i];
-		iocb = (struct iocb *)(event->obj);
-		job  = (struct io_job *)container_of(iocb, struct io_job, iocb);
+	return cc;
+}
 
-		job->ret = event->res; // return value
-		io_manager->cjob[io_manager->cjob_head] = job;
-		io_manager->cjob_head++;
+static int libaio_poll(struct nvfuse_io_manager *io_manager)
+{
+	struct timespec time_out = {0, 0};
+	int res;
+
+	if (io_manager->queue_cur_count == 0)
+		return 0;
+
+	do {
+		res = io_getevents(io_manager->io_ctx, 0, io_manager->queue_cur_count,
+				   io_manager->events, &time_out);
+	} while (res == -EINTR);
+
+	if (res < 0) {
+		io_getevents_error(res);
+		return 0;
 	}
 
-	return cc;
+	libaio_reap_events(io_manager, res);
+
+	return res;
 }
 
 static struct io_job *libaio_getnextcjob(struct nvfuse_io_manager *io_manager)
@@ -261,6 +308,8 @@ void nvfuse_init_blkdevio(struct nvfuse_io_manager *io_manager, char *name, char
 	io_manager->io_close = blkdev_close;
 	io_manager->io_read = blkdev_read_blk;
 	io_manager->io_write = blkdev_write_blk;
+	io_manager->io_readv = blkdev_readv_blk;
+	io_manager->io_writev = blkdev_writev_blk;
 
 	io_manager->cjob_head = 0;
 	io_manager->cjob_tail = 0;
@@ -277,12 +326,462 @@ void nvfuse_init_blkdevio(struct nvfuse_io_manager *io_manager, char *name, char
 	io_manager->aio_prep = libaio_prep;
 	io_manager->aio_submit = libaio_submit;
 	io_manager->aio_complete = libaio_complete;
+	io_manager->aio_poll = libaio_poll;
 	io_manager->aio_getnextcjob = libaio_getnextcjob;
 	io_manager->aio_resetnextcjob = libaio_resetnextcjob;
 	io_manager->aio_cancel = libaio_cancel;
 	io_manager->dev_format = NULL;
 }
 
+#ifdef LIBURING_ENABLED
+/*
+ * io_uring backend
+ *
+ * Sync I/O is shared with blkdev. Async jobs are turned into sqes at
+ * submission time with the device registered as fixed file 0. Buffers
+ * registered through io_register_buf() (i.e., buffer cache arena chunks)
+ * are transferred by read_fixed/write_fixed so that the kernel doesn't
+ * have to pin and map the pages for every request.
+ */
+
+/* registered buffer range */
+struct nvfuse_uring_buf {
+	void *addr;
+	size_t len;
+	int idx; /* index into registered buffer table */
+};
+
+struct nvfuse_uring {
+	struct io_uring ring;
+	int nr_bufs; /* slots of sparse buffer table (0: fixed buffer unsupported) */
+	int free_bufs[NVFUSE_URING_MAX_BUFS]; /* stack of free slots */
+	int nr_free_bufs;
+	struct nvfuse_uring_buf ranges[NVFUSE_URING_MAX_BUFS]; /* sorted by address */
+	int nr_ranges;
+	/* buffers are registered by allocating thread while ring is used by its owner */
+	pthread_mutex_t buf_lock;
+};
+
+/* returns the last range starting at or below addr, -1 if none */
+static int uring_buf_search(struct nvfuse_uring *uring, void *addr)
+{
+	int lo = 0, hi = uring->nr_ranges - 1;
+	int mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if ((char *)uring->ranges[mid].addr <= (char *)addr)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return hi;
+}
+
+/* registered range containing [addr, addr + len) */
+static struct nvfuse_uring_buf *uring_buf_lookup(struct nvfuse_uring *uring, void *addr, size_t len)
+{
+	struct nvfuse_uring_buf *entry;
+	int i;
+
+	i = uring_buf_search(uring, addr);
+	if (i < 0)
+		return NULL;
+
+	entry = &uring->ranges[i];
+	if ((char *)addr + len > (char *)entry->addr + entry->len)
+		return NULL;
+
+	return entry;
+}
+
+static void uring_buf_insert(struct nvfuse_uring *uring, void *addr, size_t len, int idx)
+{
+	int i = uring_buf_search(uring, addr) + 1;
+
+	assert(uring->nr_ranges < NVFUSE_URING_MAX_BUFS);
+	memmove(&uring->ranges[i + 1], &uring->ranges[i],
+		(uring->nr_ranges - i) * sizeof(struct nvfuse_uring_buf));
+	uring->ranges[i].addr = addr;
+	uring->ranges[i].len = len;
+	uring->ranges[i].idx = idx;
+	uring->nr_ranges++;
+}
+
+static void uring_buf_remove(struct nvfuse_uring *uring, int i)
+{
+	uring->nr_ranges--;
+	memmove(&uring->ranges[i], &uring->ranges[i + 1],
+		(uring->nr_ranges - i) * sizeof(struct nvfuse_uring_buf));
+}
+
+/* base address if segments of iov are adjacent in memory, otherwise NULL */
+static void *uring_iov_contig(struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 1; i < iovcnt; i++) {
+		if ((char *)iov[i - 1].iov_base + iov[i - 1].iov_len != (char *)iov[i].iov_base)
+			return NULL;
+	}
+
+	return iov[0].iov_base;
+}
+
+static int uring_init(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_uring *uring;
+	struct io_uring_params params;
+	int ret;
+	int i;
+
+	uring = (struct nvfuse_uring *)malloc(sizeof(struct nvfuse_uring));
+	if (uring == NULL) {
+		printf(" Error: malloc() \n");
+		return -1;
+	}
+	memset(uring, 0x00, sizeof(struct nvfuse_uring));
+	pthread_mutex_init(&uring->buf_lock, NULL);
+
+	memset(&params, 0x00, sizeof(struct io_uring_params));
+#ifdef NVFUSE_USE_URING_SQPOLL
+	params.flags |= IORING_SETUP_SQPOLL;
+	params.sq_thread_idle = NVFUSE_URING_SQPOLL_IDLE_MS;
+#endif
+
+	ret = io_uring_queue_init_params(io_manager->iodepth, &uring->ring, &params);
+	if (ret < 0) {
+		printf(" Error: io_uring_queue_init ret = %d \n", ret);
+		free(uring);
+		return -1;
+	}
+
+	ret = io_uring_register_files(&uring->ring, &io_manager->dev, 1);
+	if (ret < 0) {
+		printf(" Error: io_uring_register_files ret = %d \n", ret);
+		io_uring_queue_exit(&uring->ring);
+		free(uring);
+		return -1;
+	}
+
+	/* slots are filled as buffer caches are allocated */
+	ret = io_uring_register_buffers_sparse(&uring->ring, NVFUSE_URING_MAX_BUFS);
+	if (ret < 0) {
+		printf(" io_uring: fixed buffers are not available ret = %d \n", ret);
+	} else {
+		uring->nr_bufs = NVFUSE_URING_MAX_BUFS;
+		for (i = 0; i < uring->nr_bufs; i++)
+			uring->free_bufs[i] = uring->nr_bufs - 1 - i;
+		uring->nr_free_bufs = uring->nr_bufs;
+	}
+
+	io_manager->uring = uring;
+
+	printf(" called: io_uring init (sqpoll = %d) \n", (params.flags & IORING_SETUP_SQPOLL) ? 1 : 0);
+
+	return 0;
+}
+
+static int uring_cleanup(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_uring *uring = io_manager->uring;
+
+	if (uring == NULL)
+		return 0;
+
+	/* registered files and buffers are released together */
+	io_uring_queue_exit(&uring->ring);
+	pthread_mutex_destroy(&uring->buf_lock);
+	free(uring);
+	io_manager->uring = NULL;
+
+	return 0;
+}
+
+static int uring_register_buf(struct nvfuse_io_manager *io_manager, void *buf, size_t len)
+{
+	struct nvfuse_uring *uring = io_manager->uring;
+	struct iovec iov;
+	int idx;
+	int ret;
+
+	/* unregistered buffers are still transferred by ordinary requests */
+	if (uring == NULL)
+		return -1;
+
+	pthread_mutex_lock(&uring->buf_lock);
+	if (uring->nr_free_bufs == 0) {
+		pthread_mutex_unlock(&uring->buf_lock);
+		return -1;
+	}
+
+	idx = uring->free_bufs[uring->nr_free_bufs - 1];
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	ret = io_uring_register_buffers_update_tag(&uring->ring, idx, &iov, NULL, 1);
+	if (ret < 0) {
+		pthread_mutex_unlock(&uring->buf_lock);
+		return -1;
+	}
+
+	uring->nr_free_bufs--;
+	uring_buf_insert(uring, buf, len, idx);
+	pthread_mutex_unlock(&uring->buf_lock);
+
+	return 0;
+}
+
+static int uring_unregister_buf(struct nvfuse_io_manager *io_manager, void *buf)
+{
+	struct nvfuse_uring *uring = io_manager->uring;
+	struct iovec iov;
+	int i;
+
+	if (uring == NULL)
+		return -1;
+
+	pthread_mutex_lock(&uring->buf_lock);
+	i = uring_buf_search(uring, buf);
+	if (i < 0 || uring->ranges[i].addr != buf) {
+		pthread_mutex_unlock(&uring->buf_lock);
+		return -1;
+	}
+
+	iov.iov_base = NULL;
+	iov.iov_len = 0;
+	io_uring_register_buffers_update_tag(&uring->ring, uring->ranges[i].idx, &iov, NULL, 1);
+
+	uring->free_bufs[uring->nr_free_bufs++] = uring->ranges[i].idx;
+	uring_buf_remove(uring, i);
+	pthread_mutex_unlock(&uring->buf_lock);
+
+	return 0;
+}
+
+/* sqe is filled in uring_submit() since it belongs to the ring */
+static int uring_prep(struct nvfuse_io_manager *io_manager, struct io_job *job)
+{
+	return 0;
+}
+
+static void uring_prep_sqe(struct nvfuse_uring *uring, struct io_uring_sqe *sqe, struct io_job *job)
+{
+	struct nvfuse_uring_buf *entry = NULL;
+	void *buf;
+	int idx = 0;
+
+	/* pages merged into a job are often adjacent in an arena chunk */
+	buf = job->iovcnt > 1 ? uring_iov_contig(job->iov, job->iovcnt) : job->buf;
+	if (buf) {
+		pthread_mutex_lock(&uring->buf_lock);
+		entry = uring_buf_lookup(uring, buf, job->bytes);
+		if (entry)
+			idx = entry->idx;
+		pthread_mutex_unlock(&uring->buf_lock);
+	}
+
+	if (entry) {
+		if (job->req_type == READ)
+			io_uring_prep_read_fixed(sqe, 0, buf, job->bytes, job->offset, idx);
+		else
+			io_uring_prep_write_fixed(sqe, 0, buf, job->bytes, job->offset, idx);
+	} else if (job->iovcnt > 1) {
+		if (job->req_type == READ)
+			io_uring_prep_readv(sqe, 0, job->iov, job->iovcnt, job->offset);
+		else
+			io_uring_prep_writev(sqe, 0, job->iov, job->iovcnt, job->offset);
+	} else {
+		if (job->req_type == READ)
+			io_uring_prep_read(sqe, 0, job->buf, job->bytes, job->offset);
+		else
+			io_uring_prep_write(sqe, 0, job->buf, job->bytes, job->offset);
+	}
+
+	/* fd 0 is the index of device in registered files */
+	sqe->flags |= IOSQE_FIXED_FILE;
+
+	if (job->req_type == WRITE && job->fua)
+		sqe->rw_flags = RWF_DSYNC;
+
+	io_uring_sqe_set_data(sqe, job);
+}
+
+static int uring_submit(struct nvfuse_io_manager *io_manager, struct iocb **ioq, int qcnt)
+{
+	struct nvfuse_uring *uring = io_manager->uring;
+	struct io_uring_sqe *sqe;
+	struct io_job *job;
+	int ret;
+	int i;
+
+	for (i = 0; i < qcnt; i++) {
+		sqe = io_uring_get_sqe(&uring->ring);
+		if (sqe == NULL) {
+			/* submission queue is full, so that queued sqes are pushed to kernel */
+			ret = io_uring_submit(&uring->ring);
+			if (ret < 0) {
+				printf(" io_uring_submit error = %d \n", ret);
+				return ret;
+			}
+			sqe = io_uring_get_sqe(&uring->ring);
+			assert(sqe);
+		}
+
+		job = (struct io_job *)container_of(ioq[i], struct io_job, iocb);
+		uring_prep_sqe(uring, sqe, job);
+
+		if (job->req_type == WRITE && !job->fua)
+			io_manager->wc_dirty = 1;
+	}
+
+	ret = io_uring_submit(&uring->ring);
+	if (ret < 0) {
+		printf(" io_uring_submit error = %d \n", ret);
+		return ret;
+	}
+
+	return qcnt;
+}
+
+/* move completed cqes to completion job queue */
+static int uring_reap_cqes(struct nvfuse_io_manager *io_manager, int max_nr)
+{
+	struct nvfuse_uring *uring = io_manager->uring;
+	struct io_uring_cqe *cqe;
+	struct io_job *job;
+	unsigned head;
+	int seen = 0;
+	int cc = 0;
+
+	io_uring_for_each_cqe(&uring->ring, head, cqe) {
+		if (cc == max_nr)
+			break;
+
+		seen++;
+		job = (struct io_job *)io_uring_cqe_get_data(cqe);
+		/* cancel requests don't carry job */
+		if (job == NULL)
+			continue;
+
+		job->ret = cqe->res; // return value
+		io_manager->cjob[io_manager->cjob_head] = job;
+		io_manager->cjob_head = (io_manager->cjob_head + 1) % io_manager->iodepth;
+		cc++;
+	}
+
+	io_uring_cq_advance(&uring->ring, seen);
+
+	return cc;
+}
+
+static int uring_complete(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_uring *uring = io_manager->uring;
+	struct __kernel_timespec time_out = {AIO_MAX_TIMEOUT_SEC, AIO_MAX_TIMEOUT_NSEC}; // {sec, nano}
+	struct io_uring_cqe *cqe;
+	int max_nr = io_manager->queue_cur_count;
+	int retry_count = AIO_RETRY_COUNT;
+	int cc = 0; // completion count
+	int res;
+
+	while (max_nr && cc == 0) {
+		res = io_uring_wait_cqe_timeout(&uring->ring, &cqe, &time_out);
+		if (res == -EINTR)
+			continue;
+
+		if (res == -ETIME) { // timer expires
+			printf(" AIO timer expires curr qdepth = %d, retval = %d  \n", max_nr, res);
+			if (--retry_count)
+				continue;
+
+			break;
+		}
+
+		if (res < 0) {
+			fprintf(stderr, " io_uring error = %d\n", res);
+			assert(0);
+			break;
+		}
+
+		cc = uring_reap_cqes(io_manager, max_nr);
+	}
+
+	return cc;
+}
+
+static int uring_poll(struct nvfuse_io_manager *io_manager)
+{
+	if (io_manager->queue_cur_count == 0)
+		return 0;
+
+	return uring_reap_cqes(io_manager, io_manager->queue_cur_count);
+}
+
+static int uring_cancel(struct nvfuse_io_manager *io_manager, struct io_job *job)
+{
+	struct nvfuse_uring *uring = io_manager->uring;
+	struct io_uring_sqe *sqe;
+	int r;
+
+	sqe = io_uring_get_sqe(&uring->ring);
+	if (sqe == NULL) {
+		printf(" EAGAIN: io was not canceled\n");
+		return 0;
+	}
+
+	io_uring_prep_cancel(sqe, job, 0);
+	io_uring_sqe_set_data(sqe, NULL);
+
+	r = io_uring_submit(&uring->ring);
+	if (r < 0) {
+		io_cancel_error_decode(r);
+	}
+
+	return 0;
+}
+
+static int uring_flush(struct nvfuse_io_manager *io_manager)
+{
+	int ret;
+
+	ret = fdatasync(io_manager->dev);
+	if (ret < 0) {
+		printf(" Error: fdatasync() errno = %d \n", errno);
+		return ret;
+	}
+
+	io_manager->wc_dirty = 0;
+
+	return 0;
+}
+
+void nvfuse_init_uringio(struct nvfuse_io_manager *io_manager, char *name, char *path, int qdepth)
+{
+	/* Sync I/O is identical to blkdev */
+	nvfuse_init_blkdevio(io_manager, name, path, qdepth);
+
+	/* io_uring Function Pointers */
+	io_manager->aio_init = uring_init;
+	io_manager->aio_cleanup = uring_cleanup;
+	io_manager->aio_prep = uring_prep;
+	io_manager->aio_submit = uring_submit;
+	io_manager->aio_complete = uring_complete;
+	io_manager->aio_poll = uring_poll;
+	io_manager->aio_getnextcjob = libaio_getnextcjob;
+	io_manager->aio_resetnextcjob = libaio_resetnextcjob;
+	io_manager->aio_cancel = uring_cancel;
+	io_manager->dev_flush = uring_flush;
+	io_manager->io_register_buf = uring_register_buf;
+	io_manager->io_unregister_buf = uring_unregister_buf;
+
+	/* FUA writes are issued with RWF_DSYNC */
+	io_manager->fua_support = 1;
+	io_manager->uring = NULL;
+}
+#endif
+
 
 static int blkdev_open(struct nvfuse_io_manager *io_manager, int flags)
 {
@@ -307,7 +806,10 @@ static int blkdev_open(struct nvfuse_io_manager *io_manager, int flags)
 		exit(0);
 	}
 
-	io_manager->aio_init(io_manager);
+	if (io_manager->aio_init(io_manager) < 0) {
+		printf(" aio init error %s\n", io_manager->dev_path);
+		exit(0);
+	}
 
 	{
 		u64 no_of_sectors;
@@ -373,6 +875,48 @@ static int blkdev_write_blk(struct nvfuse_io_manager *io_manager, long block, in
 #if NVFUSE_OS == NVFUSE_OS_LINUX
 	wbytes = pwrite64(io_manager->dev, buf, size, location);
 #endif
+	io_manager->wc_dirty = 1;
+
+	return wbytes;
+}
+
+static int blkdev_readv_blk(struct nvfuse_io_manager *io_manager, long block, int count,
+			    struct iovec *iov, int iovcnt)
+{
+	int	size, rbytes = 0;
+	s64	location;
+
+	size =  count * CLUSTER_SIZE;
+	location = ((s64) block * (s64)CLUSTER_SIZE);
+
+#if NVFUSE_OS == NVFUSE_OS_LINUX
+	rbytes = preadv64(io_manager->dev, iov, iovcnt, location);
+#endif
+
+	if (rbytes != size) {
+		printf(" readv error, block = %lu, count = %d, size = %d\n", block, count, rbytes);
+	}
+
+	return rbytes;
+}
+
+static int blkdev_writev_blk(struct nvfuse_io_manager *io_manager, long block, int count,
+			     struct iovec *iov, int iovcnt)
+{
+	int	size, wbytes = 0;
+	s64	location;
+
+	size = count * CLUSTER_SIZE;
+	location = ((s64) block * (s64)CLUSTER_SIZE);
+
+#if NVFUSE_OS == NVFUSE_OS_LINUX
+	wbytes = pwritev64(io_manager->dev, iov, iovcnt, location);
+#endif
+	io_manager->wc_dirty = 1;
+
+	if (wbytes != size) {
+		printf(" writev error, block = %lu, count = %d, size = %d\n", block, count, wbytes);
+	}
 
 	return wbytes;
 }
@@ -341,6 +341,10 @@ int bp_alloc_master(struct nvfuse_superblock *sb, master_node_t *master)
 		return NVFUSE_ERROR;
 	}
 	bh = nvfuse_get_new_bh(sb, ictx, inode->i_ino, NVFUSE_SIZE_TO_BLK(inode->i_size), NVFUSE_TYPE_META);
+	if (bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return NVFUSE_ERROR;
+	}
 	memset(bh->bh_buf, 0x00, CLUSTER_SIZE);
 
 	master->m_ondisk = (master_ondisk_node_t *)bh->bh_buf;
@@ -377,6 +381,10 @@ void bp_init_root(master_node_t *master)
 
 	new_bno = bp_alloc_bitmap(master, ictx);
 	bh = nvfuse_get_bh(master->m_sb, ictx, master->m_ino, new_bno, READ, NVFUSE_TYPE_META);
+	if (bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return;
+	}
 
 	root = (index_node_t *)B_dALLOC(master, master->m_ondisk->m_root, ALLOC_READ);
 	root->i_root = 1;
@@ -1595,6 +1603,10 @@ offset_t bp_alloc_bitmap(master_node_t *master, struct nvfuse_inode_ctx *ictx)
 			//bp_inc_free_bitmap(master, new_bno);
 
 			bh = nvfuse_get_new_bh(master->m_sb, ictx, inode->i_ino, new_bno, NVFUSE_TYPE_META);
+			if (bh == NULL) {
+				printf(" Error: get_bh()\n");
+				return NVFUSE_ERROR;
+			}
 
 			bitmap = bh->bh_buf + BP_NODE_HEAD_SIZE;
 
@@ -1626,6 +1638,10 @@ FREE_BLK_FOUND:
 			return NVFUSE_ERROR;
 		}
 		bh = nvfuse_get_new_bh(master->m_sb, ictx, inode->i_ino, new_bno, NVFUSE_TYPE_META);
+		if (bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return NVFUSE_ERROR;
+		}
 
 		node = (index_node_t *)bh->bh_buf;
 		node->i_status = INDEX_NODE_USED;
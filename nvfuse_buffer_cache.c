@@ -17,31 +17,70 @@
 #include <rte_lcore.h>
 #include <rte_mempool.h>
 #include <rte_malloc.h>
+#include <rte_memcpy.h>
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 //#define NDEBUG
 #include <assert.h>
 
 #include "nvfuse_core.h"
 #include "nvfuse_dep.h"
 #include "nvfuse_buffer_cache.h"
+#include "nvfuse_io_channel.h"
 #include "nvfuse_malloc.h"
+#include "nvfuse_indirect.h"
 #include "nvfuse_ipc_ring.h"
 #include "nvfuse_control_plane.h"
+#include "nvfuse_writeback.h"
+#include "nvfuse_readahead.h"
+#include "nvfuse_bc_policy.h"
 #include "list.h"
 #include "rbtree.h"
 
-void nvfuse_move_buffer_list(struct nvfuse_superblock *sb, 
+/* clean buffers are linked to the clean list of their partition */
+static inline struct list_head *nvfuse_bc_list_head(struct nvfuse_buffer_manager *bm,
+		struct nvfuse_buffer_cache *bc, s32 type)
+{
+	if (type == BUFFER_TYPE_CLEAN)
+		return &bm->bm_part[bc->bc_part].bp_clean;
+
+	return &bm->bm_list[type];
+}
+
+static inline s32 nvfuse_bc_part_min(struct nvfuse_buffer_manager *bm, s32 part)
+{
+	return bm->bm_cache_size * bm->bm_part[part].bp_min_percent / 100;
+}
+
+static inline s32 nvfuse_bc_part_max(struct nvfuse_buffer_manager *bm, s32 part)
+{
+	return bm->bm_cache_size * bm->bm_part[part].bp_max_percent / 100;
+}
+
+void __nvfuse_move_buffer_list(struct nvfuse_superblock *sb,
 							struct nvfuse_buffer_cache *bc,
 							 s32 desired_type, s32 tail)
 {
-	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	struct nvfuse_buffer_manager *bm = bc->bc_bm;
+	struct nvfuse_bc_part *part = &bm->bm_part[bc->bc_part];
 
 	if (bc->bc_list_type == desired_type)
 		return;
 
+	if (bc->bc_list_type == BUFFER_TYPE_CLEAN) {
+		nvfuse_bc_policy_del_clean(bm, bc);
+		part->bp_nr_clean--;
+	}
+
+	/* unused buffer belongs to no partition */
+	if (bc->bc_list_type == BUFFER_TYPE_UNUSED)
+		part->bp_size++;
+	else if (desired_type == BUFFER_TYPE_UNUSED)
+		part->bp_size--;
+
 	list_del(&bc->bc_list);
 	bm->bm_list_count[bc->bc_list_type]--;
 	assert(bc->bc_list_type < BUFFER_TYPE_NUM);
@@ -49,22 +88,244 @@ void nvfuse_move_buffer_list(struct nvfuse_superblock *sb,
 	bc->bc_list_type = desired_type;
 
 	if (tail)
-		list_add_tail(&bc->bc_list, &bm->bm_list[bc->bc_list_type]);
+		list_add_tail(&bc->bc_list, nvfuse_bc_list_head(bm, bc, desired_type));
 	else
-		list_add(&bc->bc_list, &bm->bm_list[bc->bc_list_type]);
+		list_add(&bc->bc_list, nvfuse_bc_list_head(bm, bc, desired_type));
 
 	bm->bm_list_count[bc->bc_list_type]++;
 
-#if 0
-	hlist_del(&bc->bc_hash);
-	if (desired_type == BUFFER_TYPE_UNUSED) {
-		hlist_add_head(&bc->bc_hash, &bm->bm_hash[HASH_NUM]);
-		bm->bm_hash_count[HASH_NUM]++;
-	} else {
-		hlist_add_head(&bc->bc_hash, &bm->bm_hash[bc->bc_bno % HASH_NUM]);
-		bm->bm_hash_count[bc->bc_bno % HASH_NUM]++;
+	if (desired_type == BUFFER_TYPE_CLEAN) {
+		part->bp_nr_clean++;
+		nvfuse_bc_policy_add_clean(bm, bc, tail);
 	}
-#endif
+}
+
+/* buffer referenced as the other kind of block moves to its partition */
+static void nvfuse_bc_change_part(struct nvfuse_buffer_manager *bm,
+				  struct nvfuse_buffer_cache *bc, s32 part)
+{
+	s32 type = bc->bc_list_type;
+
+	if (type == BUFFER_TYPE_CLEAN) {
+		nvfuse_bc_policy_del_clean(bm, bc);
+		list_del(&bc->bc_list);
+		bm->bm_part[bc->bc_part].bp_nr_clean--;
+	}
+
+	if (type != BUFFER_TYPE_UNUSED) {
+		bm->bm_part[bc->bc_part].bp_size--;
+		bm->bm_part[part].bp_size++;
+	}
+
+	bc->bc_part = part;
+
+	if (type == BUFFER_TYPE_CLEAN) {
+		list_add(&bc->bc_list, &bm->bm_part[part].bp_clean);
+		bm->bm_part[part].bp_nr_clean++;
+		nvfuse_bc_policy_add_clean(bm, bc, INSERT_HEAD);
+	}
+}
+
+/*
+ * nvfuse_bc_part_victim - choose the partition which gives up a clean buffer
+ * for a miss in part. A partition at its maximum replaces its own buffers,
+ * and the other partition is never shrunk below its minimum. Otherwise,
+ * the partition whose least recently used clean buffer is older loses it.
+ * If force is set, minimum is ignored rather than failing. It returns -1
+ * if no partition has clean buffers to give.
+ */
+static s32 nvfuse_bc_part_victim(struct nvfuse_buffer_manager *bm, s32 part, s32 force)
+{
+	struct nvfuse_bc_part *p = &bm->bm_part[part];
+	s32 other = (part == NVFUSE_BC_PART_META) ? NVFUSE_BC_PART_DATA : NVFUSE_BC_PART_META;
+	struct nvfuse_bc_part *q = &bm->bm_part[other];
+	struct nvfuse_buffer_cache *p_lru, *q_lru;
+
+	if (q->bp_nr_clean == 0 ||
+	    p->bp_size >= nvfuse_bc_part_max(bm, part) ||
+	    q->bp_size <= nvfuse_bc_part_min(bm, other)) {
+		if (p->bp_nr_clean)
+			return part;
+		return (force && q->bp_nr_clean) ? other : -1;
+	}
+
+	if (p->bp_nr_clean == 0 || p->bp_size < nvfuse_bc_part_min(bm, part))
+		return other;
+
+	p_lru = list_entry(p->bp_clean.prev, struct nvfuse_buffer_cache, bc_list);
+	q_lru = list_entry(q->bp_clean.prev, struct nvfuse_buffer_cache, bc_list);
+
+	return ((s32)(p_lru->bc_tick - q_lru->bc_tick) <= 0) ? part : other;
+}
+
+void nvfuse_move_buffer_list(struct nvfuse_superblock *sb, 
+							struct nvfuse_buffer_cache *bc,
+							 s32 desired_type, s32 tail)
+{
+	struct nvfuse_buffer_manager *bm = bc->bc_bm;
+
+	nvfuse_bm_lock(bm);
+	__nvfuse_move_buffer_list(sb, bc, desired_type, tail);
+	nvfuse_bm_unlock(bm);
+}
+
+/* take a reference of bc, victims are chosen among unreferenced buffers under shard lock */
+void nvfuse_get_bc(struct nvfuse_buffer_cache *bc)
+{
+	nvfuse_bm_lock(bc->bc_bm);
+	bc->bc_ref++;
+	nvfuse_bm_unlock(bc->bc_bm);
+}
+
+/* drop a reference taken by nvfuse_find_bc() or nvfuse_get_bc() */
+void nvfuse_put_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc, s32 tail)
+{
+	struct nvfuse_buffer_manager *bm = bc->bc_bm;
+
+	nvfuse_bm_lock(bm);
+	bc->bc_ref--;
+	assert(bc->bc_ref >= 0);
+	if (bc->bc_ref == 0 && bc->bc_list_type == BUFFER_TYPE_REF)
+		__nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_CLEAN, tail);
+	nvfuse_bm_unlock(bm);
+}
+
+/*
+ * Buffers being flushed synchronously are kept on writeback list of their
+ * shard as nvfuse_wb_submit() does, instead of a private list. A buffer
+ * dirtied again while it is written is moved back to dirty list by
+ * nvfuse_release_bh(), and nvfuse_sync_dirty_data() then leaves it dirty.
+ * Referenced dirty buffers (i.e., on ref list) are staged as well.
+ * It returns 0 if bc is not dirty or is already being written.
+ */
+s32 nvfuse_stage_flushing_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc)
+{
+	s32 staged = 0;
+
+	nvfuse_bm_lock(bc->bc_bm);
+	if (bc->bc_dirty && bc->bc_list_type != BUFFER_TYPE_WRITEBACK) {
+		__nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_WRITEBACK, INSERT_TAIL);
+		staged = 1;
+	}
+	nvfuse_bm_unlock(bc->bc_bm);
+
+	return staged;
+}
+
+/* staged bc which is not written goes back to dirty list */
+void nvfuse_unstage_flushing_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc)
+{
+	nvfuse_bm_lock(bc->bc_bm);
+	if (bc->bc_list_type == BUFFER_TYPE_WRITEBACK)
+		__nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_DIRTY, INSERT_TAIL);
+	nvfuse_bm_unlock(bc->bc_bm);
+}
+
+/*
+ * Thread to shard affinity
+ * Each thread counts its references to every shard. A thread flushes its
+ * most used shard first, and a shard running short of buffers borrows them
+ * from shards the thread rarely uses, so that buffers of shards other
+ * threads work on are left alone. Counts decay so that affinity follows
+ * the working set of the thread.
+ */
+struct nvfuse_bc_affinity {
+	struct nvfuse_superblock *ba_sb;
+	u32 ba_ref[NVFUSE_BC_SHARDS];
+	u32 ba_total;
+};
+
+static __thread struct nvfuse_bc_affinity bc_affinity;
+
+static struct nvfuse_bc_affinity *nvfuse_bc_affinity(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_bc_affinity *ba = &bc_affinity;
+
+	if (ba->ba_sb != sb) {
+		memset(ba, 0x00, sizeof(struct nvfuse_bc_affinity));
+		ba->ba_sb = sb;
+	}
+
+	return ba;
+}
+
+static void nvfuse_bc_affinity_ref(struct nvfuse_superblock *sb, struct nvfuse_buffer_manager *bm)
+{
+	struct nvfuse_bc_affinity *ba = nvfuse_bc_affinity(sb);
+	s32 i;
+
+	ba->ba_ref[bm->bm_id]++;
+	if (++ba->ba_total < (1U << NVFUSE_BC_AFFINITY_DECAY_BITS))
+		return;
+
+	ba->ba_total = 0;
+	for (i = 0; i < NVFUSE_BC_SHARDS; i++) {
+		ba->ba_ref[i] >>= 1;
+		ba->ba_total += ba->ba_ref[i];
+	}
+}
+
+/* shard referenced most by calling thread */
+static s32 nvfuse_bc_home_shard(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_bc_affinity *ba = nvfuse_bc_affinity(sb);
+	s32 home = 0;
+	s32 i;
+
+	for (i = 1; i < NVFUSE_BC_SHARDS; i++) {
+		if (ba->ba_ref[i] > ba->ba_ref[home])
+			home = i;
+	}
+
+	return home;
+}
+
+/* shard is used by calling thread more than average */
+static s32 nvfuse_bc_shard_is_hot(struct nvfuse_superblock *sb, s32 id)
+{
+	struct nvfuse_bc_affinity *ba = nvfuse_bc_affinity(sb);
+
+	return (u64)ba->ba_ref[id] * NVFUSE_BC_SHARDS > ba->ba_total;
+}
+
+/*
+ * stage up to nr dirty buffers of all shards starting from home shard of
+ * calling thread, it returns the number of staged buffers
+ */
+s32 nvfuse_stage_flushing_dirty(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache **bcs, s32 nr)
+{
+	struct nvfuse_buffer_manager *bm;
+	struct nvfuse_buffer_cache *bc;
+	struct list_head *head;
+	s32 home = nvfuse_bc_home_shard(sb);
+	s32 count = 0;
+	s32 i;
+
+	for (i = 0; i < NVFUSE_BC_SHARDS && count < nr; i++) {
+		bm = sb->sb_bm[(home + i) % NVFUSE_BC_SHARDS];
+
+		nvfuse_bm_lock(bm);
+		head = &bm->bm_list[BUFFER_TYPE_DIRTY];
+		while (!list_empty(head) && count < nr) {
+			bc = (struct nvfuse_buffer_cache *)list_entry(head->prev, struct nvfuse_buffer_cache, bc_list);
+			assert(bc->bc_dirty);
+			__nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_WRITEBACK, INSERT_TAIL);
+			bcs[count++] = bc;
+		}
+		nvfuse_bm_unlock(bm);
+	}
+
+	return count;
+}
+
+/*
+ * bc stays indexed by its key after it is moved to unused list (e.g.,
+ * truncated blocks), so it is removed from index only when it is reused.
+ */
+static void nvfuse_bc_index_del(struct nvfuse_buffer_manager *bm, struct nvfuse_buffer_cache *bc)
+{
+	if (nvfuse_index_lookup(&bm->bm_index, bc->bc_bno) == bc)
+		nvfuse_index_remove(&bm->bm_index, bc->bc_bno);
 }
 
 void nvfuse_init_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc)
@@ -76,113 +337,238 @@ void nvfuse_init_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc
 	bc->bc_load = 0;
 	bc->bc_pno = 0;
 	bc->bc_ref = 0;
+	bc->bc_ra = 0;
 	memset(bc->bc_buf, 0x00, CLUSTER_SIZE);
 }
 
-struct nvfuse_buffer_cache *nvfuse_replace_buffer_cache(struct nvfuse_superblock *sb, u64 key)
+/*
+ * A shard which runs out of unused and clean buffers borrows unused buffers
+ * from the shard having the most of them, instead of flushing its dirty
+ * buffers while other shards still have room. Shards calling thread rarely
+ * uses are preferred as donors. It returns the number of borrowed buffers.
+ * No shard lock is held by caller.
+ */
+static s32 nvfuse_steal_unused_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_manager *bm)
 {
+	struct nvfuse_buffer_manager *donor = NULL;
+	struct nvfuse_buffer_cache *bc;
+	struct list_head stolen;
+	struct list_head *ptr, *temp;
+	s32 count = 0;
+	s32 donor_hot = 0;
+	s32 hot;
+	s32 nr;
+	s32 i;
+
+	for (i = 0; i < NVFUSE_BC_SHARDS; i++) {
+		if (sb->sb_bm[i] == bm || sb->sb_bm[i]->bm_list_count[BUFFER_TYPE_UNUSED] == 0)
+			continue;
 
-	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+		hot = nvfuse_bc_shard_is_hot(sb, i);
+		if (donor == NULL || hot < donor_hot ||
+		    (hot == donor_hot &&
+		     sb->sb_bm[i]->bm_list_count[BUFFER_TYPE_UNUSED] > donor->bm_list_count[BUFFER_TYPE_UNUSED])) {
+			donor = sb->sb_bm[i];
+			donor_hot = hot;
+		}
+	}
+
+	if (donor == NULL)
+		return 0;
+
+	INIT_LIST_HEAD(&stolen);
+
+	nvfuse_bm_lock(donor);
+	/* donor keeps half of its unused buffers */
+	nr = (donor->bm_list_count[BUFFER_TYPE_UNUSED] + 1) / 2;
+	if (nr > NVFUSE_BC_SHARD_STEAL_SIZE)
+		nr = NVFUSE_BC_SHARD_STEAL_SIZE;
+
+	list_for_each_safe(ptr, temp, &donor->bm_list[BUFFER_TYPE_UNUSED]) {
+		if (count == nr)
+			break;
+
+		bc = list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+		if (bc->bc_ref || bc->bc_bh_count)
+			continue;
+
+		list_move(&bc->bc_list, &stolen);
+		nvfuse_bc_index_del(donor, bc);
+		donor->bm_list_count[BUFFER_TYPE_UNUSED]--;
+		donor->bm_cache_size--;
+		count++;
+	}
+	nvfuse_bm_unlock(donor);
+
+	if (count == 0)
+		return 0;
+
+	nvfuse_bm_lock(bm);
+	list_for_each_safe(ptr, temp, &stolen) {
+		bc = list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+		bc->bc_bm = bm;
+		list_move_tail(&bc->bc_list, &bm->bm_list[BUFFER_TYPE_UNUSED]);
+		bm->bm_list_count[BUFFER_TYPE_UNUSED]++;
+		bm->bm_cache_size++;
+	}
+	nvfuse_bm_unlock(bm);
+
+	return count;
+}
+
+static int nvfuse_add_buffer_cache_shard(struct nvfuse_superblock *sb,
+					 struct nvfuse_buffer_manager *bm, int nr);
+
+struct nvfuse_buffer_cache *nvfuse_replace_buffer_cache(struct nvfuse_superblock *sb, u64 key, s32 part)
+{
+
+	struct nvfuse_buffer_manager *bm = nvfuse_bc_shard(sb, key);
 	struct nvfuse_buffer_cache *bc;
 	struct list_head *remove_ptr;
+	s32 victim_part;
 	s32 type = 0;
 
 	/* if buffers are insufficient, it sens buffer allocation mesg to control plane */
 	if (bm->bm_list_count[BUFFER_TYPE_UNUSED] == 0 && nvfuse_process_model_is_dataplane()) {
 		s32 nr_buffers;
 
+		nvfuse_bm_unlock(bm);
 		/* try to allocate buffers from primary process */
-		nr_buffers = NVFUSE_BUFFER_DEFAULT_ALLOC_SIZE_PER_MSG;
+		nr_buffers = NVFUSE_BUFFER_DEFAULT_ALLOC_CHUNKS_PER_MSG * sb->bc_arena->ba_chunk_pages;
 		nr_buffers = nvfuse_send_alloc_buffer_req(sb->sb_nvh, nr_buffers);
-		if (nr_buffers > 0) {
-			nvfuse_add_buffer_cache(sb, nr_buffers);
-			assert(bm->bm_list_count[BUFFER_TYPE_UNUSED]);
-		}
+		if (nr_buffers > 0)
+			nvfuse_add_buffer_cache_shard(sb, bm, nr_buffers);
+		nvfuse_bm_lock(bm);
+	}
+
+	/* buffers under writeback become clean without flushing inline */
+	if (bm->bm_list_count[BUFFER_TYPE_UNUSED] == 0 && bm->bm_list_count[BUFFER_TYPE_CLEAN] == 0) {
+		nvfuse_bm_unlock(bm);
+		if (nvfuse_steal_unused_bc(sb, bm) == 0)
+			nvfuse_wb_wait(sb);
+		nvfuse_bm_lock(bm);
 	}
 
-	if (bm->bm_list_count[BUFFER_TYPE_UNUSED]) {
+	/* partition at its maximum replaces its own buffers instead of taking unused ones */
+	victim_part = nvfuse_bc_part_victim(bm, part, 0);
+	if (bm->bm_list_count[BUFFER_TYPE_UNUSED] &&
+	    (victim_part < 0 || bm->bm_part[part].bp_size < nvfuse_bc_part_max(bm, part))) {
 		type = BUFFER_TYPE_UNUSED;
-	} else if (bm->bm_list_count[BUFFER_TYPE_CLEAN]) {
+	} else if (victim_part >= 0) {
 		type = BUFFER_TYPE_CLEAN;
 	} else {
-		type = BUFFER_TYPE_DIRTY;
 		printf(" Warning: it runs out of clean buffers.\n");
 		printf(" Warning: it needs to flush dirty pages to disks.\n");
+		nvfuse_bm_unlock(bm);
 		nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
+		nvfuse_bm_lock(bm);
+		/* flushed dirty buffers are moved to clean list */
+		type = BUFFER_TYPE_CLEAN;
+		victim_part = nvfuse_bc_part_victim(bm, part, 1);
 	}
 
-	assert(bm->bm_list_count[type]);
-	remove_ptr = (struct list_head *)(&bm->bm_list[type])->prev;
-	do {
-		bc = list_entry(remove_ptr, struct nvfuse_buffer_cache, bc_list);
-		if (bc->bc_ref == 0 && bc->bc_bh_count == 0) {
-			break;
-		}
-		remove_ptr = remove_ptr->prev;
-		if (remove_ptr == &bm->bm_list[type]) {
+	if (bm->bm_list_count[type] == 0 || (type == BUFFER_TYPE_CLEAN && victim_part < 0)) {
+		/* other threads took buffers while the lock was released */
+		printf(" Error: shard %d runs out of buffers.\n", bm->bm_id);
+		return NULL;
+	}
+	if (type == BUFFER_TYPE_CLEAN) {
+		/* replacement policy of the partition selects a clean buffer */
+		bc = nvfuse_bc_policy_victim(bm, victim_part);
+		if (bc == NULL) {
 			printf(" no more buffer head.");
 			while (1);
 		}
-		assert(remove_ptr != &bm->bm_list[type]);
-	} while (1);
+		nvfuse_bc_policy_del_clean(bm, bc);
+		bm->bm_part[bc->bc_part].bp_nr_clean--;
+		bm->bm_part[bc->bc_part].bp_size--;
+	} else {
+		remove_ptr = (struct list_head *)(&bm->bm_list[type])->prev;
+		do {
+			bc = list_entry(remove_ptr, struct nvfuse_buffer_cache, bc_list);
+			if (bc->bc_ref == 0 && bc->bc_bh_count == 0) {
+				break;
+			}
+			remove_ptr = remove_ptr->prev;
+			if (remove_ptr == &bm->bm_list[type]) {
+				printf(" no more buffer head.");
+				while (1);
+			}
+			assert(remove_ptr != &bm->bm_list[type]);
+		} while (1);
+	}
 
 	/* remove list */
 	list_del(&bc->bc_list);
-	/* remove hlist */
-	hlist_del(&bc->bc_hash);
+	/* remove index */
+	nvfuse_bc_index_del(bm, bc);
 	bm->bm_list_count[type]--;
-	if (type == BUFFER_TYPE_UNUSED)
-		bm->bm_hash_count[HASH_NUM]--;
-	else
-		bm->bm_hash_count[bc->bc_bno % HASH_NUM]--;
 	return bc;
 }
 
-struct nvfuse_buffer_cache *nvfuse_hash_lookup(struct nvfuse_buffer_manager *bm, u64 key)
+struct nvfuse_buffer_cache *nvfuse_hash_lookup(struct nvfuse_superblock *sb, u64 key)
 {
-	struct hlist_node *node;
-	struct hlist_head *head;
-	struct nvfuse_buffer_cache *bh;
-
-	head = &bm->bm_hash[key % HASH_NUM];
-	hlist_for_each(node, head) {
-		bh = hlist_entry(node, struct nvfuse_buffer_cache, bc_hash);
-		if (bh->bc_bno == key)
-			return bh;
-	}
+	struct nvfuse_buffer_manager *bm = nvfuse_bc_shard(sb, key);
+	struct nvfuse_buffer_cache *bc;
 
-	return NULL;
+	nvfuse_bm_lock(bm);
+	bc = (struct nvfuse_buffer_cache *)nvfuse_index_lookup(&bm->bm_index, key);
+	nvfuse_bm_unlock(bm);
+
+	return bc;
 }
 
-struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key, lbno_t lblock)
+struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key, lbno_t lblock,
+					   s32 is_meta)
 {
-	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	struct nvfuse_buffer_manager *bm = nvfuse_bc_shard(sb, key);
 	struct nvfuse_buffer_cache *bc;
+	s32 part;
 	s32 status;
 
+	part = is_meta ? NVFUSE_BC_PART_META : NVFUSE_BC_PART_DATA;
+
+	nvfuse_bc_affinity_ref(sb, bm);
+
+	nvfuse_bm_lock(bm);
+	bm->bm_tick++;
 	bm->bm_cache_ref++;
-	bc = nvfuse_hash_lookup(sb->sb_bm, key);
+	bm->bm_part[part].bp_cache_ref++;
+	bc = (struct nvfuse_buffer_cache *)nvfuse_index_lookup(&bm->bm_index, key);
 	if (bc) {
 		/* in case of cache hit */
 		bc->bc_lbno = lblock;
+		if (bc->bc_part != part)
+			nvfuse_bc_change_part(bm, bc, part);
 
 		// cache move to mru position
 		list_del(&bc->bc_list);
 		bm->bm_list_count[bc->bc_list_type]--;
 
-		list_add(&bc->bc_list, &bm->bm_list[bc->bc_list_type]);
+		list_add(&bc->bc_list, nvfuse_bc_list_head(bm, bc, bc->bc_list_type));
 		bm->bm_list_count[bc->bc_list_type]++;
 		bm->bm_cache_hit++;
+		bm->bm_part[part].bp_cache_hit++;
+		bc->bc_tick = bm->bm_tick;
+		/* pinned before shard lock is released, so it cannot be replaced */
+		bc->bc_ref++;
+
+		nvfuse_bc_policy_hit(bm, bc);
 
 		//printf(" hit count = %d, inode = %d, hit rate = %f \n", bc->bc_hit, bc->bc_ino,
 		//(double)bm->bm_cache_hit/bm->bm_cache_ref);
 	} else {
-		bc = nvfuse_replace_buffer_cache(sb, key);
+		bc = nvfuse_replace_buffer_cache(sb, key, part);
 		if (bc) {
 			nvfuse_init_bc(sb, bc);
-			/* hash list insertion */
-			hlist_add_head(&bc->bc_hash, &bm->bm_hash[key % HASH_NUM]);
-			bm->bm_hash_count[key % HASH_NUM]++;
+			/* index insertion */
+			if (nvfuse_index_insert(&bm->bm_index, key, bc) < 0) {
+				list_add_tail(&bc->bc_list, &bm->bm_list[BUFFER_TYPE_UNUSED]);
+				bm->bm_list_count[BUFFER_TYPE_UNUSED]++;
+				bc->bc_list_type = BUFFER_TYPE_UNUSED;
+				nvfuse_bm_unlock(bm);
+				return NULL;
+			}
 
 			status = BUFFER_TYPE_REF;
 			/* list insertion */
@@ -194,8 +580,15 @@ struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key
 			bc->bc_list_type = status;
 			INIT_LIST_HEAD(&bc->bc_bh_head);
 			bc->bc_bh_count = 0;
+			bc->bc_part = part;
+			bc->bc_tick = bm->bm_tick;
+			bc->bc_ref = 1;
+			bm->bm_part[part].bp_size++;
+
+			nvfuse_bc_policy_miss(bm, bc);
 		}
 	}
+	nvfuse_bm_unlock(bm);
 
 	return bc;
 }
@@ -220,7 +613,7 @@ struct nvfuse_buffer_head *nvfuse_alloc_buffer_head(struct nvfuse_superblock *sb
 
 void nvfuse_free_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc)
 {
-	spdk_mempool_put(sb->bc_mempool, bc);
+	nvfuse_bc_arena_free(sb->bc_arena, bc);
 }
 
 void nvfuse_free_buffer_head(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *bh)
@@ -235,10 +628,15 @@ struct nvfuse_buffer_head *nvfuse_get_bh(struct nvfuse_superblock *sb,
 	struct nvfuse_buffer_cache *bc;
 	u64 key;
 
+	nvfuse_wb_wait_block(sb, ino, lblock);
+
 	bh = nvfuse_find_bh_in_ictx(sb, ictx, ino, lblock);
 	if (bh) {
 		bc = bh->bh_bc;
 		assert(bh->bh_buf == bc->bc_buf);
+		nvfuse_get_bc(bc);
+		if (bc->bc_ra)
+			nvfuse_ra_wait_bc(sb, bc);
 		goto FOUND_BH;
 	} else {
 		bh = nvfuse_alloc_buffer_head(sb);
@@ -247,11 +645,15 @@ struct nvfuse_buffer_head *nvfuse_get_bh(struct nvfuse_superblock *sb,
 	}
 
 	nvfuse_make_pbno_key(ino, lblock, &key, NVFUSE_BP_TYPE_DATA);
-	bc = nvfuse_find_bc(sb, key, lblock);
+	bc = nvfuse_find_bc(sb, key, lblock, is_meta);
 	if (bc == NULL) {
+		nvfuse_free_buffer_head(sb, bh);
 		return NULL;
 	}
 
+	if (bc->bc_ra)
+		nvfuse_ra_wait_bc(sb, bc);
+
 	if (!bc->bc_pno) {
 		/* logical to physical address translation */
 		bc->bc_pno = nvfuse_get_pbn(sb, ictx, ino, lblock);
@@ -260,11 +662,11 @@ struct nvfuse_buffer_head *nvfuse_get_bh(struct nvfuse_superblock *sb,
 
 	if (bc->bc_pno) {
 		if (sync_read && !bc->bc_load) {
-			if (!nvfuse_read_block(bc->bc_buf, bc->bc_pno, sb->io_manager)) {
+			if (!nvfuse_read_block(bc->bc_buf, bc->bc_pno, nvfuse_io_channel(sb))) {
 				/* FIXME: how can we handle this case? */
 				printf(" Error: block read in %s\n", __FUNCTION__);
-				/* necesary to release bc here */
-				/* necesary to release bh here */
+				nvfuse_put_bc(sb, bc, INSERT_TAIL);
+				nvfuse_free_buffer_head(sb, bh);
 				return NULL;
 			}
 			bc->bc_load = 1;
@@ -289,8 +691,7 @@ FOUND_BH:
 
 	bc->bc_ino = ino;
 	bc->bc_lbno = lblock;
-	bc->bc_ref++;
-	assert(bc->bc_ref >= 0);
+	assert(bc->bc_ref > 0);
 	assert(bc->bc_pno);
 	assert(bh->bh_bc);
 
@@ -307,12 +708,17 @@ struct nvfuse_buffer_head *nvfuse_get_new_bh(struct nvfuse_superblock *sb,
 	struct nvfuse_buffer_head *bh;
 	u64 key = 0;
 
+	nvfuse_wb_wait_block(sb, ino, lblock);
+
 	nvfuse_make_pbno_key(ino, lblock, &key, NVFUSE_BP_TYPE_DATA);
-	bc = nvfuse_find_bc(sb, key, lblock);
+	bc = nvfuse_find_bc(sb, key, lblock, is_meta);
 	if (bc == NULL) {
 		return NULL;
 	}
 
+	if (bc->bc_ra)
+		nvfuse_ra_wait_bc(sb, bc);
+
 	if (!bc->bc_pno) {
 		/* logical to physical address translation */
 		bc->bc_pno = nvfuse_get_pbn(sb, ictx, ino, lblock);
@@ -328,12 +734,13 @@ struct nvfuse_buffer_head *nvfuse_get_new_bh(struct nvfuse_superblock *sb,
 	bc->bc_load = 1;
 	bc->bc_ino = ino;
 	bc->bc_lbno = lblock;
-	bc->bc_ref++;
 	assert(bc->bc_ref == 1);
 
 	bh = nvfuse_alloc_buffer_head(sb);
-	if (!bh)
+	if (!bh) {
+		nvfuse_put_bc(sb, bc, INSERT_TAIL);
 		return NULL;
+	}
 
 	bh->bh_bc = bc;
 	bh->bh_buf = bc->bc_buf;
@@ -349,113 +756,290 @@ struct nvfuse_buffer_head *nvfuse_get_new_bh(struct nvfuse_superblock *sb,
 	return bh;
 }
 
+/*
+ * nvfuse_prefetch_bc - load uncached data blocks of [lblock, lblock + nr_blocks)
+ * into the buffer cache. Missing blocks which are physically contiguous are
+ * read by a single vectored I/O straight into their buffer caches.
+ * It returns the number of loaded blocks.
+ */
+s32 nvfuse_prefetch_bc(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+		       inode_t ino, lbno_t lblock, u32 nr_blocks)
+{
+	struct nvfuse_io_manager *io_manager = nvfuse_io_channel(sb);
+	struct nvfuse_buffer_cache *bcs[NVFUSE_MAX_COALESCED_READ_SIZE / CLUSTER_SIZE];
+	struct iovec iov[NVFUSE_MAX_COALESCED_READ_SIZE / CLUSTER_SIZE];
+	struct nvfuse_buffer_cache *bc;
+	lbno_t end = lblock + nr_blocks;
+	u32 max_blocks = NVFUSE_MAX_COALESCED_READ_SIZE / CLUSTER_SIZE;
+	u32 num_blocks, pblock;
+	s32 loaded = 0;
+	u64 key;
+	s32 ret;
+	u32 i;
+
+	/* backend without vectored read leaves blocks to nvfuse_get_bh() */
+	if (io_manager->io_readv == NULL)
+		return 0;
+
+	while (lblock < end) {
+		/* skip blocks already cached */
+		nvfuse_make_pbno_key(ino, lblock, &key, NVFUSE_BP_TYPE_DATA);
+		if (nvfuse_hash_lookup(sb, key)) {
+			lblock++;
+			continue;
+		}
+
+		num_blocks = end - lblock;
+		if (num_blocks > max_blocks)
+			num_blocks = max_blocks;
+
+		/* logical to physical address translation for contiguous blocks */
+		ret = nvfuse_get_block(sb, ictx, lblock, num_blocks, &num_blocks, &pblock, 0);
+		if (ret || pblock == 0 || num_blocks == 0) {
+			/* hole or error, leave it to nvfuse_get_bh() */
+			lblock++;
+			continue;
+		}
+
+		/* the run ends at the first block already cached */
+		for (i = 1; i < num_blocks; i++) {
+			nvfuse_make_pbno_key(ino, lblock + i, &key, NVFUSE_BP_TYPE_DATA);
+			if (nvfuse_hash_lookup(sb, key))
+				break;
+		}
+		num_blocks = i;
+
+		/* a single block is read through the normal path */
+		if (num_blocks == 1) {
+			lblock++;
+			continue;
+		}
+
+		/* newly allocated bc is pinned in ref list until it is loaded */
+		for (i = 0; i < num_blocks; i++) {
+			nvfuse_make_pbno_key(ino, lblock + i, &key, NVFUSE_BP_TYPE_DATA);
+			bc = nvfuse_find_bc(sb, key, lblock + i, NVFUSE_TYPE_DATA);
+			if (bc == NULL)
+				break;
+
+			/* block cached by others in the meantime ends the run */
+			if (bc->bc_load || bc->bc_dirty || bc->bc_ra) {
+				nvfuse_put_bc(sb, bc, INSERT_HEAD);
+				break;
+			}
+
+			bcs[i] = bc;
+			iov[i].iov_base = bc->bc_buf;
+			iov[i].iov_len = CLUSTER_SIZE;
+		}
+		num_blocks = i;
+
+		if (num_blocks == 0) {
+			lblock++;
+			continue;
+		}
+
+		ret = nvfuse_readv_ncluster(iov, num_blocks, pblock, num_blocks, io_manager);
+		if (ret != (s32)(num_blocks << CLUSTER_SIZE_BITS))
+			printf(" Error: block read in %s\n", __FUNCTION__);
+
+		for (i = 0; i < num_blocks; i++) {
+			bc = bcs[i];
+			/* unloaded bc is read again by nvfuse_get_bh() */
+			if (ret == (s32)(num_blocks << CLUSTER_SIZE_BITS)) {
+				bc->bc_pno = pblock + i;
+				bc->bc_load = 1;
+				bc->bc_ino = ino;
+				bc->bc_lbno = lblock + i;
+				loaded++;
+			}
+
+			nvfuse_put_bc(sb, bc, INSERT_HEAD);
+		}
+
+		if (ret != (s32)(num_blocks << CLUSTER_SIZE_BITS))
+			break;
+
+		lblock += num_blocks;
+	}
+
+	return loaded;
+}
+
 struct nvfuse_buffer_cache *nvfuse_alloc_bc(struct nvfuse_superblock *sb)
 {
 	struct nvfuse_buffer_cache *bc;
+	s8 *buf;
+	u32 idx;
 
-	bc = (struct nvfuse_buffer_cache *)spdk_mempool_get(sb->bc_mempool);
+	bc = nvfuse_bc_arena_alloc(sb->bc_arena);
 	if (bc == NULL) {
 		printf(" %s:%d: nvfuse_malloc error \n", __FUNCTION__, __LINE__);
 		return bc;
 	}
+
+	/* page and index are bound to descriptor by arena */
+	buf = bc->bc_buf;
+	idx = bc->bc_idx;
 	memset(bc, 0x00, sizeof(struct nvfuse_buffer_cache));
+	bc->bc_buf = buf;
+	bc->bc_idx = idx;
 
 	return bc;
 }
 
-s32 nvfuse_remove_buffer_cache(struct nvfuse_superblock *sb, s32 nr_buffers)
+/* release unused buffers whose arena index is not below min_idx, it returns the number not released */
+static s32 nvfuse_remove_unused_bc(struct nvfuse_superblock *sb, s32 nr_buffers, u32 min_idx)
 {
-	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	struct nvfuse_buffer_manager *bm;
 	struct nvfuse_buffer_cache *bc;
 	struct list_head *head;
 	struct list_head *ptr, *temp;
+	s32 i;
+
+	for (i = 0; i < NVFUSE_BC_SHARDS && nr_buffers; i++) {
+		bm = sb->sb_bm[i];
+		nvfuse_bm_lock(bm);
+		head = &bm->bm_list[BUFFER_TYPE_UNUSED];
+		list_for_each_safe(ptr, temp, head) {
+			bc = (struct nvfuse_buffer_cache *)list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+			if (bc->bc_idx < min_idx)
+				continue;
+
+			if (bc->bc_bh_count)
+				nvfuse_remove_bhs_in_bc(sb, bc);
+
+			assert(!bc->bc_bh_count);
+			assert(!bc->bc_dirty);
+			list_del(&bc->bc_list);
+			nvfuse_bc_index_del(bm, bc);
+
+			nvfuse_free_bc(sb, bc);
+
+			bm->bm_list_count[BUFFER_TYPE_UNUSED]--;
+			bm->bm_cache_size--;
+
+			if (--nr_buffers == 0)
+				break;
+		}
+		nvfuse_bm_unlock(bm);
+	}
+
+	return nr_buffers;
+}
+
+s32 nvfuse_remove_buffer_cache(struct nvfuse_superblock *sb, s32 nr_buffers)
+{
+	struct nvfuse_bc_arena *arena = sb->bc_arena;
+	s32 cache_size = nvfuse_get_cache_size(sb);
+	s32 unused_count = nvfuse_get_list_count(sb, BUFFER_TYPE_UNUSED);
+	u32 min_idx;
 
 	assert(nr_buffers > 0);
 
-	if (bm->bm_cache_size - nr_buffers < NVFUSE_INITIAL_BUFFER_SIZE_DATA) {
-		printf(" Warninig: current buffer size = %.3f \n", (double)bm->bm_cache_size / 256);
+	if (cache_size - nr_buffers < NVFUSE_INITIAL_BUFFER_SIZE_DATA) {
+		printf(" Warninig: current buffer size = %.3f \n", (double)cache_size / 256);
 		return -1;
 	}
 
-	if (nr_buffers > bm->bm_list_count[BUFFER_TYPE_UNUSED]) {
+	if (nr_buffers > unused_count) {
 		printf(" Warninig: current unused buffer size = %.3f \n",
-		       (double)bm->bm_list_count[BUFFER_TYPE_UNUSED] / 256);
+		       (double)unused_count / 256);
 		return -1;
 	}
 
 	//printf(" remove buffer cache (%d 4K pages) to process\n", nr);
-	head = &sb->sb_bm->bm_list[BUFFER_TYPE_UNUSED];
-	list_for_each_safe(ptr, temp, head) {
-		bc = (struct nvfuse_buffer_cache *)list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
-
-		if (bc->bc_bh_count)
-			nvfuse_remove_bhs_in_bc(sb, bc);
-
-		assert(!bc->bc_bh_count);
-		assert(!bc->bc_dirty);
-		list_del(&bc->bc_list);
-		hlist_del(&bc->bc_hash);
 
-		nvfuse_free_aligned_buffer(bc->bc_buf);
-		nvfuse_free_bc(sb, bc);
-
-		bm->bm_hash_count[HASH_NUM]--;
-		bm->bm_list_count[BUFFER_TYPE_UNUSED]--;
-		bm->bm_cache_size--;
-
-		if (--nr_buffers == 0)
-			break;
-	}
+	/*
+	 * Buffers in the last chunks of arena are released first, so that
+	 * shrinking returns whole hugepage regions rather than leaving
+	 * holes in every chunk.
+	 */
+	min_idx = (arena->ba_nr_used - nr_buffers + arena->ba_chunk_pages - 1) /
+		  arena->ba_chunk_pages * arena->ba_chunk_pages;
+	nr_buffers = nvfuse_remove_unused_bc(sb, nr_buffers, min_idx);
+	if (nr_buffers)
+		nvfuse_remove_unused_bc(sb, nr_buffers, 0);
 
 	return 0;
 }
 
 
-int nvfuse_add_buffer_cache(struct nvfuse_superblock *sb, int nr)
+static int nvfuse_add_buffer_cache_shard(struct nvfuse_superblock *sb,
+					 struct nvfuse_buffer_manager *bm, int nr)
 {
-	struct nvfuse_buffer_manager *bm = sb->sb_bm;
 	struct nvfuse_buffer_cache *bc;
+	struct list_head added;
+	s32 cache_size = nvfuse_get_cache_size(sb);
+	s32 count = 0;
+	s32 ret = 0;
 
 	assert(nr > 0);
 
 	if (nvfuse_process_model_is_dataplane() &&
-	    bm->bm_cache_size / 256 >= NVFUSE_MAX_BUFFER_SIZE_DATA) {
-		printf(" Current buffer size = %.3f \n", (double)bm->bm_cache_size / 256);
+	    cache_size / 256 >= NVFUSE_MAX_BUFFER_SIZE_DATA) {
+		printf(" Current buffer size = %.3f \n", (double)cache_size / 256);
 		return -1;
 	}
 
 	//printf(" Add buffer cache (%d 4K pages) to process\n", nr);
 
+	/* pages are cleared by nvfuse_init_bc() when they are taken */
+	INIT_LIST_HEAD(&added);
 	while (nr--) {
 		bc = nvfuse_alloc_bc(sb);
 		if (!bc) {
-			return -1;
+			ret = -1;
+			break;
 		}
 
 		bc->bc_sb = sb;
-		bc->bc_buf = (s8 *)nvfuse_alloc_aligned_buffer(CLUSTER_SIZE);
-		if (bc->bc_buf == NULL) {
-			printf(" %s:%d: nvfuse_malloc error \n", __FUNCTION__, __LINE__);
-#ifdef SPDK_ENABLED
-			printf(" Please, increase # of huge pages in scripts/setup.sh\n");
-#endif
-			return -1;
-		}
-
-		memset(bc->bc_buf, 0x00, CLUSTER_SIZE);
-
-		list_add(&bc->bc_list, &bm->bm_list[BUFFER_TYPE_UNUSED]);
-		hlist_add_head(&bc->bc_hash, &bm->bm_hash[HASH_NUM]);
-		bm->bm_hash_count[HASH_NUM]++;
-		bm->bm_list_count[BUFFER_TYPE_UNUSED]++;
-		bm->bm_cache_size++;
+		bc->bc_bm = bm;
+		list_add(&bc->bc_list, &added);
+		count++;
 	}
 
+	nvfuse_bm_lock(bm);
+	list_splice(&added, &bm->bm_list[BUFFER_TYPE_UNUSED]);
+	bm->bm_list_count[BUFFER_TYPE_UNUSED] += count;
+	bm->bm_cache_size += count;
+	nvfuse_bm_unlock(bm);
+
 #if 0
 	printf(" Buffer Size = %.3f MB\n", (double)bm->bm_cache_size / 256);
 	printf(" buffer Unused = %.3f MB\n", (double)bm->bm_list_count[BUFFER_TYPE_UNUSED] / 256);
 #endif
 
+	return ret;
+}
+
+/* new buffers are given to the smallest shard in batches */
+int nvfuse_add_buffer_cache(struct nvfuse_superblock *sb, int nr)
+{
+	struct nvfuse_buffer_manager *bm;
+	s32 batch;
+	s32 i;
+
+	assert(nr > 0);
+
+	while (nr) {
+		bm = sb->sb_bm[0];
+		for (i = 1; i < NVFUSE_BC_SHARDS; i++) {
+			if (sb->sb_bm[i]->bm_cache_size < bm->bm_cache_size)
+				bm = sb->sb_bm[i];
+		}
+
+		batch = sb->bc_arena->ba_chunk_pages / NVFUSE_BC_SHARDS;
+		if (batch == 0)
+			batch = 1;
+		if (batch > nr)
+			batch = nr;
+
+		if (nvfuse_add_buffer_cache_shard(sb, bm, batch) < 0)
+			return -1;
+		nr -= batch;
+	}
+
 	return 0;
 }
 
@@ -463,9 +1047,11 @@ int nvfuse_add_buffer_cache(struct nvfuse_superblock *sb, int nr)
 int nvfuse_init_buffer_cache(struct nvfuse_superblock *sb, s32 buffer_size)
 {
 	struct nvfuse_buffer_manager *bm;
+	struct nvfuse_bc_part *part;
 	s32 buffer_size_in_4k;
 	s8 mempool_name[16];
 	s32 mempool_size;
+	s32 shard;
 	s32 i;
 
 	sprintf(mempool_name, "nvfuse_bh_%d", rte_lcore_id());
@@ -484,45 +1070,53 @@ int nvfuse_init_buffer_cache(struct nvfuse_superblock *sb, s32 buffer_size)
 		exit(0);
 	}
 
-	sprintf(mempool_name, "nvfuse_bc");
+	/* each process carves its own buffers out of hugepage regions */
+	sb->bc_arena = (struct nvfuse_bc_arena *)nvfuse_malloc(sizeof(struct nvfuse_bc_arena));
+	if (sb->bc_arena == NULL) {
+		printf(" %s:%d: nvfuse_malloc error \n", __FUNCTION__, __LINE__);
+		return -1;
+	}
 
-	/* mempool is created by a primary process and shared to all processes. */
-	if (spdk_process_is_primary() || nvfuse_process_model_is_standalone()) {
-		mempool_size = NVFUSE_BC_MEMPOOL_TOTAL_SIZE;
-		printf(" create mempool for bc head size = %d \n",
-		       (int)(mempool_size * sizeof(struct nvfuse_buffer_cache)));
-		sb->bc_mempool = (struct spdk_mempool *)spdk_mempool_create(mempool_name, mempool_size,
-				 sizeof(struct nvfuse_buffer_cache), NVFUSE_BC_MEMPOOL_CACHE_SIZE, -1);
-		if (sb->bc_mempool == NULL) {
-			fprintf(stderr, " Error: allocation of bc mempool \n");
-			exit(0);
+	if (nvfuse_bc_arena_init(sb->bc_arena, sb->io_manager) < 0)
+		return -1;
+
+	/* shards are allocated separately not to share cache lines */
+	for (shard = 0; shard < NVFUSE_BC_SHARDS; shard++) {
+		bm = (struct nvfuse_buffer_manager *)spdk_malloc(sizeof(struct nvfuse_buffer_manager), 0, NULL);
+		if (bm == NULL) {
+			printf(" %s:%d: nvfuse_malloc error \n", __FUNCTION__, __LINE__);
+			return -1;
 		}
-	} else {
-		printf(" use shared mempool for bc head size = %d \n",
-		       (int)(mempool_size * sizeof(struct nvfuse_buffer_cache)));
-		sb->bc_mempool = (struct spdk_mempool *)rte_mempool_lookup(mempool_name);
-		if (sb->bc_mempool == NULL) {
-			fprintf(stderr, " Error: allocation of bc mempool \n");
-			exit(0);
+		memset(bm, 0x00, sizeof(struct nvfuse_buffer_manager));
+		sb->sb_bm[shard] = bm;
+
+		pthread_mutex_init(&bm->bm_lock, NULL);
+		bm->bm_id = shard;
+
+		for (i = BUFFER_TYPE_UNUSED; i < BUFFER_TYPE_NUM; i++) {
+			INIT_LIST_HEAD(&bm->bm_list[i]);
+			bm->bm_list_count[i] = 0;
 		}
-	}
 
-	bm = (struct nvfuse_buffer_manager *)spdk_malloc(sizeof(struct nvfuse_buffer_manager), 0, NULL);
-	if (bm == NULL) {
-		printf(" %s:%d: nvfuse_malloc error \n", __FUNCTION__, __LINE__);
-		return -1;
-	}
-	memset(bm, 0x00, sizeof(struct nvfuse_buffer_manager));
-	sb->sb_bm = bm;
+		for (i = 0; i < NVFUSE_BC_PART_NUM; i++) {
+			part = &bm->bm_part[i];
+			INIT_LIST_HEAD(&part->bp_clean);
+			part->bp_nr_clean = 0;
+			part->bp_size = 0;
+			if (i == NVFUSE_BC_PART_META) {
+				part->bp_min_percent = NVFUSE_BC_META_MIN_PERCENT;
+				part->bp_max_percent = NVFUSE_BC_META_MAX_PERCENT;
+			} else {
+				part->bp_min_percent = NVFUSE_BC_DATA_MIN_PERCENT;
+				part->bp_max_percent = NVFUSE_BC_DATA_MAX_PERCENT;
+			}
+		}
 
-	for (i = BUFFER_TYPE_UNUSED; i < BUFFER_TYPE_NUM; i++) {
-		INIT_LIST_HEAD(&bm->bm_list[i]);
-		bm->bm_list_count[i] = 0;
-	}
+		if (nvfuse_index_init(&bm->bm_index, NVFUSE_INDEX_MIN_SIZE) < 0)
+			return -1;
 
-	for (i = 0; i < HASH_NUM + 1; i++) {
-		INIT_HLIST_HEAD(&bm->bm_hash[i]);
-		bm->bm_hash_count[i] = 0;
+		if (nvfuse_bc_policy_init(bm, sb->sb_nvh->nvh_params.bc_policy) < 0)
+			return -1;
 	}
 
 	if (nvfuse_process_model_is_standalone()) {
@@ -558,67 +1152,83 @@ int nvfuse_init_buffer_cache(struct nvfuse_superblock *sb, s32 buffer_size)
 	}
 
 	/* alloc unsed list buffer cache */
-	for (i = 0; i < buffer_size_in_4k; i++) {
-		s32 res;
-
-		res = nvfuse_add_buffer_cache(sb, 1);
-		if (res < 0) {
-			printf(" Error: buffer cannot be allocated. \n");
-			break;
-		}
-	}
+	if (nvfuse_add_buffer_cache(sb, buffer_size_in_4k) < 0)
+		printf(" Error: buffer cannot be allocated. \n");
 
 	//rte_malloc_dump_stats(stdout, NULL);
 
 	return 0;
 }
 
-void nvfuse_deinit_buffer_cache(struct nvfuse_superblock *sb)
+static s32 nvfuse_free_bc_list(struct nvfuse_superblock *sb, struct list_head *head)
 {
-	struct list_head *head;
 	struct list_head *ptr, *temp;
 	struct nvfuse_buffer_cache *bc;
-	s32 type;
 	s32 removed_count = 0;
 
-	/* dealloc buffer cache */
-	for (type = BUFFER_TYPE_UNUSED; type < BUFFER_TYPE_NUM; type++) {
-		head = &sb->sb_bm->bm_list[type];
-		list_for_each_safe(ptr, temp, head) {
-			bc = (struct nvfuse_buffer_cache *)list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+	list_for_each_safe(ptr, temp, head) {
+		bc = (struct nvfuse_buffer_cache *)list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
 
-			if (bc->bc_bh_count)
-				nvfuse_remove_bhs_in_bc(sb, bc);
+		if (bc->bc_bh_count)
+			nvfuse_remove_bhs_in_bc(sb, bc);
 
-			assert(!bc->bc_bh_count);
-			assert(!bc->bc_dirty);
-			list_del(&bc->bc_list);
-			nvfuse_free_aligned_buffer(bc->bc_buf);
-			nvfuse_free_bc(sb, bc);
-			removed_count++;
-		}
+		assert(!bc->bc_bh_count);
+		assert(!bc->bc_dirty);
+		list_del(&bc->bc_list);
+		nvfuse_free_bc(sb, bc);
+		removed_count++;
+	}
+
+	return removed_count;
+}
+
+void nvfuse_deinit_buffer_cache(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_buffer_manager *bm;
+	s32 cache_size = nvfuse_get_cache_size(sb);
+	s32 shard;
+	s32 type;
+	s32 removed_count = 0;
+
+	/* dealloc buffer cache */
+	for (shard = 0; shard < NVFUSE_BC_SHARDS; shard++) {
+		bm = sb->sb_bm[shard];
+		for (type = BUFFER_TYPE_UNUSED; type < BUFFER_TYPE_NUM; type++)
+			removed_count += nvfuse_free_bc_list(sb, &bm->bm_list[type]);
+
+		/* clean buffers are linked to partition lists */
+		for (type = 0; type < NVFUSE_BC_PART_NUM; type++)
+			removed_count += nvfuse_free_bc_list(sb, &bm->bm_part[type].bp_clean);
 	}
 
-	assert(removed_count == sb->sb_bm->bm_cache_size);
+	assert(removed_count == cache_size);
 	if (!spdk_process_is_primary() && nvfuse_process_model_is_dataplane()) {
 		nvfuse_send_dealloc_buffer_req(sb->sb_nvh, removed_count);
 	}
 
 	spdk_mempool_free(sb->bh_mempool);
 
-	if (spdk_process_is_primary()) {
-		spdk_mempool_free(sb->bc_mempool);
-	}
-	printf(" > buffer cache hit rate = %f \n",
-	       (double)sb->sb_bm->bm_cache_hit / sb->sb_bm->bm_cache_ref);
+	nvfuse_bc_arena_deinit(sb->bc_arena);
+	nvfuse_free(sb->bc_arena);
+	sb->bc_arena = NULL;
 
-	spdk_free(sb->sb_bm);
+	nvfuse_bc_policy_print_stat(sb);
+
+	for (shard = 0; shard < NVFUSE_BC_SHARDS; shard++) {
+		nvfuse_bc_policy_deinit(sb->sb_bm[shard]);
+		nvfuse_index_deinit(&sb->sb_bm[shard]->bm_index);
+		pthread_mutex_destroy(&sb->sb_bm[shard]->bm_lock);
+		spdk_free(sb->sb_bm[shard]);
+		sb->sb_bm[shard] = NULL;
+	}
 }
 
 void nvfuse_mark_dirty_bh(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *bh)
 {
 	assert(bh != NULL);
 
+	if (!bh->bh_bc->bc_dirty)
+		bh->bh_bc->bc_dirty_tsc = spdk_get_ticks();
 	bh->bh_bc->bc_dirty = 1;
 	set_bit(&bh->bh_status, BUFFER_STATUS_DIRTY);
 	if (bh->bh_ictx) {
@@ -736,7 +1346,9 @@ s32 nvfuse_forget_bh(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *bh
 	struct nvfuse_buffer_cache *bc;
 
 	bc = bh->bh_bc;
+	nvfuse_bm_lock(bc->bc_bm);
 	bc->bc_ref--;
+	nvfuse_bm_unlock(bc->bc_bm);
 	nvfuse_remove_bhs_in_bc(sb, bc);
 
 	bc->bc_dirty = 0;
@@ -763,20 +1375,25 @@ s32 nvfuse_release_bh(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *b
 
 	bc = bh->bh_bc;
 
+	/* reference and list are changed together with respect to victim selection */
+	nvfuse_bm_lock(bc->bc_bm);
 	bc->bc_ref--;
 	assert(bc->bc_ref >= 0);
 
 	if (dirty || bc->bc_dirty) {
+		if (!bc->bc_dirty)
+			bc->bc_dirty_tsc = spdk_get_ticks();
 		bc->bc_dirty = 1;
 		bc->bc_load = 1;
-		nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_DIRTY, tail);
+		__nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_DIRTY, tail);
 	} else {
 		bc->bc_dirty = 0;
 		if (bc->bc_ref == 0)
-			nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_CLEAN, tail);
+			__nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_CLEAN, tail);
 		else
-			nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_REF, tail);
+			__nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_REF, tail);
 	}
+	nvfuse_bm_unlock(bc->bc_bm);
 
 	if (dirty)
 		set_bit(&bh->bh_status, BUFFER_STATUS_DIRTY);
@@ -836,6 +1453,7 @@ void nvfuse_remove_bhs_in_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_
 		/* FIXME: */
 		if (ictx->ictx_bh == bh) {
 			ictx->ictx_bh = NULL;
+			/* caller may hold shard lock (e.g., arena shrink) */
 			bc->bc_ref--;
 		}
 
@@ -930,55 +1548,43 @@ struct nvfuse_buffer_head *nvfuse_find_bh_in_ictx(struct nvfuse_superblock *sb,
 }
 
 
-__inline void unused_count_dec(struct nvfuse_superblock *sb)
+s32 nvfuse_get_list_count(struct nvfuse_superblock *sb, s32 buffer_type)
 {
-	sb->sb_bm->bm_list_count[BUFFER_TYPE_UNUSED]--;
-}
+	s32 count = 0;
+	s32 i;
 
-__inline void unused_count_inc(struct nvfuse_superblock *sb)
-{
-	sb->sb_bm->bm_list_count[BUFFER_TYPE_UNUSED]++;
-}
+	for (i = 0; i < NVFUSE_BC_SHARDS; i++)
+		count += sb->sb_bm[i]->bm_list_count[buffer_type];
 
-__inline void clean_count_dec(struct nvfuse_superblock *sb)
-{
-	sb->sb_bm->bm_list_count[BUFFER_TYPE_CLEAN]--;
+	return count;
 }
 
-__inline void clean_count_inc(struct nvfuse_superblock *sb)
+s32 nvfuse_get_cache_size(struct nvfuse_superblock *sb)
 {
-	sb->sb_bm->bm_list_count[BUFFER_TYPE_CLEAN]++;
-}
+	s32 size = 0;
+	s32 i;
 
-__inline void dirty_count_dec(struct nvfuse_superblock *sb)
-{
-	sb->sb_bm->bm_list_count[BUFFER_TYPE_DIRTY]--;
-}
+	for (i = 0; i < NVFUSE_BC_SHARDS; i++)
+		size += sb->sb_bm[i]->bm_cache_size;
 
-__inline void dirty_count_inc(struct nvfuse_superblock *sb)
-{
-	sb->sb_bm->bm_list_count[BUFFER_TYPE_DIRTY]++;
+	return size;
 }
 
-__inline s32 nvfuse_get_dirty_count(struct nvfuse_superblock *sb)
+s32 nvfuse_get_dirty_count(struct nvfuse_superblock *sb)
 {
-	return sb->sb_bm->bm_list_count[BUFFER_TYPE_DIRTY];
+	return nvfuse_get_list_count(sb, BUFFER_TYPE_DIRTY);
 }
 
 struct nvfuse_inode_ctx *nvfuse_ictx_hash_lookup(struct nvfuse_ictx_manager *ictxc, inode_t ino)
 {
-	struct hlist_node *node;
-	struct hlist_head *head;
-	struct nvfuse_inode_ctx *ictx;
-
-	head = &ictxc->ictxc_hash[ino % HASH_NUM];
-	hlist_for_each(node, head) {
-		ictx = hlist_entry(node, struct nvfuse_inode_ctx, ictx_hash);
-		if (ictx->ictx_ino == ino)
-			return ictx;
-	}
+	return (struct nvfuse_inode_ctx *)nvfuse_index_lookup(&ictxc->ictxc_index, ino);
+}
 
-	return NULL;
+/* unused ictxs are not kept in index */
+static void nvfuse_ictx_index_del(struct nvfuse_ictx_manager *ictxc, struct nvfuse_inode_ctx *ictx)
+{
+	if (nvfuse_index_lookup(&ictxc->ictxc_index, ictx->ictx_ino) == ictx)
+		nvfuse_index_remove(&ictxc->ictxc_index, ictx->ictx_ino);
 }
 
 struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb)
@@ -1020,13 +1626,10 @@ struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb)
 
 	/* remove list */
 	list_del(&ictx->ictx_cache_list);
-	/* remove hlist */
-	hlist_del(&ictx->ictx_hash);
+	/* remove index */
+	if (type != BUFFER_TYPE_UNUSED)
+		nvfuse_ictx_index_del(ictxc, ictx);
 	ictxc->ictxc_list_count[type]--;
-	if (type == BUFFER_TYPE_UNUSED)
-		ictxc->ictxc_hash_count[HASH_NUM]--;
-	else
-		ictxc->ictxc_hash_count[ictx->ictx_ino % HASH_NUM]--;
 	return ictx;
 }
 
@@ -1046,9 +1649,9 @@ void nvfuse_insert_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *i
 	inode_t ino = ictx->ictx_ino;
 	s32 type = BUFFER_TYPE_REF;
 
-	/* hash list insertion */
-	hlist_add_head(&ictx->ictx_hash, &ictxc->ictxc_hash[ino % HASH_NUM]);
-	ictxc->ictxc_hash_count[ino % HASH_NUM]++;
+	/* index insertion */
+	if (nvfuse_index_insert(&ictxc->ictxc_index, ino, ictx) < 0)
+		printf(" Error: ictx (ino = %d) cannot be indexed\n", ino);
 
 	/* list insertion */
 	list_add(&ictx->ictx_cache_list, &ictxc->ictxc_list[type]);
@@ -1079,6 +1682,9 @@ void nvfuse_init_ictx(struct nvfuse_inode_ctx *ictx)
 
 	ictx->ictx_meta_dirty_count = 0;
 	ictx->ictx_data_dirty_count = 0;
+#ifdef NVFUSE_USE_MAP_CACHE
+	nvfuse_map_cache_init(ictx);
+#endif
 
 	ictx->ictx_type = 0;
 	ictx->ictx_status = 0;
@@ -1115,6 +1721,9 @@ struct nvfuse_inode_ctx *nvfuse_get_ictx(struct nvfuse_superblock *sb, inode_t i
 
 			ictx->ictx_meta_dirty_count = 0;
 			ictx->ictx_data_dirty_count = 0;
+#ifdef NVFUSE_USE_MAP_CACHE
+			nvfuse_map_cache_init(ictx);
+#endif
 			ictx->ictx_ino = ino;
 			ictx->ictx_status = 0;
 			ictx->ictx_ref = 0;
@@ -1129,6 +1738,7 @@ void nvfuse_move_ictx_list(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx
 			   s32 desired_type)
 {
 	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
+	s32 old_type = ictx->ictx_type;
 
 	list_del(&ictx->ictx_cache_list);
 	ictxc->ictxc_list_count[ictx->ictx_type]--;
@@ -1138,13 +1748,12 @@ void nvfuse_move_ictx_list(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx
 	list_add(&ictx->ictx_cache_list, &ictxc->ictxc_list[ictx->ictx_type]);
 	ictxc->ictxc_list_count[ictx->ictx_type]++;
 
-	hlist_del(&ictx->ictx_hash);
 	if (desired_type == BUFFER_TYPE_UNUSED) {
-		hlist_add_head(&ictx->ictx_hash, &ictxc->ictxc_hash[HASH_NUM]);
-		ictxc->ictxc_hash_count[HASH_NUM]++;
-	} else {
-		hlist_add_head(&ictx->ictx_hash, &ictxc->ictxc_hash[ictx->ictx_ino % HASH_NUM]);
-		ictxc->ictxc_hash_count[ictx->ictx_ino % HASH_NUM]++;
+		if (old_type != BUFFER_TYPE_UNUSED)
+			nvfuse_ictx_index_del(ictxc, ictx);
+	} else if (old_type == BUFFER_TYPE_UNUSED) {
+		if (nvfuse_index_lookup(&ictxc->ictxc_index, ictx->ictx_ino) == NULL)
+			nvfuse_index_insert(&ictxc->ictxc_index, ictx->ictx_ino, ictx);
 	}
 }
 
@@ -1208,10 +1817,8 @@ int nvfuse_init_ictx_cache(struct nvfuse_superblock *sb)
 		ictxc->ictxc_list_count[i] = 0;
 	}
 
-	for (i = 0; i < HASH_NUM + 1; i++) {
-		INIT_HLIST_HEAD(&ictxc->ictxc_hash[i]);
-		ictxc->ictxc_hash_count[i] = 0;
-	}
+	if (nvfuse_index_init(&ictxc->ictxc_index, NVFUSE_INDEX_MIN_SIZE) < 0)
+		return -1;
 
 	ictxc->ictx_buf = spdk_malloc(sizeof(struct nvfuse_inode_ctx) * NVFUSE_ICTXC_SIZE, 0, NULL);
 
@@ -1224,8 +1831,6 @@ int nvfuse_init_ictx_cache(struct nvfuse_superblock *sb)
 		ictx = ((struct nvfuse_inode_ctx *)ictxc->ictx_buf) + i;
 
 		list_add(&ictx->ictx_cache_list, &ictxc->ictxc_list[BUFFER_TYPE_UNUSED]);
-		hlist_add_head(&ictx->ictx_hash, &ictxc->ictxc_hash[HASH_NUM]);
-		ictxc->ictxc_hash_count[HASH_NUM]++;
 		ictxc->ictxc_list_count[BUFFER_TYPE_UNUSED]++;
 	}
 
@@ -1253,6 +1858,7 @@ void nvfuse_deinit_ictx_cache(struct nvfuse_superblock *sb)
 	/* deallocate whole ictx buffer */
 	spdk_free(sb->sb_ictxc->ictx_buf);
 	assert(removed_count == NVFUSE_ICTXC_SIZE);
+	nvfuse_index_deinit(&sb->sb_ictxc->ictxc_index);
 	spdk_free(sb->sb_ictxc);
 }
 
@@ -556,6 +556,10 @@ s32 nvfuse_destroy_containers_for_app_unregistration(struct nvfuse_handle *nvh,
 			continue;
 
 		bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, container_id, READ, NVFUSE_TYPE_META);
+		if (bd_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return -1;
+		}
 		bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 
 		/* format bg (container) summary with initial value */
@@ -565,11 +569,19 @@ s32 nvfuse_destroy_containers_for_app_unregistration(struct nvfuse_handle *nvh,
 
 		/* clear data bitmap tables */
 		dbitmap_bh = nvfuse_get_bh(sb, NULL, DBITMAP_INO, container_id, READ, NVFUSE_TYPE_META);
+		if (dbitmap_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return -1;
+		}
 		memset(dbitmap_bh->bh_buf, 0x00, CLUSTER_SIZE);
 		nvfuse_release_bh(sb, dbitmap_bh, 0, DIRTY);
 
 		/* clear inode bitmap tables */
 		ibitmap_bh = nvfuse_get_bh(sb, NULL, IBITMAP_INO, container_id, READ, NVFUSE_TYPE_META);
+		if (ibitmap_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return -1;
+		}
 		memset(ibitmap_bh->bh_buf, 0x00, CLUSTER_SIZE);
 		nvfuse_release_bh(sb, ibitmap_bh, 0, DIRTY);
 		nvfuse_get_dirty_count(sb);
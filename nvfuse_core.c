@@ -44,8 +44,13 @@
 #include "nvfuse_buffer_cache.h"
 #include "nvfuse_core.h"
 #include "nvfuse_io_manager.h"
+#include "nvfuse_io_channel.h"
 #include "nvfuse_gettimeofday.h"
 #include "nvfuse_indirect.h"
+#include "nvfuse_extent.h"
+#include "nvfuse_readahead.h"
+#include "nvfuse_writeback.h"
+#include "nvfuse_aio.h"
 #include "nvfuse_bp_tree.h"
 #include "nvfuse_config.h"
 #include "nvfuse_malloc.h"
@@ -201,6 +206,9 @@ void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 	u64 key;
 	s32 unused_count = 0;
 
+	/* buffers pinned by readahead must be released before truncation */
+	nvfuse_ra_wait_all(sb);
+
 	inode = ictx->ictx_inode;
 
 	num_block = NVFUSE_SIZE_TO_BLK(inode->i_size);
@@ -208,6 +216,12 @@ void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 	if (inode->i_size & (CLUSTER_SIZE - 1))
 		num_block++;
 
+	/* inline data is moved to a block even if file grows by whole blocks */
+	if (nvfuse_inode_has_inline_data(inode) && size > NVFUSE_INLINE_DATA_SIZE) {
+		nvfuse_truncate_blocks(sb, ictx, size);
+		return;
+	}
+
 	/* debug code
 	*if(trun_num_block)
 	*	printf(" trun num block = %d\n", trun_num_block);
@@ -222,8 +236,9 @@ void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 	 */
 
 	for (offset = num_block - 1; offset >= trun_num_block; offset--) {
+		nvfuse_wb_wait_block(sb, inode->i_ino, offset);
 		nvfuse_make_pbno_key(inode->i_ino, offset, &key, NVFUSE_BP_TYPE_DATA);
-		bc = (struct nvfuse_buffer_cache *)nvfuse_hash_lookup(sb->sb_bm, key);
+		bc = (struct nvfuse_buffer_cache *)nvfuse_hash_lookup(sb, key);
 		if (bc) {
 			nvfuse_remove_bhs_in_bc(sb, bc);
 
@@ -242,15 +257,19 @@ void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 	}
 
 	if (!sb->sb_nvh->nvh_params.preallocation && nvfuse_process_model_is_dataplane()) {
-		while (unused_count--) {
-			if (sb->sb_bm->bm_list_count[BUFFER_TYPE_UNUSED] >= NVFUSE_BUFFER_DEFAULT_ALLOC_SIZE_PER_MSG) {
-				res = nvfuse_remove_buffer_cache(sb, NVFUSE_BUFFER_DEFAULT_ALLOC_SIZE_PER_MSG);
+		s32 nr_buffers = NVFUSE_BUFFER_DEFAULT_ALLOC_CHUNKS_PER_MSG * sb->bc_arena->ba_chunk_pages;
+
+		/* buffers are returned to control plane in arena chunk unit */
+		while (unused_count >= nr_buffers) {
+			if (nvfuse_get_list_count(sb, BUFFER_TYPE_UNUSED) >= nr_buffers) {
+				res = nvfuse_remove_buffer_cache(sb, nr_buffers);
 				if (res == 0) {
-					nvfuse_send_dealloc_buffer_req(sb->sb_nvh, NVFUSE_BUFFER_DEFAULT_ALLOC_SIZE_PER_MSG);
+					nvfuse_send_dealloc_buffer_req(sb->sb_nvh, nr_buffers);
 				}
 			} else {
 				break;
 			}
+			unused_count -= nr_buffers;
 		}
 	}
 
@@ -258,6 +277,61 @@ void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 	nvfuse_truncate_blocks(sb, ictx, size);
 }
 
+/*
+ * move inline data of inode to the first data block. The block is allocated
+ * and filled before the inline area is given to block mapping, so inline data
+ * is kept if either of them fails.
+ */
+s32 nvfuse_inline_data_convert(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	struct nvfuse_buffer_head *bh;
+	u32 pblock = 0;
+	u32 size;
+
+	assert(nvfuse_inode_has_inline_data(inode));
+	assert(inode->i_size <= NVFUSE_INLINE_DATA_SIZE);
+
+	size = (u32)inode->i_size;
+	if (size == 0) {
+		/* the area is used for block mapping from now on */
+		memset(inode->i_inline_data, 0x00, NVFUSE_INLINE_DATA_SIZE);
+		inode->i_flags &= ~NVFUSE_INODE_FLAG_INLINE_DATA;
+		nvfuse_mark_inode_dirty(ictx);
+		return 0;
+	}
+
+	if (nvfuse_alloc_free_block(sb, inode, &pblock, 1) != 1) {
+		printf(" Error: data block allocation for inline data (ino = %d)\n", inode->i_ino);
+		return -1;
+	}
+
+	/* inline inode has no mapping, so bc gets its address here */
+	bh = nvfuse_get_new_bh(sb, ictx, inode->i_ino, 0, NVFUSE_TYPE_DATA);
+	if (bh == NULL) {
+		printf(" Error: get_new_bh() for inline data (ino = %d)\n", inode->i_ino);
+		nvfuse_free_blocks(sb, pblock, 1);
+		return -1;
+	}
+
+	bh->bh_bc->bc_pno = pblock;
+	memset(bh->bh_buf, 0x00, CLUSTER_SIZE);
+	memcpy(bh->bh_buf, inode->i_inline_data, size);
+
+	/* data is in the block, the area is used for block mapping from now on */
+	memset(inode->i_inline_data, 0x00, NVFUSE_INLINE_DATA_SIZE);
+	inode->i_flags &= ~NVFUSE_INODE_FLAG_INLINE_DATA;
+	if (nvfuse_extent_enabled(sb))
+		nvfuse_ext_format_root(inode, 0, pblock, 1);
+	else
+		inode->i_blocks[0] = pblock;
+	nvfuse_mark_inode_dirty(ictx);
+
+	nvfuse_release_bh(sb, bh, 0, DIRTY);
+
+	return 0;
+}
+
 inode_t nvfuse_alloc_new_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
 {
 	struct nvfuse_buffer_head *bh;
@@ -292,6 +366,10 @@ inode_t nvfuse_alloc_new_inode(struct nvfuse_superblock *sb, struct nvfuse_inode
 
 
 	bh = nvfuse_get_bh(sb, ictx, ITABLE_INO, search_block, READ, NVFUSE_TYPE_META);
+	if (bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return 0;
+	}
 	ip = (struct nvfuse_inode *)bh->bh_buf;
 #ifdef NVFUSE_USE_MKFS_INODE_ZEROING
 	for (j = 0; j < INODE_ENTRY_NUM; j++) {
@@ -348,10 +426,19 @@ void nvfuse_release_ibitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 ino)
 	void *buf;
 
 	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bd_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return;
+	}
 	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 	assert(bd->bd_id == bg_id);
 
 	bh = nvfuse_get_bh(sb, NULL, IBITMAP_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bh == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_bh(sb, bd_bh, 0, CLEAN);
+		return;
+	}
 	buf = bh->bh_buf;
 
 	if (ext2fs_test_bit(ino % bd->bd_max_inodes, buf)) {
@@ -372,6 +459,10 @@ void nvfuse_inc_free_inodes(struct nvfuse_superblock *sb, inode_t ino)
 
 	bg_id = ino / sb->sb_no_of_inodes_per_bg;
 	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bd_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return;
+	}
 	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 	assert(bd->bd_id == bg_id);
 
@@ -403,6 +494,10 @@ void nvfuse_dec_free_inodes(struct nvfuse_superblock *sb, inode_t ino)
 
 	bg_id = ino / sb->sb_no_of_inodes_per_bg;
 	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bd_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return;
+	}
 	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 	assert(bd->bd_id == bg_id);
 
@@ -423,6 +518,10 @@ void nvfuse_inc_free_blocks(struct nvfuse_superblock *sb, u32 blockno, u32 cnt)
 
 	bg_id = blockno / sb->sb_no_of_blocks_per_bg;
 	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bd_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return;
+	}
 	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 	assert(bd->bd_id == bg_id);
 
@@ -457,6 +556,10 @@ void nvfuse_update_owner_in_bd_info(struct nvfuse_superblock *sb, s32 bg_id)
 	struct nvfuse_buffer_head *bd_bh;
 
 	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bd_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return;
+	}
 	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 	bd->bd_owner = sb->asb.asb_core_id;
 
@@ -477,10 +580,19 @@ u32 nvfuse_scan_free_ibitmap(struct nvfuse_superblock *sb, struct nvfuse_inode_c
 	u32 found = 0;
 
 	bd_bh = nvfuse_get_bh(sb, ictx, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bd_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return 0;
+	}
 	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 	assert(bd->bd_id == bg_id);
 
 	bh = nvfuse_get_bh(sb, ictx, IBITMAP_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bh == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_bh(sb, bd_bh, 0, CLEAN);
+		return 0;
+	}
 	buf = bh->bh_buf;
 
 	while (bd->bd_free_inodes && count < sb->sb_no_of_inodes_per_bg) {
@@ -626,6 +738,10 @@ void nvfuse_dec_free_blocks(struct nvfuse_superblock *sb, u32 blockno, u32 cnt)
 
 	bg_id = blockno / sb->sb_no_of_blocks_per_bg;
 	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bd_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return;
+	}
 	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 	assert(bd->bd_id == bg_id);
 
@@ -718,6 +834,62 @@ RESET:
 	}
 }
 
+#ifdef NVFUSE_USE_DELAYED_BPTREE_CREATION
+/*
+ * Build bptree of a directory which outgrows NVFUSE_DIR_INDEX_THRESHOLD.
+ * Dentries stored so far are indexed except for the one at skip_offset,
+ * which is inserted by the caller.
+ */
+static s32 nvfuse_promote_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode,
+				       u32 skip_offset)
+{
+	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_buffer_head *dir_bh = NULL;
+	struct nvfuse_dir_entry *dir = NULL;
+	u32 dir_num, entry;
+	s32 ret;
+
+	ret = nvfuse_create_bptree(sb, inode);
+	if (ret) {
+		printf(" bptree allocation fails.");
+		return NVFUSE_ERROR;
+	}
+
+	ictx = nvfuse_read_inode(sb, NULL, inode->i_ino);
+	nvfuse_mark_inode_dirty(ictx);
+
+	dir_num = inode->i_size / DIR_ENTRY_SIZE;
+	for (entry = 0; entry < dir_num; entry++, dir++) {
+		if (!(entry % DIR_ENTRY_NUM)) {
+			if (dir_bh)
+				nvfuse_release_bh(sb, dir_bh, 0, CLEAN);
+			dir_bh = nvfuse_get_bh(sb, ictx, inode->i_ino, entry / DIR_ENTRY_NUM, READ,
+					       NVFUSE_TYPE_META);
+			if (dir_bh == NULL) {
+				printf(" Error: get_bh()\n");
+				nvfuse_release_inode(sb, ictx, DIRTY);
+				return NVFUSE_ERROR;
+			}
+			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
+		}
+
+		if (entry == skip_offset || dir->d_flag != DIR_USED)
+			continue;
+
+		if (!strcmp(dir->d_filename, ".") || !strcmp(dir->d_filename, ".."))
+			continue;
+
+		nvfuse_set_dir_indexing(sb, inode, dir->d_filename, entry);
+	}
+
+	if (dir_bh)
+		nvfuse_release_bh(sb, dir_bh, 0, CLEAN);
+	nvfuse_release_inode(sb, ictx, DIRTY);
+
+	return 0;
+}
+#endif
+
 s32 nvfuse_set_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename,
 			    u32 offset)
 {
@@ -729,6 +901,17 @@ s32 nvfuse_set_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 	u64 end_tsc;
 	master_node_t *master;
 
+#ifdef NVFUSE_USE_DELAYED_BPTREE_CREATION
+	if (inode->i_bpino == 0) {
+		/* small directory relies on linear search */
+		if (offset < NVFUSE_DIR_INDEX_THRESHOLD)
+			return 0;
+
+		if (nvfuse_promote_dir_indexing(sb, inode, offset))
+			return NVFUSE_ERROR;
+	}
+#endif
+
 	assert(inode->i_bpino);
 
 	master = bp_init_master(sb);
@@ -775,6 +958,12 @@ s32 nvfuse_get_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 	int res = 0;
 	master_node_t *master;
 
+	/* unindexed small directory is searched from the first dentry */
+	if (inode->i_bpino == 0) {
+		*offset = 0;
+		return 0;
+	}
+
 	assert(inode->i_bpino);
 
 	master = bp_init_master(sb);
@@ -819,6 +1008,11 @@ s32 nvfuse_update_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode
 
 	master_node_t *master;
 
+	if (inode->i_bpino == 0) {
+		*offset = 0;
+		return 0;
+	}
+
 	assert(inode->i_bpino);
 
 	master = bp_init_master(sb);
@@ -861,6 +1055,9 @@ s32 nvfuse_del_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 	u32 c;
 	master_node_t *master = NULL;
 
+	if (inode->i_bpino == 0)
+		return 0;
+
 	assert(inode->i_bpino);
 
 	master = bp_init_master(sb);
@@ -907,30 +1104,31 @@ void io_cancel_incomplete_ios(struct nvfuse_superblock *sb, struct io_job **jobq
 		if (job && job->complete)
 			continue;
 
-		nvfuse_aio_cancel(job, sb->io_manager);
+		nvfuse_aio_cancel(job, nvfuse_io_channel(sb));
 	}
 }
 
 s32 nvfuse_wait_aio_completion(struct nvfuse_superblock *sb, struct io_job **jobq, int job_cnt)
 {
+	struct nvfuse_io_manager *io_manager = nvfuse_io_channel(sb);
 	struct io_job *job;
 	int cc; // completion count
 
-	//nvfuse_aio_resetnextcjob(sb->io_manager);
-	while (sb->io_manager->queue_cur_count) {
+	//nvfuse_aio_resetnextcjob(io_manager);
+	while (io_manager->queue_cur_count) {
 
-		cc = nvfuse_aio_complete(sb->io_manager);
-		sb->io_manager->queue_cur_count -= cc;
-		assert(sb->io_manager->queue_cur_count >= 0);
+		cc = nvfuse_aio_complete(io_manager);
+		io_manager->queue_cur_count -= cc;
+		assert(io_manager->queue_cur_count >= 0);
 
 		while (cc--) {
-			job = nvfuse_aio_getnextcjob(sb->io_manager);
+			job = nvfuse_aio_getnextcjob(io_manager);
 
 			if (job->ret != job->bytes) {
 				printf(" Error: IO \n");
 			}
 
-			job->complete = 1;
+			nvfuse_aio_dispatch_cjob(sb, job);
 		}
 
 		//printf(" spdk cjob size = %d, cnt = %d\n", cjob_size(sb->io_manager), sb->io_manager->cjob_cnt);
@@ -955,6 +1153,15 @@ s32 nvfuse_make_jobs(struct nvfuse_superblock *sb, struct io_job **jobs, int num
 		/* FIXME: how can we handle this error? */
 		assert(0);
 	}
+
+	/* foreground async queue unless caller steers jobs elsewhere */
+	for (res = 0; res < numjobs; res++) {
+		jobs[res]->qid = SPDK_QUEUE_AIO;
+		jobs[res]->iov = NULL;
+		jobs[res]->iovcnt = 0;
+		jobs[res]->fua = 0;
+	}
+
 	return 0;
 }
 
@@ -963,20 +1170,66 @@ void nvfuse_release_jobs(struct nvfuse_superblock *sb, struct io_job **jobs, int
 	rte_mempool_put_bulk((struct rte_mempool *)sb->io_job_mempool, (void **)jobs, numjobs);
 }
 
-s32 nvfuse_sync_dirty_data(struct nvfuse_superblock *sb, struct list_head *head, s32 num_blocks)
+int nvfuse_bc_pno_cmp(const void *a, const void *b)
 {
-	struct list_head *ptr, *temp;
+	const struct nvfuse_buffer_cache *bc_a = *(struct nvfuse_buffer_cache * const *)a;
+	const struct nvfuse_buffer_cache *bc_b = *(struct nvfuse_buffer_cache * const *)b;
+
+	if (bc_a->bc_pno < bc_b->bc_pno)
+		return -1;
+	return bc_a->bc_pno > bc_b->bc_pno;
+}
+
+/* fsync'd blocks are written with FUA instead of flushing device write cache */
+s32 nvfuse_sync_use_fua(struct nvfuse_superblock *sb)
+{
+#ifdef NVFUSE_USE_FUA_SYNC
+	return sb->io_manager->fua_support;
+#else
+	return 0;
+#endif
+}
+
+/* flush device write cache unless every write since the last flush was FUA */
+void nvfuse_sync_dev_cache(struct nvfuse_superblock *sb)
+{
+	if (nvfuse_sync_use_fua(sb) && !nvfuse_io_wc_dirty(sb))
+		return;
+
+	nvfuse_io_flush(sb);
+}
+
+/*
+ * write buffers staged by nvfuse_stage_flushing_bc() and wait for them.
+ * written buffers become clean unless they are dirtied again in the meantime,
+ * and failed buffers go back to dirty list.
+ */
+s32 nvfuse_sync_dirty_data(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache **bcs,
+			   s32 num_blocks, s32 fua)
+{
+	struct nvfuse_io_manager *io_manager = nvfuse_io_channel(sb);
 	struct nvfuse_buffer_cache *bc;
 
 	struct io_job *jobs[AIO_MAX_QDEPTH];
 	struct iocb *iocb[AIO_MAX_QDEPTH];
+	struct iovec iov[AIO_MAX_QDEPTH];
+	struct io_job *job = NULL;
+	s32 written;
 	s32 count = 0;
+	s32 error = 0;
 	s32 res = 0;
+	s32 i;
 
 	assert(num_blocks <= AIO_MAX_QDEPTH);
 
+	if (num_blocks == 0)
+		return 0;
+
+	/* a run of physically adjacent blocks is written by a single job */
+	qsort(bcs, num_blocks, sizeof(struct nvfuse_buffer_cache *), nvfuse_bc_pno_cmp);
+
 #if (NVFUSE_OS==NVFUSE_OS_LINUX)
-	if (sb->io_manager->type == IO_MANAGER_SPDK || sb->io_manager->type == IO_MANAGER_BLKDEVIO) {
+	if (nvfuse_io_support_aio(io_manager)) {
 
 		res = nvfuse_make_jobs(sb, jobs, num_blocks);
 		if (res != 0) {
@@ -984,55 +1237,95 @@ s32 nvfuse_sync_dirty_data(struct nvfuse_superblock *sb, struct list_head *head,
 			fprintf(stderr, "mempool get error for io job \n");
 		}
 
-		list_for_each_safe(ptr, temp, head) {
-			bc = (struct nvfuse_buffer_cache *)list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+		for (i = 0; i < num_blocks; i++) {
+			bc = bcs[i];
 			assert(bc->bc_dirty);
 
-			jobs[count]->offset = (s64)bc->bc_pno * CLUSTER_SIZE;
-			jobs[count]->bytes = (size_t)CLUSTER_SIZE;
-			jobs[count]->ret = 0;
-			jobs[count]->req_type = WRITE;
-			jobs[count]->buf = bc->bc_buf;
-			jobs[count]->complete = 0;
-			iocb[count] = &jobs[count]->iocb;
-			count++;
+			iov[i].iov_base = bc->bc_buf;
+			iov[i].iov_len = CLUSTER_SIZE;
 
-		}
+			if (job && job->iovcnt < AIO_MAX_IOV &&
+			    job->offset + (s64)job->bytes == (s64)bc->bc_pno * CLUSTER_SIZE) {
+				job->bytes += CLUSTER_SIZE;
+				job->iovcnt++;
+				continue;
+			}
 
-		count = 0;
-		while (count < num_blocks) {
-			nvfuse_aio_prep(jobs[count], sb->io_manager);
+			job = jobs[count];
+			job->offset = (s64)bc->bc_pno * CLUSTER_SIZE;
+			job->bytes = (size_t)CLUSTER_SIZE;
+			job->ret = 0;
+			job->req_type = WRITE;
+			job->buf = bc->bc_buf;
+			job->complete = 0;
+			job->qid = SPDK_QUEUE_WRITEBACK;
+			job->fua = fua;
+			job->iov = &iov[i];
+			job->iovcnt = 1;
+			iocb[count] = &job->iocb;
 			count++;
 		}
 
-		nvfuse_aio_submit(iocb, num_blocks, sb->io_manager);
-		sb->io_manager->queue_cur_count = num_blocks;
+		if (count < num_blocks)
+			nvfuse_release_jobs(sb, jobs + count, num_blocks - count);
+
+		for (i = 0; i < count; i++)
+			nvfuse_aio_prep(jobs[i], io_manager);
 
-		nvfuse_wait_aio_completion(sb, jobs, num_blocks);
+		nvfuse_aio_submit(iocb, count, io_manager);
+		io_manager->queue_cur_count += count;
 
-		nvfuse_release_jobs(sb, jobs, num_blocks);
+		nvfuse_wait_aio_completion(sb, jobs, count);
+
+		for (i = 0; i < count; i++) {
+			if (jobs[i]->ret != jobs[i]->bytes)
+				error = 1;
+		}
+
+		nvfuse_release_jobs(sb, jobs, count);
 	} else
 #endif
-	{	/* in case of ramdisk or filedisk */
-		list_for_each_safe(ptr, temp, head) {
-			bc = (struct nvfuse_buffer_cache *)list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+	{	/* in case of backend without aio */
+		for (i = 0; i < num_blocks; i++) {
+			bc = bcs[i];
 			assert(bc->bc_dirty);
-			nvfuse_write_cluster(bc->bc_buf, bc->bc_pno, sb->io_manager);
+			if (nvfuse_write_cluster(bc->bc_buf, bc->bc_pno, io_manager) != CLUSTER_SIZE)
+				error = 1;
 		}
 	}
 
-	list_for_each_safe(ptr, temp, head) {
-		bc = (struct nvfuse_buffer_cache *)list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+	for (i = 0; i < num_blocks; i++) {
+		bc = bcs[i];
+
+		nvfuse_bm_lock(bc->bc_bm);
+		written = (bc->bc_list_type == BUFFER_TYPE_WRITEBACK);
+		if (written && error) {
+			/* failed buffers are written again later */
+			__nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_DIRTY, INSERT_TAIL);
+			written = 0;
+		}
+		nvfuse_bm_unlock(bc->bc_bm);
 
+		/* buffer dirtied again while it was written is left on dirty list */
+		if (!written)
+			continue;
+
+		/* bc is not replaced while it is on writeback list */
 		nvfuse_remove_bhs_in_bc(sb, bc);
 
-		assert(bc->bc_dirty);
-		bc->bc_dirty = 0;
+		nvfuse_bm_lock(bc->bc_bm);
+		if (bc->bc_list_type == BUFFER_TYPE_WRITEBACK) {
+			assert(bc->bc_dirty);
+			bc->bc_dirty = 0;
+			__nvfuse_move_buffer_list(sb, bc, bc->bc_ref ? BUFFER_TYPE_REF : BUFFER_TYPE_CLEAN,
+						  INSERT_HEAD);
+		}
+		nvfuse_bm_unlock(bc->bc_bm);
+	}
 
-		/*if (bc->bc_ref) {
-			printf("debug\n");
-		}*/
-		nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_CLEAN, INSERT_HEAD);
+	if (error) {
+		printf(" Error: dirty data IO (nr_bcs = %d)\n", num_blocks);
+		return -1;
 	}
 
 	return 0;
@@ -1057,6 +1350,10 @@ void nvfuse_update_sb_with_bd_info(struct nvfuse_superblock *sb, s32 bg_id, s32
 		struct nvfuse_buffer_head *bd_bh;
 
 		bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+		if (bd_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return;
+		}
 		bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 
 		if (increament) {
@@ -1167,6 +1464,10 @@ void nvfuse_print_bg_list(struct nvfuse_superblock *sb)
 		s32 bg_id = node->bg_id;
 
 		bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+		if (bd_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return;
+		}
 		bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 		assert(bd->bd_id == bg_id);
 		printf(" bg = %d, free inodes = %d blocks = %d \n", bg_id, bd->bd_free_inodes,
@@ -1309,6 +1610,21 @@ void nvfuse_send_health_check_msg_to_primary_process(struct nvfuse_handle *nvh)
 	rte_mempool_put(mempool, ipc_msg);
 }
 
+void nvfuse_lock_init(struct nvfuse_superblock *sb)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&sb->sb_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void nvfuse_lock_exit(struct nvfuse_superblock *sb)
+{
+	pthread_mutex_destroy(&sb->sb_lock);
+}
+
 s32 nvfuse_mount(struct nvfuse_handle *nvh)
 {
 	struct nvfuse_superblock *sb;
@@ -1415,6 +1731,10 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 		}
 	}
 
+	nvfuse_wb_init(sb);
+	nvfuse_io_channel_init(sb);
+	nvfuse_lock_init(sb);
+
 	res = nvfuse_init_ictx_cache(sb);
 	if (res < 0) {
 		printf(" Error: initialization of inode context cache \n");
@@ -1697,6 +2017,7 @@ s32 nvfuse_umount(struct nvfuse_handle *nvh)
 	gettimeofday(&sb->sb_time_end, NULL);
 	timeval_subtract(&sb->sb_time_total, &sb->sb_time_end, &sb->sb_time_start);
 
+	nvfuse_ra_wait_all(sb);
 	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
 
 	if (spdk_process_is_primary() || nvfuse_process_model_is_standalone()) {
@@ -1704,6 +2025,8 @@ s32 nvfuse_umount(struct nvfuse_handle *nvh)
 		nvfuse_write_cluster(buf, INIT_NVFUSE_SUPERBLOCK_NO, sb->io_manager);
 	}
 
+	nvfuse_io_channel_release_all(sb);
+
 	/* deallocation of mempool for bptree*/
 	{
 		s32 type;
@@ -1754,6 +2077,7 @@ s32 nvfuse_umount(struct nvfuse_handle *nvh)
 	spdk_free(sb->sb_bd);
 	spdk_free(sb->sb_file_table);
 
+	nvfuse_lock_exit(sb);
 	nvh->nvh_mounted = 0;
 
 	nvfuse_free_aligned_buffer(buf);
@@ -1886,6 +2210,13 @@ s32 nvfuse_scan_superblock(struct nvfuse_superblock *cur_sb)
 	if (read_sb->sb_signature == NVFUSE_SB_SIGNATURE) {
 		nvfuse_copy_disk_sb_to_sb(cur_sb, read_sb);
 		res = 0;
+
+		/* on-disk layout depends on block size */
+		if (nvfuse_sb_block_size(cur_sb) != CLUSTER_SIZE) {
+			printf(" Error: file system block size = %d, but compiled with %d (BLOCK_SIZE_BITS)\n",
+			       nvfuse_sb_block_size(cur_sb), CLUSTER_SIZE);
+			res = -1;
+		}
 	} else {
 		printf(" super block signature is mismatched. \n");
 		res = -1;
@@ -1927,7 +2258,7 @@ u32 nvfuse_create_bptree(struct nvfuse_superblock *sb, struct nvfuse_inode *inod
 	return 0;
 }
 
-s32 nvfuse_dir(struct nvfuse_handle *nvh)
+static s32 __nvfuse_dir(struct nvfuse_handle *nvh)
 {
 	struct nvfuse_inode_ctx *dir_ictx, *ictx;
 	struct nvfuse_inode *dir_inode, *inode;
@@ -1952,6 +2283,11 @@ s32 nvfuse_dir(struct nvfuse_handle *nvh)
 			}
 			dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(read_bytes), READ,
 					       NVFUSE_TYPE_META);
+			if (dir_bh == NULL) {
+				printf(" Error: get_bh()\n");
+				nvfuse_release_inode(sb, dir_ictx, CLEAN);
+				return NVFUSE_ERROR;
+			}
 			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 		}
 
@@ -1978,6 +2314,18 @@ s32 nvfuse_dir(struct nvfuse_handle *nvh)
 	return NVFUSE_SUCCESS;
 }
 
+s32 nvfuse_dir(struct nvfuse_handle *nvh)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_dir(nvh);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
 
 s32 nvfuse_allocate_open_file_table(struct nvfuse_superblock *sb)
 {
@@ -2021,6 +2369,11 @@ s32 nvfuse_truncate(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename,
 	if ((start & (CLUSTER_SIZE - 1))) {
 		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(start), READ,
 				       NVFUSE_TYPE_META);
+		if (dir_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			nvfuse_release_inode(sb, dir_ictx, CLEAN);
+			return NVFUSE_ERROR;
+		}
 		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 		dir += (offset % DIR_ENTRY_NUM);
 	}
@@ -2032,6 +2385,11 @@ s32 nvfuse_truncate(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename,
 
 			dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(read_bytes), READ,
 					       NVFUSE_TYPE_META);
+			if (dir_bh == NULL) {
+				printf(" Error: get_bh()\n");
+				nvfuse_release_inode(sb, dir_ictx, CLEAN);
+				return NVFUSE_ERROR;
+			}
 			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 		}
 
@@ -2080,7 +2438,7 @@ s32 nvfuse_truncate_ino(struct nvfuse_superblock *sb, inode_t ino, s64 trunc_siz
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_chmod(struct nvfuse_handle *nvh, inode_t par_ino, s8 *filename, mode_t mode)
+static s32 __nvfuse_chmod(struct nvfuse_handle *nvh, inode_t par_ino, s8 *filename, mode_t mode)
 {
 	struct nvfuse_inode_ctx *dir_ictx, *ictx;
 	struct nvfuse_inode *dir_inode, *inode = NULL;
@@ -2108,6 +2466,11 @@ s32 nvfuse_chmod(struct nvfuse_handle *nvh, inode_t par_ino, s8 *filename, mode_
 	if (start & (CLUSTER_SIZE - 1)) {
 		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(start), READ,
 				       NVFUSE_TYPE_META);
+		if (dir_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			nvfuse_release_inode(sb, dir_ictx, CLEAN);
+			return NVFUSE_ERROR;
+		}
 		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 		dir += (offset % DIR_ENTRY_NUM);
 	}
@@ -2119,6 +2482,11 @@ s32 nvfuse_chmod(struct nvfuse_handle *nvh, inode_t par_ino, s8 *filename, mode_
 
 			dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(read_bytes), READ,
 					       NVFUSE_TYPE_META);
+			if (dir_bh == NULL) {
+				printf(" Error: get_bh()\n");
+				nvfuse_release_inode(sb, dir_ictx, CLEAN);
+				return NVFUSE_ERROR;
+			}
 			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 		}
 
@@ -2150,6 +2518,18 @@ s32 nvfuse_chmod(struct nvfuse_handle *nvh, inode_t par_ino, s8 *filename, mode_
 	return NVFUSE_SUCCESS;
 }
 
+s32 nvfuse_chmod(struct nvfuse_handle *nvh, inode_t par_ino, s8 *filename, mode_t mode)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_chmod(nvh, par_ino, filename, mode);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
 s32 nvfuse_is_directio(struct nvfuse_superblock *sb, s32 fid)
 {
 	struct nvfuse_file_table *ft;
@@ -2162,8 +2542,8 @@ s32 nvfuse_is_directio(struct nvfuse_superblock *sb, s32 fid)
 	return 0;
 }
 
-s32 nvfuse_path_open(struct nvfuse_handle *nvh, s8 *path, s8 *filename,
-		     struct nvfuse_dir_entry *get)
+static s32 __nvfuse_path_open(struct nvfuse_handle *nvh, s8 *path, s8 *filename,
+			      struct nvfuse_dir_entry *get)
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
@@ -2202,8 +2582,21 @@ s32 nvfuse_path_open(struct nvfuse_handle *nvh, s8 *path, s8 *filename,
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_path_open2(struct nvfuse_handle *nvh, s8 *path, s8 *filename,
-		      struct nvfuse_dir_entry *get)
+s32 nvfuse_path_open(struct nvfuse_handle *nvh, s8 *path, s8 *filename,
+		     struct nvfuse_dir_entry *get)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_path_open(nvh, path, filename, get);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_path_open2(struct nvfuse_handle *nvh, s8 *path, s8 *filename,
+			       struct nvfuse_dir_entry *get)
 {
 	struct nvfuse_superblock *sb;
 	struct nvfuse_dir_entry dir_entry;
@@ -2272,7 +2665,20 @@ RES:
 	return res;
 }
 
-s32 nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, u32 offset, s32 position)
+s32 nvfuse_path_open2(struct nvfuse_handle *nvh, s8 *path, s8 *filename,
+		      struct nvfuse_dir_entry *get)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_path_open2(nvh, path, filename, get);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
+static s32 __nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, u32 offset, s32 position)
 {
 	struct nvfuse_file_table *of;
 	struct nvfuse_superblock *sb;
@@ -2293,6 +2699,18 @@ s32 nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, u32 offset, s32 position)
 	return (NVFUSE_SUCCESS);
 }
 
+s32 nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, u32 offset, s32 position)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_lseek(nvh, fd, offset, position);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
 s32 nvfuse_seek(struct nvfuse_superblock *sb, struct nvfuse_file_table *of, s64 offset, s32 position)
 {
 	if (position == SEEK_SET)             /* SEEK_SET */
@@ -2316,9 +2734,18 @@ u32 nvfuse_alloc_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 *alloc_blk
 	u32 alloc_cnt = 0;
 
 	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bd_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		return 0;
+	}
 	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
 
 	bh = nvfuse_get_bh(sb, NULL, DBITMAP_INO, bg_id, READ, NVFUSE_TYPE_META);
+	if (bh == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_bh(sb, bd_bh, 0, CLEAN);
+		return 0;
+	}
 	buf = bh->bh_buf;
 
 	free_block = bd->bd_next_block % sb->sb_no_of_blocks_per_bg;
@@ -2452,6 +2879,12 @@ s32 nvfuse_link(struct nvfuse_superblock *sb, u32 newino, s8 *new_filename, s32
 	inode->i_links_count++;
 
 	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ, NVFUSE_TYPE_META);
+	if (dir_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_inode(sb, ictx, DIRTY);
+		nvfuse_release_inode(sb, dir_ictx, DIRTY);
+		return -1;
+	}
 	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 	dir[search_entry].d_flag = DIR_USED;
 	dir[search_entry].d_ino = ino;
@@ -2501,6 +2934,10 @@ RETRY:
 	// find an empty dentry
 	for (i = 0; i < num_block; i++) {
 		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ, NVFUSE_TYPE_META);
+		if (dir_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return NVFUSE_ERROR;
+		}
 		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 
 		for (new_entry = 0; new_entry < DIR_ENTRY_NUM; new_entry++) {
@@ -2538,6 +2975,10 @@ RETRY:
 
 		dir_bh = nvfuse_get_new_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(dir_inode->i_size),
 					   NVFUSE_TYPE_META);
+		if (dir_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return NVFUSE_ERROR;
+		}
 		nvfuse_release_bh(sb, dir_bh, INSERT_HEAD, DIRTY);
 		assert(dir_inode->i_size < MAX_FILE_SIZE);
 		dir_inode->i_size += CLUSTER_SIZE;
@@ -2576,6 +3017,10 @@ s32 nvfuse_find_existing_dentry(struct nvfuse_superblock *sb, struct nvfuse_inod
 	if ((start & (CLUSTER_SIZE - 1))) {
 		dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(start), READ,
 				       NVFUSE_TYPE_META);
+		if (dir_bh == NULL) {
+			printf(" Error: get_bh()\n");
+			return -1;
+		}
 		dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 		dir += (offset % DIR_ENTRY_NUM);
 	}
@@ -2586,6 +3031,10 @@ s32 nvfuse_find_existing_dentry(struct nvfuse_superblock *sb, struct nvfuse_inod
 				nvfuse_release_bh(sb, dir_bh, 0/*tail*/, 0/*dirty*/);
 			dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, NVFUSE_SIZE_TO_BLK(read_bytes), READ,
 					       NVFUSE_TYPE_META);
+			if (dir_bh == NULL) {
+				printf(" Error: get_bh()\n");
+				return -1;
+			}
 			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 		}
 
@@ -2625,6 +3074,11 @@ s32 nvfuse_rm_direntry(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name,
 	search_entry = found_entry % DIR_ENTRY_NUM;
 	dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ,
 						   NVFUSE_TYPE_META);
+	if (dir_bh == NULL) {
+		printf(" Error: get_bh()\n");
+		nvfuse_release_inode(sb, dir_ictx, CLEAN);
+		return -1;
+	}
 	dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
 	dir += search_entry;
 
@@ -2737,27 +3191,38 @@ int nvfuse_read_block(char *buf, unsigned long block, struct nvfuse_io_manager *
 	return nvfuse_read_cluster(buf, block, io_manager);
 }
 
-void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force)
+static void __nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force)
 {
-	struct list_head *dirty_head, *flushing_head;
-	struct list_head *temp, *ptr;
-	struct nvfuse_buffer_cache *bc;
+	struct nvfuse_buffer_cache *stack_bcs[AIO_MAX_QDEPTH];
+	struct nvfuse_buffer_cache **bcs = stack_bcs;
 	s32 dirty_count = 0;
 	s32 flushing_count = 0;
-	s32 res;
+	s32 staged_count;
+	s32 res = 0;
+	s32 i;
 	u64 start_tsc;
 
 	if (spdk_process_is_primary() && nvfuse_process_model_is_dataplane()) {
 		force = DIRTY_FLUSH_FORCE;
 	}
 
+#ifdef NVFUSE_USE_BACKGROUND_WRITEBACK
+	if (nvfuse_wb_support_aio(sb)) {
+		if (force != DIRTY_FLUSH_FORCE && nvfuse_wb_run(sb) == 0)
+			goto RES;
+
+		/* buffers under writeback are neither clean nor on dirty list */
+		nvfuse_wb_wait(sb);
+	}
+#endif
+
 	dirty_count = nvfuse_get_dirty_count(sb);
 	/* check dirty flush with force option */
 	if (force != DIRTY_FLUSH_FORCE && dirty_count < NVFUSE_SYNC_DIRTY_COUNT)
 		goto RES;
 
 	/* no more dirty data */
-	if (dirty_count == 0)
+	if (dirty_count == 0 && !sb->sb_wb.wb_need_flush)
 		goto RES;
 
 	// if (!spdk_process_is_primary())
@@ -2767,27 +3232,44 @@ void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force)
 
 	start_tsc = spdk_get_ticks();
 
-	while ((dirty_count = nvfuse_get_dirty_count(sb)) != 0) {
-		dirty_head = &sb->sb_bm->bm_list[BUFFER_TYPE_DIRTY];
-		flushing_head = &sb->sb_bm->bm_list[BUFFER_TYPE_FLUSHING];
-		flushing_count = 0;
+	/* each batch covers a narrow range of blocks if dirty buffers are sorted as a whole */
+	if (dirty_count > AIO_MAX_QDEPTH) {
+		bcs = malloc(sizeof(struct nvfuse_buffer_cache *) * dirty_count);
+		/* unsorted flush is still correct */
+		if (bcs == NULL) {
+			bcs = stack_bcs;
+			dirty_count = AIO_MAX_QDEPTH;
+		}
+	}
 
-		list_for_each_safe(ptr, temp, dirty_head) {
-			bc = (struct nvfuse_buffer_cache *)list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
-			assert(bc->bc_dirty);
-			list_move(&bc->bc_list, flushing_head);
-			flushing_count++;
-			if (flushing_count >= AIO_MAX_QDEPTH)
+	/*
+	 * dirty buffers stay on writeback list of their shards while they are
+	 * written, so that they are never unlinked from a list others can see.
+	 */
+	do {
+		staged_count = nvfuse_stage_flushing_dirty(sb, bcs, dirty_count);
+		qsort(bcs, staged_count, sizeof(struct nvfuse_buffer_cache *), nvfuse_bc_pno_cmp);
+
+		for (i = 0; i < staged_count; i += flushing_count) {
+			flushing_count = staged_count - i;
+			if (flushing_count > AIO_MAX_QDEPTH)
+				flushing_count = AIO_MAX_QDEPTH;
+
+			res = nvfuse_sync_dirty_data(sb, bcs + i, flushing_count, 0);
+			if (res)
 				break;
 		}
 
-		res = nvfuse_sync_dirty_data(sb, flushing_head, flushing_count);
-		if (res)
-			break;
-	}
+		/* buffers left by error go back to dirty list */
+		for (i += flushing_count; i < staged_count; i++)
+			nvfuse_unstage_flushing_bc(sb, bcs[i]);
+	} while (!res && staged_count && staged_count == dirty_count);
+
+	if (bcs != stack_bcs)
+		free(bcs);
 
 	/* flush cmd to nvme ssd */
-	nvfuse_dev_flush(sb->io_manager);
+	nvfuse_io_flush(sb);
 
 	sb->nvme_io_tsc += (spdk_get_ticks() - start_tsc);
 	sb->nvme_io_count ++;
@@ -2801,6 +3283,13 @@ RES:
 	return;
 }
 
+void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force)
+{
+	nvfuse_lock(sb);
+	__nvfuse_check_flush_dirty(sb, force);
+	nvfuse_unlock(sb);
+}
+
 struct nvfuse_superblock *nvfuse_read_super(struct nvfuse_handle *nvh)
 {
 	return &nvh->nvh_sb;
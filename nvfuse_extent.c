@@ -0,0 +1,534 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+/*
+*  Extent Based Block Mapping Scheme
+*
+*  Files are mapped with (logical block, length, physical block) extents
+*  kept in a B+tree. The root node lives in inode->i_blocks and holds up to
+*  NVFUSE_EXT_ROOT_MAX entries. When the root is full, its entries are moved
+*  to a new block and the tree grows in depth. Index entries point to child
+*  nodes with the first logical block they cover, and a lookup follows the
+*  last index entry whose block is not larger than the target block.
+*
+*  The format is selected at mkfs time (NVFUSE_FEATURE_EXTENT).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "spdk/env.h"
+
+#include "nvfuse_core.h"
+#include "nvfuse_io_manager.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_indirect.h"
+#include "nvfuse_extent.h"
+
+struct nvfuse_ext_path {
+	struct nvfuse_extent_header *p_hdr;
+	struct nvfuse_buffer_head *p_bh; /* NULL for root node */
+	s32 p_pos; /* last entry whose block <= target, -1 if none */
+};
+
+static struct nvfuse_extent_header *nvfuse_ext_root(struct nvfuse_inode *inode)
+{
+	return (struct nvfuse_extent_header *)inode->i_blocks;
+}
+
+static void nvfuse_ext_init_root(struct nvfuse_inode *inode)
+{
+	struct nvfuse_extent_header *hdr = nvfuse_ext_root(inode);
+
+	memset(inode->i_blocks, 0x00, sizeof(inode->i_blocks));
+	hdr->eh_magic = NVFUSE_EXT_MAGIC;
+	hdr->eh_entries = 0;
+	hdr->eh_max = NVFUSE_EXT_ROOT_MAX;
+	hdr->eh_depth = 0;
+}
+
+/* used by mkfs to map the root directory and by inline data conversion */
+void nvfuse_ext_format_root(struct nvfuse_inode *inode, u32 lblock, u32 pblock, u32 len)
+{
+	struct nvfuse_extent_header *hdr = nvfuse_ext_root(inode);
+	struct nvfuse_extent *ex = NVFUSE_EXT_FIRST_EXTENT(hdr);
+
+	nvfuse_ext_init_root(inode);
+	ex->ee_block = lblock;
+	ex->ee_len = len;
+	ex->ee_start = pblock;
+	hdr->eh_entries = 1;
+}
+
+/* binary search for the last entry whose block is not larger than lblock */
+static s32 nvfuse_ext_search(struct nvfuse_extent_header *hdr, u32 lblock)
+{
+	struct nvfuse_extent *ents = NVFUSE_EXT_FIRST_EXTENT(hdr);
+	s32 l = 0, r = (s32)hdr->eh_entries - 1, m;
+	s32 pos = -1;
+
+	while (l <= r) {
+		m = (l + r) / 2;
+		if (ents[m].ee_block <= lblock) {
+			pos = m;
+			l = m + 1;
+		} else {
+			r = m - 1;
+		}
+	}
+
+	return pos;
+}
+
+static void nvfuse_ext_release_path(struct nvfuse_superblock *sb, struct nvfuse_ext_path *path,
+				    s32 depth)
+{
+	s32 level;
+
+	for (level = depth; level > 0; level--) {
+		if (path[level].p_bh)
+			nvfuse_release_bh(sb, path[level].p_bh, 0, CLEAN);
+		path[level].p_bh = NULL;
+	}
+}
+
+static void nvfuse_ext_mark_dirty(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				  struct nvfuse_buffer_head *bh)
+{
+	if (bh)
+		nvfuse_mark_dirty_bh(sb, bh);
+	else
+		nvfuse_mark_inode_dirty(ictx);
+}
+
+/* returns depth of the tree or negative value on error */
+static s32 nvfuse_ext_find_path(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				u32 lblock, struct nvfuse_ext_path *path)
+{
+	struct nvfuse_extent_header *hdr = nvfuse_ext_root(ictx->ictx_inode);
+	struct nvfuse_buffer_head *bh;
+	struct nvfuse_extent_idx *idx;
+	s32 depth, level, pos;
+
+	/* a newly created inode has zeroed i_blocks */
+	if (hdr->eh_magic != NVFUSE_EXT_MAGIC) {
+		if (hdr->eh_magic || hdr->eh_entries) {
+			printf(" Error: invalid extent header (ino = %d)\n", ictx->ictx_ino);
+			return -EIO;
+		}
+		nvfuse_ext_init_root(ictx->ictx_inode);
+	}
+
+	depth = hdr->eh_depth;
+	if (depth > NVFUSE_EXT_MAX_DEPTH) {
+		printf(" Error: invalid extent depth = %d (ino = %d)\n", depth, ictx->ictx_ino);
+		return -EIO;
+	}
+
+	path[0].p_hdr = hdr;
+	path[0].p_bh = NULL;
+
+	for (level = 0; ; level++) {
+		pos = nvfuse_ext_search(hdr, lblock);
+		if (level == depth) {
+			path[level].p_pos = pos;
+			break;
+		}
+
+		if (hdr->eh_entries == 0) {
+			printf(" Error: empty extent index node (ino = %d)\n", ictx->ictx_ino);
+			nvfuse_ext_release_path(sb, path, level);
+			return -EIO;
+		}
+
+		/* the first child also covers blocks below its index */
+		if (pos < 0)
+			pos = 0;
+		path[level].p_pos = pos;
+
+		idx = NVFUSE_EXT_FIRST_INDEX(hdr) + pos;
+		bh = nvfuse_get_bh(sb, ictx, BLOCK_IO_INO, idx->ei_leaf, READ, NVFUSE_TYPE_META);
+		if (bh == NULL) {
+			nvfuse_ext_release_path(sb, path, level);
+			return -EIO;
+		}
+
+		hdr = (struct nvfuse_extent_header *)bh->bh_buf;
+		path[level + 1].p_hdr = hdr;
+		path[level + 1].p_bh = bh;
+
+		if (hdr->eh_magic != NVFUSE_EXT_MAGIC || hdr->eh_depth != depth - level - 1) {
+			printf(" Error: corrupted extent node = %d (ino = %d)\n", idx->ei_leaf, ictx->ictx_ino);
+			nvfuse_ext_release_path(sb, path, level + 1);
+			return -EIO;
+		}
+	}
+
+	return depth;
+}
+
+/* first mapped block after the path position */
+static u32 nvfuse_ext_next_block(struct nvfuse_ext_path *path, s32 depth)
+{
+	struct nvfuse_extent_header *hdr;
+	s32 level;
+
+	for (level = depth; level >= 0; level--) {
+		hdr = path[level].p_hdr;
+		if (path[level].p_pos + 1 < hdr->eh_entries)
+			return NVFUSE_EXT_FIRST_EXTENT(hdr)[path[level].p_pos + 1].ee_block;
+	}
+
+	return (u32)~0;
+}
+
+static struct nvfuse_buffer_head *nvfuse_ext_new_node(struct nvfuse_superblock *sb,
+		struct nvfuse_inode_ctx *ictx, u32 depth, u32 *pblock)
+{
+	struct nvfuse_extent_header *hdr;
+	struct nvfuse_buffer_head *bh;
+
+	if (nvfuse_alloc_free_block(sb, ictx->ictx_inode, pblock, 1) != 1) {
+		printf(" Error: extent node allocation fails.\n");
+		return NULL;
+	}
+
+	bh = nvfuse_get_bh(sb, ictx, BLOCK_IO_INO, *pblock, WRITE, NVFUSE_TYPE_META);
+	if (bh == NULL) {
+		nvfuse_free_blocks(sb, *pblock, 1);
+		return NULL;
+	}
+
+	memset(bh->bh_buf, 0x00, CLUSTER_SIZE);
+	hdr = (struct nvfuse_extent_header *)bh->bh_buf;
+	hdr->eh_magic = NVFUSE_EXT_MAGIC;
+	hdr->eh_entries = 0;
+	hdr->eh_max = NVFUSE_EXT_NODE_MAX;
+	hdr->eh_depth = depth;
+
+	return bh;
+}
+
+/* insert an entry into a node which has a free slot */
+static void nvfuse_ext_insert_at(struct nvfuse_extent_header *hdr, struct nvfuse_extent *new)
+{
+	struct nvfuse_extent *ents = NVFUSE_EXT_FIRST_EXTENT(hdr);
+	s32 pos;
+
+	assert(hdr->eh_entries < hdr->eh_max);
+
+	pos = nvfuse_ext_search(hdr, new->ee_block) + 1;
+	memmove(ents + pos + 1, ents + pos, (hdr->eh_entries - pos) * sizeof(struct nvfuse_extent));
+	ents[pos] = *new;
+	hdr->eh_entries++;
+}
+
+/*
+ * insert a leaf or index entry into the node at the level of the path.
+ * a full node is split and the new node is linked to its parent, and a
+ * full root grows the tree in depth.
+ */
+static s32 nvfuse_ext_insert_entry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				   struct nvfuse_ext_path *path, s32 level, struct nvfuse_extent *new)
+{
+	struct nvfuse_extent_header *hdr = path[level].p_hdr;
+	struct nvfuse_extent *ents = NVFUSE_EXT_FIRST_EXTENT(hdr);
+	struct nvfuse_extent_header *nhdr;
+	struct nvfuse_extent *nents;
+	struct nvfuse_extent_idx idx;
+	struct nvfuse_buffer_head *nbh;
+	u32 nblock;
+	s32 pos, split;
+
+	if (hdr->eh_entries < hdr->eh_max) {
+		nvfuse_ext_insert_at(hdr, new);
+		nvfuse_ext_mark_dirty(sb, ictx, path[level].p_bh);
+		return 0;
+	}
+
+	if (level == 0) {
+		/* move entries of root to a new node */
+		nbh = nvfuse_ext_new_node(sb, ictx, hdr->eh_depth, &nblock);
+		if (nbh == NULL)
+			return -ENOSPC;
+
+		nhdr = (struct nvfuse_extent_header *)nbh->bh_buf;
+		memcpy(NVFUSE_EXT_FIRST_EXTENT(nhdr), ents, hdr->eh_entries * sizeof(struct nvfuse_extent));
+		nhdr->eh_entries = hdr->eh_entries;
+		nvfuse_ext_insert_at(nhdr, new);
+
+		idx.ei_block = NVFUSE_EXT_FIRST_EXTENT(nhdr)->ee_block;
+		idx.ei_leaf = nblock;
+		idx.ei_unused = 0;
+
+		hdr->eh_depth++;
+		hdr->eh_entries = 1;
+		*NVFUSE_EXT_FIRST_INDEX(hdr) = idx;
+		nvfuse_mark_inode_dirty(ictx);
+
+		nvfuse_release_bh(sb, nbh, 0, DIRTY);
+		return 0;
+	}
+
+	/* split full node */
+	nbh = nvfuse_ext_new_node(sb, ictx, hdr->eh_depth, &nblock);
+	if (nbh == NULL)
+		return -ENOSPC;
+
+	nhdr = (struct nvfuse_extent_header *)nbh->bh_buf;
+	nents = NVFUSE_EXT_FIRST_EXTENT(nhdr);
+
+	pos = nvfuse_ext_search(hdr, new->ee_block) + 1;
+	/* appending to the rightmost position starts a new node */
+	if (pos == hdr->eh_entries)
+		split = pos;
+	else
+		split = hdr->eh_entries / 2;
+
+	nhdr->eh_entries = hdr->eh_entries - split;
+	memcpy(nents, ents + split, nhdr->eh_entries * sizeof(struct nvfuse_extent));
+	hdr->eh_entries = split;
+
+	if (pos < split)
+		nvfuse_ext_insert_at(hdr, new);
+	else
+		nvfuse_ext_insert_at(nhdr, new);
+
+	nvfuse_ext_mark_dirty(sb, ictx, path[level].p_bh);
+
+	idx.ei_block = nents[0].ee_block;
+	idx.ei_leaf = nblock;
+	idx.ei_unused = 0;
+
+	nvfuse_release_bh(sb, nbh, 0, DIRTY);
+
+	return nvfuse_ext_insert_entry(sb, ictx, path, level - 1, (struct nvfuse_extent *)&idx);
+}
+
+/* map [lblock, lblock + len) to [pblock, pblock + len) */
+static s32 nvfuse_ext_add(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			  u32 lblock, u32 pblock, u32 len)
+{
+	struct nvfuse_ext_path path[NVFUSE_EXT_MAX_DEPTH + 1];
+	struct nvfuse_extent_header *leaf;
+	struct nvfuse_extent *ex, new;
+	s32 depth, ret = 0;
+
+	depth = nvfuse_ext_find_path(sb, ictx, lblock, path);
+	if (depth < 0)
+		return depth;
+
+	leaf = path[depth].p_hdr;
+	if (path[depth].p_pos >= 0) {
+		ex = NVFUSE_EXT_FIRST_EXTENT(leaf) + path[depth].p_pos;
+		/* merge with the previous extent if it is contiguous */
+		if (ex->ee_block + ex->ee_len == lblock && ex->ee_start + ex->ee_len == pblock) {
+			ex->ee_len += len;
+			nvfuse_ext_mark_dirty(sb, ictx, path[depth].p_bh);
+			goto RES;
+		}
+	}
+
+	new.ee_block = lblock;
+	new.ee_len = len;
+	new.ee_start = pblock;
+	ret = nvfuse_ext_insert_entry(sb, ictx, path, depth, &new);
+
+RES:
+	nvfuse_ext_release_path(sb, path, depth);
+	return ret;
+}
+
+s32 nvfuse_ext_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
+			 u32 maxblocks, u32 *num_alloc_blocks, u32 *pblock, u32 create)
+{
+	struct nvfuse_ext_path path[NVFUSE_EXT_MAX_DEPTH + 1];
+	struct nvfuse_extent *ex;
+	u32 *blocks;
+	u32 next, count = 0;
+	u32 first_block = 0;
+	u32 num, i, j;
+	s32 depth;
+	s32 ret = 0;
+
+	if (pblock)
+		*pblock = 0;
+
+	if (num_alloc_blocks)
+		*num_alloc_blocks = 0;
+
+	if (lblock < 0 || maxblocks == 0)
+		return -1;
+
+	depth = nvfuse_ext_find_path(sb, ictx, lblock, path);
+	if (depth < 0)
+		return depth;
+
+	if (path[depth].p_pos >= 0) {
+		ex = NVFUSE_EXT_FIRST_EXTENT(path[depth].p_hdr) + path[depth].p_pos;
+		if ((u32)lblock < ex->ee_block + ex->ee_len) {
+			first_block = ex->ee_start + (lblock - ex->ee_block);
+			count = ex->ee_block + ex->ee_len - lblock;
+			if (count > maxblocks)
+				count = maxblocks;
+			nvfuse_ext_release_path(sb, path, depth);
+			goto got_it;
+		}
+	}
+
+	/* hole */
+	next = nvfuse_ext_next_block(path, depth);
+	nvfuse_ext_release_path(sb, path, depth);
+
+	if (!create)
+		return 0;
+
+	num = maxblocks;
+	if (num > next - lblock)
+		num = next - lblock;
+	if (num > NVFUSE_EXT_MAX_ALLOC)
+		num = NVFUSE_EXT_MAX_ALLOC;
+
+	blocks = spdk_zmalloc(sizeof(u32) * num, 0, NULL);
+	assert(blocks != NULL);
+
+	if (nvfuse_alloc_free_block(sb, ictx->ictx_inode, blocks, num) != num) {
+		printf(" Warning: it runs out of free blocks.\n");
+		spdk_free(blocks);
+		return -ENOSPC;
+	}
+
+	/* blocks are not always contiguous, so each run becomes an extent */
+	for (i = 0; i < num; i = j) {
+		for (j = i + 1; j < num && blocks[j] == blocks[j - 1] + 1; j++)
+			;
+
+		ret = nvfuse_ext_add(sb, ictx, lblock + i, blocks[i], j - i);
+		if (ret) {
+			nvfuse_return_free_blocks(sb, blocks + i, num - i);
+			break;
+		}
+
+		if (i == 0) {
+			first_block = blocks[0];
+			count = j;
+		}
+	}
+
+	spdk_free(blocks);
+	nvfuse_mark_inode_dirty(ictx);
+
+	if (count == 0)
+		return ret;
+
+got_it:
+	if (num_alloc_blocks)
+		*num_alloc_blocks = count;
+
+	if (pblock)
+		*pblock = first_block;
+
+	return 0;
+}
+
+/* remove mappings at or beyond iblock in the subtree, returns 1 if node is changed */
+static s32 nvfuse_ext_truncate_node(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				    struct nvfuse_extent_header *hdr, u32 iblock)
+{
+	struct nvfuse_extent_header *chdr;
+	struct nvfuse_buffer_head *bh;
+	struct nvfuse_extent_idx *idx;
+	struct nvfuse_extent *ex;
+	s32 changed = 0;
+	u32 cut;
+	s32 i;
+
+	if (hdr->eh_depth == 0) {
+		for (i = (s32)hdr->eh_entries - 1; i >= 0; i--) {
+			ex = NVFUSE_EXT_FIRST_EXTENT(hdr) + i;
+			if (ex->ee_block >= iblock) {
+				nvfuse_free_blocks(sb, ex->ee_start, ex->ee_len);
+				hdr->eh_entries--;
+				changed = 1;
+				continue;
+			}
+
+			if (ex->ee_block + ex->ee_len > iblock) {
+				cut = ex->ee_block + ex->ee_len - iblock;
+				nvfuse_free_blocks(sb, ex->ee_start + ex->ee_len - cut, cut);
+				ex->ee_len -= cut;
+				changed = 1;
+			}
+			break;
+		}
+		return changed;
+	}
+
+	for (i = (s32)hdr->eh_entries - 1; i >= 0; i--) {
+		idx = NVFUSE_EXT_FIRST_INDEX(hdr) + i;
+
+		bh = nvfuse_get_bh(sb, ictx, BLOCK_IO_INO, idx->ei_leaf, READ, NVFUSE_TYPE_META);
+		if (bh == NULL) {
+			printf(" Error: extent node read failure, inode=%ld, block=%ld",
+			       (unsigned long)ictx->ictx_ino, (unsigned long)idx->ei_leaf);
+			break;
+		}
+
+		chdr = (struct nvfuse_extent_header *)bh->bh_buf;
+		if (nvfuse_ext_truncate_node(sb, ictx, chdr, iblock))
+			nvfuse_mark_dirty_bh(sb, bh);
+
+		if (chdr->eh_entries == 0) {
+			/* children are removed from the rightmost one */
+			assert(i == hdr->eh_entries - 1);
+			nvfuse_release_bh(sb, bh, 0, CLEAN);
+			nvfuse_free_blocks(sb, idx->ei_leaf, 1);
+			hdr->eh_entries--;
+			changed = 1;
+		} else {
+			nvfuse_release_bh(sb, bh, 0, CLEAN);
+		}
+
+		if (idx->ei_block <= iblock)
+			break;
+	}
+
+	return changed;
+}
+
+void nvfuse_ext_truncate_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				u64 offset)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	struct nvfuse_extent_header *hdr = nvfuse_ext_root(inode);
+	u32 iblock;
+
+	if (hdr->eh_magic != NVFUSE_EXT_MAGIC)
+		return;
+
+	iblock = NVFUSE_SIZE_TO_BLK(offset + CLUSTER_SIZE - 1);
+
+	if (nvfuse_ext_truncate_node(sb, ictx, hdr, iblock))
+		nvfuse_mark_inode_dirty(ictx);
+
+	/* tree without any extent shrinks to an empty leaf root */
+	if (hdr->eh_entries == 0 && hdr->eh_depth) {
+		nvfuse_ext_init_root(inode);
+		nvfuse_mark_inode_dirty(ictx);
+	}
+
+	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+}
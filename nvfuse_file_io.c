@@ -20,10 +20,49 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "nvfuse_core.h"
 #include "nvfuse_io_manager.h"
 #include "nvfuse_types.h"
 #include "nvfuse_malloc.h"
+#include "list.h"
+
+/*
+ * File Disk
+ *
+ * Blocks are read and written by pread/pwrite at block offsets of a
+ * regular file. Async jobs are pushed to a submission ring and served by
+ * NVFUSE_FILEIO_WORKERS threads concurrently, so that a file disk can be
+ * driven with the queue depth of the caller. Finished jobs are collected
+ * by aio_complete() or aio_poll() into the completion job queue of the
+ * io manager, which is only accessed by the caller.
+ */
+
+struct nvfuse_fileio {
+	pthread_t workers[NVFUSE_FILEIO_WORKERS];
+	s32 nr_workers;
+	s32 stop;
+
+	pthread_mutex_t lock;
+	pthread_cond_t sq_cond; /* signaled when jobs are submitted */
+	pthread_cond_t cq_cond; /* signaled when jobs are finished */
+
+	/* submitted jobs */
+	struct io_job *sq[AIO_MAX_QDEPTH];
+	s32 sq_head;
+	s32 sq_tail;
+	s32 sq_cnt;
+
+	/* finished jobs */
+	struct io_job *cq[AIO_MAX_QDEPTH];
+	s32 cq_head;
+	s32 cq_tail;
+	s32 cq_cnt;
+};
 
 static int file_open(struct nvfuse_io_manager *io_manager, int flags);
 static int file_close(struct nvfuse_io_manager *io_manager);
@@ -31,11 +70,265 @@ static int file_read_blk(struct nvfuse_io_manager *io_manager, long block,
 			 int count, void *buf);
 static int file_write_blk(struct nvfuse_io_manager *io_manager, long block,
 			  int count, void *buf);
+static int file_readv_blk(struct nvfuse_io_manager *io_manager, long block,
+			  int count, struct iovec *iov, int iovcnt);
+static int file_writev_blk(struct nvfuse_io_manager *io_manager, long block,
+			   int count, struct iovec *iov, int iovcnt);
+
+static void file_do_job(struct nvfuse_io_manager *io_manager, struct io_job *job)
+{
+	struct iovec single;
+	struct iovec *iov;
+	ssize_t ret;
+	int iovcnt;
+
+	/* merged pages are transferred by a single vectored request */
+	if (job->iovcnt > 1) {
+		iov = job->iov;
+		iovcnt = job->iovcnt;
+	} else {
+		single.iov_base = job->buf;
+		single.iov_len = job->bytes;
+		iov = &single;
+		iovcnt = 1;
+	}
+
+	do {
+		if (job->req_type == READ)
+			ret = preadv(io_manager->dev, iov, iovcnt, job->offset);
+		else
+			ret = pwritev2(io_manager->dev, iov, iovcnt, job->offset,
+				       job->fua ? RWF_DSYNC : 0);
+	} while (ret < 0 && errno == EINTR);
+
+	job->ret = (size_t)ret;
+}
+
+static void *file_worker(void *arg)
+{
+	struct nvfuse_io_manager *io_manager = (struct nvfuse_io_manager *)arg;
+	struct nvfuse_fileio *fio = io_manager->fileio;
+	struct io_job *job;
+
+	pthread_mutex_lock(&fio->lock);
+	while (1) {
+		while (fio->sq_cnt == 0 && !fio->stop)
+			pthread_cond_wait(&fio->sq_cond, &fio->lock);
+
+		if (fio->sq_cnt == 0)
+			break;
+
+		job = fio->sq[fio->sq_tail];
+		fio->sq_tail = (fio->sq_tail + 1) % AIO_MAX_QDEPTH;
+		fio->sq_cnt--;
+		pthread_mutex_unlock(&fio->lock);
+
+		file_do_job(io_manager, job);
+
+		pthread_mutex_lock(&fio->lock);
+		fio->cq[fio->cq_head] = job;
+		fio->cq_head = (fio->cq_head + 1) % AIO_MAX_QDEPTH;
+		fio->cq_cnt++;
+		pthread_cond_signal(&fio->cq_cond);
+	}
+	pthread_mutex_unlock(&fio->lock);
+
+	return NULL;
+}
+
+static int file_aio_init(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_fileio *fio;
+	int ret;
+	int i;
+
+	fio = (struct nvfuse_fileio *)nvfuse_malloc(sizeof(struct nvfuse_fileio));
+	if (fio == NULL) {
+		printf(" Error: nvfuse_malloc() \n");
+		return -1;
+	}
+	memset(fio, 0x00, sizeof(struct nvfuse_fileio));
+
+	pthread_mutex_init(&fio->lock, NULL);
+	pthread_cond_init(&fio->sq_cond, NULL);
+	pthread_cond_init(&fio->cq_cond, NULL);
+
+	io_manager->fileio = fio;
+
+	for (i = 0; i < NVFUSE_FILEIO_WORKERS; i++) {
+		ret = pthread_create(&fio->workers[i], NULL, file_worker, io_manager);
+		if (ret) {
+			printf(" Error: pthread_create() ret = %d \n", ret);
+			break;
+		}
+		fio->nr_workers++;
+	}
+
+	if (fio->nr_workers == 0) {
+		io_manager->fileio = NULL;
+		nvfuse_free(fio);
+		return -1;
+	}
+
+	printf(" called: file aio init (workers = %d) \n", fio->nr_workers);
+
+	return 0;
+}
+
+static int file_aio_cleanup(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_fileio *fio = io_manager->fileio;
+	int i;
+
+	if (fio == NULL)
+		return 0;
+
+	/* workers exit after submitted jobs are drained */
+	pthread_mutex_lock(&fio->lock);
+	fio->stop = 1;
+	pthread_cond_broadcast(&fio->sq_cond);
+	pthread_mutex_unlock(&fio->lock);
+
+	for (i = 0; i < fio->nr_workers; i++)
+		pthread_join(fio->workers[i], NULL);
+
+	pthread_cond_destroy(&fio->cq_cond);
+	pthread_cond_destroy(&fio->sq_cond);
+	pthread_mutex_destroy(&fio->lock);
+
+	nvfuse_free(fio);
+	io_manager->fileio = NULL;
+
+	return 0;
+}
+
+/* job itself carries everything a worker needs */
+static int file_aio_prep(struct nvfuse_io_manager *io_manager, struct io_job *job)
+{
+	return 0;
+}
+
+static int file_aio_submit(struct nvfuse_io_manager *io_manager, struct iocb **ioq, int qcnt)
+{
+	struct nvfuse_fileio *fio = io_manager->fileio;
+	struct io_job *job;
+	int i;
+
+	pthread_mutex_lock(&fio->lock);
+	for (i = 0; i < qcnt; i++) {
+		job = (struct io_job *)container_of(ioq[i], struct io_job, iocb);
+
+		assert(fio->sq_cnt < AIO_MAX_QDEPTH);
+		fio->sq[fio->sq_head] = job;
+		fio->sq_head = (fio->sq_head + 1) % AIO_MAX_QDEPTH;
+		fio->sq_cnt++;
+
+		if (job->req_type == WRITE && !job->fua)
+			io_manager->wc_dirty = 1;
+	}
+	pthread_cond_broadcast(&fio->sq_cond);
+	pthread_mutex_unlock(&fio->lock);
+
+	return qcnt;
+}
+
+/* move finished jobs to completion job queue (called with lock held) */
+static int file_aio_reap(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_fileio *fio = io_manager->fileio;
+	int cc = 0; // completion count
+
+	while (fio->cq_cnt) {
+		io_manager->cjob[io_manager->cjob_head] = fio->cq[fio->cq_tail];
+		io_manager->cjob_head = (io_manager->cjob_head + 1) % io_manager->iodepth;
+		fio->cq_tail = (fio->cq_tail + 1) % AIO_MAX_QDEPTH;
+		fio->cq_cnt--;
+		cc++;
+	}
+
+	return cc;
+}
+
+static int file_aio_complete(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_fileio *fio = io_manager->fileio;
+	struct timespec time_out;
+	int retry_count = AIO_RETRY_COUNT;
+	int cc;
+	int res;
+
+	if (io_manager->queue_cur_count == 0)
+		return 0;
+
+	pthread_mutex_lock(&fio->lock);
+	while (fio->cq_cnt == 0) {
+		clock_gettime(CLOCK_REALTIME, &time_out);
+		time_out.tv_sec += AIO_MAX_TIMEOUT_SEC;
+
+		res = pthread_cond_timedwait(&fio->cq_cond, &fio->lock, &time_out);
+		if (res == ETIMEDOUT) { // timer expires
+			printf(" AIO timer expires curr qdepth = %d, retval = %d  \n",
+			       io_manager->queue_cur_count, res);
+			if (--retry_count)
+				continue;
+
+			break;
+		}
+	}
+	cc = file_aio_reap(io_manager);
+	pthread_mutex_unlock(&fio->lock);
+
+	return cc;
+}
+
+static int file_aio_poll(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_fileio *fio = io_manager->fileio;
+	int cc;
+
+	if (io_manager->queue_cur_count == 0)
+		return 0;
+
+	pthread_mutex_lock(&fio->lock);
+	cc = file_aio_reap(io_manager);
+	pthread_mutex_unlock(&fio->lock);
+
+	return cc;
+}
+
+static struct io_job *file_aio_getnextcjob(struct nvfuse_io_manager *io_manager)
+{
+	struct io_job *cur_job;
+
+	assert(!cjob_empty(io_manager));
+
+	cur_job = io_manager->cjob[io_manager->cjob_tail];
+	io_manager->cjob[io_manager->cjob_tail] = NULL;
+
+	io_manager->cjob_tail = (io_manager->cjob_tail + 1) % io_manager->iodepth;
+	return cur_job;
+}
+
+static int file_dev_flush(struct nvfuse_io_manager *io_manager)
+{
+	int ret;
+
+	ret = fdatasync(io_manager->dev);
+	if (ret < 0) {
+		printf(" Error: fdatasync() errno = %d \n", errno);
+		return ret;
+	}
+
+	io_manager->wc_dirty = 0;
+
+	return 0;
+}
 
 /* dev_size in MB units */
 void nvfuse_init_fileio(struct nvfuse_io_manager *io_manager, char *name, char *path, s32 dev_size)
 {
 	int len;
+	int i;
 
 	len = strlen(path) + 1;
 
@@ -52,40 +345,68 @@ void nvfuse_init_fileio(struct nvfuse_io_manager *io_manager, char *name, char *
 	io_manager->io_close = file_close;
 	io_manager->io_read = file_read_blk;
 	io_manager->io_write = file_write_blk;
+	io_manager->io_readv = file_readv_blk;
+	io_manager->io_writev = file_writev_blk;
 	io_manager->dev_format = NULL;
+	io_manager->dev_flush = file_dev_flush;
+
+	io_manager->cjob_head = 0;
+	io_manager->cjob_tail = 0;
+	io_manager->iodepth = AIO_MAX_QDEPTH;
+	io_manager->queue_cur_count = 0;
+
+	for (i = 0; i < AIO_MAX_QDEPTH; i++) {
+		io_manager->cjob[i] = NULL;
+	}
+
+	/* Worker Thread AIO Function Pointers */
+	io_manager->aio_init = file_aio_init;
+	io_manager->aio_cleanup = file_aio_cleanup;
+	io_manager->aio_prep = file_aio_prep;
+	io_manager->aio_submit = file_aio_submit;
+	io_manager->aio_complete = file_aio_complete;
+	io_manager->aio_poll = file_aio_poll;
+	io_manager->aio_getnextcjob = file_aio_getnextcjob;
+	io_manager->aio_resetnextcjob = NULL;
+	io_manager->aio_cancel = NULL;
+
+	/* FUA writes are issued with RWF_DSYNC */
+	io_manager->fua_support = 1;
+	io_manager->fileio = NULL;
 
 	io_manager->total_blkcount = (s64)dev_size * NVFUSE_MEGA_BYTES / SECTOR_SIZE;
 }
 
 static int file_open(struct nvfuse_io_manager *io_manager, int flags)
 {
-	FILE *fp;
-	char buf[CLUSTER_SIZE];
+	struct stat st;
+	s64 size;
 	int	retval = 0;
-	int i;
-	s64 max;
 
-	memset(buf, 0x00, CLUSTER_SIZE);
+	io_manager->dev = open(io_manager->dev_path, O_RDWR | O_CREAT, 0644);
+	if (io_manager->dev < 0) {
+		printf(" open error %s\n", io_manager->dev_path);
+		retval = -1;
+		goto cleanup;
+	}
 
-	fp = fopen(io_manager->dev_path, "rb+");
-	if (fp == NULL) {
-		fp = fopen(io_manager->dev_path, "wb+");
-		if (fp == NULL) {
-			printf(" fopen error\n");
+	/* unwritten area of a sparse file reads as zero */
+	size = (s64)io_manager->total_blkcount * SECTOR_SIZE;
+	if (fstat(io_manager->dev, &st) == 0 && st.st_size < size) {
+		printf("create file for FILE IO\n");
+		if (ftruncate(io_manager->dev, size) < 0) {
+			printf(" ftruncate error %s\n", io_manager->dev_path);
+			close(io_manager->dev);
 			retval = -1;
 			goto cleanup;
 		}
-
-		max = io_manager->total_blkcount * 512;
-		max = max / CLUSTER_SIZE;
-		printf("create file for FILE IO\n");
-		for (i = 0; i < max; i++) {
-			fwrite(buf, CLUSTER_SIZE, 1, fp);
-		}
 	}
 
-
-	io_manager->fp = fp;
+	if (io_manager->aio_init(io_manager) < 0) {
+		close(io_manager->dev);
+		retval = -1;
+		goto cleanup;
+	}
 
 	printf(" File Disk Init\n");
 
@@ -99,7 +420,11 @@ static int file_close(struct nvfuse_io_manager *io_manager)
 {
 	int	retval = 0;
 
-	fclose(io_manager->fp);
+	io_manager->aio_cleanup(io_manager);
+
+	if (close(io_manager->dev) < 0) {
+		retval = errno;
+	}
 
 	free(io_manager->dev_path);
 	free(io_manager->io_name);
@@ -110,60 +435,67 @@ static int file_close(struct nvfuse_io_manager *io_manager)
 static int file_read_blk(struct nvfuse_io_manager *io_manager, long block,
 			 int count, void *buf)
 {
-	int	size, ret;
-#if (_FILE_OFFSET_BITS==64)
+	int	size, rbytes;
 	s64 location;
-#else
-	s32	location;
-#endif
 
 	size = count * CLUSTER_SIZE;
 	location = ((s64) block * CLUSTER_SIZE);
 
-#if (_FILE_OFFSET_BITS==64)
-	fsetpos64(io_manager->fp, (fpos64_t *)(&location));
-#else
-	fsetpos(io_manager->fp, (fpos_t *)(&location));
-#endif
-	ret = fread(buf, size, 1, io_manager->fp);
-
-	if (ret)
-		return size;
-	else
+	rbytes = pread(io_manager->dev, buf, size, location);
+	if (rbytes != size)
 		return -1;
+
+	return size;
 }
 
 static int file_write_blk(struct nvfuse_io_manager *io_manager, long block,
 			  int count, void *buf)
 {
-	int	size, ret;
-#if (FILE_OFFSET_BITS==64)
+	int	size, wbytes;
 	s64 location;
-#else
-	s32	location;
-#endif
 
-	/* debug code */
-#if 0
-	if (block % 32768 == NVFUSE_BD_OFFSET) {
-		struct nvfuse_bg_descriptor *bd = buf;
-		assert(bd->bd_dbitmap_size);
-	}
-#endif
+	size = count * CLUSTER_SIZE;
+	location = ((s64) block * CLUSTER_SIZE);
+
+	wbytes = pwrite(io_manager->dev, buf, size, location);
+	io_manager->wc_dirty = 1;
+	if (wbytes != size)
+		return -1;
+
+	return size;
+}
+
+static int file_readv_blk(struct nvfuse_io_manager *io_manager, long block,
+			  int count, struct iovec *iov, int iovcnt)
+{
+	int	size, rbytes;
+	s64 location;
 
 	size = count * CLUSTER_SIZE;
 	location = ((s64) block * CLUSTER_SIZE);
 
-#if (_FILE_OFFSET_BITS==64)
-	fsetpos64(io_manager->fp, (fpos64_t *)&location);
-#else
-	fsetpos(io_manager->fp, (fpos_t *)(&location));
-#endif
-	ret = fwrite(buf, size, 1, io_manager->fp);
+	rbytes = preadv(io_manager->dev, iov, iovcnt, location);
+	if (rbytes != size) {
+		printf(" readv error, block = %lu, count = %d, size = %d\n", block, count, rbytes);
+	}
 
-	if (ret)
-		return size;
-	else
-		return -1;
+	return rbytes;
 }
 
+static int file_writev_blk(struct nvfuse_io_manager *io_manager, long block,
+			   int count, struct iovec *iov, int iovcnt)
+{
+	int	size, wbytes;
+	s64 location;
+
+	size = count * CLUSTER_SIZE;
+	location = ((s64) block * CLUSTER_SIZE);
+
+	wbytes = pwritev(io_manager->dev, iov, iovcnt, location);
+	io_manager->wc_dirty = 1;
+	if (wbytes != size) {
+		printf(" writev error, block = %lu, count = %d, size = %d\n", block, count, wbytes);
+	}
+
+	return wbytes;
+}
@@ -0,0 +1,195 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nvfuse_config.h"
+#include "nvfuse_index.h"
+
+/*
+ * The index doubles when the load factor exceeds NVFUSE_INDEX_MAX_LOAD
+ * percent and halves when it drops below a quarter of that, but never
+ * shrinks below min_capacity. Removal shifts following entries back
+ * instead of leaving tombstones, so probe sequences stay short.
+ */
+
+static inline u32 nvfuse_index_hash(struct nvfuse_index *index, u64 key)
+{
+	/* fibonacci hashing */
+	return (u32)((key * 0x9E3779B97F4A7C15ULL) >> index->shift);
+}
+
+static u32 nvfuse_index_bits(u32 capacity)
+{
+	u32 bits = 0;
+
+	while ((1U << bits) < capacity)
+		bits++;
+
+	return bits;
+}
+
+static s32 nvfuse_index_alloc(struct nvfuse_index *index, u32 capacity)
+{
+	u32 bits = nvfuse_index_bits(capacity);
+
+	index->slots = (struct nvfuse_index_slot *)calloc((size_t)1 << bits,
+			sizeof(struct nvfuse_index_slot));
+	if (index->slots == NULL)
+		return -1;
+
+	index->capacity = 1U << bits;
+	index->shift = 64 - bits;
+	index->count = 0;
+
+	return 0;
+}
+
+static void nvfuse_index_put(struct nvfuse_index *index, u64 key, void *val)
+{
+	u32 mask = index->capacity - 1;
+	u32 pos = nvfuse_index_hash(index, key);
+
+	while (index->slots[pos].val)
+		pos = (pos + 1) & mask;
+
+	index->slots[pos].key = key;
+	index->slots[pos].val = val;
+	index->count++;
+}
+
+static s32 nvfuse_index_resize(struct nvfuse_index *index, u32 capacity)
+{
+	struct nvfuse_index_slot *old_slots = index->slots;
+	u32 old_capacity = index->capacity;
+	u32 i;
+
+	if (nvfuse_index_alloc(index, capacity) < 0) {
+		index->slots = old_slots;
+		return -1;
+	}
+
+	for (i = 0; i < old_capacity; i++) {
+		if (old_slots[i].val)
+			nvfuse_index_put(index, old_slots[i].key, old_slots[i].val);
+	}
+
+	free(old_slots);
+
+	return 0;
+}
+
+s32 nvfuse_index_init(struct nvfuse_index *index, u32 min_capacity)
+{
+	if (min_capacity < 2)
+		min_capacity = 2;
+
+	if (nvfuse_index_alloc(index, min_capacity) < 0) {
+		printf(" Error: calloc() \n");
+		return -1;
+	}
+
+	index->min_capacity = index->capacity;
+
+	return 0;
+}
+
+void nvfuse_index_deinit(struct nvfuse_index *index)
+{
+	free(index->slots);
+	index->slots = NULL;
+	index->capacity = 0;
+	index->count = 0;
+}
+
+void *nvfuse_index_lookup(struct nvfuse_index *index, u64 key)
+{
+	struct nvfuse_index_slot *slot;
+	u32 mask = index->capacity - 1;
+	u32 pos = nvfuse_index_hash(index, key);
+
+	while (1) {
+		slot = &index->slots[pos];
+		if (slot->val == NULL)
+			return NULL;
+		if (slot->key == key)
+			return slot->val;
+		pos = (pos + 1) & mask;
+	}
+}
+
+s32 nvfuse_index_insert(struct nvfuse_index *index, u64 key, void *val)
+{
+	u32 old_capacity = index->capacity;
+
+	assert(val);
+	assert(nvfuse_index_lookup(index, key) == NULL);
+
+	if ((u64)(index->count + 1) * 100 > (u64)index->capacity * NVFUSE_INDEX_MAX_LOAD) {
+		/* a crowded index still works as long as an empty slot is left */
+		if (nvfuse_index_resize(index, index->capacity * 2) < 0 &&
+		    index->count + 1 >= old_capacity) {
+			printf(" Error: index is full (count = %u) \n", index->count);
+			return -1;
+		}
+	}
+
+	nvfuse_index_put(index, key, val);
+
+	return 0;
+}
+
+void *nvfuse_index_remove(struct nvfuse_index *index, u64 key)
+{
+	struct nvfuse_index_slot *slots = index->slots;
+	u32 mask = index->capacity - 1;
+	u32 pos = nvfuse_index_hash(index, key);
+	u32 next, home;
+	void *val;
+
+	while (1) {
+		if (slots[pos].val == NULL)
+			return NULL;
+		if (slots[pos].key == key)
+			break;
+		pos = (pos + 1) & mask;
+	}
+
+	val = slots[pos].val;
+
+	/* backward shift of entries whose probe sequence passes the hole */
+	next = (pos + 1) & mask;
+	while (slots[next].val) {
+		home = nvfuse_index_hash(index, slots[next].key);
+		if (((next - home) & mask) >= ((next - pos) & mask)) {
+			slots[pos] = slots[next];
+			pos = next;
+		}
+		next = (next + 1) & mask;
+	}
+
+	slots[pos].key = 0;
+	slots[pos].val = NULL;
+	index->count--;
+
+	if (index->capacity > index->min_capacity &&
+	    (u64)index->count * 400 < (u64)index->capacity * NVFUSE_INDEX_MAX_LOAD)
+		nvfuse_index_resize(index, index->capacity / 2);
+
+	return val;
+}
@@ -58,6 +58,7 @@
 #include "nvfuse_gettimeofday.h"
 #include "nvfuse_ipc_ring.h"
 #include "nvfuse_indirect.h"
+#include "nvfuse_extent.h"
 
 typedef struct {
 	u32 *p;
@@ -569,8 +570,8 @@ static void nvfuse_splice_branch(struct nvfuse_superblock *sb, struct nvfuse_ino
 * return = 0, if plain lookup failed.
 * return < 0, error case.
 */
-s32 nvfuse_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
-		     u32 maxblocks, u32 *num_alloc_blocks, u32 *pblock, u32 create)
+static s32 __nvfuse_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			      s32 lblock, u32 maxblocks, u32 *num_alloc_blocks, u32 *pblock, u32 create)
 {
 	s32 offsets[INDIRECT_BLOCKS_LEVEL];
 	Indirect chain[INDIRECT_BLOCKS_LEVEL];
@@ -668,6 +669,191 @@ cleanup:
 	return 0;
 }
 
+#ifdef NVFUSE_USE_MAP_CACHE
+void nvfuse_map_cache_init(struct nvfuse_inode_ctx *ictx)
+{
+	ictx->ictx_map.mc_nr = 0;
+	ictx->ictx_map.mc_clock = 0;
+}
+
+/* index of the last entry whose mc_lblk <= lblock, -1 if none */
+static s32 nvfuse_map_cache_search(struct nvfuse_map_cache *mc, lbno_t lblock)
+{
+	s32 l = 0, r = mc->mc_nr - 1, m;
+	s32 pos = -1;
+
+	while (l <= r) {
+		m = (l + r) / 2;
+		if (mc->mc_ents[m].mc_lblk <= lblock) {
+			pos = m;
+			l = m + 1;
+		} else {
+			r = m - 1;
+		}
+	}
+
+	return pos;
+}
+
+static s32 nvfuse_map_cache_lookup(struct nvfuse_map_cache *mc, lbno_t lblock, u32 maxblocks,
+				   u32 *num_blocks, u32 *pblock)
+{
+	struct nvfuse_map_cache_entry *ent;
+	u32 count;
+	s32 pos;
+
+	pos = nvfuse_map_cache_search(mc, lblock);
+	if (pos < 0)
+		return 0;
+
+	ent = &mc->mc_ents[pos];
+	if (lblock >= ent->mc_lblk + ent->mc_len)
+		return 0;
+
+	count = ent->mc_len - (lblock - ent->mc_lblk);
+	if (maxblocks && count > maxblocks)
+		count = maxblocks;
+
+	*pblock = ent->mc_pblk + (lblock - ent->mc_lblk);
+	*num_blocks = count;
+	ent->mc_stamp = ++mc->mc_clock;
+
+	return 1;
+}
+
+static void nvfuse_map_cache_remove(struct nvfuse_map_cache *mc, s32 pos)
+{
+	memmove(mc->mc_ents + pos, mc->mc_ents + pos + 1,
+		(mc->mc_nr - pos - 1) * sizeof(struct nvfuse_map_cache_entry));
+	mc->mc_nr--;
+}
+
+static void nvfuse_map_cache_insert(struct nvfuse_map_cache *mc, lbno_t lblock, u32 pblock,
+				    u32 len)
+{
+	struct nvfuse_map_cache_entry *ent;
+	s32 pos, victim, i;
+
+	if (len == 0)
+		return;
+
+	/* drop runs overlapping the new one since it is the latest mapping */
+	pos = nvfuse_map_cache_search(mc, lblock + len - 1);
+	while (pos >= 0 && mc->mc_ents[pos].mc_lblk + mc->mc_ents[pos].mc_len > lblock) {
+		nvfuse_map_cache_remove(mc, pos);
+		pos--;
+	}
+
+	/* extend the previous run if both logically and physically contiguous */
+	if (pos >= 0) {
+		ent = &mc->mc_ents[pos];
+		if (ent->mc_lblk + ent->mc_len == lblock && ent->mc_pblk + ent->mc_len == pblock) {
+			ent->mc_len += len;
+			ent->mc_stamp = ++mc->mc_clock;
+			return;
+		}
+	}
+
+	if (mc->mc_nr == NVFUSE_MAP_CACHE_SIZE) {
+		/* evict the least recently used run */
+		victim = 0;
+		for (i = 1; i < mc->mc_nr; i++) {
+			if (mc->mc_ents[i].mc_stamp < mc->mc_ents[victim].mc_stamp)
+				victim = i;
+		}
+		nvfuse_map_cache_remove(mc, victim);
+		if (victim <= pos)
+			pos--;
+	}
+
+	pos++;
+	memmove(mc->mc_ents + pos + 1, mc->mc_ents + pos,
+		(mc->mc_nr - pos) * sizeof(struct nvfuse_map_cache_entry));
+	ent = &mc->mc_ents[pos];
+	ent->mc_lblk = lblock;
+	ent->mc_pblk = pblock;
+	ent->mc_len = len;
+	ent->mc_stamp = ++mc->mc_clock;
+	mc->mc_nr++;
+}
+
+/* forget mappings at or beyond iblock */
+static void nvfuse_map_cache_truncate(struct nvfuse_map_cache *mc, lbno_t iblock)
+{
+	struct nvfuse_map_cache_entry *ent;
+
+	while (mc->mc_nr) {
+		ent = &mc->mc_ents[mc->mc_nr - 1];
+		if (ent->mc_lblk >= iblock) {
+			mc->mc_nr--;
+			continue;
+		}
+
+		if (ent->mc_lblk + ent->mc_len > iblock)
+			ent->mc_len = iblock - ent->mc_lblk;
+		break;
+	}
+}
+#endif
+
+/*
+* Lookup (and allocation if create is set) of block mapping.
+* Recently resolved runs are served from the mapping cache of inode context
+* without walking indirect blocks or extent tree.
+*/
+s32 nvfuse_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
+		     u32 maxblocks, u32 *num_alloc_blocks, u32 *pblock, u32 create)
+{
+	u32 num_blocks = 0;
+	u32 first_block = 0;
+	s32 ret;
+
+	if (pblock)
+		*pblock = 0;
+
+	if (num_alloc_blocks)
+		*num_alloc_blocks = 0;
+
+	if (lblock < 0)
+		return -1;
+
+	/* inline data has no block mapping until it is moved to a block */
+	if (nvfuse_inode_has_inline_data(ictx->ictx_inode)) {
+		if (!create)
+			return 0;
+
+		ret = nvfuse_inline_data_convert(sb, ictx);
+		if (ret)
+			return ret;
+	}
+
+#ifdef NVFUSE_USE_MAP_CACHE
+	if (nvfuse_map_cache_lookup(&ictx->ictx_map, lblock, maxblocks, &num_blocks, &first_block))
+		goto got_it;
+#endif
+
+	if (nvfuse_extent_enabled(sb))
+		ret = nvfuse_ext_get_block(sb, ictx, lblock, maxblocks, &num_blocks, &first_block, create);
+	else
+		ret = __nvfuse_get_block(sb, ictx, lblock, maxblocks, &num_blocks, &first_block, create);
+
+	if (ret || first_block == 0)
+		return ret;
+
+#ifdef NVFUSE_USE_MAP_CACHE
+	nvfuse_map_cache_insert(&ictx->ictx_map, lblock, first_block, num_blocks);
+
+got_it:
+#endif
+	if (num_alloc_blocks)
+		*num_alloc_blocks = num_blocks;
+
+	if (pblock)
+		*pblock = first_block;
+
+	return 0;
+}
+
 /*
 * Probably it should be a library function... search for first non-zero word
 * or memcmp with zero_page, whatever is better for particular architecture.
@@ -961,6 +1147,29 @@ void nvfuse_truncate_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 	if (IS_APPEND(inode) || IS_IMMUTABLE(inode))
 		return;*/
 
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+
+	if (nvfuse_inode_has_inline_data(inode)) {
+		if (offset > NVFUSE_INLINE_DATA_SIZE) {
+			/* file is extended beyond inline area */
+			nvfuse_inline_data_convert(sb, ictx);
+		} else if (offset < inode->i_size) {
+			/* inline area beyond i_size is kept zeroed */
+			memset(inode->i_inline_data + offset, 0x00, NVFUSE_INLINE_DATA_SIZE - offset);
+			nvfuse_mark_inode_dirty(ictx);
+		}
+		return;
+	}
+
+#ifdef NVFUSE_USE_MAP_CACHE
+	nvfuse_map_cache_truncate(&ictx->ictx_map, NVFUSE_SIZE_TO_BLK(offset + CLUSTER_SIZE - 1));
+#endif
+
+	if (nvfuse_extent_enabled(sb)) {
+		nvfuse_ext_truncate_blocks(sb, ictx, offset);
+		return;
+	}
+
 	//dax_sem_down_write(EXT2_I(inode));
 	__nvfuse_truncate_blocks(sb, ictx, offset);
 	//dax_sem_up_write(EXT2_I(inode));
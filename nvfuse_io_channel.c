@@ -0,0 +1,228 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "nvfuse_core.h"
+#include "nvfuse_io_manager.h"
+#include "nvfuse_io_channel.h"
+#include "nvfuse_malloc.h"
+#include "list.h"
+
+/*
+ * Per-thread I/O channels
+ *
+ * SPDK qpairs, libaio contexts and io_uring rings must not be used by
+ * multiple threads at once. Instead of serializing every thread on a
+ * single io_manager, each thread submits foreground I/O (sync reads and
+ * writes, user aio, fsync) through its own channel, which is a clone of
+ * sb->io_manager with private qpairs (or aio context) and a private
+ * completion ring. A channel is created on first use and released at
+ * unmount.
+ *
+ * Writeback and readahead keep using sb->io_manager as a background
+ * channel. Their jobs may be reaped by any thread, so the background
+ * channel is used under sb_bg_io_lock.
+ */
+
+/* cache of the channel looked up last by this thread */
+static __thread struct nvfuse_superblock *tls_sb;
+static __thread u64 tls_gen;
+static __thread struct nvfuse_io_manager *tls_iom;
+
+/* generation distinguishes a superblock mounted again at the same address */
+static u64 nvfuse_io_channel_gen;
+
+void nvfuse_io_channel_init(struct nvfuse_superblock *sb)
+{
+	pthread_mutexattr_t attr;
+
+	INIT_LIST_HEAD(&sb->sb_io_channels);
+	pthread_mutex_init(&sb->sb_io_channel_lock, NULL);
+	sb->sb_io_channel_gen = __sync_add_and_fetch(&nvfuse_io_channel_gen, 1);
+
+	/* writeback may be waited for while a buffer is replaced during readahead */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&sb->sb_bg_io_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static struct nvfuse_io_channel *nvfuse_io_channel_create(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_io_channel *ch;
+	struct nvfuse_io_manager *iom;
+	s32 ns, i;
+	s32 res;
+
+	ch = (struct nvfuse_io_channel *)nvfuse_malloc(sizeof(struct nvfuse_io_channel));
+	if (ch == NULL) {
+		printf(" Error: nvfuse_malloc() \n");
+		return NULL;
+	}
+
+	/* device and callbacks are shared, queues and completions are private */
+	iom = &ch->ch_iom;
+	memcpy(iom, sb->io_manager, sizeof(struct nvfuse_io_manager));
+	memset(iom->cjob, 0x00, sizeof(iom->cjob));
+	memset(&iom->perf_stat_dev, 0x00, sizeof(iom->perf_stat_dev));
+	iom->cjob_head = 0;
+	iom->cjob_tail = 0;
+	iom->cjob_cnt = 0;
+	iom->queue_cur_count = 0;
+	iom->wc_dirty = 0;
+#if NVFUSE_OS == NVFUSE_OS_LINUX
+	iom->uring = NULL;
+	iom->fileio = NULL;
+	iom->ramdisk_model = NULL;
+#endif
+
+	if (iom->type == IO_MANAGER_SPDK) {
+		for (ns = 0; ns < SPDK_MAX_NAMESPACES; ns++) {
+			for (i = 0; i < SPDK_QUEUE_NUM; i++)
+				iom->spdk_queue[ns][i] = NULL;
+		}
+		res = spdk_alloc_qpair(iom);
+		if (res < 0)
+			spdk_free_qpair(iom);
+	} else if (iom->aio_init) {
+		res = iom->aio_init(iom);
+	} else {
+		res = 0;
+	}
+
+	if (res < 0) {
+		printf(" Error: I/O channel init \n");
+		nvfuse_free(ch);
+		return NULL;
+	}
+
+	ch->ch_thread = pthread_self();
+
+	return ch;
+}
+
+static void nvfuse_io_channel_destroy(struct nvfuse_superblock *sb, struct nvfuse_io_channel *ch)
+{
+	struct nvfuse_io_manager *iom = &ch->ch_iom;
+	struct perf_stat_dev *stat = &sb->io_manager->perf_stat_dev.stat_dev;
+
+	assert(iom->queue_cur_count == 0);
+
+	if (iom->type == IO_MANAGER_SPDK)
+		spdk_free_qpair(iom);
+	else if (iom->aio_cleanup)
+		iom->aio_cleanup(iom);
+
+	/* device statistics are reported by the handle */
+	stat->total_io_count += iom->perf_stat_dev.stat_dev.total_io_count;
+	stat->read_io_count += iom->perf_stat_dev.stat_dev.read_io_count;
+	stat->write_io_count += iom->perf_stat_dev.stat_dev.write_io_count;
+
+	nvfuse_free(ch);
+}
+
+/* release channels of all threads, no I/O may be in flight */
+void nvfuse_io_channel_release_all(struct nvfuse_superblock *sb)
+{
+	struct list_head *ptr, *temp;
+	struct nvfuse_io_channel *ch;
+
+	pthread_mutex_lock(&sb->sb_io_channel_lock);
+	list_for_each_safe(ptr, temp, &sb->sb_io_channels) {
+		ch = (struct nvfuse_io_channel *)list_entry(ptr, struct nvfuse_io_channel, ch_list);
+		list_del(&ch->ch_list);
+		nvfuse_io_channel_destroy(sb, ch);
+	}
+	pthread_mutex_unlock(&sb->sb_io_channel_lock);
+
+	/* stale caches of other threads are rejected by generation */
+	sb->sb_io_channel_gen = __sync_add_and_fetch(&nvfuse_io_channel_gen, 1);
+	tls_sb = NULL;
+	tls_iom = NULL;
+}
+
+struct nvfuse_io_manager *nvfuse_io_channel(struct nvfuse_superblock *sb)
+{
+	struct list_head *ptr;
+	struct nvfuse_io_channel *ch = NULL;
+	pthread_t self = pthread_self();
+
+	if (tls_sb == sb && tls_gen == sb->sb_io_channel_gen)
+		return tls_iom;
+
+	pthread_mutex_lock(&sb->sb_io_channel_lock);
+	__list_for_each(ptr, &sb->sb_io_channels) {
+		ch = (struct nvfuse_io_channel *)list_entry(ptr, struct nvfuse_io_channel, ch_list);
+		if (pthread_equal(ch->ch_thread, self))
+			break;
+		ch = NULL;
+	}
+
+	if (ch == NULL) {
+		ch = nvfuse_io_channel_create(sb);
+		if (ch == NULL) {
+			pthread_mutex_unlock(&sb->sb_io_channel_lock);
+			/* FIXME: how can we handle this error? */
+			assert(0);
+			return sb->io_manager;
+		}
+		list_add_tail(&ch->ch_list, &sb->sb_io_channels);
+	}
+	pthread_mutex_unlock(&sb->sb_io_channel_lock);
+
+	tls_sb = sb;
+	tls_gen = sb->sb_io_channel_gen;
+	tls_iom = &ch->ch_iom;
+
+	return tls_iom;
+}
+
+/* non-FUA writes of any channel may sit in device write cache */
+s32 nvfuse_io_wc_dirty(struct nvfuse_superblock *sb)
+{
+	struct list_head *ptr;
+	struct nvfuse_io_channel *ch;
+	s32 dirty = sb->io_manager->wc_dirty;
+
+	pthread_mutex_lock(&sb->sb_io_channel_lock);
+	__list_for_each(ptr, &sb->sb_io_channels) {
+		ch = (struct nvfuse_io_channel *)list_entry(ptr, struct nvfuse_io_channel, ch_list);
+		dirty |= ch->ch_iom.wc_dirty;
+	}
+	pthread_mutex_unlock(&sb->sb_io_channel_lock);
+
+	return dirty;
+}
+
+/*
+ * device write cache is flushed through caller's channel. it also covers
+ * writeback batches retired so far, and background channel is clean if
+ * no batch is in flight.
+ */
+void nvfuse_io_flush(struct nvfuse_superblock *sb)
+{
+	nvfuse_bg_io_lock(sb);
+	sb->sb_wb.wb_need_flush = 0;
+	if (sb->sb_wb.wb_nr_batches == 0)
+		sb->io_manager->wc_dirty = 0;
+	nvfuse_bg_io_unlock(sb);
+
+	nvfuse_dev_flush(nvfuse_io_channel(sb));
+}
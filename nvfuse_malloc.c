@@ -23,6 +23,7 @@
 static u64 memalloc_allocated_size = 0;
 #if NVFUSE_OS == NVFUSE_OS_LINUX
 #include <unistd.h> /* getpagesize() */
+#include <sys/mman.h> /* madvise() */
 
 #ifdef SPDK_ENABLED
 #include <rte_config.h>
@@ -54,12 +55,44 @@ void *nvfuse_alloc_aligned_buffer(size_t size)
 	memalloc_allocated_size++;
 	return p;
 }
+
+/* allocate a region aligned to its size so that it is backed by a single hugepage */
+void *nvfuse_alloc_hugepage_region(size_t size)
+{
+	void *p;
+#ifndef USE_RTE_MEMALLOC
+	s32 ret;
+	ret = posix_memalign(&p, size, size);
+	if (ret) {
+		perror("memalign");
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(p, size, MADV_HUGEPAGE);
+#endif
+#else
+	p = rte_malloc(NULL, size, size);
+	if (p == NULL) {
+		fprintf(stderr, "rte_malloc failed\n");
+		rte_malloc_dump_stats(stdout, NULL);
+		return NULL;
+	}
+#endif
+	memalloc_allocated_size++;
+	return p;
+}
 #else
 void *nvfuse_alloc_aligned_buffer(size_t size)
 {
 	memalloc_allocated_size++;
 	return malloc((size_t)size);
 }
+
+void *nvfuse_alloc_hugepage_region(size_t size)
+{
+	memalloc_allocated_size++;
+	return malloc((size_t)size);
+}
 #endif
 
 void *nvfuse_malloc(size_t size)
@@ -89,3 +122,8 @@ void nvfuse_free_aligned_buffer(void *ptr)
 }
 #endif
 
+void nvfuse_free_hugepage_region(void *ptr)
+{
+	nvfuse_free_aligned_buffer(ptr);
+}
+
@@ -748,7 +748,7 @@ s32 nvfuse_fallocate_test(struct nvfuse_handle *nvh)
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_cd(struct nvfuse_handle *nvh, s8 *str)
+static s32 __nvfuse_cd(struct nvfuse_handle *nvh, s8 *str)
 {
 	struct nvfuse_dir_entry dir_temp;
 	struct nvfuse_inode_ctx *d_ictx;
@@ -777,6 +777,18 @@ s32 nvfuse_cd(struct nvfuse_handle *nvh, s8 *str)
 	return NVFUSE_SUCCESS;
 }
 
+s32 nvfuse_cd(struct nvfuse_handle *nvh, s8 *str)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 res;
+
+	nvfuse_lock(sb);
+	res = __nvfuse_cd(nvh, str);
+	nvfuse_unlock(sb);
+
+	return res;
+}
+
 void nvfuse_test(struct nvfuse_handle *nvh)
 {
 	s32 i, k;
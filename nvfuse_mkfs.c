@@ -30,6 +30,7 @@
 #include "nvfuse_dirhash.h"
 #include "nvfuse_gettimeofday.h"
 #include "nvfuse_mkfs.h"
+#include "nvfuse_extent.h"
 
 s32 nvfuse_alloc_root_inode_direct(struct nvfuse_io_manager *io_manager,
 		struct nvfuse_superblock *sb_disk, u32 bg_id, u32 bg_size)
@@ -99,7 +100,10 @@ s32 nvfuse_alloc_root_inode_direct(struct nvfuse_io_manager *io_manager,
 		inode[ino].i_ctime = time(NULL);
 		inode[ino].i_mtime = time(NULL);
 		inode[ino].i_links_count = 2;
-		inode[ino].i_blocks[0] = bd->bd_dtable_start;
+		if (nvfuse_extent_enabled(sb_disk))
+			nvfuse_ext_format_root(&inode[ino], 0, bd->bd_dtable_start, 1);
+		else
+			inode[ino].i_blocks[0] = bd->bd_dtable_start;
 	}
 	nvfuse_write_cluster(buf, bd->bd_itable_start, io_manager);
 
@@ -353,7 +357,6 @@ s32 nvfuse_format(struct nvfuse_handle *nvh)
 
 	u32 bg_size_bits;
 	s32 bg_p_clu = 0;
-	u32 bg_size = 0;
 
 	u64 num_clu, num_sectors, num_bg;
 	s8 *buf;
@@ -387,6 +390,15 @@ s32 nvfuse_format(struct nvfuse_handle *nvh)
 	memset(buf, 0x00, CLUSTER_SIZE);
 	nvfuse_sb_disk = (struct nvfuse_superblock *) buf;
 
+	if (nvh->nvh_params.extent_mapping) {
+		nvfuse_sb_disk->sb_features |= NVFUSE_FEATURE_EXTENT;
+		printf(" block mapping = extent\n");
+	}
+
+#ifdef NVFUSE_USE_INLINE_DATA
+	nvfuse_sb_disk->sb_features |= NVFUSE_FEATURE_INLINE_DATA;
+#endif
+
 #if NVFUSE_OS == NVFUSE_OS_WINDOWS
 	num_sectors = NO_OF_SECTORS;
 	num_clu = (u32)NVFUSE_NUM_CLU;
@@ -417,13 +429,14 @@ s32 nvfuse_format(struct nvfuse_handle *nvh)
 
 	printf(" sectors = %lu, blocks = %lu\n", (unsigned long)num_sectors, (unsigned long)num_clu);
 
-	bg_size = CLUSTER_SIZE << BITS_PER_CLUSTER_BITS << CLUSTER_SIZE_BITS;
-	bg_size_bits = (s32)log2(bg_size);
+	/* a cluster of block bitmap covers a block group */
+	bg_size_bits = CLUSTER_SIZE_BITS + BITS_PER_CLUSTER_BITS + CLUSTER_SIZE_BITS;
 
 	num_bg = NVFUSE_BG_NUM(num_clu, bg_size_bits - CLUSTER_SIZE_BITS);
 	num_clu = num_bg << (bg_size_bits - CLUSTER_SIZE_BITS);
 
-	printf(" bg size = %dMB \n", (1 << bg_size_bits) / 1024 / 1024);
+	printf(" block size = %dKB \n", CLUSTER_SIZE / 1024);
+	printf(" bg size = %luMB \n", (unsigned long)((1ULL << bg_size_bits) / 1024 / 1024));
 	printf(" num bgs = %ld \n", (unsigned long)num_bg);
 
 	bg_p_clu = 1 << (bg_size_bits - CLUSTER_SIZE_BITS);
@@ -446,6 +459,7 @@ s32 nvfuse_format(struct nvfuse_handle *nvh)
 	nvfuse_sb_disk->sb_no_of_blocks = num_clu;
 
 	nvfuse_sb_disk->sb_signature = NVFUSE_SB_SIGNATURE;
+	nvfuse_sb_disk->sb_block_size = CLUSTER_SIZE;
 
 	nvfuse_sb_disk->sb_no_of_inodes_per_bg = NVFUSE_IBITMAP_SIZE * CLUSTER_SIZE * 8 / 2;
 	nvfuse_sb_disk->sb_no_of_blocks_per_bg = NVFUSE_IBITMAP_SIZE * CLUSTER_SIZE * 8;
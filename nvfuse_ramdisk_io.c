@@ -18,20 +18,262 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include "nvfuse_core.h"
 #include "nvfuse_io_manager.h"
 #include "nvfuse_malloc.h"
+#include "list.h"
+
+/*
+ * Ramdisk Device Model
+ *
+ * Async commands are completed after an emulated device time rather than
+ * right after memcpy so that queueing and completion paths are exercised
+ * as on SSDs. Each command takes a base latency plus uniform jitter and
+ * occasionally a tail latency. It is served by the first idle one of
+ * NVFUSE_RAMDISK_CHANNELS channels and its data moves over a link shared
+ * by all channels at NVFUSE_RAMDISK_BW_MBPS. Commands finished earlier
+ * are reported earlier regardless of submission order unless
+ * NVFUSE_RAMDISK_REORDER is 0. Data is copied when a command is reaped,
+ * so a buffer must not be touched until its job completes.
+ */
+
+struct nvfuse_ramdisk_cmd {
+	struct io_job *job;
+	u64 done_ns; /* emulated completion time */
+};
+
+struct nvfuse_ramdisk_model {
+	u64 chan_free_ns[NVFUSE_RAMDISK_CHANNELS]; /* time each channel becomes idle */
+	u64 link_free_ns; /* time shared link becomes idle */
+	u64 last_done_ns;
+	unsigned int seed;
+
+	/* in-flight commands */
+	struct nvfuse_ramdisk_cmd cmds[AIO_MAX_QDEPTH];
+	s32 nr_cmds;
+};
 
 static int mem_open(struct nvfuse_io_manager *io_manager, int flags);
 static int mem_close(struct nvfuse_io_manager *io_manager);
 static int mem_read_blk(struct nvfuse_io_manager *io_manager, long block, int count, void *buf);
 static int mem_write_blk(struct nvfuse_io_manager *io_manager, long block, int count, void *buf);
 
+static inline u64 mem_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* return emulated completion time of a new command */
+static u64 mem_model_schedule(struct nvfuse_ramdisk_model *model, int req_type, size_t bytes)
+{
+	u64 now = mem_now_ns();
+#ifdef NVFUSE_USE_RAMDISK_MODEL
+	u64 lat, start, done;
+	s32 chan = 0;
+	s32 i;
+
+	lat = (req_type == READ) ? NVFUSE_RAMDISK_READ_USEC : NVFUSE_RAMDISK_WRITE_USEC;
+	lat += rand_r(&model->seed) % (NVFUSE_RAMDISK_JITTER_USEC + 1);
+	if (rand_r(&model->seed) % 1000 < NVFUSE_RAMDISK_TAIL_PERMIL)
+		lat += NVFUSE_RAMDISK_TAIL_USEC;
+	lat *= 1000;
+
+	/* command is served by the channel which becomes idle first */
+	for (i = 1; i < NVFUSE_RAMDISK_CHANNELS; i++) {
+		if (model->chan_free_ns[i] < model->chan_free_ns[chan])
+			chan = i;
+	}
+
+	start = (model->chan_free_ns[chan] > now) ? model->chan_free_ns[chan] : now;
+	done = start + lat;
+
+#if NVFUSE_RAMDISK_BW_MBPS
+	/* bytes / (MB/s) in ns */
+	if (done < model->link_free_ns)
+		done = model->link_free_ns;
+	done += (u64)bytes * 1000 / NVFUSE_RAMDISK_BW_MBPS;
+	model->link_free_ns = done;
+#endif
+
+	model->chan_free_ns[chan] = done;
+
+#if NVFUSE_RAMDISK_REORDER == 0
+	if (done < model->last_done_ns)
+		done = model->last_done_ns;
+	model->last_done_ns = done;
+#endif
+
+	return done;
+#else
+	return now;
+#endif
+}
+
+/* sync I/O also spends emulated device time */
+static void mem_model_wait(struct nvfuse_io_manager *io_manager, int req_type, size_t bytes)
+{
+	struct nvfuse_ramdisk_model *model = io_manager->ramdisk_model;
+	u64 done;
+
+	if (model == NULL)
+		return;
+
+	done = mem_model_schedule(model, req_type, bytes);
+	while (mem_now_ns() < done)
+		;
+}
+
+static void mem_copy_job(struct nvfuse_io_manager *io_manager, struct io_job *job)
+{
+	char *disk = io_manager->ramdisk + job->offset;
+	s32 i;
+
+	if (job->iovcnt > 1) {
+		for (i = 0; i < job->iovcnt; i++) {
+			if (job->req_type == READ)
+				memcpy(job->iov[i].iov_base, disk, job->iov[i].iov_len);
+			else
+				memcpy(disk, job->iov[i].iov_base, job->iov[i].iov_len);
+			disk += job->iov[i].iov_len;
+		}
+		return;
+	}
+
+	if (job->req_type == READ)
+		memcpy(job->buf, disk, job->bytes);
+	else
+		memcpy(disk, job->buf, job->bytes);
+}
+
+static int mem_aio_init(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_ramdisk_model *model;
+
+	model = (struct nvfuse_ramdisk_model *)nvfuse_malloc(sizeof(struct nvfuse_ramdisk_model));
+	if (model == NULL) {
+		printf(" Error: nvfuse_malloc() \n");
+		return -1;
+	}
+	memset(model, 0x00, sizeof(struct nvfuse_ramdisk_model));
+	model->seed = (unsigned int)mem_now_ns();
+
+	io_manager->ramdisk_model = model;
+
+	return 0;
+}
+
+static int mem_aio_cleanup(struct nvfuse_io_manager *io_manager)
+{
+	if (io_manager->ramdisk_model)
+		nvfuse_free(io_manager->ramdisk_model);
+	io_manager->ramdisk_model = NULL;
+
+	return 0;
+}
+
+/* job itself carries everything the model needs */
+static int mem_aio_prep(struct nvfuse_io_manager *io_manager, struct io_job *job)
+{
+	return 0;
+}
+
+static int mem_aio_submit(struct nvfuse_io_manager *io_manager, struct iocb **ioq, int qcnt)
+{
+	struct nvfuse_ramdisk_model *model = io_manager->ramdisk_model;
+	struct nvfuse_ramdisk_cmd *cmd;
+	struct io_job *job;
+	int i;
+
+	for (i = 0; i < qcnt; i++) {
+		job = (struct io_job *)container_of(ioq[i], struct io_job, iocb);
+
+		assert(model->nr_cmds < AIO_MAX_QDEPTH);
+		cmd = &model->cmds[model->nr_cmds++];
+		cmd->job = job;
+		cmd->done_ns = mem_model_schedule(model, job->req_type, job->bytes);
+	}
+
+	return qcnt;
+}
+
+/* move commands whose emulated time has passed to completion job queue */
+static int mem_aio_reap(struct nvfuse_io_manager *io_manager)
+{
+	struct nvfuse_ramdisk_model *model = io_manager->ramdisk_model;
+	struct io_job *job;
+	u64 now = mem_now_ns();
+	int cc = 0; // completion count
+	s32 min;
+	s32 i;
+
+	while (model->nr_cmds) {
+		/* finished commands are reported in the order of completion time */
+		min = -1;
+		for (i = 0; i < model->nr_cmds; i++) {
+			if (model->cmds[i].done_ns > now)
+				continue;
+			if (min < 0 || model->cmds[i].done_ns < model->cmds[min].done_ns)
+				min = i;
+		}
+
+		if (min < 0)
+			break;
+
+		job = model->cmds[min].job;
+		mem_copy_job(io_manager, job);
+		job->ret = job->bytes;
+
+		io_manager->cjob[io_manager->cjob_head] = job;
+		io_manager->cjob_head = (io_manager->cjob_head + 1) % io_manager->iodepth;
+
+		model->cmds[min] = model->cmds[--model->nr_cmds];
+		cc++;
+	}
+
+	return cc;
+}
+
+static int mem_aio_complete(struct nvfuse_io_manager *io_manager)
+{
+	int cc = 0; // completion count
+
+	/* busy waiting like polled devices */
+	while (io_manager->ramdisk_model->nr_cmds && cc == 0)
+		cc = mem_aio_reap(io_manager);
+
+	return cc;
+}
+
+static int mem_aio_poll(struct nvfuse_io_manager *io_manager)
+{
+	return mem_aio_reap(io_manager);
+}
+
+static struct io_job *mem_aio_getnextcjob(struct nvfuse_io_manager *io_manager)
+{
+	struct io_job *cur_job;
+
+	assert(!cjob_empty(io_manager));
+
+	cur_job = io_manager->cjob[io_manager->cjob_tail];
+	io_manager->cjob[io_manager->cjob_tail] = NULL;
+
+	io_manager->cjob_tail = (io_manager->cjob_tail + 1) % io_manager->iodepth;
+	return cur_job;
+}
+
 /* dev_size in MB units */
 void nvfuse_init_memio(struct nvfuse_io_manager *io_manager, char *name, char *path, int dev_size)
 {
 	int len;
+	int i;
 
 	len = strlen(path) + 1;
 	io_manager->dev_path = (char *)nvfuse_malloc(len);
@@ -47,8 +289,31 @@ void nvfuse_init_memio(struct nvfuse_io_manager *io_manager, char *name, char *p
 	io_manager->io_close = mem_close;
 	io_manager->io_read = mem_read_blk;
 	io_manager->io_write = mem_write_blk;
+	io_manager->io_readv = NULL;
+	io_manager->io_writev = NULL;
 	io_manager->dev_format = NULL;
 
+	io_manager->cjob_head = 0;
+	io_manager->cjob_tail = 0;
+	io_manager->iodepth = AIO_MAX_QDEPTH;
+	io_manager->queue_cur_count = 0;
+
+	for (i = 0; i < AIO_MAX_QDEPTH; i++) {
+		io_manager->cjob[i] = NULL;
+	}
+
+	/* Emulated Device AIO Function Pointers */
+	io_manager->aio_init = mem_aio_init;
+	io_manager->aio_cleanup = mem_aio_cleanup;
+	io_manager->aio_prep = mem_aio_prep;
+	io_manager->aio_submit = mem_aio_submit;
+	io_manager->aio_complete = mem_aio_complete;
+	io_manager->aio_poll = mem_aio_poll;
+	io_manager->aio_getnextcjob = mem_aio_getnextcjob;
+	io_manager->aio_resetnextcjob = NULL;
+	io_manager->aio_cancel = NULL;
+	io_manager->ramdisk_model = NULL;
+
 	io_manager->total_blkcount = (s64)dev_size * NVFUSE_MEGA_BYTES / SECTOR_SIZE;
 }
 
@@ -70,6 +335,12 @@ static int mem_open(struct nvfuse_io_manager *io_manager, int flags)
 		return -1;
 	}
 
+	if (io_manager->aio_init(io_manager) < 0) {
+		free(io_manager->ramdisk);
+		io_manager->ramdisk = NULL;
+		return -1;
+	}
+
 	printf(" Ram Disk Init\n");
 	return 0;
 
@@ -77,6 +348,8 @@ static int mem_open(struct nvfuse_io_manager *io_manager, int flags)
 
 static int mem_close(struct nvfuse_io_manager *io_manager)
 {
+	io_manager->aio_cleanup(io_manager);
+
 	if (io_manager->ramdisk)
 		free(io_manager->ramdisk);
 	return 0;
@@ -87,11 +360,13 @@ static int mem_read_blk(struct nvfuse_io_manager *io_manager, long block,
 			int count, void *buf)
 {
 	int	size;
-	int	location;
+	s64	location;
 	char *disk;
 
 	size = (count < 0) ? -count : count * CLUSTER_SIZE;
-	location = ((int) block * (int)CLUSTER_SIZE);
+	location = ((s64) block * CLUSTER_SIZE);
+
+	mem_model_wait(io_manager, READ, size);
 
 	disk = io_manager->ramdisk;
 	memcpy(buf, &disk[location], size);
@@ -104,11 +379,13 @@ static int mem_write_blk(struct nvfuse_io_manager *io_manager, long block,
 			 int count, void *buf)
 {
 	int		size;
-	int	location;
+	s64	location;
 	char *disk;
 
 	size = (count < 0) ? -count : count * CLUSTER_SIZE;
-	location = ((s32) block * CLUSTER_SIZE);
+	location = ((s64) block * CLUSTER_SIZE);
+
+	mem_model_wait(io_manager, WRITE, size);
 
 	disk = io_manager->ramdisk;
 	memcpy(disk +  location, buf, size);
@@ -0,0 +1,331 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nvfuse_core.h"
+#include "nvfuse_io_manager.h"
+#include "nvfuse_io_channel.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_indirect.h"
+#include "nvfuse_readahead.h"
+#include "nvfuse_aio.h"
+
+/*
+ * Sequential readahead
+ *
+ * Each open file keeps a readahead window [ra_start, ra_start + ra_size).
+ * A read which starts where the previous one ended (or at block 0) is
+ * regarded as sequential. The first sequential read opens a window of
+ * NVFUSE_MIN_RA_SIZE right after the requested range, and the window
+ * size is doubled up to NVFUSE_MAX_RA_SIZE whenever the reader enters the
+ * current window. Any non-sequential read collapses the window to zero.
+ *
+ * Blocks in the window are read asynchronously through aio of the
+ * background channel (sb->io_manager under sb_bg_io_lock, i.e.,
+ * SPDK_QUEUE_RA for spdk) into pinned buffer caches, so subsequent
+ * nvfuse_get_bh() calls hit in the cache. Such buffers are marked with
+ * bc_ra until the read is completed, and nvfuse_get_bh() and
+ * nvfuse_get_new_bh() of any file wait for them.
+ */
+
+void nvfuse_ra_init(struct nvfuse_readahead *ra)
+{
+	ra->ra_next = 0;
+	ra->ra_head = 0;
+	ra->ra_start = 0;
+	ra->ra_size = 0;
+	ra->ra_nr_jobs = 0;
+}
+
+static s32 nvfuse_ra_support_aio(struct nvfuse_superblock *sb)
+{
+#if (NVFUSE_OS==NVFUSE_OS_LINUX)
+	if (nvfuse_io_support_aio(sb->io_manager))
+		return 1;
+#endif
+	return 0;
+}
+
+static s32 nvfuse_ra_submit(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			    struct nvfuse_readahead *ra, lbno_t lblock, u32 nr_blocks)
+{
+	struct nvfuse_io_manager *io_manager = sb->io_manager;
+	struct io_job *jobs[NVFUSE_RA_MAX_BLOCKS];
+	struct iocb *iocb[NVFUSE_RA_MAX_BLOCKS];
+	struct nvfuse_buffer_cache *bc;
+	inode_t ino = ictx->ictx_ino;
+	lbno_t end = lblock + nr_blocks;
+	u32 num_blocks, pblock;
+	s32 slots, count = 0;
+	u64 key;
+	s32 ret;
+	u32 i;
+
+	slots = NVFUSE_RA_MAX_BLOCKS - ra->ra_nr_jobs;
+	if (slots > io_manager->iodepth - io_manager->queue_cur_count)
+		slots = io_manager->iodepth - io_manager->queue_cur_count;
+
+	while (lblock < end && count < slots) {
+		nvfuse_make_pbno_key(ino, lblock, &key, NVFUSE_BP_TYPE_DATA);
+		if (nvfuse_hash_lookup(sb, key)) {
+			lblock++;
+			continue;
+		}
+
+		ret = nvfuse_get_block(sb, ictx, lblock, end - lblock, &num_blocks, &pblock, 0);
+		if (ret || pblock == 0 || num_blocks == 0) {
+			lblock++;
+			continue;
+		}
+
+		for (i = 0; i < num_blocks && count < slots; i++, lblock++) {
+			nvfuse_make_pbno_key(ino, lblock, &key, NVFUSE_BP_TYPE_DATA);
+			if (nvfuse_hash_lookup(sb, key))
+				continue;
+
+			/* bc is pinned by nvfuse_find_bc() until the read is completed */
+			bc = nvfuse_find_bc(sb, key, lblock, NVFUSE_TYPE_DATA);
+			if (bc == NULL)
+				goto SUBMIT;
+
+			bc->bc_pno = pblock + i;
+			bc->bc_ino = ino;
+			bc->bc_lbno = lblock;
+			bc->bc_ra = 1;
+			ra->ra_bcs[ra->ra_nr_jobs + count] = bc;
+			count++;
+		}
+	}
+
+SUBMIT:
+	if (count == 0)
+		return 0;
+
+	nvfuse_make_jobs(sb, jobs, count);
+
+	for (i = 0; i < count; i++) {
+		bc = ra->ra_bcs[ra->ra_nr_jobs + i];
+
+		jobs[i]->offset = (s64)bc->bc_pno * CLUSTER_SIZE;
+		jobs[i]->bytes = (size_t)CLUSTER_SIZE;
+		jobs[i]->ret = 0;
+		jobs[i]->req_type = READ;
+		jobs[i]->buf = bc->bc_buf;
+		jobs[i]->complete = 0;
+		/* null tag1 distinguishes prefetch requests from nvfuse_aio_ctx requests */
+		jobs[i]->tag1 = NULL;
+		/* readahead must not delay foreground requests */
+		jobs[i]->qid = SPDK_QUEUE_RA;
+		iocb[i] = &jobs[i]->iocb;
+
+		nvfuse_aio_prep(jobs[i], io_manager);
+		ra->ra_jobs[ra->ra_nr_jobs + i] = jobs[i];
+	}
+
+	ret = nvfuse_aio_submit(iocb, count, io_manager);
+	if (ret < 0) {
+		printf(" Error: aio submit error = %d\n", ret);
+		for (i = 0; i < count; i++) {
+			bc = ra->ra_bcs[ra->ra_nr_jobs + i];
+			bc->bc_pno = 0;
+			bc->bc_ra = 0;
+			nvfuse_put_bc(sb, bc, INSERT_TAIL);
+		}
+		nvfuse_release_jobs(sb, jobs, count);
+		return -1;
+	}
+
+	io_manager->queue_cur_count += count;
+	ra->ra_nr_jobs += count;
+
+	return count;
+}
+
+void nvfuse_ra_wait(struct nvfuse_superblock *sb, struct nvfuse_readahead *ra)
+{
+	struct nvfuse_io_manager *io_manager = sb->io_manager;
+	struct nvfuse_buffer_cache *bc;
+	struct io_job *job;
+	s32 cc; // completion count
+	s32 i;
+
+	if (ra->ra_nr_jobs == 0)
+		return;
+
+	nvfuse_bg_io_lock(sb);
+
+	i = 0;
+	while (i < ra->ra_nr_jobs) {
+		if (ra->ra_jobs[i]->complete) {
+			i++;
+			continue;
+		}
+
+		cc = nvfuse_aio_complete(io_manager);
+		io_manager->queue_cur_count -= cc;
+		assert(io_manager->queue_cur_count >= 0);
+
+		/* jobs of nvfuse_aio_ctx sharing the ring must be accounted too */
+		while (cc--) {
+			job = nvfuse_aio_getnextcjob(io_manager);
+			nvfuse_aio_dispatch_cjob(sb, job);
+		}
+	}
+
+	for (i = 0; i < ra->ra_nr_jobs; i++) {
+		job = ra->ra_jobs[i];
+		bc = ra->ra_bcs[i];
+
+		if (job->ret == job->bytes) {
+			bc->bc_load = 1;
+		} else {
+			/* leave it to nvfuse_get_bh() to read the block again */
+			printf(" Error: readahead IO (pblock = %d)\n", bc->bc_pno);
+		}
+
+		bc->bc_ra = 0;
+		nvfuse_put_bc(sb, bc, INSERT_HEAD);
+	}
+
+	nvfuse_release_jobs(sb, ra->ra_jobs, ra->ra_nr_jobs);
+	ra->ra_nr_jobs = 0;
+
+	nvfuse_bg_io_unlock(sb);
+}
+
+void nvfuse_ra_wait_range(struct nvfuse_superblock *sb, struct nvfuse_readahead *ra,
+			  lbno_t lblock, u32 nr_blocks)
+{
+	struct nvfuse_buffer_cache *bc;
+	s32 i;
+
+	for (i = 0; i < ra->ra_nr_jobs; i++) {
+		bc = ra->ra_bcs[i];
+		if (bc->bc_lbno >= lblock && bc->bc_lbno < lblock + nr_blocks) {
+			nvfuse_ra_wait(sb, ra);
+			break;
+		}
+	}
+}
+
+/* blocks in [lblock, lblock + nr_blocks) were issued by windows of current stream */
+s32 nvfuse_ra_covered(struct nvfuse_readahead *ra, lbno_t lblock, u32 nr_blocks)
+{
+	if (ra->ra_size == 0)
+		return 0;
+
+	return lblock >= ra->ra_head && lblock + nr_blocks <= ra->ra_start + ra->ra_size;
+}
+
+/*
+ * bc read by readahead of any open file is waited for before it is handed
+ * out, otherwise the late completion overwrites data written in the meantime.
+ */
+void nvfuse_ra_wait_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc)
+{
+	struct nvfuse_file_table *of;
+	s32 i;
+
+	nvfuse_bg_io_lock(sb);
+	for (i = 0; i < MAX_OPEN_FILE && bc->bc_ra; i++) {
+		of = &sb->sb_file_table[i];
+		if (of->used && of->ino == bc->bc_ino && of->ra.ra_nr_jobs)
+			nvfuse_ra_wait(sb, &of->ra);
+	}
+
+	assert(!bc->bc_ra);
+	nvfuse_bg_io_unlock(sb);
+}
+
+void nvfuse_ra_wait_all(struct nvfuse_superblock *sb)
+{
+	s32 i;
+
+	if (sb->sb_file_table == NULL)
+		return;
+
+	for (i = 0; i < MAX_OPEN_FILE; i++) {
+		if (sb->sb_file_table[i].used)
+			nvfuse_ra_wait(sb, &sb->sb_file_table[i].ra);
+	}
+}
+
+void nvfuse_ra_update(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+		      struct nvfuse_file_table *of, lbno_t lblock, u32 nr_blocks)
+{
+	struct nvfuse_readahead *ra = &of->ra;
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	lbno_t end = lblock + nr_blocks;
+	lbno_t last;
+	u32 size;
+
+	if (nr_blocks == 0)
+		return;
+
+	/* random access collapses readahead window */
+	if (lblock != ra->ra_next && lblock + 1 != ra->ra_next && lblock != 0) {
+		ra->ra_start = 0;
+		ra->ra_size = 0;
+		goto RES;
+	}
+
+	if (ra->ra_size == 0) {
+		/* new sequential stream */
+		ra->ra_head = end;
+		ra->ra_start = end;
+		ra->ra_size = NVFUSE_RA_MIN_BLOCKS;
+	} else if (end > ra->ra_start) {
+		/* reader entered current window, so ramp up next window */
+		ra->ra_start += ra->ra_size;
+		if (ra->ra_start < end)
+			ra->ra_start = end;
+
+		ra->ra_size <<= 1;
+		if (ra->ra_size > NVFUSE_RA_MAX_BLOCKS)
+			ra->ra_size = NVFUSE_RA_MAX_BLOCKS;
+	} else {
+		goto RES;
+	}
+
+	if (inode->i_size == 0)
+		goto RES;
+
+	last = NVFUSE_SIZE_TO_BLK(inode->i_size - 1) + 1;
+	if (ra->ra_start >= last)
+		goto RES;
+
+	size = ra->ra_size;
+	if (ra->ra_start + size > last)
+		size = last - ra->ra_start;
+
+	if (nvfuse_ra_support_aio(sb)) {
+		nvfuse_bg_io_lock(sb);
+		nvfuse_ra_submit(sb, ictx, ra, ra->ra_start, size);
+		nvfuse_bg_io_unlock(sb);
+	}
+#ifdef NVFUSE_USE_COALESCED_READ
+	else {
+		/* backend without aio reads blocks in advance */
+		nvfuse_prefetch_bc(sb, ictx, ictx->ictx_ino, ra->ra_start, size);
+	}
+#endif
+
+RES:
+	ra->ra_next = end;
+}
@@ -48,6 +48,7 @@
 #include <libaio.h>
 #	include <unistd.h>
 #	include <sys/types.h>
+#	include <sys/uio.h>
 #endif
 
 struct ctrlr_entry {
@@ -66,6 +67,9 @@ struct ns_entry {
 static struct ctrlr_entry *g_controllers = NULL;
 static struct ns_entry *g_namespaces = NULL;
 
+/* namespaces in use, indexed by stripe order */
+static struct ns_entry *g_stripe_ns[SPDK_MAX_NAMESPACES];
+
 static char *ealargs[] = {
 	"hello_world",
 	"-c 0x1",
@@ -168,42 +172,61 @@ s8 *spdk_qname_decode(s32 qid)
 		return "SPDK_QUEUE_SYNC";
 	case SPDK_QUEUE_AIO:
 		return "SPDK_QUEUE_AIO";
+	case SPDK_QUEUE_WRITEBACK:
+		return "SPDK_QUEUE_WRITEBACK";
+	case SPDK_QUEUE_RA:
+		return "SPDK_QUEUE_RA";
 	}
 	return "SPDK_QUEUE_UNKOWN";
 }
 
 int spdk_alloc_qpair(struct nvfuse_io_manager *io_manager)
 {
-	struct ns_entry *ns_entry = g_namespaces;
+	int ns;
 	int i;
 
-	for (i = 0; i < SPDK_QUEUE_NUM; i++) {
-		printf(" Alloc NVMe Queue = %d (%s)\n", i, spdk_qname_decode(i));
+	/* each namespace has its own qpairs */
+	for (ns = 0; ns < io_manager->spdk_nr_ns; ns++) {
+		for (i = 0; i < io_manager->spdk_nr_queues; i++) {
+			printf(" Alloc NVMe Queue = %d (%s) ns = %d\n", i, spdk_qname_decode(i), ns);
 
-		io_manager->spdk_queue[i] = spdk_nvme_ctrlr_alloc_io_qpair(ns_entry->ctrlr, 0);
-		if (io_manager->spdk_queue[i] == NULL) {
-			printf("ERROR: spdk_nvme_ctrlr_alloc_io_qpair() failed\n");
-			return -1;
+			io_manager->spdk_queue[ns][i] = spdk_nvme_ctrlr_alloc_io_qpair(g_stripe_ns[ns]->ctrlr, 0);
+			if (io_manager->spdk_queue[ns][i] == NULL) {
+				printf("ERROR: spdk_nvme_ctrlr_alloc_io_qpair() failed\n");
+				return -1;
+			}
 		}
 	}
 
 	return 0;
 }
 
-void spdk_release_qpair(struct nvfuse_io_manager *io_manager)
+void spdk_free_qpair(struct nvfuse_io_manager *io_manager)
 {
+	int ns;
 	int i;
 	int ret;
 
-	fprintf(stdout, " Release NVMe I/O Q pair.\n");
+	for (ns = 0; ns < io_manager->spdk_nr_ns; ns++) {
+		for (i = 0; i < io_manager->spdk_nr_queues; i++) {
+			if (io_manager->spdk_queue[ns][i] == NULL)
+				continue;
 
-	for (i = 0; i < SPDK_QUEUE_NUM; i++) {
-		ret = spdk_nvme_ctrlr_free_io_qpair(io_manager->spdk_queue[i]);
-		if (ret < 0) {
-			fprintf(stderr, " Error: release NVMe I/O Q pair.\n");
-			break;
+			ret = spdk_nvme_ctrlr_free_io_qpair(io_manager->spdk_queue[ns][i]);
+			if (ret < 0) {
+				fprintf(stderr, " Error: release NVMe I/O Q pair.\n");
+				break;
+			}
+			io_manager->spdk_queue[ns][i] = NULL;
 		}
 	}
+}
+
+void spdk_release_qpair(struct nvfuse_io_manager *io_manager)
+{
+	fprintf(stdout, " Release NVMe I/O Q pair.\n");
+
+	spdk_free_qpair(io_manager);
 
 	printf(" Device Total I/O = %.3f MB\n",
 	       (double)io_manager->perf_stat_dev.stat_dev.total_io_count * CLUSTER_SIZE / MB);
@@ -222,6 +245,7 @@ static int spdk_init(struct nvfuse_io_manager *io_manager)
 {
 	struct ns_entry *ns_entry = g_namespaces;
 	int rc = 0;
+	int ns;
 	int i;
 #if 0
 	int core;
@@ -247,8 +271,10 @@ static int spdk_init(struct nvfuse_io_manager *io_manager)
 		}
 	}
 #else
-	for (i = 0 ; i < SPDK_QUEUE_NUM; i++) {
-		io_manager->spdk_queue[i] = NULL;
+	for (ns = 0; ns < SPDK_MAX_NAMESPACES; ns++) {
+		for (i = 0 ; i < SPDK_QUEUE_NUM; i++) {
+			io_manager->spdk_queue[ns][i] = NULL;
+		}
 	}
 #endif
 
@@ -279,6 +305,77 @@ int spdk_cleanup(struct nvfuse_io_manager *io_manager)
 	return 0;
 }
 
+/*
+ * Map a sector range onto the stripe set. Stripe i is stored in namespace
+ * (i % spdk_nr_ns) at stripe (i / spdk_nr_ns). Returns the number of
+ * sectors which belong to the same stripe.
+ */
+static u32 spdk_stripe_map(struct nvfuse_io_manager *io_manager, u64 lba, u32 nr_lbas,
+			   int *ns, u64 *ns_lba)
+{
+	u64 unit = (u64)io_manager->spdk_stripe_blocks * SECTORS_PER_CLUSTER;
+	u64 stripe;
+	u64 len;
+
+	if (io_manager->spdk_nr_ns <= 1) {
+		*ns = 0;
+		*ns_lba = lba;
+		return nr_lbas;
+	}
+
+	stripe = lba / unit;
+	len = unit - lba % unit;
+	if (len > nr_lbas)
+		len = nr_lbas;
+
+	*ns = stripe % io_manager->spdk_nr_ns;
+	*ns_lba = (stripe / io_manager->spdk_nr_ns) * unit + lba % unit;
+
+	return (u32)len;
+}
+
+/* classes beyond spdk_nr_queues share the last qpair */
+static inline int spdk_queue_index(struct nvfuse_io_manager *io_manager, int qid)
+{
+	if (qid < 0 || qid >= SPDK_QUEUE_NUM)
+		qid = SPDK_QUEUE_AIO;
+
+	return qid < io_manager->spdk_nr_queues ? qid : io_manager->spdk_nr_queues - 1;
+}
+
+static inline struct spdk_nvme_qpair *spdk_get_qpair(struct nvfuse_io_manager *io_manager, int ns,
+		int qid)
+{
+	return io_manager->spdk_queue[ns][spdk_queue_index(io_manager, qid)];
+}
+
+/*
+ * SPDK qpairs must not be used by multiple threads at once. Qpairs and the
+ * cjob ring of an io_manager belong to a single I/O channel, and each
+ * thread submits through its own channel (see nvfuse_io_channel.c).
+ */
+
+/* poll the qpair of the given class in every namespace */
+static void spdk_process_completions(struct nvfuse_io_manager *io_manager, int qid, u32 max_completions)
+{
+	int ns;
+
+	for (ns = 0; ns < io_manager->spdk_nr_ns; ns++)
+		spdk_nvme_qpair_process_completions(spdk_get_qpair(io_manager, ns, qid), max_completions);
+}
+
+/* poll every asynchronous qpair in every namespace */
+static void spdk_process_aio_completions(struct nvfuse_io_manager *io_manager, u32 max_completions)
+{
+	int ns;
+	int i;
+
+	for (ns = 0; ns < io_manager->spdk_nr_ns; ns++) {
+		for (i = spdk_queue_index(io_manager, SPDK_QUEUE_AIO); i < io_manager->spdk_nr_queues; i++)
+			spdk_nvme_qpair_process_completions(io_manager->spdk_queue[ns][i], max_completions);
+	}
+}
+
 static int spdk_prep(struct nvfuse_io_manager *io_manager, struct io_job *job)
 {
 	job->complete = 0;
@@ -292,13 +389,14 @@ static void spdk_callback(void *arg, const struct spdk_nvme_cpl *cpl)
 	struct io_job *job = (struct io_job *)arg;
 	struct nvfuse_io_manager *io_manager = (struct nvfuse_io_manager *)job->tag2;
 
-	job->complete = 1;
-
-	if (!spdk_nvme_cpl_is_error(cpl)) {
-		job->ret = job->bytes;
-	} else {
+	if (spdk_nvme_cpl_is_error(cpl))
 		job->ret = -1;
-	}
+
+	/* a job striped over namespaces completes with its last piece */
+	if (--job->pending)
+		return;
+
+	job->complete = 1;
 
 	//printf(" spdk callback()\n");
 
@@ -312,10 +410,79 @@ static void spdk_callback(void *arg, const struct spdk_nvme_cpl *cpl)
 	io_manager->cjob_cnt++;
 }
 
+/* scatter gather callbacks for a job merged from multiple pages */
+static void spdk_job_reset_sgl(void *ref, uint32_t sgl_offset)
+{
+	struct io_job *job = ref;
+
+	job->iov_idx = 0;
+	while (job->iov_idx < job->iovcnt && sgl_offset >= job->iov[job->iov_idx].iov_len) {
+		sgl_offset -= job->iov[job->iov_idx].iov_len;
+		job->iov_idx++;
+	}
+	job->iov_offset = sgl_offset;
+}
+
+static int spdk_job_next_sge(void *ref, void **address, uint32_t *length)
+{
+	struct io_job *job = ref;
+	struct iovec *iov;
+
+	if (job->iov_idx >= job->iovcnt)
+		return -1;
+
+	iov = &job->iov[job->iov_idx];
+	*address = (char *)iov->iov_base + job->iov_offset;
+	*length = iov->iov_len - job->iov_offset;
+
+	job->iov_idx++;
+	job->iov_offset = 0;
+
+	return 0;
+}
+
+/* submit a piece of job to a namespace */
+static int spdk_submit_piece(struct io_job *job, struct ns_entry *ns_entry, struct spdk_nvme_qpair *qpair,
+			     char *buf, u64 lba, u32 nr_lbas)
+{
+	u32 io_flags = job->fua ? SPDK_NVME_IO_FLAGS_FORCE_UNIT_ACCESS : 0;
+
+	job->pending++;
+
+	if (buf == NULL) {
+		/* whole job goes to a namespace with a single SGL command */
+		if (job->req_type == READ)
+			return spdk_nvme_ns_cmd_readv(ns_entry->ns, qpair, lba, nr_lbas,
+						      spdk_callback, job, 0,
+						      spdk_job_reset_sgl, spdk_job_next_sge);
+		else
+			return spdk_nvme_ns_cmd_writev(ns_entry->ns, qpair, lba, nr_lbas,
+						       spdk_callback, job, io_flags,
+						       spdk_job_reset_sgl, spdk_job_next_sge);
+	}
+
+	if (job->req_type == READ)
+		return spdk_nvme_ns_cmd_read(ns_entry->ns, qpair, buf,
+					     lba, /* LBA start */
+					     nr_lbas, /* number of LBAs */
+					     spdk_callback, job, 0);
+
+	return spdk_nvme_ns_cmd_write(ns_entry->ns, qpair, buf,
+				      lba, /* LBA start */
+				      nr_lbas, /* number of LBAs */
+				      spdk_callback, job, io_flags);
+}
+
 static int spdk_submit(struct nvfuse_io_manager *io_manager, struct iocb **ioq, int qcnt)
 {
-	struct ns_entry *ns_entry = g_namespaces;
+	struct ns_entry *ns_entry;
+	struct spdk_nvme_qpair *qpair;
 	struct io_job *job;
+	u64 lba, end, ns_lba;
+	u32 nr_lbas;
+	char *buf;
+	int iov_idx;
+	int ns;
 	int i;
 	int ret = 0;
 
@@ -323,28 +490,69 @@ static int spdk_submit(struct nvfuse_io_manager *io_manager, struct iocb **ioq,
 		struct iocb *iocb = ioq[i];
 		job  = (struct io_job *)container_of(iocb, struct io_job, iocb);
 
-		if (job->req_type == READ) {
-			ret = spdk_nvme_ns_cmd_read(ns_entry->ns, io_manager->spdk_queue[SPDK_QUEUE_AIO], job->buf,
-						    job->offset / 512, /* LBA start */
-						    job->bytes / 512, /* number of LBAs */
-						    spdk_callback, job, 0);
-
-			io_manager->perf_stat_dev.stat_dev.read_io_count += (job->bytes / 4096);
-		} else {
-			ret = spdk_nvme_ns_cmd_write(ns_entry->ns, io_manager->spdk_queue[SPDK_QUEUE_AIO], job->buf,
-						     job->offset / 512, /* LBA start */
-						     job->bytes / 512, /* number of LBAs */
-						     spdk_callback, job, 0);
+		job->ret = job->bytes;
+		job->pending = 0;
+
+		lba = job->offset / 512;
+		end = lba + job->bytes / 512;
+
+		if (job->iovcnt > 1) {
+			nr_lbas = spdk_stripe_map(io_manager, lba, end - lba, &ns, &ns_lba);
+			if (lba + nr_lbas == end) {
+				ret = spdk_submit_piece(job, g_stripe_ns[ns], spdk_get_qpair(io_manager, ns, job->qid),
+							NULL, ns_lba, nr_lbas);
+				if (ret != 0) {
+					fprintf(stderr, "starting write I/O failed\n");
+					exit(1);
+				}
+				goto STAT;
+			}
 
-			io_manager->perf_stat_dev.stat_dev.write_io_count += (job->bytes / 4096);
+			/* pages spanning stripes are sent one by one */
+			for (iov_idx = 0; iov_idx < job->iovcnt; iov_idx++) {
+				nr_lbas = spdk_stripe_map(io_manager, lba, job->iov[iov_idx].iov_len / 512, &ns, &ns_lba);
+				assert(nr_lbas == job->iov[iov_idx].iov_len / 512);
+
+				ret = spdk_submit_piece(job, g_stripe_ns[ns], spdk_get_qpair(io_manager, ns, job->qid),
+							job->iov[iov_idx].iov_base, ns_lba, nr_lbas);
+				if (ret != 0) {
+					fprintf(stderr, "starting write I/O failed\n");
+					exit(1);
+				}
+				lba += nr_lbas;
+			}
+			goto STAT;
 		}
 
-		io_manager->perf_stat_dev.stat_dev.total_io_count += (job->bytes / 4096);
+		buf = job->buf;
 
-		if (ret != 0) {
-			fprintf(stderr, "starting write I/O failed\n");
-			exit(1);
+		/* job is split at stripe boundaries */
+		while (lba < end) {
+			nr_lbas = spdk_stripe_map(io_manager, lba, end - lba, &ns, &ns_lba);
+			ns_entry = g_stripe_ns[ns];
+			qpair = spdk_get_qpair(io_manager, ns, job->qid);
+
+			ret = spdk_submit_piece(job, ns_entry, qpair, buf, ns_lba, nr_lbas);
+			if (ret != 0) {
+				fprintf(stderr, "starting write I/O failed\n");
+				exit(1);
+			}
+
+			lba += nr_lbas;
+			buf += (size_t)nr_lbas * 512;
 		}
+
+STAT:
+
+		if (job->req_type == READ)
+			io_manager->perf_stat_dev.stat_dev.read_io_count += (job->bytes / CLUSTER_SIZE);
+		else
+			io_manager->perf_stat_dev.stat_dev.write_io_count += (job->bytes / CLUSTER_SIZE);
+
+		if (job->req_type != READ && !job->fua)
+			io_manager->wc_dirty = 1;
+
+		io_manager->perf_stat_dev.stat_dev.total_io_count += (job->bytes / CLUSTER_SIZE);
 	}
 
 	//printf(" spdk: %d jobs submitted total count = %d\n", qcnt, io_manager->io_job_subq_count);
@@ -361,13 +569,20 @@ static int spdk_complete(struct nvfuse_io_manager *io_manager)
 #endif
 	/* Polling */
 	while (cjob_size(io_manager) == 0)
-		spdk_nvme_qpair_process_completions(io_manager->spdk_queue[SPDK_QUEUE_AIO], max_completions);
+		spdk_process_aio_completions(io_manager, max_completions);
 
 	//printf(" spdk cjob size = %d, cnt = %d\n", cjob_size(io_manager), io_manager->cjob_cnt);
 
 	return cjob_size(io_manager);
 }
 
+static int spdk_poll(struct nvfuse_io_manager *io_manager)
+{
+	spdk_process_aio_completions(io_manager, 0);
+
+	return cjob_size(io_manager);
+}
+
 static struct io_job *spdk_getnextcjob(struct nvfuse_io_manager *io_manager)
 {
 	struct io_job *cur_job;
@@ -430,17 +645,142 @@ sync_req_complete(void *arg, const struct spdk_nvme_cpl *completion)
 	job->is_completed = 1;
 }
 
-static int spdk_read_blk(struct nvfuse_io_manager *io_manager, long block, int count, void *buf)
+/* scatter gather list for readv and writev */
+struct spdk_sgl_job {
+	struct spdk_job job; /* must be the first member for sync_req_complete() */
+	struct iovec	*iov;
+	int		iovcnt;
+	int		iov_idx;
+	uint32_t	iov_offset;
+	uint32_t	iov_base; /* byte offset of this piece in iov */
+};
+
+/* Maximum Number of Pieces Submitted at once by a Sync Request */
+#define SPDK_MAX_STRIPE_PIECES 16
+
+static void spdk_reset_sgl(void *ref, uint32_t sgl_offset)
+{
+	struct spdk_sgl_job *sgl = ref;
+
+	sgl_offset += sgl->iov_base;
+
+	sgl->iov_idx = 0;
+	while (sgl->iov_idx < sgl->iovcnt && sgl_offset >= sgl->iov[sgl->iov_idx].iov_len) {
+		sgl_offset -= sgl->iov[sgl->iov_idx].iov_len;
+		sgl->iov_idx++;
+	}
+	sgl->iov_offset = sgl_offset;
+}
+
+static int spdk_next_sge(void *ref, void **address, uint32_t *length)
 {
+	struct spdk_sgl_job *sgl = ref;
+	struct iovec *iov;
+
+	if (sgl->iov_idx >= sgl->iovcnt)
+		return -1;
+
+	iov = &sgl->iov[sgl->iov_idx];
+	*address = (char *)iov->iov_base + sgl->iov_offset;
+	*length = iov->iov_len - sgl->iov_offset;
+
+	sgl->iov_idx++;
+	sgl->iov_offset = 0;
+
+	return 0;
+}
+
+/*
+ * Synchronous I/O through SPDK_QUEUE_SYNC. The request is split at stripe
+ * boundaries and the pieces are issued to their namespaces concurrently.
+ * Data is transferred to or from buf, or iov if buf is NULL.
+ */
+static int spdk_rw_sync(struct nvfuse_io_manager *io_manager, long block, int count, char *buf,
+			struct iovec *iov, int iovcnt, int is_read)
+{
+	struct spdk_sgl_job pieces[SPDK_MAX_STRIPE_PIECES];
+	struct spdk_sgl_job *sgl;
+	struct spdk_nvme_qpair *qpair;
 	struct ns_entry *ns_entry;
-	struct spdk_job job;
-	int rbytes = 0;
-	int res;
+	u64 lba = (u64)block * SECTORS_PER_CLUSTER;
+	u64 end = lba + (u64)count * SECTORS_PER_CLUSTER;
+	u64 ns_lba;
+	u32 nr_lbas;
+	u32 done = 0;
+	int nr_pieces;
+	int ns;
+	int res = 0;
+	int i;
 
-	ns_entry = g_namespaces;
-	job.buf = buf;
-	job.is_completed = 0;
-	job.ns_entry = ns_entry;
+	if (!is_read)
+		io_manager->wc_dirty = 1;
+
+	while (lba < end && res == 0) {
+		nr_pieces = 0;
+		while (lba < end && nr_pieces < SPDK_MAX_STRIPE_PIECES) {
+			nr_lbas = spdk_stripe_map(io_manager, lba, end - lba, &ns, &ns_lba);
+			ns_entry = g_stripe_ns[ns];
+			qpair = spdk_get_qpair(io_manager, ns, SPDK_QUEUE_SYNC);
+
+			sgl = &pieces[nr_pieces];
+			sgl->job.buf = buf ? buf + done : NULL;
+			sgl->job.is_completed = 0;
+			sgl->job.ns_entry = ns_entry;
+			sgl->iov = iov;
+			sgl->iovcnt = iovcnt;
+			sgl->iov_idx = 0;
+			sgl->iov_offset = 0;
+			sgl->iov_base = done;
+
+			if (buf && is_read)
+				res = spdk_nvme_ns_cmd_read(ns_entry->ns, qpair, sgl->job.buf,
+							    ns_lba, /* LBA start */
+							    nr_lbas, /* number of LBAs */
+							    sync_req_complete, sgl, 0);
+			else if (buf)
+				res = spdk_nvme_ns_cmd_write(ns_entry->ns, qpair, sgl->job.buf,
+							     ns_lba, /* LBA start */
+							     nr_lbas, /* number of LBAs */
+							     sync_req_complete, sgl, 0);
+			else if (is_read)
+				res = spdk_nvme_ns_cmd_readv(ns_entry->ns, qpair,
+							     ns_lba, /* LBA start */
+							     nr_lbas, /* number of LBAs */
+							     sync_req_complete, sgl, 0,
+							     spdk_reset_sgl, spdk_next_sge);
+			else
+				res = spdk_nvme_ns_cmd_writev(ns_entry->ns, qpair,
+							      ns_lba, /* LBA start */
+							      nr_lbas, /* number of LBAs */
+							      sync_req_complete, sgl, 0,
+							      spdk_reset_sgl, spdk_next_sge);
+
+			if (res != 0) {
+				fprintf(stderr, "starting %s I/O failed\n", is_read ? "read" : "write");
+				break;
+			}
+
+			nr_pieces++;
+			lba += nr_lbas;
+			done += nr_lbas * SECTOR_SIZE;
+		}
+
+		/* submitted pieces must be completed even on failure */
+		for (i = 0; i < nr_pieces; i++) {
+			while (!pieces[i].job.is_completed)
+				spdk_process_completions(io_manager, SPDK_QUEUE_SYNC, 0);
+		}
+	}
+
+	if (res != 0)
+		return -1;
+
+	return count * CLUSTER_SIZE;
+}
+
+static int spdk_read_blk(struct nvfuse_io_manager *io_manager, long block, int count, void *buf)
+{
+	int rbytes = 0;
 
 	/*if ( block/32768 < 10 &&  (block % 32768) == NVFUSE_BD_OFFSET)
 	printf(" bd read: block = %ld count = %d \n", block, count);*/
@@ -448,35 +788,21 @@ static int spdk_read_blk(struct nvfuse_io_manager *io_manager, long block, int c
 	io_manager->perf_stat_dev.stat_dev.total_io_count += count;
 	io_manager->perf_stat_dev.stat_dev.read_io_count += count;
 
-	res = spdk_nvme_ns_cmd_read(ns_entry->ns, io_manager->spdk_queue[SPDK_QUEUE_SYNC], job.buf,
-				    (uint64_t)block * 8, /* LBA start */
-				    count * 8, /* number of LBAs */
-				    sync_req_complete, &job, 0);
-
-	if (res != 0) {
-		fprintf(stderr, "starting read I/O failed\n");
-		exit(1);
-	}
-
 #if NVFUSE_USE_USLEEP_US > 0
 	rte_delay_us_block(count * NVFUSE_USE_USLEEP_US);
 #endif
 
-	while (!job.is_completed) {
-		spdk_nvme_qpair_process_completions(io_manager->spdk_queue[SPDK_QUEUE_SYNC], 0);
-	}
+	rbytes = spdk_rw_sync(io_manager, block, count, buf, NULL, 0, 1);
+	if (rbytes < 0)
+		exit(1);
 
-	rbytes = count * CLUSTER_SIZE;
 	return rbytes;
 }
 
 
 static int spdk_write_blk(struct nvfuse_io_manager *io_manager, long block, int count, void *buf)
 {
-	struct ns_entry *ns_entry;
-	struct spdk_job job;
 	int wbytes = 0;
-	int res;
 
 	/*if (block/32768 < 10 &&  (block % 32768) == NVFUSE_BD_OFFSET)
 	printf(" bd write: block = %ld count = %d \n", block, count);*/
@@ -484,56 +810,63 @@ static int spdk_write_blk(struct nvfuse_io_manager *io_manager, long block, int
 	io_manager->perf_stat_dev.stat_dev.total_io_count += count;
 	io_manager->perf_stat_dev.stat_dev.write_io_count += count;
 
-	ns_entry = g_namespaces;
-	job.buf = buf;
-	job.is_completed = 0;
-	job.ns_entry = ns_entry;
-
-	res = spdk_nvme_ns_cmd_write(ns_entry->ns, io_manager->spdk_queue[SPDK_QUEUE_SYNC], job.buf,
-				     (uint64_t)block * 8, /* LBA start */
-				     count * 8, /* number of LBAs */
-				     sync_req_complete, &job, 0);
-
-	if (res != 0) {
-		fprintf(stderr, "starting write I/O failed\n");
-		exit(1);
-	}
-
 #if NVFUSE_USE_USLEEP_US > 0
 	rte_delay_us_block(count * NVFUSE_USE_USLEEP_US);
 #endif
 
-	while (!job.is_completed) {
-		spdk_nvme_qpair_process_completions(io_manager->spdk_queue[SPDK_QUEUE_SYNC], 0);
-	}
-
-	wbytes = count * CLUSTER_SIZE;
+	wbytes = spdk_rw_sync(io_manager, block, count, buf, NULL, 0, 0);
+	if (wbytes < 0)
+		exit(1);
 
 	return wbytes;
 }
 
+static int spdk_readv_blk(struct nvfuse_io_manager *io_manager, long block, int count,
+			  struct iovec *iov, int iovcnt)
+{
+	io_manager->perf_stat_dev.stat_dev.total_io_count += count;
+	io_manager->perf_stat_dev.stat_dev.read_io_count += count;
+
+	return spdk_rw_sync(io_manager, block, count, NULL, iov, iovcnt, 1);
+}
+
+static int spdk_writev_blk(struct nvfuse_io_manager *io_manager, long block, int count,
+			   struct iovec *iov, int iovcnt)
+{
+	io_manager->perf_stat_dev.stat_dev.total_io_count += count;
+	io_manager->perf_stat_dev.stat_dev.write_io_count += count;
+
+	return spdk_rw_sync(io_manager, block, count, NULL, iov, iovcnt, 0);
+}
+
 static int spdk_flush(struct nvfuse_io_manager *io_manager)
 {
-	struct ns_entry *ns_entry;
-	struct spdk_job job;
+	struct spdk_job jobs[SPDK_MAX_NAMESPACES];
 	int res;
+	int ns;
 
-	ns_entry = g_namespaces;
-	job.is_completed = 0;
-	job.ns_entry = ns_entry;
+	/* every namespace in stripe set is flushed */
+	for (ns = 0; ns < io_manager->spdk_nr_ns; ns++) {
+		jobs[ns].is_completed = 0;
+		jobs[ns].ns_entry = g_stripe_ns[ns];
 
-	res = spdk_nvme_ns_cmd_flush(ns_entry->ns, io_manager->spdk_queue[SPDK_QUEUE_SYNC],
-				     sync_req_complete, &job);
+		res = spdk_nvme_ns_cmd_flush(g_stripe_ns[ns]->ns, spdk_get_qpair(io_manager, ns, SPDK_QUEUE_WRITEBACK),
+					     sync_req_complete, &jobs[ns]);
 
-	if (res != 0) {
-		fprintf(stderr, "starting write I/O failed\n");
-		exit(1);
+		if (res != 0) {
+			fprintf(stderr, "starting write I/O failed\n");
+			exit(1);
+		}
 	}
 
-	while (!job.is_completed) {
-		spdk_nvme_qpair_process_completions(io_manager->spdk_queue[SPDK_QUEUE_SYNC], 0);
+	for (ns = 0; ns < io_manager->spdk_nr_ns; ns++) {
+		while (!jobs[ns].is_completed) {
+			spdk_process_completions(io_manager, SPDK_QUEUE_WRITEBACK, 0);
+		}
 	}
 
+	io_manager->wc_dirty = 0;
+
 	return 0;
 }
 
@@ -618,6 +951,81 @@ RET:
 	return ret;
 }
 
+#ifdef NVFUSE_USE_SPDK_STRIPING
+/* stripe order follows serial number and nsid so as not to depend on probe order */
+static int spdk_ns_cmp(struct ns_entry *a, struct ns_entry *b)
+{
+	const struct spdk_nvme_ctrlr_data *cdata_a = spdk_nvme_ctrlr_get_data(a->ctrlr);
+	const struct spdk_nvme_ctrlr_data *cdata_b = spdk_nvme_ctrlr_get_data(b->ctrlr);
+	int ret;
+
+	ret = memcmp(cdata_a->sn, cdata_b->sn, sizeof(cdata_a->sn));
+	if (ret)
+		return ret;
+
+	return (int)spdk_nvme_ns_get_id(a->ns) - (int)spdk_nvme_ns_get_id(b->ns);
+}
+#endif
+
+/* choose namespaces to be used and compute capacity of stripe set */
+static int spdk_setup_stripe(struct nvfuse_io_manager *io_manager)
+{
+	struct ns_entry *ns_entry;
+	u64 nr_sectors, min_sectors = 0;
+	u64 unit;
+	int nr_ns = 0;
+	int i;
+
+	if (g_namespaces == NULL) {
+		fprintf(stderr, " Error: no active namespace\n");
+		return -1;
+	}
+
+#ifdef NVFUSE_USE_SPDK_STRIPING
+	for (ns_entry = g_namespaces; ns_entry; ns_entry = ns_entry->next) {
+		if (nr_ns == SPDK_MAX_NAMESPACES) {
+			printf(" Warning: namespaces beyond %d are not used\n", SPDK_MAX_NAMESPACES);
+			break;
+		}
+
+		for (i = nr_ns; i > 0 && spdk_ns_cmp(ns_entry, g_stripe_ns[i - 1]) < 0; i--)
+			g_stripe_ns[i] = g_stripe_ns[i - 1];
+		g_stripe_ns[i] = ns_entry;
+		nr_ns++;
+	}
+#else
+	ns_entry = g_namespaces;
+	g_stripe_ns[nr_ns++] = ns_entry;
+#endif
+
+	io_manager->blk_size = spdk_nvme_ns_get_sector_size(g_stripe_ns[0]->ns);
+	for (i = 0; i < nr_ns; i++) {
+		if (spdk_nvme_ns_get_sector_size(g_stripe_ns[i]->ns) != io_manager->blk_size) {
+			fprintf(stderr, " Error: namespaces of different sector sizes cannot be striped\n");
+			return -1;
+		}
+
+		nr_sectors = spdk_nvme_ns_get_num_sectors(g_stripe_ns[i]->ns);
+		if (i == 0 || nr_sectors < min_sectors)
+			min_sectors = nr_sectors;
+	}
+
+	io_manager->spdk_nr_ns = nr_ns;
+	io_manager->spdk_stripe_blocks = NVFUSE_SPDK_STRIPE_BLOCKS;
+
+	if (nr_ns == 1) {
+		io_manager->total_blkcount = (min_sectors >> 3) << 3;
+	} else {
+		/* every namespace contributes the same number of whole stripes */
+		unit = (u64)NVFUSE_SPDK_STRIPE_BLOCKS * SECTORS_PER_CLUSTER;
+		io_manager->total_blkcount = (min_sectors / unit) * unit * nr_ns;
+		printf(" NVMe: %d namespaces are striped (stripe unit = %d KB)\n", nr_ns,
+		       NVFUSE_SPDK_STRIPE_BLOCKS * CLUSTER_SIZE / 1024);
+	}
+
+	return 0;
+}
+
 static int spdk_open(struct nvfuse_io_manager *io_manager, int flags)
 {
 	int rc;
@@ -652,8 +1060,10 @@ static int spdk_open(struct nvfuse_io_manager *io_manager, int flags)
 	}
 
 #if 1
-	io_manager->blk_size = spdk_nvme_ns_get_sector_size(g_namespaces->ns);
-	io_manager->total_blkcount = (spdk_nvme_ns_get_num_sectors(g_namespaces->ns) >> 3) << 3;
+	if (spdk_setup_stripe(io_manager)) {
+		spdk_close(io_manager);
+		return 1;
+	}
 #else /* Reduced Device Size */
 	io_manager->blk_size = spdk_nvme_ns_get_sector_size(g_namespaces->ns);
 	io_manager->total_blkcount = (long) 2 * 1024 * 1024 * 1024 * 2;
@@ -731,12 +1141,20 @@ void nvfuse_init_spdk(struct nvfuse_io_manager *io_manager, char *filename, char
 	io_manager->io_close = spdk_close;
 	io_manager->io_read = spdk_read_blk;
 	io_manager->io_write = spdk_write_blk;
+	io_manager->io_readv = spdk_readv_blk;
+	io_manager->io_writev = spdk_writev_blk;
 
 	io_manager->cjob_head = 0;
 	io_manager->cjob_tail = 0;
 	io_manager->iodepth = AIO_MAX_QDEPTH;
 	io_manager->queue_cur_count = 0;
 
+	io_manager->spdk_nr_queues = NVFUSE_SPDK_NR_QUEUES;
+	if (io_manager->spdk_nr_queues < 1)
+		io_manager->spdk_nr_queues = 1;
+	if (io_manager->spdk_nr_queues > SPDK_QUEUE_NUM)
+		io_manager->spdk_nr_queues = SPDK_QUEUE_NUM;
+
 	for (i = 0; i < io_manager->iodepth; i++) {
 		io_manager->cjob[i] = NULL;
 	}
@@ -747,11 +1165,14 @@ void nvfuse_init_spdk(struct nvfuse_io_manager *io_manager, char *filename, char
 	io_manager->aio_prep = spdk_prep;
 	io_manager->aio_submit = spdk_submit;
 	io_manager->aio_complete = spdk_complete;
+	io_manager->aio_poll = spdk_poll;
 	io_manager->aio_getnextcjob = spdk_getnextcjob;
 	io_manager->aio_resetnextcjob = spdk_resetnextcjob;
 	io_manager->aio_cancel = spdk_cancel;
 	io_manager->dev_format = spdk_dev_format;
 	io_manager->dev_flush = spdk_flush;
+	/* FUA is mandatory for nvme write commands */
+	io_manager->fua_support = 1;
 
 	printf("Initialization complete.\n");
 }
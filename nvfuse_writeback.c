@@ -0,0 +1,364 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 17/10/2026
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "spdk/env.h"
+
+#include "nvfuse_core.h"
+#include "nvfuse_io_manager.h"
+#include "nvfuse_io_channel.h"
+#include "nvfuse_buffer_cache.h"
+#include "nvfuse_writeback.h"
+#include "nvfuse_aio.h"
+
+/*
+ * Asynchronous dirty buffer writeback
+ *
+ * Dirty buffers are written in batches of up to NVFUSE_WB_BATCH_BLOCKS
+ * and up to NVFUSE_WB_MAX_BATCHES batches are kept in flight on
+ * SPDK_QUEUE_WRITEBACK. A batch is retired in submission order once all
+ * of its jobs are completed; its buffers then become clean.
+ *
+ * Writeback starts when the number of dirty buffers exceeds
+ * NVFUSE_WB_HIGH_WATERMARK and continues until it drops to
+ * NVFUSE_WB_LOW_WATERMARK. Buffers which have been dirty for
+ * NVFUSE_WB_EXPIRE_SEC are written regardless of watermarks. The caller is
+ * blocked only when dirty buffers reach NVFUSE_WB_HARD_LIMIT.
+ *
+ * There is no flusher thread; nvfuse_wb_run() is driven by
+ * nvfuse_check_flush_dirty() which is called after each update.
+ * Buffers under writeback are kept on BUFFER_TYPE_WRITEBACK list, and
+ * nvfuse_get_bh() waits for their completion before handing them out.
+ * Batches are issued on the background channel (sb->io_manager), so the
+ * entry points below hold sb_bg_io_lock.
+ */
+
+void nvfuse_wb_init(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_writeback *wb = &sb->sb_wb;
+
+	wb->wb_active = 0;
+	wb->wb_head = 0;
+	wb->wb_nr_batches = 0;
+	wb->wb_nr_bcs = 0;
+	wb->wb_need_flush = 0;
+	wb->wb_next_shard = 0;
+	wb->wb_expire_tsc = 0;
+	wb->wb_next_scan_tsc = spdk_get_ticks() + NVFUSE_WB_EXPIRE_SEC * spdk_get_ticks_hz();
+}
+
+s32 nvfuse_wb_support_aio(struct nvfuse_superblock *sb)
+{
+#if (NVFUSE_OS==NVFUSE_OS_LINUX)
+	if (nvfuse_io_support_aio(sb->io_manager))
+		return 1;
+#endif
+	return 0;
+}
+
+/* reap completed requests without blocking */
+static void nvfuse_wb_poll(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_io_manager *io_manager = sb->io_manager;
+	struct io_job *job;
+	s32 cc; // completion count
+
+	cc = nvfuse_aio_poll(io_manager);
+	io_manager->queue_cur_count -= cc;
+	assert(io_manager->queue_cur_count >= 0);
+
+	/* jobs of nvfuse_aio_ctx sharing the ring must be accounted too */
+	while (cc--) {
+		job = nvfuse_aio_getnextcjob(io_manager);
+		nvfuse_aio_dispatch_cjob(sb, job);
+	}
+}
+
+/*
+ * submit a batch of dirty buffers which are not referenced.
+ * only buffers dirtied before expire_tsc are chosen if it is non-zero.
+ * returns the number of buffers submitted or -1 if no batch can be issued.
+ */
+static s32 nvfuse_wb_submit(struct nvfuse_superblock *sb, u64 expire_tsc)
+{
+	struct nvfuse_writeback *wb = &sb->sb_wb;
+	struct nvfuse_io_manager *io_manager = sb->io_manager;
+	struct nvfuse_wb_batch *batch;
+	struct nvfuse_buffer_manager *bm;
+	struct nvfuse_buffer_cache *bc;
+	struct list_head *head, *ptr, *prev;
+	struct iocb *iocb[NVFUSE_WB_BATCH_BLOCKS];
+	struct io_job *job = NULL;
+	s32 max_bcs;
+	s32 count = 0;
+	s32 ret;
+	s32 shard;
+	s32 i;
+
+	if (wb->wb_nr_batches == NVFUSE_WB_MAX_BATCHES)
+		return -1;
+
+	max_bcs = io_manager->iodepth - io_manager->queue_cur_count;
+	if (max_bcs <= 0)
+		return -1;
+	if (max_bcs > NVFUSE_WB_BATCH_BLOCKS)
+		max_bcs = NVFUSE_WB_BATCH_BLOCKS;
+
+	batch = &wb->wb_batch[(wb->wb_head + wb->wb_nr_batches) % NVFUSE_WB_MAX_BATCHES];
+	batch->nr_bcs = 0;
+
+	/* least recently used buffers first, shards are scanned in turn */
+	for (i = 0; i < NVFUSE_BC_SHARDS && batch->nr_bcs < max_bcs; i++) {
+		shard = (wb->wb_next_shard + i) % NVFUSE_BC_SHARDS;
+		bm = sb->sb_bm[shard];
+
+		nvfuse_bm_lock(bm);
+		head = &bm->bm_list[BUFFER_TYPE_DIRTY];
+		for (ptr = head->prev; ptr != head && batch->nr_bcs < max_bcs; ptr = prev) {
+			prev = ptr->prev;
+			bc = (struct nvfuse_buffer_cache *)list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+			assert(bc->bc_dirty);
+
+			/* referenced buffer may be modified while it is written */
+			if (bc->bc_ref)
+				continue;
+
+			if (expire_tsc && bc->bc_dirty_tsc >= expire_tsc)
+				continue;
+
+			batch->bcs[batch->nr_bcs++] = bc;
+			__nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_WRITEBACK, INSERT_TAIL);
+		}
+		nvfuse_bm_unlock(bm);
+	}
+	wb->wb_next_shard = (wb->wb_next_shard + 1) % NVFUSE_BC_SHARDS;
+
+	if (batch->nr_bcs == 0)
+		return 0;
+
+	/* a run of physically adjacent blocks is written by a single job */
+	qsort(batch->bcs, batch->nr_bcs, sizeof(struct nvfuse_buffer_cache *), nvfuse_bc_pno_cmp);
+
+	nvfuse_make_jobs(sb, batch->jobs, batch->nr_bcs);
+
+	for (i = 0; i < batch->nr_bcs; i++) {
+		bc = batch->bcs[i];
+
+		batch->iov[i].iov_base = bc->bc_buf;
+		batch->iov[i].iov_len = CLUSTER_SIZE;
+
+		if (job && job->iovcnt < AIO_MAX_IOV &&
+		    job->offset + (s64)job->bytes == (s64)bc->bc_pno * CLUSTER_SIZE) {
+			job->bytes += CLUSTER_SIZE;
+			job->iovcnt++;
+			continue;
+		}
+
+		job = batch->jobs[count];
+		job->offset = (s64)bc->bc_pno * CLUSTER_SIZE;
+		job->bytes = (size_t)CLUSTER_SIZE;
+		job->ret = 0;
+		job->req_type = WRITE;
+		job->buf = bc->bc_buf;
+		job->complete = 0;
+		/* null tag1 distinguishes writeback requests from nvfuse_aio_ctx requests */
+		job->tag1 = NULL;
+		job->qid = SPDK_QUEUE_WRITEBACK;
+		job->iov = &batch->iov[i];
+		job->iovcnt = 1;
+		iocb[count] = &job->iocb;
+		count++;
+	}
+
+	if (count < batch->nr_bcs)
+		nvfuse_release_jobs(sb, batch->jobs + count, batch->nr_bcs - count);
+
+	for (i = 0; i < count; i++)
+		nvfuse_aio_prep(batch->jobs[i], io_manager);
+
+	ret = nvfuse_aio_submit(iocb, count, io_manager);
+	if (ret < 0) {
+		printf(" Error: aio submit error = %d\n", ret);
+		for (i = 0; i < batch->nr_bcs; i++)
+			nvfuse_move_buffer_list(sb, batch->bcs[i], BUFFER_TYPE_DIRTY, INSERT_HEAD);
+		nvfuse_release_jobs(sb, batch->jobs, count);
+		return -1;
+	}
+
+	io_manager->queue_cur_count += count;
+	batch->nr_jobs = count;
+	wb->wb_nr_batches++;
+	wb->wb_nr_bcs += batch->nr_bcs;
+
+	return batch->nr_bcs;
+}
+
+/*
+ * retire the oldest batch. returns 0 if there is no batch or, unless wait
+ * is set, the batch is still in progress.
+ */
+static s32 nvfuse_wb_retire(struct nvfuse_superblock *sb, s32 wait)
+{
+	struct nvfuse_writeback *wb = &sb->sb_wb;
+	struct nvfuse_wb_batch *batch;
+	struct nvfuse_buffer_cache *bc;
+	s32 error = 0;
+	s32 i;
+
+	if (wb->wb_nr_batches == 0)
+		return 0;
+
+	batch = &wb->wb_batch[wb->wb_head];
+
+	i = 0;
+	while (i < batch->nr_jobs) {
+		if (batch->jobs[i]->complete) {
+			i++;
+			continue;
+		}
+
+		nvfuse_wb_poll(sb);
+		if (!wait && !batch->jobs[i]->complete)
+			return 0;
+	}
+
+	for (i = 0; i < batch->nr_jobs; i++) {
+		if (batch->jobs[i]->ret != batch->jobs[i]->bytes)
+			error = 1;
+	}
+
+	if (error)
+		printf(" Error: writeback IO (nr_bcs = %d)\n", batch->nr_bcs);
+
+	for (i = 0; i < batch->nr_bcs; i++) {
+		bc = batch->bcs[i];
+
+		/* failed buffers are written again later */
+		if (error) {
+			nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_DIRTY, INSERT_TAIL);
+			continue;
+		}
+
+		nvfuse_remove_bhs_in_bc(sb, bc);
+
+		assert(bc->bc_dirty);
+		bc->bc_dirty = 0;
+		nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_CLEAN, INSERT_HEAD);
+	}
+
+	nvfuse_release_jobs(sb, batch->jobs, batch->nr_jobs);
+
+	wb->wb_head = (wb->wb_head + 1) % NVFUSE_WB_MAX_BATCHES;
+	wb->wb_nr_batches--;
+	wb->wb_nr_bcs -= batch->nr_bcs;
+	/* written data stays in volatile device cache until next flush */
+	wb->wb_need_flush = 1;
+
+	return 1;
+}
+
+/*
+ * returns -1 if dirty buffers cannot be reduced below hard limit by
+ * writeback so that the caller has to flush them synchronously.
+ */
+s32 nvfuse_wb_run(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_writeback *wb = &sb->sb_wb;
+	u64 expire_ticks = NVFUSE_WB_EXPIRE_SEC * spdk_get_ticks_hz();
+	u64 now;
+	s32 res = 0;
+
+	nvfuse_bg_io_lock(sb);
+
+	while (nvfuse_wb_retire(sb, 0))
+		;
+
+	now = spdk_get_ticks();
+	if (now >= wb->wb_next_scan_tsc) {
+		if (now > expire_ticks)
+			wb->wb_expire_tsc = now - expire_ticks;
+		wb->wb_next_scan_tsc = now + expire_ticks;
+	}
+
+	/* throttle foreground writer */
+	while (nvfuse_get_dirty_count(sb) >= NVFUSE_WB_HARD_LIMIT) {
+		res = nvfuse_wb_submit(sb, 0);
+		if (res > 0)
+			continue;
+		if (res == 0 || !nvfuse_wb_retire(sb, 1)) {
+			nvfuse_bg_io_unlock(sb);
+			return -1;
+		}
+	}
+
+	if (nvfuse_get_dirty_count(sb) >= NVFUSE_WB_HIGH_WATERMARK)
+		wb->wb_active = 1;
+
+	while (wb->wb_active) {
+		if (nvfuse_get_dirty_count(sb) <= NVFUSE_WB_LOW_WATERMARK) {
+			wb->wb_active = 0;
+			break;
+		}
+
+		if (nvfuse_wb_submit(sb, 0) <= 0)
+			break;
+	}
+
+	while (wb->wb_expire_tsc) {
+		res = nvfuse_wb_submit(sb, wb->wb_expire_tsc);
+		if (res < 0)
+			break;
+		/* no more expired buffers */
+		if (res == 0)
+			wb->wb_expire_tsc = 0;
+	}
+
+	nvfuse_bg_io_unlock(sb);
+
+	return 0;
+}
+
+void nvfuse_wb_wait(struct nvfuse_superblock *sb)
+{
+	nvfuse_bg_io_lock(sb);
+	while (nvfuse_wb_retire(sb, 1))
+		;
+	nvfuse_bg_io_unlock(sb);
+}
+
+void nvfuse_wb_wait_block(struct nvfuse_superblock *sb, inode_t ino, lbno_t lblock)
+{
+	struct nvfuse_buffer_cache *bc;
+	u64 key;
+
+	if (sb->sb_wb.wb_nr_batches == 0)
+		return;
+
+	nvfuse_make_pbno_key(ino, lblock, &key, NVFUSE_BP_TYPE_DATA);
+	bc = nvfuse_hash_lookup(sb, key);
+	if (bc == NULL)
+		return;
+
+	nvfuse_bg_io_lock(sb);
+	while (bc->bc_list_type == BUFFER_TYPE_WRITEBACK) {
+		if (!nvfuse_wb_retire(sb, 1))
+			break;
+	}
+	nvfuse_bg_io_unlock(sb);
+}